@@ -0,0 +1,357 @@
+/*
+ * Runs the EFS workflow from a configuration file instead of by editing TestEFS.hpp: a
+ * baseline simulation, an optional checkpoint of it, then one EFS branch per frequency. The
+ * branches start from the baseline held in memory (see EfsScenarioRunner), so the mesh is read
+ * and partitioned once for the whole run.
+ *
+ * Usage: EfsDriver <configuration file>
+ *
+ * The configuration has one "key value" per line; lines starting with # are ignored. Keys, with
+ * the defaults of TestEFS in brackets:
+ *   mesh                   mesh file base name, relative to the Chaste source root
+ *                          [projects/mesh/EFS_problem/EFS_problem_0-5_0-025]
+ *   output                 baseline output directory, relative to CHASTE_TEST_OUTPUT
+ *                          [EFS_problem_0-5_0-025-BaselineCheckpoint]
+ *   bath_attribute, icc_attribute          element attributes [0, 1]
+ *   baseline_duration, efs_duration        ms [60000, 60000]
+ *   ode_dt, pde_dt, print_dt               ms [0.1, 0.1, 100]
+ *   intracellular_conductivity             x and y, mS/cm [0.12 0.12]
+ *   extracellular_conductivity             x and y, mS/cm [0.2 0.2]
+ *   surface_area_to_volume_ratio           1/cm [2000]
+ *   capacitance                            uF/cm^2 [2.5]
+ *   mesh_cache             whether to load the mesh through a binary cache (CachedMeshReader) [1]
+ *   weighted_partition     whether to balance the cost of the cells ICCFactory creates rather
+ *                          than node counts across processes; always uses the cache [0]
+ *   icc_weight             cost of an ICC node relative to a bath node, for the partition
+ *                          and the load imbalance report [6]
+ *   node_ordering          partition, rcm or morton: how to number the nodes within each
+ *                          process (see MeshNodeOrdering); other than partition, always uses
+ *                          the cache [partition]
+ *   max_pde_dt             longest adaptive PDE time step in ms, or 0 to keep pde_dt fixed [0]
+ *   max_voltage_change     largest change of V at a node over an adaptive step, mV [0.5]
+ *   ode_threads            threads per process solving the cell ODEs, e.g. cores per process
+ *                          when running one process per socket [1]
+ *   linear_solver          configured, block_diagonal, bath_two_level or ldu: KSP preset for
+ *                          the bidomain system (see LinearSolverStrategy) [configured]
+ *   steady_nodes           number of ICC nodes per process to watch, ending the baseline
+ *                          early once their slow waves are periodic (see SteadyStateDetector),
+ *                          or 0 to run the whole baseline_duration [10]
+ *   steady_period_tolerance, steady_amplitude_tolerance
+ *                          largest change between cycles of the period (ms) and amplitude (mV)
+ *                          of a periodic node [50, 0.5]
+ *   steady_cycles          number of matching cycles in a row needed at every watched node [2]
+ *   steady_check_interval  simulated time between steady state checks, ms [5000]
+ *   checkpoint             whether to save output/checkpoint_problem after the baseline [1]
+ *   frequency              EFS frequency in Hz; repeat for several branches, each written to
+ *                          <output>_EFS_<frequency>Hz [none]
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "ExecutableSupport.hpp"
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+#include "HeartConfig.hpp"
+#include "HeartEventHandler.hpp"
+#include "DistributedTetrahedralMesh.hpp"
+#include "DistributedVectorFactory.hpp"
+#include "TrianglesMeshReader.hpp"
+#include "UblasCustomFunctions.hpp"
+
+#include "../../src/BidomainProblemNeural.hpp"
+#include "../../src/CachedMeshReader.hpp"
+#include "../../src/CardiacSimulationArchiverNeural.hpp"
+#include "../../src/EfsScenarioRunner.hpp"
+#include "../../src/ICCFactory.hpp"
+
+static const unsigned PROBLEM_SPACE_DIM = 2;
+static const unsigned PROBLEM_ELEMENT_DIM = 2;
+
+/**
+ * Settings of a run, defaulting to those of TestEFS.
+ */
+struct EfsDriverConfig
+{
+    std::string mesh = "projects/mesh/EFS_problem/EFS_problem_0-5_0-025";
+    std::string output = "EFS_problem_0-5_0-025-BaselineCheckpoint";
+    unsigned bathAttribute = 0;
+    unsigned iccAttribute = 1;
+    double baselineDuration = 60000.0;
+    double efsDuration = 60000.0;
+    double odeDt = 0.1;
+    double pdeDt = 0.1;
+    double printDt = 100.0;
+    double sigmaI[2] = {0.12, 0.12};
+    double sigmaE[2] = {0.2, 0.2};
+    double surfaceAreaToVolumeRatio = 2000.0;
+    double capacitance = 2.5;
+    bool meshCache = true;
+    bool weightedPartition = false;
+    double iccWeight = 6.0;
+    MeshNodeOrdering::type nodeOrdering = MeshNodeOrdering::PARTITION;
+    double maxPdeDt = 0.0;
+    double maxVoltageChange = 0.5;
+    unsigned odeThreads = 1;
+    LinearSolverStrategy::type linearSolver = LinearSolverStrategy::CONFIGURED;
+    unsigned steadyNodes = 10;
+    double steadyPeriodTolerance = 50.0;
+    double steadyAmplitudeTolerance = 0.5;
+    unsigned steadyCycles = 2;
+    double steadyCheckInterval = 5000.0;
+    bool checkpoint = true;
+    std::vector<std::string> frequencies;
+};
+
+/**
+ * Read a configuration file.
+ *
+ * @param rPath  the file
+ * @return the settings
+ */
+static EfsDriverConfig ReadConfig(const std::string& rPath)
+{
+    std::ifstream config_file(rPath.c_str());
+    if (!config_file.is_open())
+    {
+        EXCEPTION("Unable to open configuration file: " + rPath);
+    }
+
+    EfsDriverConfig config;
+    std::string line;
+    unsigned line_number = 0;
+    while (std::getline(config_file, line))
+    {
+        line_number++;
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || key[0] == '#')
+        {
+            continue;
+        }
+
+        bool ok = true;
+        if (key == "mesh") ok = bool(fields >> config.mesh);
+        else if (key == "output") ok = bool(fields >> config.output);
+        else if (key == "bath_attribute") ok = bool(fields >> config.bathAttribute);
+        else if (key == "icc_attribute") ok = bool(fields >> config.iccAttribute);
+        else if (key == "baseline_duration") ok = bool(fields >> config.baselineDuration);
+        else if (key == "efs_duration") ok = bool(fields >> config.efsDuration);
+        else if (key == "ode_dt") ok = bool(fields >> config.odeDt);
+        else if (key == "pde_dt") ok = bool(fields >> config.pdeDt);
+        else if (key == "print_dt") ok = bool(fields >> config.printDt);
+        else if (key == "intracellular_conductivity") ok = bool(fields >> config.sigmaI[0] >> config.sigmaI[1]);
+        else if (key == "extracellular_conductivity") ok = bool(fields >> config.sigmaE[0] >> config.sigmaE[1]);
+        else if (key == "surface_area_to_volume_ratio") ok = bool(fields >> config.surfaceAreaToVolumeRatio);
+        else if (key == "capacitance") ok = bool(fields >> config.capacitance);
+        else if (key == "mesh_cache") ok = bool(fields >> config.meshCache);
+        else if (key == "weighted_partition") ok = bool(fields >> config.weightedPartition);
+        else if (key == "icc_weight") ok = bool(fields >> config.iccWeight);
+        else if (key == "node_ordering")
+        {
+            std::string ordering;
+            ok = bool(fields >> ordering);
+            if (ordering == "partition") config.nodeOrdering = MeshNodeOrdering::PARTITION;
+            else if (ordering == "rcm") config.nodeOrdering = MeshNodeOrdering::REVERSE_CUTHILL_MCKEE;
+            else if (ordering == "morton") config.nodeOrdering = MeshNodeOrdering::MORTON;
+            else ok = false;
+        }
+        else if (key == "max_pde_dt") ok = bool(fields >> config.maxPdeDt);
+        else if (key == "max_voltage_change") ok = bool(fields >> config.maxVoltageChange);
+        else if (key == "ode_threads") ok = bool(fields >> config.odeThreads);
+        else if (key == "linear_solver")
+        {
+            std::string strategy;
+            ok = bool(fields >> strategy);
+            if (ok) config.linearSolver = LinearSolverStrategy::FromName(strategy);
+        }
+        else if (key == "steady_nodes") ok = bool(fields >> config.steadyNodes);
+        else if (key == "steady_period_tolerance") ok = bool(fields >> config.steadyPeriodTolerance);
+        else if (key == "steady_amplitude_tolerance") ok = bool(fields >> config.steadyAmplitudeTolerance);
+        else if (key == "steady_cycles") ok = bool(fields >> config.steadyCycles);
+        else if (key == "steady_check_interval") ok = bool(fields >> config.steadyCheckInterval);
+        else if (key == "checkpoint") ok = bool(fields >> config.checkpoint);
+        else if (key == "frequency")
+        {
+            std::string frequency;
+            ok = bool(fields >> frequency);
+            config.frequencies.push_back(frequency);
+        }
+        else
+        {
+            EXCEPTION("Unknown key '" << key << "' on line " << line_number << " of " << rPath);
+        }
+        if (!ok)
+        {
+            EXCEPTION("Bad value for '" << key << "' on line " << line_number << " of " << rPath);
+        }
+    }
+    return config;
+}
+
+/**
+ * Run the baseline, checkpoint and EFS branches.
+ *
+ * @param rConfig  the settings
+ */
+static void Run(const EfsDriverConfig& rConfig)
+{
+    // Every node costs one for the PDE, on top of which ICCFactory::GetNodeWeights adds its cell
+    DistributedTetrahedralMesh<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM> mesh;
+    if (rConfig.weightedPartition)
+    {
+        // Kept beside the mesh cache, so the text files are only read when they or the weights change
+        std::vector<double> node_weights = ICCFactory<PROBLEM_SPACE_DIM>::GetNodeWeights(rConfig.mesh, rConfig.iccAttribute,
+                                                                                         rConfig.iccWeight - 1.0);
+        CachedMeshReader<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM>::ConstructMesh(rConfig.mesh, mesh, node_weights,
+                                                                               rConfig.nodeOrdering);
+    }
+    else if (rConfig.meshCache || rConfig.nodeOrdering != MeshNodeOrdering::PARTITION)
+    {
+        CachedMeshReader<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM>::ConstructMesh(rConfig.mesh, mesh, rConfig.nodeOrdering);
+    }
+    else
+    {
+        TrianglesMeshReader<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM> mesh_reader(rConfig.mesh);
+        mesh.ConstructFromMeshReader(mesh_reader);
+    }
+    CachedMeshReader<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM>::ReportLoadImbalance(
+        ICCFactory<PROBLEM_SPACE_DIM>::GetLocalWeight(mesh, rConfig.iccAttribute, rConfig.iccWeight - 1.0));
+
+    // Non-boundary nodes of ICC elements get ICC cells; the rest is bath
+    std::set<unsigned> icc_nodes;
+    for (DistributedTetrahedralMesh<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM>::ElementIterator iter = mesh.GetElementIteratorBegin();
+         iter != mesh.GetElementIteratorEnd();
+         ++iter)
+    {
+        if (iter->GetAttribute() == rConfig.iccAttribute)
+        {
+            for (unsigned i = 0; i < iter->GetNumNodes(); i++)
+            {
+                if (!iter->GetNode(i)->IsBoundaryNode())
+                {
+                    icc_nodes.insert(iter->GetNodeGlobalIndex(i));
+                }
+            }
+        }
+    }
+
+    std::set<unsigned> icc_ids;
+    icc_ids.insert(rConfig.iccAttribute);
+    std::set<unsigned> bath_ids;
+    bath_ids.insert(rConfig.bathAttribute);
+
+    ICCFactory<PROBLEM_SPACE_DIM> network_cells(icc_nodes);
+    BidomainProblemNeural<PROBLEM_SPACE_DIM> bidomain_problem(&network_cells, true);
+    bidomain_problem.SetMesh(&mesh);
+    bidomain_problem.SetOdeThreads(rConfig.odeThreads);
+    bidomain_problem.SetAdaptiveTimeStep(rConfig.maxPdeDt, rConfig.maxVoltageChange);
+    bidomain_problem.SetLinearSolverStrategy(rConfig.linearSolver);
+
+    // Watch a spread of the ICC nodes this process owns
+    std::vector<unsigned> owned_icc_nodes;
+    for (std::set<unsigned>::const_iterator it = icc_nodes.begin(); it != icc_nodes.end(); ++it)
+    {
+        if (mesh.GetDistributedVectorFactory()->IsGlobalIndexLocal(*it))
+        {
+            owned_icc_nodes.push_back(*it);
+        }
+    }
+    unsigned num_steady_nodes = std::min<unsigned>(rConfig.steadyNodes, owned_icc_nodes.size());
+    std::vector<unsigned> steady_nodes;
+    for (unsigned i = 0; i < num_steady_nodes; i++)
+    {
+        steady_nodes.push_back(owned_icc_nodes[(i*owned_icc_nodes.size())/num_steady_nodes]);
+    }
+    bidomain_problem.SetSteadyStateDetection(steady_nodes, rConfig.steadyPeriodTolerance, rConfig.steadyAmplitudeTolerance,
+                                             rConfig.steadyCycles, rConfig.steadyCheckInterval);
+
+    HeartConfig::Instance()->Reset();
+    HeartConfig::Instance()->SetSimulationDuration(rConfig.baselineDuration);
+    HeartConfig::Instance()->SetOutputDirectory(rConfig.output);
+    HeartConfig::Instance()->SetOutputFilenamePrefix("results");
+    HeartConfig::Instance()->SetTissueAndBathIdentifiers(icc_ids, bath_ids);
+    HeartConfig::Instance()->SetIntracellularConductivities(Create_c_vector(rConfig.sigmaI[0], rConfig.sigmaI[1]));
+    HeartConfig::Instance()->SetExtracellularConductivities(Create_c_vector(rConfig.sigmaE[0], rConfig.sigmaE[1]));
+    HeartConfig::Instance()->SetSurfaceAreaToVolumeRatio(rConfig.surfaceAreaToVolumeRatio);
+    HeartConfig::Instance()->SetCapacitance(rConfig.capacitance);
+    HeartConfig::Instance()->SetVisualizeWithMeshalyzer(true);
+    HeartConfig::Instance()->SetOdePdeAndPrintingTimeSteps(rConfig.odeDt, rConfig.pdeDt, rConfig.printDt);
+    // A partitioned or reordered mesh is renumbered, but the output stays in file numbering
+    HeartConfig::Instance()->SetOutputUsingOriginalNodeOrdering(!mesh.rGetNodePermutation().empty());
+
+    bidomain_problem.SetWriteInfo();
+    bidomain_problem.Initialise();
+    bidomain_problem.Solve();
+    if (bidomain_problem.GetSteadyStateTime() >= 0.0 && PetscTools::AmMaster())
+    {
+        std::cout << "Steady slow waves at " << bidomain_problem.GetSteadyStateTime() << " ms; ended the baseline there" << std::endl;
+    }
+    const QuiescentTimeStepController* p_controller = bidomain_problem.GetTimeStepController();
+    if (p_controller && PetscTools::AmMaster())
+    {
+        std::cout << "Baseline took " << p_controller->GetNumSteps() << " PDE steps, changing the time step "
+                  << p_controller->GetNumChanges() << " times" << std::endl;
+    }
+    const LinearSolveStatistics& r_solves = bidomain_problem.rGetLinearSolveStatistics();
+    if (PetscTools::AmMaster())
+    {
+        std::cout << "Linear solver " << LinearSolverStrategy::GetName(rConfig.linearSolver) << ": "
+                  << r_solves.numSolves << " solves, " << r_solves.GetMeanIterations() << " iterations on average (at most "
+                  << r_solves.maxIterations << "), " << r_solves.GetMeanTime() << " ms per solve" << std::endl;
+    }
+
+    if (rConfig.checkpoint)
+    {
+        CardiacSimulationArchiverNeural<BidomainProblemNeural<PROBLEM_SPACE_DIM> >::Save(bidomain_problem, rConfig.output + "/checkpoint_problem");
+    }
+
+    // The branches rewind to the baseline in memory, on the mesh and partition already set up,
+    // and run their whole duration
+    if (!rConfig.frequencies.empty())
+    {
+        EfsScenarioRunner<PROBLEM_SPACE_DIM> runner(bidomain_problem, rConfig.iccAttribute);
+        for (unsigned i = 0; i < rConfig.frequencies.size(); i++)
+        {
+            EfsScenario scenario;
+            scenario.frequency = atof(rConfig.frequencies[i].c_str());
+            scenario.outputDirectory = rConfig.output + "_EFS_" + rConfig.frequencies[i] + "Hz";
+            runner.Run(scenario, rConfig.efsDuration);
+        }
+    }
+
+    HeartEventHandler::Headings();
+    HeartEventHandler::Report();
+}
+
+int main(int argc, char* argv[])
+{
+    ExecutableSupport::StartupWithoutShowingCopyright(&argc, &argv);
+    int exit_code = ExecutableSupport::EXIT_OK;
+
+    if (argc != 2)
+    {
+        ExecutableSupport::PrintError("Usage: EfsDriver <configuration file>", true);
+        exit_code = ExecutableSupport::EXIT_BAD_ARGUMENTS;
+    }
+    else
+    {
+        try
+        {
+            Run(ReadConfig(argv[1]));
+        }
+        catch (const Exception& e)
+        {
+            ExecutableSupport::PrintError(e.GetMessage());
+            exit_code = ExecutableSupport::EXIT_ERROR;
+        }
+    }
+
+    ExecutableSupport::FinalizePetsc();
+    return exit_code;
+}
@@ -0,0 +1,182 @@
+/*
+ * Runs an EFS frequency sweep as one large MPI job. The processes are split into groups of
+ * a fixed size, each with its own PETSc world, and each group loads the baseline checkpoint
+ * once and then runs scenarios from a shared list (see EfsScenarioRunner), taking the next
+ * unclaimed scenario whenever it finishes one, so faster groups run more of them.
+ *
+ * Usage: EfsEnsemble <baseline checkpoint> <scenario file> <processes per group> <duration (ms)>
+ *
+ * The checkpoint directory is relative to CHASTE_TEST_OUTPUT. Each line of the scenario file
+ * is an output directory (relative to CHASTE_TEST_OUTPUT) and an EFS frequency in Hz.
+ */
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <mpi.h>
+#include <petscsys.h>
+
+#include "ExecutableSupport.hpp"
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+#include "Timer.hpp"
+#include "../../src/EfsScenarioRunner.hpp"
+
+static const unsigned PROBLEM_SPACE_DIM = 2;
+
+/**
+ * Read the scenario list.
+ *
+ * @param rPath  scenario file
+ * @param rScenarios  filled with the scenarios
+ * @return false if the file could not be read
+ */
+static bool ReadScenarios(const std::string& rPath, std::vector<EfsScenario>& rScenarios)
+{
+    std::ifstream in_file(rPath.c_str());
+    if (!in_file.is_open())
+    {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in_file, line))
+    {
+        std::istringstream fields(line);
+        EfsScenario scenario;
+        if (fields >> scenario.outputDirectory >> scenario.frequency)
+        {
+            rScenarios.push_back(scenario);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    // MPI is started first so that PETSc can be given each group's communicator as its world
+    MPI_Init(&argc, &argv);
+    int world_rank, world_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    int group_size = (argc > 3) ? atoi(argv[3]) : 0;
+    if (argc < 5 || group_size < 1 || world_size % group_size != 0)
+    {
+        if (world_rank == 0)
+        {
+            std::cerr << "Usage: " << argv[0] << " <baseline checkpoint> <scenario file> <processes per group> <duration (ms)>" << std::endl
+                      << "The number of processes must be a multiple of the group size." << std::endl;
+        }
+        MPI_Finalize();
+        return EXIT_FAILURE;
+    }
+    const std::string checkpoint = argv[1];
+    const std::string scenario_file = argv[2];
+    const double duration = atof(argv[4]);
+
+    int group = world_rank / group_size;
+    MPI_Comm group_comm;
+    MPI_Comm_split(MPI_COMM_WORLD, group, world_rank, &group_comm);
+    PETSC_COMM_WORLD = group_comm;
+    ExecutableSupport::InitializePetsc(&argc, &argv);
+
+    // Every process reads the (small) list, so only scenario numbers need sharing
+    std::vector<EfsScenario> scenarios;
+    int exit_code = ExecutableSupport::EXIT_OK;
+    bool read_ok = ReadScenarios(scenario_file, scenarios);
+
+    // The next unclaimed scenario, counted on world rank 0 and claimed by group masters
+    long long next_scenario = 0;
+    MPI_Win counter;
+    MPI_Win_create(&next_scenario, (world_rank == 0) ? sizeof(long long) : 0, sizeof(long long),
+                   MPI_INFO_NULL, MPI_COMM_WORLD, &counter);
+
+    if (!read_ok)
+    {
+        if (world_rank == 0)
+        {
+            std::cerr << "Unable to open scenario file: " << scenario_file << std::endl;
+        }
+        exit_code = ExecutableSupport::EXIT_ERROR;
+    }
+    else
+    {
+        // Failures are shared over the group, so that no process goes on to claim another
+        // scenario (or waits in one) while the others give up
+        std::string error;
+        boost::scoped_ptr<EfsScenarioRunner<PROBLEM_SPACE_DIM> > p_runner;
+        try
+        {
+            p_runner.reset(new EfsScenarioRunner<PROBLEM_SPACE_DIM>(checkpoint));
+        }
+        catch (const Exception& e)
+        {
+            error = e.GetMessage();
+        }
+        if (PetscTools::ReplicateBool(!error.empty()))
+        {
+            if (!error.empty())
+            {
+                ExecutableSupport::PrintError(error);
+            }
+            p_runner.reset();
+            exit_code = ExecutableSupport::EXIT_ERROR;
+        }
+
+        while (p_runner)
+        {
+            long long scenario = 0;
+            if (PetscTools::AmMaster())
+            {
+                const long long one = 1;
+                MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, counter);
+                MPI_Fetch_and_op(&one, &scenario, MPI_LONG_LONG, 0, 0, MPI_SUM, counter);
+                MPI_Win_unlock(0, counter);
+            }
+            MPI_Bcast(&scenario, 1, MPI_LONG_LONG, 0, PETSC_COMM_WORLD);
+            if (scenario >= (long long) scenarios.size())
+            {
+                break;
+            }
+
+            // A failed scenario is reported, and the group carries on with the next
+            double start = Timer::GetElapsedTime();
+            error.clear();
+            try
+            {
+                p_runner->Run(scenarios[scenario], duration);
+            }
+            catch (const Exception& e)
+            {
+                error = e.GetMessage();
+            }
+            if (PetscTools::ReplicateBool(!error.empty()))
+            {
+                if (!error.empty())
+                {
+                    std::cerr << "Group " << group << " failed " << scenarios[scenario].outputDirectory
+                              << " on process " << PetscTools::GetMyRank() << ": " << error << std::endl;
+                }
+                exit_code = ExecutableSupport::EXIT_ERROR;
+            }
+            else if (PetscTools::AmMaster())
+            {
+                std::cout << "Group " << group << " ran " << scenarios[scenario].outputDirectory
+                          << " (" << scenarios[scenario].frequency << " Hz) in "
+                          << Timer::GetElapsedTime() - start << " s" << std::endl;
+            }
+        }
+    }
+
+    // All groups must be done with the counter before it goes
+    MPI_Win_free(&counter);
+    ExecutableSupport::FinalizePetsc();
+    MPI_Comm_free(&group_comm);
+    MPI_Finalize();
+    return exit_code;
+}
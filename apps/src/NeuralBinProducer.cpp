@@ -0,0 +1,75 @@
+/*
+ * Stand-in for a live NEURON simulation: replays a neural histogram file into the ring buffer
+ * created by a BidomainProblemNeural set up with SetNeuralStream(), one bin per row.
+ *
+ * Usage: NeuralBinProducer <buffer name> <histogram file> [delay between bins (ms)] [repeats]
+ */
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "Exception.hpp"
+#include "../../src/NeuralRingBuffer.hpp"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "Usage: " << argv[0] << " <buffer name> <histogram file> [delay between bins (ms)] [repeats]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string buffer_name = argv[1];
+    const std::string histogram_file = argv[2];
+    const double delay = (argc > 3) ? atof(argv[3]) : 0.0;
+    const int repeats = (argc > 4) ? atoi(argv[4]) : 1;
+
+    try
+    {
+        NeuralRingBuffer buffer(buffer_name, 600.0);
+        std::vector<double> bin(buffer.GetBinSize());
+
+        unsigned num_bins = 0;
+        for (int repeat = 0; repeat < repeats; repeat++)
+        {
+            std::ifstream in_file(histogram_file.c_str());
+            if (!in_file.is_open())
+            {
+                EXCEPTION("Unable to open neural histogram file: " + histogram_file);
+            }
+            while (true)
+            {
+                unsigned num_read = 0;
+                while (num_read < bin.size() && in_file >> bin[num_read])
+                {
+                    num_read++;
+                }
+                if (num_read == 0)
+                {
+                    break;
+                }
+                if (num_read < bin.size())
+                {
+                    EXCEPTION("Neural histogram file " + histogram_file + " ends part way through a bin");
+                }
+                if (delay > 0.0)
+                {
+                    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(delay));
+                }
+                buffer.Push(bin.data());
+                num_bins++;
+            }
+        }
+        buffer.Close();
+        std::cout << "Sent " << num_bins << " bins of " << bin.size() << " regions to " << buffer_name << std::endl;
+    }
+    catch (const Exception& e)
+    {
+        std::cerr << e.GetMessage() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
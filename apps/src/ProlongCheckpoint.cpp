@@ -0,0 +1,113 @@
+/*
+ * Carries a baseline checkpoint on a coarse mesh over to a finer mesh of the same geometry
+ * (see BidomainProblemNeural::LoadProlonged), so the fine run only needs a short relaxation
+ * instead of the whole warm-up.
+ *
+ * Usage: ProlongCheckpoint <coarse checkpoint> <fine mesh> <output checkpoint> [icc attribute]
+ *
+ * The checkpoints are relative to CHASTE_TEST_OUTPUT and the mesh is a file base name as for
+ * EfsDriver. Non-boundary nodes of elements with the ICC attribute [1] get ICC cells, as in
+ * EfsDriver. The output is a checkpoint that CardiacSimulationArchiverNeural::Load accepts.
+ */
+
+#include <cstdlib>
+#include <iostream>
+#include <set>
+
+#include "ExecutableSupport.hpp"
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+#include "DistributedTetrahedralMesh.hpp"
+
+#include "../../src/BidomainProblemNeural.hpp"
+#include "../../src/CachedMeshReader.hpp"
+#include "../../src/CardiacSimulationArchiverNeural.hpp"
+#include "../../src/ICCFactory.hpp"
+
+static const unsigned PROBLEM_SPACE_DIM = 2;
+static const unsigned PROBLEM_ELEMENT_DIM = 2;
+
+/**
+ * Prolong a checkpoint and save the result.
+ *
+ * @param rCoarseCheckpoint  the coarse checkpoint
+ * @param rFineMesh  the fine mesh file base name
+ * @param rOutput  the fine checkpoint to write
+ * @param iccAttribute  element attribute of the ICC network
+ */
+static void Run(const std::string& rCoarseCheckpoint, const std::string& rFineMesh,
+                const std::string& rOutput, unsigned iccAttribute)
+{
+    DistributedTetrahedralMesh<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM>* p_mesh = new DistributedTetrahedralMesh<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM>;
+    std::set<unsigned> icc_nodes;
+    try
+    {
+        CachedMeshReader<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM>::ConstructMesh(rFineMesh, *p_mesh);
+        for (DistributedTetrahedralMesh<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM>::ElementIterator iter = p_mesh->GetElementIteratorBegin();
+             iter != p_mesh->GetElementIteratorEnd();
+             ++iter)
+        {
+            if (iter->GetAttribute() == iccAttribute)
+            {
+                for (unsigned i = 0; i < iter->GetNumNodes(); i++)
+                {
+                    if (!iter->GetNode(i)->IsBoundaryNode())
+                    {
+                        icc_nodes.insert(iter->GetNodeGlobalIndex(i));
+                    }
+                }
+            }
+        }
+    }
+    catch (const Exception&)
+    {
+        delete p_mesh;
+        throw;
+    }
+
+    ICCFactory<PROBLEM_SPACE_DIM> network_cells(icc_nodes);
+    BidomainProblemNeural<PROBLEM_SPACE_DIM>* p_problem =
+        BidomainProblemNeural<PROBLEM_SPACE_DIM>::LoadProlonged(rCoarseCheckpoint, p_mesh, &network_cells);
+    try
+    {
+        CardiacSimulationArchiverNeural<BidomainProblemNeural<PROBLEM_SPACE_DIM> >::Save(*p_problem, rOutput);
+    }
+    catch (const Exception&)
+    {
+        delete p_problem;
+        throw;
+    }
+    if (PetscTools::AmMaster())
+    {
+        std::cout << "Prolonged " << rCoarseCheckpoint << " at " << p_problem->GetCurrentTime() << " ms onto "
+                  << p_problem->rGetMesh().GetNumNodes() << " nodes in " << rOutput << std::endl;
+    }
+    delete p_problem;
+}
+
+int main(int argc, char* argv[])
+{
+    ExecutableSupport::StartupWithoutShowingCopyright(&argc, &argv);
+    int exit_code = ExecutableSupport::EXIT_OK;
+
+    if (argc != 4 && argc != 5)
+    {
+        ExecutableSupport::PrintError("Usage: ProlongCheckpoint <coarse checkpoint> <fine mesh> <output checkpoint> [icc attribute]", true);
+        exit_code = ExecutableSupport::EXIT_BAD_ARGUMENTS;
+    }
+    else
+    {
+        try
+        {
+            Run(argv[1], argv[2], argv[3], (argc == 5) ? (unsigned) atoi(argv[4]) : 1u);
+        }
+        catch (const Exception& e)
+        {
+            ExecutableSupport::PrintError(e.GetMessage());
+            exit_code = ExecutableSupport::EXIT_ERROR;
+        }
+    }
+
+    ExecutableSupport::FinalizePetsc();
+    return exit_code;
+}
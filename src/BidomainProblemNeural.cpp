@@ -34,18 +34,114 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
 
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <sstream>
+
 #include "BidomainProblemNeural.hpp"
+#include "AbstractUntemplatedParameterisedSystem.hpp"
+#include "ArchiveLocationInfo.hpp"
+#include "ChasteCuboid.hpp"
+#include "ChastePoint.hpp"
+#include "DistributedTetrahedralMesh.hpp"
+#include "DistributedVectorFactory.hpp"
+#include "FileFinder.hpp"
+#include "HeartConfig.hpp"
+#include "HeartEventHandler.hpp"
+#include "OutputFileHandler.hpp"
+#include "TetrahedralMesh.hpp"
+#include "TrianglesMeshReader.hpp"
+#include "Warnings.hpp"
+#include "../src/BidomainSolverNeural.hpp"
+#include "../src/CachedMeshReader.hpp"
 
 template<unsigned DIM>
 BidomainProblemNeural<DIM>::BidomainProblemNeural(
             AbstractCardiacCellFactory<DIM>* pCellFactory, bool hasBath)
-    : BidomainProblem<DIM>(pCellFactory, hasBath)
+    : BidomainProblem<DIM>(pCellFactory, hasBath),
+      mNeuralNumX(0),
+      mNeuralNumY(0),
+      mNeuralNumT(0),
+      mNeuralXLength(0.0),
+      mNeuralYLength(0.0),
+      mNeuralBinWidth(0.0),
+      mNeuralNodeShared(false),
+      mLastNeuralBin(-1),
+      mCheckpointInterval(0.0),
+      mCheckpointsToKeep(2),
+      mCheckpointWallInterval(0.0),
+      mCheckpointFormat(CheckpointArchiveFormat::TEXT),
+      mCheckpointCompression(CheckpointCompression::NONE),
+      mCheckpointCompressionLevel(6),
+      mCheckpointAsync(false),
+      mNeuralRegionsArchived(false),
+      mNeuralStreamCapacity(0),
+      mNeuralStreamTimeout(0.0),
+      mNeuralStreamStartTime(0.0),
+      mMeasuredOdeTime(0.0),
+      mMeasuredAssemblyTime(0.0),
+      mLoadedImbalance(0.0),
+      mBalancedImbalance(0.0),
+      mOdeThreads(1),
+      mAdaptiveMaxTimeStep(0.0),
+      mAdaptiveMaxVoltageChange(0.5),
+      mMonodomainWhenUnstimulated(false),
+      mLinearSolverStrategy(LinearSolverStrategy::CONFIGURED),
+      mSolverLinearSolverStrategy(LinearSolverStrategy::CONFIGURED),
+      mSteadyPeriodTolerance(0.0),
+      mSteadyAmplitudeTolerance(0.0),
+      mSteadyCycles(0),
+      mSteadyThreshold(0.0),
+      mSteadyCheckInterval(0.0),
+      mSteadyStateTime(-1.0)
 {
 }
 
 template<unsigned DIM>
 BidomainProblemNeural<DIM>::BidomainProblemNeural()
-    : BidomainProblem<DIM>()
+    : BidomainProblem<DIM>(),
+      mNeuralNumX(0),
+      mNeuralNumY(0),
+      mNeuralNumT(0),
+      mNeuralXLength(0.0),
+      mNeuralYLength(0.0),
+      mNeuralBinWidth(0.0),
+      mNeuralNodeShared(false),
+      mLastNeuralBin(-1),
+      mCheckpointInterval(0.0),
+      mCheckpointsToKeep(2),
+      mCheckpointWallInterval(0.0),
+      mCheckpointFormat(CheckpointArchiveFormat::TEXT),
+      mCheckpointCompression(CheckpointCompression::NONE),
+      mCheckpointCompressionLevel(6),
+      mCheckpointAsync(false),
+      mNeuralRegionsArchived(false),
+      mNeuralStreamCapacity(0),
+      mNeuralStreamTimeout(0.0),
+      mNeuralStreamStartTime(0.0),
+      mMeasuredOdeTime(0.0),
+      mMeasuredAssemblyTime(0.0),
+      mLoadedImbalance(0.0),
+      mBalancedImbalance(0.0),
+      mOdeThreads(1),
+      mAdaptiveMaxTimeStep(0.0),
+      mAdaptiveMaxVoltageChange(0.5),
+      mMonodomainWhenUnstimulated(false),
+      mLinearSolverStrategy(LinearSolverStrategy::CONFIGURED),
+      mSolverLinearSolverStrategy(LinearSolverStrategy::CONFIGURED),
+      mSteadyPeriodTolerance(0.0),
+      mSteadyAmplitudeTolerance(0.0),
+      mSteadyCycles(0),
+      mSteadyThreshold(0.0),
+      mSteadyCheckInterval(0.0),
+      mSteadyStateTime(-1.0)
 {
 }
 
@@ -54,23 +150,1513 @@ BidomainProblemNeural<DIM>::~BidomainProblemNeural()
 {
 }
 
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetNeuralInput(const std::string& rHistogramFile, unsigned numX, unsigned numY, unsigned numT,
+                                                double xLength, double yLength, double binWidth)
+{
+    mNeuralFile = rHistogramFile;
+    mNeuralNumX = numX;
+    mNeuralNumY = numY;
+    mNeuralNumT = numT;
+    mNeuralXLength = xLength;
+    mNeuralYLength = yLength;
+    mNeuralBinWidth = binWidth;
+    mpNeuralInput.reset();
+    mNeuralStreamName.clear();
+    mpNeuralStream.reset();
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetNeuralInput(const std::string& rHistogramFile, unsigned numX, unsigned numY, unsigned numT, double binWidth)
+{
+    SetNeuralInput(rHistogramFile, numX, numY, numT, 0.0, 0.0, binWidth);
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetNeuralStream(const std::string& rBufferName, unsigned numX, unsigned numY, double binWidth, unsigned capacity,
+                                                 double timeout)
+{
+    SetNeuralInput("", numX, numY, 0, binWidth);
+    mNeuralStreamName = rBufferName;
+    mNeuralStreamCapacity = capacity;
+    mNeuralStreamTimeout = timeout;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::AddNeuralParameter(const std::string& rParameterName, const std::string& rCalibrationName)
+{
+    mNeuralParameters.push_back(std::make_pair(rParameterName, rCalibrationName));
+    mpNeuralInput.reset();
+    mpNeuralStream.reset();
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetNeuralInputNodeShared(bool nodeShared)
+{
+    mNeuralNodeShared = nodeShared;
+    mpNeuralInput.reset();
+}
+
+template<unsigned DIM>
+unsigned BidomainProblemNeural<DIM>::GetNumLocalNeuralRegions() const
+{
+    return mpNeuralInput ? mpNeuralInput->rGetHistogram().GetNumLocalRegions() : 0u;
+}
+
+template<unsigned DIM>
+bool BidomainProblemNeural<DIM>::IsNeuralInputNodeShared() const
+{
+    return mpNeuralInput && mpNeuralInput->rGetHistogram().IsNodeShared();
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::PreSolveChecks()
+{
+    LinearSolverStrategy::Apply(mLinearSolverStrategy, this->mHasBath);
+    BidomainSolverNeural<DIM>* p_solver = dynamic_cast<BidomainSolverNeural<DIM>*>(this->mpSolver);
+    if (p_solver && mSolverLinearSolverStrategy != mLinearSolverStrategy)
+    {
+        p_solver->ResetKspFromConfig();
+    }
+    mSolverLinearSolverStrategy = mLinearSolverStrategy;
+    BidomainProblem<DIM>::PreSolveChecks();
+    if (mMonodomainWhenUnstimulated && !this->mpElectrodes)
+    {
+        // Otherwise nothing would ever switch back to the bidomain system. With electrodes there
+        // is always a bath, so the monodomain steps are an approximation (see BidomainSolverNeural)
+        EXCEPTION("Monodomain between pulses needs electrodes, which need a bath, to switch back to bidomain");
+    }
+
+    if ((!mNeuralFile.empty() && !mpNeuralInput) || (!mNeuralStreamName.empty() && !mpNeuralStream))
+    {
+        SetUpNeuralInput();
+    }
+
+    if (mAdaptiveMaxTimeStep > 0.0)
+    {
+        double pde_dt = HeartConfig::Instance()->GetPdeTimeStep();
+        double printing_dt = HeartConfig::Instance()->GetPrintingTimeStep();
+        if (!mpTimeStepController || !mpTimeStepController->IsFor(pde_dt, printing_dt, mAdaptiveMaxTimeStep, mAdaptiveMaxVoltageChange))
+        {
+            mpTimeStepController.reset(new QuiescentTimeStepController(pde_dt, printing_dt, mAdaptiveMaxTimeStep, mAdaptiveMaxVoltageChange));
+        }
+        // Kept over the chunks of a solve, so the step need not start again from the base at each
+        this->SetUseTimeAdaptivityController(true, mpTimeStepController.get());
+    }
+    else if (mpTimeStepController)
+    {
+        mpTimeStepController.reset();
+        this->SetUseTimeAdaptivityController(false);
+    }
+
+    // Kept over the chunks of a solve, so cycles can span them
+    if (mSteadyCheckInterval > 0.0 && !mpSteadyStateDetector)
+    {
+        DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+        mpSteadyStateDetector.reset(new SteadyStateDetector(mSteadySampleNodes, p_factory->GetLow(), p_factory->GetHigh(),
+                                                            mSteadyPeriodTolerance, mSteadyAmplitudeTolerance,
+                                                            mSteadyCycles, mSteadyThreshold));
+        if (p_solver)
+        {
+            // Chaste keeps the solver between solves, so it must be told of a new detector
+            p_solver->SetSteadyStateDetector(mpSteadyStateDetector.get());
+        }
+    }
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetUpNeuralInput()
+{
+    // Only cells exposing all the neurally driven parameters (i.e. not bath or dummy cells)
+    std::vector<unsigned> driven_nodes;
+    AbstractCardiacTissue<DIM>* p_tissue = this->GetTissue();
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    for (unsigned node_index = p_factory->GetLow(); node_index < p_factory->GetHigh(); node_index++)
+    {
+        AbstractUntemplatedParameterisedSystem* p_cell = dynamic_cast<AbstractUntemplatedParameterisedSystem*>(p_tissue->GetCardiacCell(node_index));
+        bool is_driven = (p_cell != NULL) && !mNeuralParameters.empty();
+        for (unsigned i = 0; is_driven && i < mNeuralParameters.size(); i++)
+        {
+            is_driven = p_cell->HasParameter(mNeuralParameters[i].first);
+        }
+        if (is_driven)
+        {
+            driven_nodes.push_back(node_index);
+        }
+    }
+
+    // Without explicit lengths, the control region grid covers the bounding box of the driven
+    // tissue, which the histogram describes, rather than of the whole mesh including any bath
+    double x_origin = 0.0;
+    double y_origin = 0.0;
+    double x_length = mNeuralXLength;
+    double y_length = mNeuralYLength;
+    if (x_length <= 0.0)
+    {
+        // Lower corner negated, so a single MAX reduction gives both corners
+        double local_extent[4] = {-DBL_MAX, -DBL_MAX, -DBL_MAX, -DBL_MAX};
+        for (unsigned i = 0; i < driven_nodes.size(); i++)
+        {
+            const c_vector<double, DIM>& r_location = this->mpMesh->GetNode(driven_nodes[i])->rGetLocation();
+            for (unsigned dim = 0; dim < std::min(DIM, 2u); dim++)
+            {
+                local_extent[2*dim] = std::max(local_extent[2*dim], -r_location[dim]);
+                local_extent[2*dim+1] = std::max(local_extent[2*dim+1], r_location[dim]);
+            }
+        }
+        double extent[4];
+        MPI_Allreduce(local_extent, extent, 4, MPI_DOUBLE, MPI_MAX, PETSC_COMM_WORLD);
+
+        if (extent[1] < -extent[0])
+        {
+            // No driven tissue anywhere, so no region will be used; fall back to the whole mesh
+            ChasteCuboid<DIM> bounding_box = this->mpMesh->CalculateBoundingBox();
+            for (unsigned dim = 0; dim < std::min(DIM, 2u); dim++)
+            {
+                extent[2*dim] = -bounding_box.rGetLowerCorner()[dim];
+                extent[2*dim+1] = bounding_box.rGetUpperCorner()[dim];
+            }
+        }
+        x_origin = -extent[0];
+        x_length = extent[1] + extent[0];
+        if (DIM > 1)
+        {
+            y_origin = -extent[2];
+            y_length = extent[3] + extent[2];
+        }
+    }
+    // y_length stays 0 in 1D, so every node falls in the first row of regions
+    HistogramData grid(mNeuralNumX, mNeuralNumY, x_length, y_length);
+
+    mNeuralRegionNodes.clear();
+
+    std::set<unsigned> local_regions;
+    for (unsigned i = 0; i < driven_nodes.size(); i++)
+    {
+        const c_vector<double, DIM>& r_location = this->mpMesh->GetNode(driven_nodes[i])->rGetLocation();
+        unsigned region = grid.GetRegion(r_location[0] - x_origin, DIM > 1 ? r_location[1] - y_origin : 0.0);
+        mNeuralRegionNodes[region].push_back(driven_nodes[i]);
+        local_regions.insert(region);
+    }
+
+    if (!mNeuralStreamName.empty())
+    {
+        mpNeuralStream.reset();
+        mpNeuralStream.reset(new NeuralStream(mNeuralStreamName, mNeuralNumX, mNeuralNumY, mNeuralStreamCapacity,
+                                              mNeuralParameters, local_regions, mNeuralStreamTimeout));
+        mNeuralStreamStartTime = this->mCurrentTime;
+        return;
+    }
+
+    // Release any previous (possibly node shared) histogram collectively before replacing it
+    mpNeuralInput.reset();
+
+    // After loading a checkpoint, use its series if every process has all the regions it needs
+    bool missing_region = mNeuralArchivedSeries.empty() && !local_regions.empty();
+    std::map<unsigned, std::vector<double> > archived_series;
+    for (std::set<unsigned>::iterator it = local_regions.begin(); it != local_regions.end() && !missing_region; ++it)
+    {
+        std::map<unsigned, std::vector<double> >::iterator p_series = mNeuralArchivedSeries.find(*it);
+        missing_region = (p_series == mNeuralArchivedSeries.end());
+        if (!missing_region)
+        {
+            archived_series[*it].swap(p_series->second);
+        }
+    }
+    mNeuralArchivedSeries.clear();
+
+    if (!PetscTools::ReplicateBool(missing_region))
+    {
+        mpNeuralInput.reset(new NeuralIngestion(mNeuralNumX, mNeuralNumY, mNeuralNumT,
+                                                x_length, y_length, mNeuralBinWidth,
+                                                mNeuralParameters, archived_series, mNeuralNodeShared));
+    }
+    else
+    {
+        mpNeuralInput.reset(new NeuralIngestion(mNeuralFile, mNeuralNumX, mNeuralNumY, mNeuralNumT,
+                                                x_length, y_length, mNeuralBinWidth,
+                                                mNeuralParameters, local_regions, mNeuralNodeShared));
+    }
+    mLastNeuralBin = -1;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::PackNeuralRegions(std::vector<unsigned>& rRegions, std::vector<double>& rBlock) const
+{
+    rRegions.clear();
+    rBlock.clear();
+    if (mpNeuralInput)
+    {
+        const HistogramData& r_histogram = mpNeuralInput->rGetHistogram();
+        for (std::map<unsigned, std::vector<unsigned> >::const_iterator it = mNeuralRegionNodes.begin(); it != mNeuralRegionNodes.end(); ++it)
+        {
+            const double* p_series = r_histogram.GetRegionSeries(it->first);
+            rRegions.push_back(it->first);
+            rBlock.insert(rBlock.end(), p_series, p_series + mNeuralNumT);
+        }
+    }
+    else
+    {
+        // Loaded but not yet set up: pass on what was loaded
+        for (std::map<unsigned, std::vector<double> >::const_iterator it = mNeuralArchivedSeries.begin(); it != mNeuralArchivedSeries.end(); ++it)
+        {
+            rRegions.push_back(it->first);
+            rBlock.insert(rBlock.end(), it->second.begin(), it->second.end());
+        }
+    }
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::UnpackNeuralRegions(const std::vector<unsigned>& rRegions, const std::vector<double>& rBlock)
+{
+    for (unsigned i = 0; i < rRegions.size(); i++)
+    {
+        mNeuralArchivedSeries[rRegions[i]].assign(rBlock.begin() + i*mNeuralNumT, rBlock.begin() + (i+1)*mNeuralNumT);
+    }
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::ApplyNeuralRegion(unsigned region, unsigned bin)
+{
+  const std::vector<ModifiableParams>& r_params = mpNeuralInput->rGetRegionParams(region);
+  const std::vector<unsigned>& r_nodes = mNeuralRegionNodes[region];
+  AbstractCardiacTissue<DIM>* p_tissue = this->GetTissue();
+  if (mpTimeStepController && !r_nodes.empty())
+  {
+    mpTimeStepController->NotifyEvent();
+  }
+  for (unsigned i = 0; i < r_nodes.size(); i++)
+  {
+    AbstractCardiacCellInterface* p_cell = p_tissue->GetCardiacCell(r_nodes[i]);
+    for (unsigned j = 0; j < r_params.size(); j++)
+    {
+      p_cell->SetParameter(r_params[j].GetName(), r_params[j].GetValue((int) bin));
+    }
+  }
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::ApplyNeuralUpdates(const NeuralUpdate* pBegin, const NeuralUpdate* pEnd, const std::vector<std::string>& rParameterNames)
+{
+  AbstractCardiacTissue<DIM>* p_tissue = this->GetTissue();
+  if (mpTimeStepController && pBegin != pEnd)
+  {
+    mpTimeStepController->NotifyEvent();
+  }
+  for (const NeuralUpdate* p_update = pBegin; p_update != pEnd; ++p_update)
+  {
+    const std::vector<unsigned>& r_nodes = mNeuralRegionNodes[p_update->region];
+    for (unsigned i = 0; i < r_nodes.size(); i++)
+    {
+      p_tissue->GetCardiacCell(r_nodes[i])->SetParameter(rParameterNames[p_update->parameter], p_update->value);
+    }
+  }
+}
+
 template<unsigned DIM>
 void BidomainProblemNeural<DIM>::AtBeginningOfTimestep(double time)
 {
-  // Run electrode update as per BidomainProblem
+  // Run electrode update as per BidomainProblem, noting a switch for the time step controller
+  bool electrodes_were_active = this->mpElectrodes && this->mpElectrodes->AreActive();
   BidomainProblem<DIM>::AtBeginningOfTimestep(time);
+  if (mpTimeStepController && electrodes_were_active != (this->mpElectrodes && this->mpElectrodes->AreActive()))
+  {
+    mpTimeStepController->NotifyEvent();
+  }
+  if (mMonodomainWhenUnstimulated)
+  {
+    BidomainSolverNeural<DIM>* p_solver = dynamic_cast<BidomainSolverNeural<DIM>*>(this->mpSolver);
+    if (p_solver)
+    {
+      p_solver->SetMonodomainActive(!(this->mpElectrodes && this->mpElectrodes->AreActive()));
+    }
+  }
 
-  // TODO: Update parameters from singleton instance of ParamConfig
-  // -- Where parameters are changed in a region: for cells in region, set respective parameters to new value
-  // ---- Call a function of ParamConfig that returns a vector of objects
-  // ---- where each object has (int globalIndex, std::string paramNameString, double paramValue)
-/*
-  std::vector< customStruct > update_list(ParamConfig::GetUpdateList(double time));
-  for each row in update_list
-    GetBidomainTissue->GetCardiacCell(row.globalIndex)->SetParameter(row.paramName, row.paramValue)
-*/
+  if (mpNeuralStream)
+  {
+    // Read (and apply in turn, since each only holds changes) every live bin up to this time
+    unsigned bin = (unsigned) floor((time - mNeuralStreamStartTime)/mNeuralBinWidth + 1e-9);
+    while (!mpNeuralStream->IsFinished() && mpNeuralStream->GetNumBinsRead() <= bin)
+    {
+      if (mpNeuralStream->ReadBin())
+      {
+        ApplyNeuralUpdates(mpNeuralStream->GetUpdatesBegin(), mpNeuralStream->GetUpdatesEnd(), mpNeuralStream->rGetParameterNames());
+      }
+      else
+      {
+        WARNING("Live neural input " << mNeuralStreamName << " ended at " << time << " ms; keeping the last parameter values");
+      }
+    }
+    return;
+  }
+
+  if (!mpNeuralInput)
+  {
+    return;
+  }
+
+  // Parameters only change when a new histogram bin is entered
+  int bin = mpNeuralInput->GetBin(time);
+  if (bin == mLastNeuralBin)
+  {
+    return;
+  }
+
+  if (mLastNeuralBin >= 0 && (unsigned) bin == (mLastNeuralBin + 1) % mpNeuralInput->GetNumBins())
+  {
+    // Entering the next bin: only the regions whose values change need touching
+    ApplyNeuralUpdates(mpNeuralInput->GetUpdatesBegin(bin), mpNeuralInput->GetUpdatesEnd(bin), mpNeuralInput->rGetParameterNames());
+  }
+  else
+  {
+    // First update, or bins were skipped: set every region
+    for (std::map<unsigned, std::vector<unsigned> >::iterator it = mNeuralRegionNodes.begin(); it != mNeuralRegionNodes.end(); ++it)
+    {
+      ApplyNeuralRegion(it->first, bin);
+    }
+  }
+  mLastNeuralBin = bin;
+}
+
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetAdaptiveTimeStep(double maxTimeStep, double maxVoltageChange)
+{
+    if (maxTimeStep < 0.0 || maxVoltageChange <= 0.0)
+    {
+        EXCEPTION("Adaptive time step limits must be positive");
+    }
+    mAdaptiveMaxTimeStep = maxTimeStep;
+    mAdaptiveMaxVoltageChange = maxVoltageChange;
+}
+
+template<unsigned DIM>
+const QuiescentTimeStepController* BidomainProblemNeural<DIM>::GetTimeStepController() const
+{
+    return mpTimeStepController.get();
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetMonodomainWhenUnstimulated(bool useMonodomain)
+{
+    mMonodomainWhenUnstimulated = useMonodomain;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetLinearSolverStrategy(LinearSolverStrategy::type strategy)
+{
+    mLinearSolverStrategy = strategy;
+}
+
+template<unsigned DIM>
+LinearSolverStrategy::type BidomainProblemNeural<DIM>::GetLinearSolverStrategy() const
+{
+    return mLinearSolverStrategy;
+}
+
+template<unsigned DIM>
+const LinearSolveStatistics& BidomainProblemNeural<DIM>::rGetLinearSolveStatistics() const
+{
+    return mLinearSolveStatistics;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::ResetLinearSolveStatistics()
+{
+    mLinearSolveStatistics = LinearSolveStatistics();
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetSteadyStateDetection(const std::vector<unsigned>& rSampleNodes, double periodTolerance,
+                                                         double amplitudeTolerance, unsigned numCycles,
+                                                         double checkInterval, double threshold)
+{
+    if (periodTolerance < 0.0 || amplitudeTolerance < 0.0 || numCycles == 0 || checkInterval <= 0.0)
+    {
+        EXCEPTION("Steady state tolerances must not be negative, and the number of cycles and check interval must be positive");
+    }
+    // Held on every process, so they can be archived and moved to a new partition
+    int num_local = rSampleNodes.size();
+    std::vector<int> counts(PetscTools::GetNumProcs());
+    MPI_Allgather(&num_local, 1, MPI_INT, &counts[0], 1, MPI_INT, PETSC_COMM_WORLD);
+    std::vector<int> offsets(counts.size(), 0);
+    for (unsigned i = 1; i < counts.size(); i++)
+    {
+        offsets[i] = offsets[i - 1] + counts[i - 1];
+    }
+    std::vector<unsigned> sample_nodes(offsets.back() + counts.back());
+    MPI_Allgatherv(rSampleNodes.empty() ? NULL : const_cast<unsigned*>(&rSampleNodes[0]), num_local, MPI_UNSIGNED,
+                   sample_nodes.empty() ? NULL : &sample_nodes[0], &counts[0], &offsets[0], MPI_UNSIGNED, PETSC_COMM_WORLD);
+    std::sort(sample_nodes.begin(), sample_nodes.end());
+    sample_nodes.erase(std::unique(sample_nodes.begin(), sample_nodes.end()), sample_nodes.end());
+
+    mSteadySampleNodes = sample_nodes;
+    mSteadyPeriodTolerance = periodTolerance;
+    mSteadyAmplitudeTolerance = amplitudeTolerance;
+    mSteadyCycles = numCycles;
+    mSteadyThreshold = threshold;
+    mSteadyCheckInterval = sample_nodes.empty() ? 0.0 : checkInterval;
+    mpSteadyStateDetector.reset();
+    BidomainSolverNeural<DIM>* p_solver = dynamic_cast<BidomainSolverNeural<DIM>*>(this->mpSolver);
+    if (p_solver)
+    {
+        // The next solve makes a detector if one is needed
+        p_solver->SetSteadyStateDetector(NULL);
+    }
+}
+
+template<unsigned DIM>
+double BidomainProblemNeural<DIM>::GetSteadyStateTime() const
+{
+    return mSteadyStateTime;
+}
+
+template<unsigned DIM>
+bool BidomainProblemNeural<DIM>::IsDetectingSteadyState() const
+{
+    return mSteadyCheckInterval > 0.0;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetOdeThreads(unsigned numThreads)
+{
+    if (numThreads == 0)
+    {
+        EXCEPTION("Number of ODE threads must be positive");
+    }
+    mOdeThreads = numThreads;
+}
+
+template<unsigned DIM>
+unsigned BidomainProblemNeural<DIM>::GetOdeThreads() const
+{
+    return mOdeThreads;
+}
+
+template<unsigned DIM>
+AbstractDynamicLinearPdeSolver<DIM, DIM, 2>* BidomainProblemNeural<DIM>::CreateSolver()
+{
+    if (mOdeThreads == 1)
+    {
+        mpOdeThreadPool.reset();
+    }
+    else if (!mpOdeThreadPool || mpOdeThreadPool->GetNumThreads() != mOdeThreads)
+    {
+        mpOdeThreadPool.reset(new CellSweepPool(mOdeThreads));
+    }
+
+    // As BidomainProblem::CreateSolver()
+    BidomainSolverNeural<DIM>* p_solver = new BidomainSolverNeural<DIM>(this->mHasBath,
+                                                                        this->mpMesh,
+                                                                        this->mpBidomainTissue,
+                                                                        this->mpBoundaryConditionsContainer.get(),
+                                                                        mpOdeThreadPool);
+    p_solver->SetLinearSolveStatistics(&mLinearSolveStatistics);
+    p_solver->SetSteadyStateDetector(mpSteadyStateDetector.get());
+    this->mpSolver = p_solver;
+    try
+    {
+        this->mpSolver->SetFixedExtracellularPotentialNodes(this->mFixedExtracellularPotentialNodes);
+        this->mpSolver->SetRowForAverageOfPhiZeroed(this->mRowForAverageOfPhiZeroed);
+    }
+    catch (const Exception&)
+    {
+        delete this->mpSolver;
+        throw;
+    }
+    return this->mpSolver;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetCheckpointing(const std::string& rDirectory, double interval, unsigned numToKeep, double wallInterval)
+{
+    if (interval <= 0.0 || numToKeep == 0)
+    {
+        EXCEPTION("Checkpoint interval and number of checkpoints to keep must be positive");
+    }
+    mCheckpointDirectory = rDirectory;
+    mCheckpointInterval = interval;
+    mCheckpointsToKeep = numToKeep;
+    mCheckpointWallInterval = wallInterval;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SetCheckpointArchiveOptions(CheckpointArchiveFormat::type format,
+                                                             CheckpointCompression::type compression,
+                                                             int compressionLevel, bool async)
+{
+    mCheckpointFormat = format;
+    mCheckpointCompression = compression;
+    mCheckpointCompressionLevel = compressionLevel;
+    mCheckpointAsync = async;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::Solve()
+{
+    const bool is_checkpointing = !mCheckpointDirectory.empty();
+    const bool is_detecting = (mSteadyCheckInterval > 0.0);
+    mSteadyStateTime = -1.0;
+    if (mpTimeStepController)
+    {
+        // The state may have been changed since the last solve, e.g. rewound by EfsScenarioRunner
+        mpTimeStepController->Reset();
+    }
+    if (!is_checkpointing && !is_detecting)
+    {
+        SolveAndMeasure();
+        return;
+    }
+    if (mpSteadyStateDetector)
+    {
+        // The slow waves must settle again in each solve
+        mpSteadyStateDetector->Reset();
+    }
+
+    // Solve up to each checkpoint or check time in turn, as CardiacSimulation does
+    const double end_time = HeartConfig::Instance()->GetSimulationDuration();
+    const double tolerance = 1e-10*std::max(1.0, end_time);
+    mLastCheckpointWallTime = std::chrono::steady_clock::now();
+    try
+    {
+        while (this->mCurrentTime < end_time - tolerance)
+        {
+            double chunk_end = end_time;
+            double next_checkpoint = end_time;
+            if (is_checkpointing)
+            {
+                next_checkpoint = (floor((this->mCurrentTime + tolerance)/mCheckpointInterval) + 1.0)*mCheckpointInterval;
+                chunk_end = std::min(chunk_end, next_checkpoint);
+            }
+            if (is_detecting)
+            {
+                chunk_end = std::min(chunk_end, (floor((this->mCurrentTime + tolerance)/mSteadyCheckInterval) + 1.0)*mSteadyCheckInterval);
+            }
+            HeartConfig::Instance()->SetSimulationDuration(chunk_end);
+            SolveAndMeasure();
+
+            bool is_steady = is_detecting && mpSteadyStateDetector->IsSteady();
+            if (is_steady)
+            {
+                mSteadyStateTime = this->mCurrentTime;
+            }
+
+            // With a wall time interval, the master's clock decides for everyone (the end is always saved)
+            bool is_last = is_steady || chunk_end >= end_time - tolerance;
+            bool is_due = is_checkpointing && (is_last || chunk_end >= next_checkpoint - tolerance);
+            if (is_due && !is_last && mCheckpointWallInterval > 0.0)
+            {
+                double minutes = std::chrono::duration<double>(std::chrono::steady_clock::now() - mLastCheckpointWallTime).count()/60.0;
+                is_due = PetscTools::ReplicateBool(PetscTools::AmMaster() && minutes >= mCheckpointWallInterval);
+            }
+            if (is_due)
+            {
+                SaveCheckpoint();
+            }
+            if (is_steady)
+            {
+                break;
+            }
+        }
+    }
+    catch (Exception&)
+    {
+        HeartConfig::Instance()->SetSimulationDuration(end_time);
+        throw;
+    }
+    HeartConfig::Instance()->SetSimulationDuration(end_time);
+    CompletePendingCheckpoint();
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SolveAndMeasure()
+{
+    double ode_time = HeartEventHandler::GetElapsedTime(HeartEventHandler::SOLVE_ODES);
+    double assembly_time = HeartEventHandler::GetElapsedTime(HeartEventHandler::ASSEMBLE_SYSTEM);
+    // The preset only holds for this solve, so HeartConfig is left as it was for other problems and checkpoints
+    HeartConfig* p_config = HeartConfig::Instance();
+    const std::string ksp_solver = p_config->GetKSPSolver();
+    const std::string ksp_preconditioner = p_config->GetKSPPreconditioner();
+    try
+    {
+        BidomainProblem<DIM>::Solve();
+    }
+    catch (Exception&)
+    {
+        p_config->SetKSPSolver(ksp_solver.c_str());
+        p_config->SetKSPPreconditioner(ksp_preconditioner.c_str());
+        throw;
+    }
+    p_config->SetKSPSolver(ksp_solver.c_str());
+    p_config->SetKSPPreconditioner(ksp_preconditioner.c_str());
+    mMeasuredOdeTime += HeartEventHandler::GetElapsedTime(HeartEventHandler::SOLVE_ODES) - ode_time;
+    mMeasuredAssemblyTime += HeartEventHandler::GetElapsedTime(HeartEventHandler::ASSEMBLE_SYSTEM) - assembly_time;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::GetMeasuredLoad(double& rOdeTime, double& rAssemblyTime) const
+{
+    rOdeTime = mMeasuredOdeTime;
+    rAssemblyTime = mMeasuredAssemblyTime;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::GetLoadImbalance(double& rLoadedImbalance, double& rBalancedImbalance) const
+{
+    rLoadedImbalance = mLoadedImbalance;
+    rBalancedImbalance = mBalancedImbalance;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SaveCheckpoint()
+{
+    CompletePendingCheckpoint();
+
+    // Fixed point to at least the precision of the printing time step that chunks end on, so
+    // names neither switch to exponent notation nor round neighbouring times to the same name
+    int digits = std::max(3, (int) ceil(-log10(HeartConfig::Instance()->GetPrintingTimeStep()) - 1e-9));
+    std::stringstream name;
+    name << std::fixed << std::setprecision(digits) << this->mCurrentTime << "ms";
+    std::string path = mCheckpointDirectory + "/" + name.str();
+    if (mCheckpointAsync)
+    {
+        CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::SaveAsync(*this, path, true, mCheckpointFormat,
+                                                                               mCheckpointCompression, mCheckpointCompressionLevel);
+        mPendingCheckpoint = name.str();
+    }
+    else
+    {
+        CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::Save(*this, path, true, mCheckpointFormat,
+                                                                          mCheckpointCompression, mCheckpointCompressionLevel);
+        RecordCheckpoint(name.str());
+    }
+    mLastCheckpointWallTime = std::chrono::steady_clock::now();
+
+    // Each checkpoint records the load since the one before
+    mMeasuredOdeTime = 0.0;
+    mMeasuredAssemblyTime = 0.0;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::CompletePendingCheckpoint()
+{
+    if (!mPendingCheckpoint.empty())
+    {
+        CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::WaitForSave();
+        std::string name = mPendingCheckpoint;
+        mPendingCheckpoint.clear();
+        RecordCheckpoint(name);
+    }
+}
+
+template<unsigned DIM>
+std::vector<std::string> BidomainProblemNeural<DIM>::ReadCheckpointIndex(const std::string& rIndexPath)
+{
+    std::vector<std::string> names;
+    std::ifstream index_file(rIndexPath.c_str());
+    std::string name;
+    while (index_file >> name)
+    {
+        names.push_back(name);
+    }
+    return names;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::RecordCheckpoint(const std::string& rName)
+{
+    OutputFileHandler handler(mCheckpointDirectory, false);
+    std::string error;
+    if (PetscTools::AmMaster())
+    {
+        std::string index_path = handler.GetOutputDirectoryFullPath() + "checkpoints.txt";
+        std::vector<std::string> names = ReadCheckpointIndex(index_path);
+        names.push_back(rName);
+
+        // Forget the oldest checkpoints before deleting them, so the index never lists a missing one
+        std::vector<std::string> old_names;
+        while (names.size() > mCheckpointsToKeep)
+        {
+            old_names.push_back(names.front());
+            names.erase(names.begin());
+        }
+        std::string temp_path = index_path + ".tmp";
+        {
+            std::ofstream index_file(temp_path.c_str());
+            for (unsigned i = 0; i < names.size(); i++)
+            {
+                index_file << names[i] << std::endl;
+            }
+            if (!index_file.good())
+            {
+                error = "Unable to write checkpoint index " + temp_path;
+            }
+        }
+        if (error.empty() && std::rename(temp_path.c_str(), index_path.c_str()) != 0)
+        {
+            error = "Unable to replace checkpoint index " + index_path;
+        }
+        for (unsigned i = 0; i < old_names.size() && error.empty(); i++)
+        {
+            // A checkpoint saved again at the same time is still wanted
+            if (std::find(names.begin(), names.end(), old_names[i]) == names.end())
+            {
+                FileFinder old_checkpoint(mCheckpointDirectory + "/" + old_names[i], RelativeTo::ChasteTestOutput);
+                if (old_checkpoint.Exists())
+                {
+                    old_checkpoint.Remove();
+                }
+            }
+        }
+    }
+    if (PetscTools::ReplicateBool(!error.empty()))
+    {
+        EXCEPTION((error.empty() ? "Unable to record checkpoint " + rName : error));
+    }
+}
+
+template<unsigned DIM>
+BidomainProblemNeural<DIM>* BidomainProblemNeural<DIM>::LoadLatestCheckpoint(const std::string& rDirectory,
+                                                                              AbstractCardiacCellFactory<DIM>* pCellFactory)
+{
+    FileFinder index(rDirectory + "/checkpoints.txt", RelativeTo::ChasteTestOutput);
+    std::vector<std::string> names = ReadCheckpointIndex(index.GetAbsolutePath());
+    if (names.empty())
+    {
+        EXCEPTION("No complete checkpoints recorded in " + index.GetAbsolutePath());
+    }
+    if (pCellFactory != NULL)
+    {
+        return LoadBalanced(rDirectory + "/" + names.back(), pCellFactory);
+    }
+    return CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::Load(rDirectory + "/" + names.back());
+}
+
+/**
+ * Split nodes into consecutive ranges of equal total cost, at least one node each where possible.
+ *
+ * @param rNodeCosts  the cost of each node
+ * @param numProcs  the number of ranges
+ * @return the number of nodes in each range
+ */
+static std::vector<unsigned> BalanceNodeRanges(const std::vector<double>& rNodeCosts, unsigned numProcs)
+{
+    unsigned num_nodes = rNodeCosts.size();
+    double total = 0.0;
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        total += rNodeCosts[i];
+    }
+
+    std::vector<unsigned> counts(numProcs, 0u);
+    unsigned node = 0;
+    double cumulative = 0.0;
+    for (unsigned rank = 0; rank + 1 < numProcs; rank++)
+    {
+        // End the range where the running total is closest to this range's share
+        double target = total*(rank + 1)/numProcs;
+        unsigned first = node;
+        unsigned last = num_nodes - std::min(num_nodes, numProcs - rank - 1);
+        while (node < last && (node == first || cumulative + 0.5*rNodeCosts[node] < target))
+        {
+            cumulative += rNodeCosts[node];
+            node++;
+        }
+        counts[rank] = node - first;
+    }
+    counts[numProcs - 1] = num_nodes - node;
+    return counts;
+}
+
+/**
+ * @return the ratio of the largest to the mean total cost of consecutive node ranges
+ * @param rNodeCosts  the cost of each node
+ * @param rCounts  the number of nodes in each range
+ */
+static double GetRangeImbalance(const std::vector<double>& rNodeCosts, const std::vector<unsigned>& rCounts)
+{
+    double largest = 0.0;
+    double total = 0.0;
+    unsigned node = 0;
+    for (unsigned rank = 0; rank < rCounts.size(); rank++)
+    {
+        double load = 0.0;
+        for (unsigned i = 0; i < rCounts[rank] && node < rNodeCosts.size(); i++, node++)
+        {
+            load += rNodeCosts[node];
+        }
+        largest = std::max(largest, load);
+        total += load;
+    }
+    return total > 0.0 ? largest*rCounts.size()/total : 1.0;
+}
+
+template<unsigned DIM>
+BidomainProblemNeural<DIM>* BidomainProblemNeural<DIM>::LoadBalanced(const std::string& rDirectory,
+                                                                      AbstractCardiacCellFactory<DIM>* pCellFactory,
+                                                                      double threshold)
+{
+    FileFinder directory(rDirectory, RelativeTo::ChasteTestOutput);
+    BidomainProblemNeural<DIM>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::Load(directory);
+    BidomainProblemNeural<DIM>* p_problem = NULL;
+    try
+    {
+        // Every process reads the same measurements, so all make the same decision
+        std::vector<double> node_costs;
+        bool is_measured = CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::GetMeasuredNodeCosts(directory, node_costs);
+        if (!is_measured || node_costs.size() != p_loaded->rGetMesh().GetNumNodes())
+        {
+            return p_loaded;
+        }
+        unsigned num_procs = PetscTools::GetNumProcs();
+        std::vector<unsigned> counts = BalanceNodeRanges(node_costs, num_procs);
+        unsigned num_local = p_loaded->rGetMesh().GetDistributedVectorFactory()->GetLocalOwnership();
+        std::vector<unsigned> loaded_counts(num_procs);
+        MPI_Allgather(&num_local, 1, MPI_UNSIGNED, &loaded_counts[0], 1, MPI_UNSIGNED, PETSC_COMM_WORLD);
+        p_loaded->mLoadedImbalance = GetRangeImbalance(node_costs, loaded_counts);
+        p_loaded->mBalancedImbalance = GetRangeImbalance(node_costs, counts);
+        if (p_loaded->mLoadedImbalance <= threshold || counts == loaded_counts)
+        {
+            return p_loaded;
+        }
+
+        // The same problem on the same mesh numbering, split where the measurements say
+        DistributedTetrahedralMesh<DIM,DIM>* p_mesh = new DistributedTetrahedralMesh<DIM,DIM>;
+        try
+        {
+            CachedMeshReader<DIM,DIM>::ConstructMeshWithPartition(directory.GetAbsolutePath() + ArchiveLocationInfo::GetMeshFilename(),
+                                                                  *p_mesh, counts, p_loaded->rGetMesh().rGetNodePermutation());
+        }
+        catch (Exception&)
+        {
+            delete p_mesh;
+            throw;
+        }
+        p_problem = new BidomainProblemNeural<DIM>(pCellFactory, p_loaded->mHasBath);
+        p_problem->SetMesh(p_mesh);
+        p_problem->mAllocatedMemoryForMesh = true;
+
+        p_problem->CopySettings(*p_loaded);
+        p_problem->mLoadedImbalance = p_loaded->mLoadedImbalance;
+        p_problem->mBalancedImbalance = p_loaded->mBalancedImbalance;
+
+        p_problem->Initialise();
+        p_problem->mSolution = p_problem->CreateInitialCondition();
+
+        // Send each node's record to its new owner
+        std::vector<double> records;
+        p_loaded->PackState(records);
+        std::vector<unsigned> new_starts(num_procs + 1, 0u);
+        for (unsigned rank = 0; rank < num_procs; rank++)
+        {
+            new_starts[rank + 1] = new_starts[rank] + counts[rank];
+        }
+        std::vector<std::vector<double> > outgoing(num_procs);
+        for (unsigned position = 0; position < records.size(); )
+        {
+            unsigned length = 5 + (unsigned) records[position + 1] + (unsigned) records[position + 2];
+            unsigned owner = std::upper_bound(new_starts.begin(), new_starts.end(), (unsigned) records[position]) - new_starts.begin() - 1;
+            outgoing[owner].insert(outgoing[owner].end(), records.begin() + position, records.begin() + position + length);
+            position += length;
+        }
+        std::vector<int> send_counts(num_procs), send_offsets(num_procs), receive_counts(num_procs), receive_offsets(num_procs);
+        std::vector<double> send_buffer;
+        for (unsigned rank = 0; rank < num_procs; rank++)
+        {
+            send_offsets[rank] = send_buffer.size();
+            send_counts[rank] = outgoing[rank].size();
+            send_buffer.insert(send_buffer.end(), outgoing[rank].begin(), outgoing[rank].end());
+        }
+        MPI_Alltoall(&send_counts[0], 1, MPI_INT, &receive_counts[0], 1, MPI_INT, PETSC_COMM_WORLD);
+        unsigned num_received = 0;
+        for (unsigned rank = 0; rank < num_procs; rank++)
+        {
+            receive_offsets[rank] = num_received;
+            num_received += receive_counts[rank];
+        }
+        std::vector<double> received(num_received);
+        MPI_Alltoallv(send_buffer.data(), &send_counts[0], &send_offsets[0], MPI_DOUBLE,
+                      received.data(), &receive_counts[0], &receive_offsets[0], MPI_DOUBLE, PETSC_COMM_WORLD);
+        p_problem->UnpackState(received, p_loaded->GetCurrentTime());
+    }
+    catch (Exception&)
+    {
+        delete p_problem;
+        delete p_loaded;
+        throw;
+    }
+    delete p_loaded;
+    return p_problem;
 }
 
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::CopySettings(const BidomainProblemNeural<DIM>& rOther)
+{
+    mNeuralFile = rOther.mNeuralFile;
+    mNeuralNumX = rOther.mNeuralNumX;
+    mNeuralNumY = rOther.mNeuralNumY;
+    mNeuralNumT = rOther.mNeuralNumT;
+    mNeuralXLength = rOther.mNeuralXLength;
+    mNeuralYLength = rOther.mNeuralYLength;
+    mNeuralBinWidth = rOther.mNeuralBinWidth;
+    mNeuralParameters = rOther.mNeuralParameters;
+    mNeuralNodeShared = rOther.mNeuralNodeShared;
+    mCheckpointDirectory = rOther.mCheckpointDirectory;
+    mCheckpointInterval = rOther.mCheckpointInterval;
+    mCheckpointsToKeep = rOther.mCheckpointsToKeep;
+    mCheckpointWallInterval = rOther.mCheckpointWallInterval;
+    mCheckpointFormat = rOther.mCheckpointFormat;
+    mCheckpointCompression = rOther.mCheckpointCompression;
+    mCheckpointCompressionLevel = rOther.mCheckpointCompressionLevel;
+    mCheckpointAsync = rOther.mCheckpointAsync;
+    mAdaptiveMaxTimeStep = rOther.mAdaptiveMaxTimeStep;
+    mAdaptiveMaxVoltageChange = rOther.mAdaptiveMaxVoltageChange;
+    mMonodomainWhenUnstimulated = rOther.mMonodomainWhenUnstimulated;
+    mOdeThreads = rOther.mOdeThreads;
+    mLinearSolverStrategy = rOther.mLinearSolverStrategy;
+    mSteadySampleNodes = rOther.mSteadySampleNodes;
+    mSteadyPeriodTolerance = rOther.mSteadyPeriodTolerance;
+    mSteadyAmplitudeTolerance = rOther.mSteadyAmplitudeTolerance;
+    mSteadyCycles = rOther.mSteadyCycles;
+    mSteadyThreshold = rOther.mSteadyThreshold;
+    mSteadyCheckInterval = rOther.mSteadyCheckInterval;
+}
+
+/**
+ * Finds the element of a (serial) mesh containing a point, through a grid of buckets over the
+ * bounding box holding the elements whose bounding boxes overlap each bucket.
+ */
+template<unsigned DIM>
+class ElementLocator
+{
+    private:
+    TetrahedralMesh<DIM,DIM>& mrMesh;
+    c_vector<double, DIM> mLower;
+    c_vector<double, DIM> mBucketSize;
+    unsigned mNumBuckets;  // along each axis
+    std::vector<std::vector<unsigned> > mBuckets;
+
+    unsigned GetBucket(const c_vector<double, DIM>& rLocation, unsigned axis) const
+    {
+        double position = (rLocation[axis] - mLower[axis])/mBucketSize[axis];
+        return (unsigned) std::min(std::max(position, 0.0), (double) (mNumBuckets - 1));
+    }
+
+    public:
+    ElementLocator(TetrahedralMesh<DIM,DIM>& rMesh)
+        : mrMesh(rMesh)
+    {
+        // About one element per bucket
+        mNumBuckets = std::max(1u, (unsigned) std::pow((double) rMesh.GetNumElements(), 1.0/DIM));
+        ChasteCuboid<DIM> box = rMesh.CalculateBoundingBox();
+        for (unsigned axis = 0; axis < DIM; axis++)
+        {
+            mLower[axis] = box.rGetLowerCorner()[axis];
+            mBucketSize[axis] = std::max(box.rGetUpperCorner()[axis] - mLower[axis], 1e-12)/mNumBuckets;
+        }
+        unsigned num_buckets = 1;
+        for (unsigned axis = 0; axis < DIM; axis++)
+        {
+            num_buckets *= mNumBuckets;
+        }
+        mBuckets.resize(num_buckets);
+
+        for (unsigned element = 0; element < rMesh.GetNumElements(); element++)
+        {
+            Element<DIM,DIM>* p_element = rMesh.GetElement(element);
+            unsigned first[DIM], last[DIM];
+            for (unsigned axis = 0; axis < DIM; axis++)
+            {
+                first[axis] = mNumBuckets;
+                last[axis] = 0;
+                for (unsigned i = 0; i < p_element->GetNumNodes(); i++)
+                {
+                    unsigned bucket = GetBucket(p_element->GetNode(i)->rGetLocation(), axis);
+                    first[axis] = std::min(first[axis], bucket);
+                    last[axis] = std::max(last[axis], bucket);
+                }
+            }
+            unsigned counter[DIM];
+            std::copy(first, first + DIM, counter);
+            while (true)
+            {
+                unsigned bucket = 0;
+                for (unsigned axis = DIM; axis-- > 0; )
+                {
+                    bucket = bucket*mNumBuckets + counter[axis];
+                }
+                mBuckets[bucket].push_back(element);
+                unsigned axis = 0;
+                while (axis < DIM && counter[axis] == last[axis])
+                {
+                    counter[axis] = first[axis];
+                    axis++;
+                }
+                if (axis == DIM)
+                {
+                    break;
+                }
+                counter[axis]++;
+            }
+        }
+    }
+
+    /**
+     * @return the element containing a point, or the one it is least outside of
+     * @param rLocation  the point
+     * @param rWeights  filled with the interpolation weights of the point in the element,
+     *     clipped to be non-negative and summing to one
+     */
+    unsigned Locate(const c_vector<double, DIM>& rLocation, c_vector<double, DIM+1>& rWeights)
+    {
+        unsigned bucket = 0;
+        for (unsigned axis = DIM; axis-- > 0; )
+        {
+            bucket = bucket*mNumBuckets + GetBucket(rLocation, axis);
+        }
+        ChastePoint<DIM> point(rLocation);
+        unsigned best = UINT_MAX;
+        double best_weight = -DBL_MAX;
+        for (unsigned i = 0; i < mBuckets[bucket].size() && best_weight < -1e-10; i++)
+        {
+            c_vector<double, DIM+1> weights = mrMesh.GetElement(mBuckets[bucket][i])->CalculateInterpolationWeights(point);
+            double smallest = *std::min_element(weights.begin(), weights.end());
+            if (smallest > best_weight)
+            {
+                best = mBuckets[bucket][i];
+                best_weight = smallest;
+            }
+        }
+        if (best == UINT_MAX)
+        {
+            best = mrMesh.GetNearestElementIndex(point);
+        }
+
+        rWeights = mrMesh.GetElement(best)->CalculateInterpolationWeights(point);
+        double total = 0.0;
+        for (unsigned i = 0; i <= DIM; i++)
+        {
+            rWeights[i] = std::max(rWeights[i], 0.0);
+            total += rWeights[i];
+        }
+        rWeights /= total;
+        return best;
+    }
+};
+
+template<unsigned DIM>
+BidomainProblemNeural<DIM>* BidomainProblemNeural<DIM>::LoadProlonged(const std::string& rDirectory,
+                                                                       DistributedTetrahedralMesh<DIM,DIM>* pFineMesh,
+                                                                       AbstractCardiacCellFactory<DIM>* pCellFactory)
+{
+    FileFinder directory(rDirectory, RelativeTo::ChasteTestOutput);
+    BidomainProblemNeural<DIM>* p_coarse = NULL;
+    BidomainProblemNeural<DIM>* p_problem = NULL;
+    try
+    {
+        p_coarse = CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::Load(directory);
+
+        // The mesh of a checkpoint is in the numbering of its solution and state records
+        TrianglesMeshReader<DIM,DIM> coarse_reader(directory.GetAbsolutePath() + ArchiveLocationInfo::GetMeshFilename());
+        TetrahedralMesh<DIM,DIM> coarse_mesh;
+        coarse_mesh.ConstructFromMeshReader(coarse_reader);
+
+        // Every process gets the state of every coarse node
+        std::vector<double> local_records;
+        p_coarse->PackState(local_records);
+        unsigned num_procs = PetscTools::GetNumProcs();
+        int num_local_values = local_records.size();
+        std::vector<int> counts(num_procs), offsets(num_procs);
+        MPI_Allgather(&num_local_values, 1, MPI_INT, &counts[0], 1, MPI_INT, PETSC_COMM_WORLD);
+        unsigned num_values = 0;
+        for (unsigned rank = 0; rank < num_procs; rank++)
+        {
+            offsets[rank] = num_values;
+            num_values += counts[rank];
+        }
+        std::vector<double> records(num_values);
+        MPI_Allgatherv(local_records.data(), num_local_values, MPI_DOUBLE,
+                       records.data(), &counts[0], &offsets[0], MPI_DOUBLE, PETSC_COMM_WORLD);
+        std::vector<unsigned> record_starts(coarse_mesh.GetNumNodes(), UINT_MAX);
+        for (unsigned position = 0; position < records.size(); )
+        {
+            unsigned node_index = (unsigned) records[position];
+            if (node_index < record_starts.size())
+            {
+                record_starts[node_index] = position;
+            }
+            position += 5 + (unsigned) records[position + 1] + (unsigned) records[position + 2];
+        }
+        if (std::find(record_starts.begin(), record_starts.end(), UINT_MAX) != record_starts.end())
+        {
+            EXCEPTION("Checkpoint " + rDirectory + " does not hold the state of every node of its mesh");
+        }
+
+        p_problem = new BidomainProblemNeural<DIM>(pCellFactory, p_coarse->mHasBath);
+        p_problem->SetMesh(pFineMesh);
+        p_problem->mAllocatedMemoryForMesh = true;
+        pFineMesh = NULL;
+        p_problem->CopySettings(*p_coarse);
+        p_problem->Initialise();
+        p_problem->mSolution = p_problem->CreateInitialCondition();
+
+        // Steady state detection samples the fine nodes nearest the coarse ones
+        DistributedVectorFactory* p_fine_factory = p_problem->rGetMesh().GetDistributedVectorFactory();
+        std::vector<unsigned> fine_sample_nodes;
+        for (unsigned i = 0; i < p_problem->mSteadySampleNodes.size(); i++)
+        {
+            const c_vector<double, DIM>& r_location = coarse_mesh.GetNode(p_problem->mSteadySampleNodes[i])->rGetLocation();
+            struct
+            {
+                double distance;
+                int index;
+            } local_nearest = {DBL_MAX, -1}, nearest;
+            for (unsigned node_index = p_fine_factory->GetLow(); node_index < p_fine_factory->GetHigh(); node_index++)
+            {
+                double distance = norm_2(p_problem->rGetMesh().GetNode(node_index)->rGetLocation() - r_location);
+                if (distance < local_nearest.distance)
+                {
+                    local_nearest.distance = distance;
+                    local_nearest.index = node_index;
+                }
+            }
+            MPI_Allreduce(&local_nearest, &nearest, 1, MPI_DOUBLE_INT, MPI_MINLOC, PETSC_COMM_WORLD);
+            fine_sample_nodes.push_back(nearest.index);
+        }
+        std::sort(fine_sample_nodes.begin(), fine_sample_nodes.end());
+        fine_sample_nodes.erase(std::unique(fine_sample_nodes.begin(), fine_sample_nodes.end()), fine_sample_nodes.end());
+        p_problem->mSteadySampleNodes = fine_sample_nodes;
+
+        // Records for the owned fine nodes, without parameters so the new cells keep theirs
+        ElementLocator<DIM> locator(coarse_mesh);
+        DistributedVectorFactory* p_factory = p_problem->rGetMesh().GetDistributedVectorFactory();
+        AbstractCardiacTissue<DIM>* p_tissue = p_problem->GetTissue();
+        std::vector<double> fine_records;
+        for (unsigned node_index = p_factory->GetLow(); node_index < p_factory->GetHigh(); node_index++)
+        {
+            c_vector<double, DIM+1> weights;
+            Element<DIM,DIM>* p_element = coarse_mesh.GetElement(locator.Locate(p_problem->rGetMesh().GetNode(node_index)->rGetLocation(), weights));
+            AbstractCardiacCellInterface* p_cell = p_tissue->GetCardiacCell(node_index);
+            std::vector<double> state = p_cell->GetStdVecStateVariables();
+
+            double phi_e = 0.0;
+            double voltage = 0.0;
+            double matching_weight = 0.0;
+            std::vector<double> matching_state(state.size(), 0.0);
+            for (unsigned i = 0; i <= DIM; i++)
+            {
+                const double* p_record = &records[record_starts[p_element->GetNodeGlobalIndex(i)]];
+                phi_e += weights[i]*p_record[4];
+                if ((unsigned) p_record[1] == state.size())
+                {
+                    voltage += weights[i]*p_record[3];
+                    for (unsigned j = 0; j < state.size(); j++)
+                    {
+                        matching_state[j] += weights[i]*p_record[5 + j];
+                    }
+                    matching_weight += weights[i];
+                }
+            }
+            if (matching_weight > 0.0)
+            {
+                voltage /= matching_weight;
+                for (unsigned j = 0; j < state.size(); j++)
+                {
+                    state[j] = matching_state[j]/matching_weight;
+                }
+            }
+            else
+            {
+                voltage = p_cell->GetVoltage();
+            }
+
+            fine_records.push_back(node_index);
+            fine_records.push_back(state.size());
+            fine_records.push_back(0.0);
+            fine_records.push_back(voltage);
+            fine_records.push_back(phi_e);
+            fine_records.insert(fine_records.end(), state.begin(), state.end());
+        }
+        p_problem->UnpackState(fine_records, p_coarse->GetCurrentTime());
+    }
+    catch (Exception&)
+    {
+        delete pFineMesh;
+        delete p_problem;
+        delete p_coarse;
+        throw;
+    }
+    delete p_coarse;
+    return p_problem;
+}
+
+/** Identifies the packed state files of a state-only checkpoint. */
+static const unsigned STATE_FILE_MAGIC = 0x4e535431;
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::PackState(std::vector<double>& rRecords)
+{
+    if (this->mSolution == NULL)
+    {
+        EXCEPTION("There is no state to save before the problem has been solved");
+    }
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    unsigned lo = p_factory->GetLow();
+    unsigned hi = p_factory->GetHigh();
+
+    // Node records: index, numbers of state variables and parameters, solution (V, phi_e), state, parameters
+    rRecords.clear();
+    AbstractCardiacTissue<DIM>* p_tissue = this->GetTissue();
+    double* p_solution;
+    VecGetArray(this->mSolution, &p_solution);
+    for (unsigned node_index = lo; node_index < hi; node_index++)
+    {
+        AbstractCardiacCellInterface* p_cell = p_tissue->GetCardiacCell(node_index);
+        std::vector<double> state = p_cell->GetStdVecStateVariables();
+        AbstractUntemplatedParameterisedSystem* p_system = dynamic_cast<AbstractUntemplatedParameterisedSystem*>(p_cell);
+        unsigned num_parameters = (p_system != NULL) ? p_system->GetNumberOfParameters() : 0u;
+
+        rRecords.push_back(node_index);
+        rRecords.push_back(state.size());
+        rRecords.push_back(num_parameters);
+        rRecords.push_back(p_solution[2*(node_index - lo)]);
+        rRecords.push_back(p_solution[2*(node_index - lo) + 1]);
+        rRecords.insert(rRecords.end(), state.begin(), state.end());
+        for (unsigned i = 0; i < num_parameters; i++)
+        {
+            rRecords.push_back(p_system->GetParameter(i));
+        }
+    }
+    VecRestoreArray(this->mSolution, &p_solution);
+}
+
+template<unsigned DIM>
+bool BidomainProblemNeural<DIM>::UnpackNodeRecords(const std::vector<double>& rRecords, unsigned& rNumLoaded)
+{
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    unsigned lo = p_factory->GetLow();
+    unsigned hi = p_factory->GetHigh();
+    AbstractCardiacTissue<DIM>* p_tissue = this->GetTissue();
+    double* p_solution;
+    VecGetArray(this->mSolution, &p_solution);
+
+    bool is_corrupt = false;
+    unsigned position = 0;
+    while (position < rRecords.size() && !is_corrupt)
+    {
+        unsigned node_index = (unsigned) rRecords[position];
+        unsigned num_state = (unsigned) rRecords[position + 1];
+        unsigned num_parameters = (unsigned) rRecords[position + 2];
+        if (position + 5 + num_state + num_parameters > rRecords.size())
+        {
+            is_corrupt = true;
+        }
+        else if (node_index >= lo && node_index < hi)
+        {
+            // A record for a different kind of cell is reported to the caller to replicate, rather
+            // than letting the cell throw on this process alone
+            AbstractCardiacCellInterface* p_cell = p_tissue->GetCardiacCell(node_index);
+            AbstractUntemplatedParameterisedSystem* p_system = dynamic_cast<AbstractUntemplatedParameterisedSystem*>(p_cell);
+            unsigned cell_parameters = (p_system != NULL) ? p_system->GetNumberOfParameters() : 0u;
+            if (num_state != p_cell->GetNumberOfStateVariables() || num_parameters != cell_parameters)
+            {
+                is_corrupt = true;
+                break;
+            }
+
+            p_solution[2*(node_index - lo)] = rRecords[position + 3];
+            p_solution[2*(node_index - lo) + 1] = rRecords[position + 4];
+
+            const double* p_values = &rRecords[position + 5];
+            p_cell->SetStateVariables(std::vector<double>(p_values, p_values + num_state));
+            for (unsigned i = 0; i < num_parameters; i++)
+            {
+                p_system->SetParameter(i, p_values[num_state + i]);
+            }
+            rNumLoaded++;
+        }
+        position += 5 + num_state + num_parameters;
+    }
+    VecRestoreArray(this->mSolution, &p_solution);
+    return !is_corrupt;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::UnpackState(const std::vector<double>& rRecords, double time)
+{
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    unsigned num_loaded = 0;
+    bool is_valid = (this->mSolution != NULL) && UnpackNodeRecords(rRecords, num_loaded);
+    if (PetscTools::ReplicateBool(!is_valid || num_loaded != p_factory->GetLocalOwnership()))
+    {
+        EXCEPTION("State does not match the nodes owned by this process");
+    }
+    this->mCurrentTime = time;
+    mLastNeuralBin = -1;
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::SaveState(const std::string& rDirectory, const std::string& rBaseCheckpoint)
+{
+    FileFinder base(rBaseCheckpoint, RelativeTo::ChasteTestOutput);
+    if (!base.IsDir())
+    {
+        EXCEPTION("Base checkpoint does not exist: " + base.GetAbsolutePath());
+    }
+
+    OutputFileHandler handler(rDirectory);
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    unsigned lo = p_factory->GetLow();
+    unsigned hi = p_factory->GetHigh();
+    std::vector<double> packed;
+    PackState(packed);
+
+    std::stringstream file_name;
+    file_name << "state." << PetscTools::GetMyRank() << ".bin";
+    std::string path = handler.GetOutputDirectoryFullPath() + file_name.str();
+    std::ofstream state_file(path.c_str(), std::ios::binary | std::ios::trunc);
+    unsigned header[3] = {STATE_FILE_MAGIC, hi - lo, (unsigned) packed.size()};
+    state_file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    state_file.write(reinterpret_cast<const char*>(packed.data()), packed.size()*sizeof(double));
+    state_file.close();
+    if (PetscTools::ReplicateBool(state_file.fail()))
+    {
+        EXCEPTION("Unable to write state-only checkpoint files in " + handler.GetOutputDirectoryFullPath());
+    }
+
+    // The master describes the checkpoint once every process has written its file
+    std::vector<unsigned> ranges(2*PetscTools::GetNumProcs());
+    unsigned my_range[2] = {lo, hi};
+    MPI_Gather(my_range, 2, MPI_UNSIGNED, ranges.data(), 2, MPI_UNSIGNED, 0, PETSC_COMM_WORLD);
+    if (PetscTools::AmMaster())
+    {
+        out_stream p_info = handler.OpenOutputFile("state.info");
+        *p_info << PetscTools::GetNumProcs() << " 0" << std::endl;
+        *p_info << "base " << rBaseCheckpoint << std::endl;
+        *p_info << "nodes " << this->mpMesh->GetNumNodes() << std::endl;
+        *p_info << std::setprecision(17) << "time " << this->mCurrentTime << std::endl;
+        for (unsigned rank = 0; rank < PetscTools::GetNumProcs(); rank++)
+        {
+            *p_info << "range " << rank << " " << ranges[2*rank] << " " << ranges[2*rank + 1] << std::endl;
+        }
+        p_info->close();
+    }
+    PetscTools::Barrier("BidomainProblemNeural::SaveState");
+}
+
+/**
+ * Read the description of a state-only checkpoint.
+ *
+ * @param rInfoPath  path of state.info
+ * @param rBase  filled with the base checkpoint directory
+ * @param rNumNodes  filled with the number of mesh nodes
+ * @param rTime  filled with the simulation time
+ * @param rRanges  filled with the node range [lo, hi) saved by each process
+ */
+static void ReadStateInfo(const std::string& rInfoPath, std::string& rBase, unsigned& rNumNodes, double& rTime,
+                          std::vector<std::pair<unsigned, unsigned> >& rRanges)
+{
+    std::ifstream info_file(rInfoPath.c_str());
+    if (!info_file.is_open())
+    {
+        EXCEPTION("Unable to open state-only checkpoint information file: " + rInfoPath);
+    }
+    unsigned num_procs, state_version;
+    info_file >> num_procs >> state_version;
+    rRanges.assign(num_procs, std::make_pair(0u, 0u));
+    std::string key;
+    while (info_file >> key)
+    {
+        if (key == "base")
+        {
+            info_file >> rBase;
+        }
+        else if (key == "nodes")
+        {
+            info_file >> rNumNodes;
+        }
+        else if (key == "time")
+        {
+            info_file >> rTime;
+        }
+        else if (key == "range")
+        {
+            unsigned rank;
+            info_file >> rank;
+            info_file >> rRanges.at(rank).first >> rRanges.at(rank).second;
+        }
+    }
+}
+
+template<unsigned DIM>
+void BidomainProblemNeural<DIM>::LoadState(const std::string& rDirectory)
+{
+    FileFinder directory(rDirectory, RelativeTo::ChasteTestOutput);
+    std::string base;
+    unsigned num_nodes = 0;
+    double time = 0.0;
+    std::vector<std::pair<unsigned, unsigned> > ranges;
+    ReadStateInfo(directory.GetAbsolutePath() + "state.info", base, num_nodes, time, ranges);
+    if (num_nodes != this->mpMesh->GetNumNodes() || this->mSolution == NULL)
+    {
+        EXCEPTION("State-only checkpoint " + directory.GetAbsolutePath() + " does not match this problem");
+    }
+
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    unsigned lo = p_factory->GetLow();
+    unsigned hi = p_factory->GetHigh();
+
+    // Only the files of processes that owned some of our nodes need reading
+    unsigned num_loaded = 0;
+    bool is_corrupt = false;
+    for (unsigned rank = 0; rank < ranges.size() && !is_corrupt; rank++)
+    {
+        if (ranges[rank].second <= lo || ranges[rank].first >= hi)
+        {
+            continue;
+        }
+        std::stringstream path;
+        path << directory.GetAbsolutePath() << "state." << rank << ".bin";
+        std::ifstream state_file(path.str().c_str(), std::ios::binary);
+        unsigned header[3] = {0u, 0u, 0u};
+        state_file.read(reinterpret_cast<char*>(header), sizeof(header));
+        std::vector<double> packed(header[2]);
+        state_file.read(reinterpret_cast<char*>(packed.data()), packed.size()*sizeof(double));
+        is_corrupt = !state_file || header[0] != STATE_FILE_MAGIC || !UnpackNodeRecords(packed, num_loaded);
+    }
+
+    if (PetscTools::ReplicateBool(is_corrupt || num_loaded != hi - lo))
+    {
+        EXCEPTION("State-only checkpoint " + directory.GetAbsolutePath() + " is incomplete or corrupt");
+    }
+    this->mCurrentTime = time;
+
+    // Neural parameters are set afresh at the next time step
+    mLastNeuralBin = -1;
+}
+
+template<unsigned DIM>
+BidomainProblemNeural<DIM>* BidomainProblemNeural<DIM>::LoadFromState(const std::string& rDirectory)
+{
+    FileFinder directory(rDirectory, RelativeTo::ChasteTestOutput);
+    std::string base;
+    unsigned num_nodes = 0;
+    double time = 0.0;
+    std::vector<std::pair<unsigned, unsigned> > ranges;
+    ReadStateInfo(directory.GetAbsolutePath() + "state.info", base, num_nodes, time, ranges);
+
+    BidomainProblemNeural<DIM>* p_problem = CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::Load(base);
+    try
+    {
+        p_problem->LoadState(rDirectory);
+    }
+    catch (Exception&)
+    {
+        delete p_problem;
+        throw;
+    }
+    return p_problem;
+}
 
 // Serialization for Boost >= 1.36
 #include "SerializationExportWrapperForCpp.hpp"
@@ -37,11 +37,29 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef BIDOMAINPROBLEMNEURAL_HPP_
 #define BIDOMAINPROBLEMNEURAL_HPP_
 
+#include <chrono>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "ChasteSerialization.hpp"
 #include <boost/serialization/base_object.hpp>
+#include <boost/serialization/binary_object.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "BidomainProblem.hpp"
 #include "AbstractCardiacCellFactory.hpp"
+#include "../src/CardiacSimulationArchiverNeural.hpp"
+#include "../src/CellSweepPool.hpp"
+#include "../src/LinearSolverStrategy.hpp"
+#include "../src/QuiescentTimeStepController.hpp"
+#include "../src/SteadyStateDetector.hpp"
+#include "ProcessSpecificArchive.hpp"
+#include "../src/NeuralComponents.hpp"
 
 /**
  * Class which specifies and solves a bidomain problem.
@@ -66,7 +84,345 @@ class BidomainProblemNeural : public BidomainProblem<DIM>
     void serialize(Archive & archive, const unsigned int version)
     {
         archive & boost::serialization::base_object< BidomainProblem<DIM> >(*this);
+
+        // Only the description of the neural input is archived. The histogram itself is
+        // re-read for the (possibly different) set of regions each process owns after loading.
+        if (version > 0)
+        {
+            archive & mNeuralFile;
+            archive & mNeuralNumX;
+            archive & mNeuralNumY;
+            archive & mNeuralNumT;
+            archive & mNeuralXLength;
+            archive & mNeuralYLength;
+            archive & mNeuralBinWidth;
+            archive & mNeuralParameters;
+        }
+        if (version > 1)
+        {
+            archive & mNeuralNodeShared;
+        }
+        if (version > 3)
+        {
+            archive & mCheckpointDirectory;
+            archive & mCheckpointInterval;
+            archive & mCheckpointsToKeep;
+            archive & mCheckpointWallInterval;
+            archive & mCheckpointFormat;
+            archive & mCheckpointCompression;
+            archive & mCheckpointCompressionLevel;
+            archive & mCheckpointAsync;
+        }
+        if (version > 4)
+        {
+            archive & mAdaptiveMaxTimeStep;
+            archive & mAdaptiveMaxVoltageChange;
+        }
+        if (version > 5)
+        {
+            archive & mMonodomainWhenUnstimulated;
+        }
+        if (version > 6)
+        {
+            archive & mOdeThreads;
+        }
+        if (version > 7)
+        {
+            archive & mLinearSolverStrategy;
+        }
+        if (version > 8)
+        {
+            archive & mSteadySampleNodes;
+            archive & mSteadyPeriodTolerance;
+            archive & mSteadyAmplitudeTolerance;
+            archive & mSteadyCycles;
+            archive & mSteadyThreshold;
+            archive & mSteadyCheckInterval;
+        }
+        // The firing rates of the regions each process uses go in its own archive, so a
+        // checkpoint does not depend on the histogram file
+        mNeuralRegionsArchived = (version > 2);
+        if (mNeuralRegionsArchived)
+        {
+            SerializeNeuralRegions(*ProcessSpecificArchive<Archive>::Get());
+        }
+    }
+
+    /**
+     * Save or load the firing rate series of the control regions used by this process, as a
+     * list of region ids followed by one packed binary block of their series.
+     *
+     * @param rArchive  a process-specific archive
+     */
+    template<class Archive>
+    void SerializeNeuralRegions(Archive & rArchive)
+    {
+        std::vector<unsigned> regions;
+        std::vector<double> block;
+        if (Archive::is_saving::value)
+        {
+            PackNeuralRegions(regions, block);
+        }
+        rArchive & regions;
+        block.resize(regions.size()*mNeuralNumT);
+        if (!block.empty())
+        {
+            rArchive & boost::serialization::make_binary_object(block.data(), block.size()*sizeof(double));
+        }
+        if (Archive::is_loading::value)
+        {
+            UnpackNeuralRegions(regions, block);
+        }
     }
+
+    /**
+     * Solve as BidomainProblem::Solve() does, adding the time spent solving cell ODEs and
+     * assembling to the measured load.
+     */
+    void SolveAndMeasure();
+
+    /**
+     * Save a periodic checkpoint of the current state, named after the current time.
+     */
+    void SaveCheckpoint();
+
+    /**
+     * Complete a background checkpoint, if one is in progress, and record it.
+     */
+    void CompletePendingCheckpoint();
+
+    /**
+     * Add a complete checkpoint to the index of the checkpoint directory, and delete the
+     * oldest ones beyond the number to keep. Must be called collectively.
+     *
+     * @param rName  the checkpoint's subdirectory of the checkpoint directory
+     */
+    void RecordCheckpoint(const std::string& rName);
+
+    /**
+     * @return the subdirectories of complete checkpoints in an index file, oldest first
+     * @param rIndexPath  full path of the index file
+     */
+    static std::vector<std::string> ReadCheckpointIndex(const std::string& rIndexPath);
+
+    /**
+     * Collect the series of the control regions used by this process for archiving.
+     *
+     * @param rRegions  filled with the region ids
+     * @param rBlock  filled with mNeuralNumT firing rates for each region in turn
+     */
+    void PackNeuralRegions(std::vector<unsigned>& rRegions, std::vector<double>& rBlock) const;
+
+    /**
+     * Keep series loaded from an archive until the neural input is next set up.
+     *
+     * @param rRegions  the region ids
+     * @param rBlock  mNeuralNumT firing rates for each region in turn
+     */
+    void UnpackNeuralRegions(const std::vector<unsigned>& rRegions, const std::vector<double>& rBlock);
+
+    /**
+     * Apply the node records of a packed state to the nodes this process owns, ignoring the rest.
+     * Not collective; the caller replicates a failure.
+     *
+     * @param rRecords  node records, as made by PackState()
+     * @param rNumLoaded  incremented for each node applied
+     * @return false if the records are malformed, or a record's numbers of state variables or
+     *     parameters differ from those of the cell of its node
+     */
+    bool UnpackNodeRecords(const std::vector<double>& rRecords, unsigned& rNumLoaded);
+
+    /**
+     * Take the archived settings of another problem (neural input, checkpointing and solve
+     * options), when rebuilding a loaded problem on another mesh or partition.
+     *
+     * @param rOther  the loaded problem
+     */
+    void CopySettings(const BidomainProblemNeural<DIM>& rOther);
+
+    /** Histogram file holding the neural input, empty if there is none. */
+    std::string mNeuralFile;
+
+    /** Number of control regions along x. */
+    unsigned mNeuralNumX;
+
+    /** Number of control regions along y. */
+    unsigned mNeuralNumY;
+
+    /** Number of time bins in the histogram. */
+    unsigned mNeuralNumT;
+
+    /** Length of the control region grid along x, or 0 to take the grid from the bounding box of the driven tissue. */
+    double mNeuralXLength;
+
+    /** Length of the control region grid along y. */
+    double mNeuralYLength;
+
+    /** Width of each histogram time bin (ms). */
+    double mNeuralBinWidth;
+
+    /** (cell parameter name, calibration function name) for each neurally driven parameter. */
+    std::vector<std::pair<std::string, std::string> > mNeuralParameters;
+
+    /** Whether the histogram is held once per compute node rather than once per process. */
+    bool mNeuralNodeShared;
+
+    /** Calibrated neural input for the control regions needed by nodes owned by this process. */
+    boost::shared_ptr<NeuralIngestion> mpNeuralInput;
+
+    /** Locally owned nodes driven by neural input, for each control region. */
+    std::map<unsigned, std::vector<unsigned> > mNeuralRegionNodes;
+
+    /** Histogram bin applied at the last update, or -1 to force an update. */
+    int mLastNeuralBin;
+
+    /** Directory (relative to CHASTE_TEST_OUTPUT) for periodic checkpoints, empty for none. */
+    std::string mCheckpointDirectory;
+
+    /** Simulated time between periodic checkpoints (ms); Solve() runs in chunks of this length. */
+    double mCheckpointInterval;
+
+    /** Number of periodic checkpoints to keep. */
+    unsigned mCheckpointsToKeep;
+
+    /** If positive, wall time (minutes) between periodic checkpoints, checked at the end of each chunk. */
+    double mCheckpointWallInterval;
+
+    /** Archive format of periodic checkpoints. */
+    CheckpointArchiveFormat::type mCheckpointFormat;
+
+    /** Compression of periodic checkpoints. */
+    CheckpointCompression::type mCheckpointCompression;
+
+    /** Compression level of periodic checkpoints. */
+    int mCheckpointCompressionLevel;
+
+    /** Whether periodic checkpoints are written in the background. */
+    bool mCheckpointAsync;
+
+    /** Name of a background checkpoint not yet recorded as complete, if any. */
+    std::string mPendingCheckpoint;
+
+    /** Wall clock time of the last periodic checkpoint (or of the start of Solve()). */
+    std::chrono::steady_clock::time_point mLastCheckpointWallTime;
+
+    /** Whether the archive this problem was loaded from holds neural region series. */
+    bool mNeuralRegionsArchived;
+
+    /** Firing rate series of control regions loaded from a checkpoint, until the input is set up. */
+    std::map<unsigned, std::vector<double> > mNeuralArchivedSeries;
+
+    /** Shared memory name of the ring buffer carrying live neural input, empty if there is none. */
+    std::string mNeuralStreamName;
+
+    /** Number of bins the live neural input producer may get ahead by. */
+    unsigned mNeuralStreamCapacity;
+
+    /** How long to wait for each live neural input bin (s), or 0 for as long as the producer lives. */
+    double mNeuralStreamTimeout;
+
+    /** Live neural input, received bin by bin from a concurrently running producer. */
+    boost::shared_ptr<NeuralStream> mpNeuralStream;
+
+    /** Simulation time at which the first live bin applies (ms). */
+    double mNeuralStreamStartTime;
+
+    /** Wall time this process spent solving cell ODEs since the last periodic checkpoint (ms). */
+    double mMeasuredOdeTime;
+
+    /** Wall time this process spent assembling since the last periodic checkpoint (ms). */
+    double mMeasuredAssemblyTime;
+
+    /** Ratio of the maximum to the mean measured load of the partition LoadBalanced() loaded with, or 0. Not archived. */
+    double mLoadedImbalance;
+
+    /** Ratio of the maximum to the mean measured load of the partition LoadBalanced() chose, or 0. Not archived. */
+    double mBalancedImbalance;
+
+    /** Number of threads solving the cell ODEs of this process. Not archived. */
+    unsigned mOdeThreads;
+
+    /** Threads for the cell ODEs, kept between solves; empty with one thread. */
+    boost::shared_ptr<CellSweepPool> mpOdeThreadPool;
+
+    /** Longest adaptive PDE time step (ms), or 0 for the fixed PDE time step of HeartConfig. */
+    double mAdaptiveMaxTimeStep;
+
+    /** Largest change of V at any node over an adaptive PDE time step (mV). */
+    double mAdaptiveMaxVoltageChange;
+
+    /** Chooses the PDE time step when adaptive time stepping is on. */
+    boost::shared_ptr<QuiescentTimeStepController> mpTimeStepController;
+
+    /** Whether to step V with a monodomain approximation while no electrodes are on. */
+    bool mMonodomainWhenUnstimulated;
+
+    /** The KSP preset set in HeartConfig before each solve. */
+    LinearSolverStrategy::type mLinearSolverStrategy;
+
+    /** The KSP preset the solver's linear system was set up with. */
+    LinearSolverStrategy::type mSolverLinearSolverStrategy;
+
+    /** The bidomain linear solves since the statistics were last reset. */
+    LinearSolveStatistics mLinearSolveStatistics;
+
+    /** Nodes sampled for steady state detection, those given by every process. */
+    std::vector<unsigned> mSteadySampleNodes;
+
+    /** Largest change of the slow wave period between cycles at a steady node (ms). */
+    double mSteadyPeriodTolerance;
+
+    /** Largest change of the slow wave amplitude between cycles at a steady node (mV). */
+    double mSteadyAmplitudeTolerance;
+
+    /** Number of consecutive matching cycles needed at every sampled node. */
+    unsigned mSteadyCycles;
+
+    /** V at which a sampled node activates (mV). */
+    double mSteadyThreshold;
+
+    /** Simulated time between steady state checks (ms), or 0 if detection is off. */
+    double mSteadyCheckInterval;
+
+    /** Watches the sampled nodes while solving, when detection is on. */
+    boost::shared_ptr<SteadyStateDetector> mpSteadyStateDetector;
+
+    /** Time at which the last solve was found to be steady (ms), or -1 if it was not. */
+    double mSteadyStateTime;
+
+    /**
+     * Work out the control regions of the nodes this process owns and load only those
+     * regions of the histogram, or open the live input. Must be called collectively.
+     */
+    void SetUpNeuralInput();
+
+    /**
+     * Set the driven parameters of all nodes in a control region to their values in a bin.
+     *
+     * @param region  the control region
+     * @param bin  the histogram time bin
+     */
+    void ApplyNeuralRegion(unsigned region, unsigned bin);
+
+    /**
+     * Apply a list of changes in parameter values to the nodes of their control regions.
+     * Used for both histogram and live input.
+     *
+     * @param pBegin  first change
+     * @param pEnd  one past the last change
+     * @param rParameterNames  names of the parameters the changes refer to
+     */
+    void ApplyNeuralUpdates(const NeuralUpdate* pBegin, const NeuralUpdate* pEnd, const std::vector<std::string>& rParameterNames);
+
+protected:
+    /**
+     * Create a BidomainSolverNeural, which solves the cell ODEs on the threads set by
+     * SetOdeThreads().
+     *
+     * @return the solver
+     */
+    AbstractDynamicLinearPdeSolver<DIM, DIM, 2>* CreateSolver();
+
 public:
     /**
      * Constructor
@@ -94,9 +450,399 @@ public:
      */
     void AtBeginningOfTimestep(double time);
 
+    /**
+     * Called at the start of Solve(). Overloaded here to distribute the neural input over
+     * the processes, which also redistributes it after a checkpoint has been migrated.
+     */
+    void PreSolveChecks();
+
+    /**
+     * Drive cell parameters from a NEURON histogram of X by Y control regions and T time bins.
+     * Each process only loads the regions that its own nodes fall in.
+     *
+     * @param rHistogramFile  histogram file, ordered by time bin, then y, then x
+     * @param numX  number of control regions along x
+     * @param numY  number of control regions along y
+     * @param numT  number of time bins
+     * @param xLength  length of the control region grid along x
+     * @param yLength  length of the control region grid along y
+     * @param binWidth  width of each time bin (ms)
+     */
+    void SetNeuralInput(const std::string& rHistogramFile, unsigned numX, unsigned numY, unsigned numT,
+                        double xLength, double yLength, double binWidth);
+
+    /**
+     * Drive cell parameters from a NEURON histogram whose control region grid spans the
+     * x-y bounding box of the neurally driven tissue (excluding any bath), so its geometry
+     * need not be entered by hand.
+     *
+     * @param rHistogramFile  histogram file, ordered by time bin, then y, then x
+     * @param numX  number of control regions along x
+     * @param numY  number of control regions along y
+     * @param numT  number of time bins
+     * @param binWidth  width of each time bin (ms)
+     */
+    void SetNeuralInput(const std::string& rHistogramFile, unsigned numX, unsigned numY, unsigned numT, double binWidth);
+
+    /**
+     * Drive cell parameters from firing rate bins produced while the simulation runs, e.g. by
+     * a concurrent NEURON simulation, instead of a precomputed histogram. The master process
+     * creates a NeuralRingBuffer of the given name at the start of Solve() for the producer
+     * to attach to. Bins are consecutive in time from the start of the solve; the simulation
+     * waits for bins that have not yet been produced, and the producer waits while it is more
+     * than capacity bins ahead. The control region grid spans the driven tissue's bounding box. If
+     * the producer exits without closing the buffer, or a bin takes longer than the timeout to
+     * arrive, Solve() throws on every process. Live input is not archived with the problem.
+     *
+     * @param rBufferName  shared memory name of the ring buffer, e.g. "/neural_bins"
+     * @param numX  number of control regions along x
+     * @param numY  number of control regions along y
+     * @param binWidth  width of each time bin (ms)
+     * @param capacity  number of bins the producer may get ahead by
+     * @param timeout  how long to wait for each bin (s), or 0 to wait as long as the producer lives
+     */
+    void SetNeuralStream(const std::string& rBufferName, unsigned numX, unsigned numY, double binWidth, unsigned capacity=64,
+                         double timeout=600.0);
+
+    /**
+     * Add a cell parameter to be driven by the neural input.
+     *
+     * @param rParameterName  name of the cell model parameter, e.g. "excitatory_neural"
+     * @param rCalibrationName  name of the CalibrationFunctions method mapping firing rate to parameter value
+     */
+    void AddNeuralParameter(const std::string& rParameterName, const std::string& rCalibrationName);
+
+    /**
+     * Hold the neural histogram in one read-only MPI shared memory window per compute node,
+     * mapped by all the processes on that node, rather than one copy per process.
+     *
+     * @param nodeShared  whether to share the histogram within each node
+     */
+    void SetNeuralInputNodeShared(bool nodeShared);
+
+    /**
+     * Let the PDE time step grow while V changes slowly everywhere, as through most of an ICC
+     * slow wave cycle, and fall back to the PDE time step of HeartConfig around upstrokes and
+     * after electrodes switch or the neural input changes cell parameters (see
+     * QuiescentTimeStepController). Steps are multiples of the configured PDE time step that
+     * divide the printing time step. The cell ODEs keep their own time step. Archived with the
+     * problem.
+     *
+     * @param maxTimeStep  the longest PDE time step (ms), or 0 to switch adaptivity off
+     * @param maxVoltageChange  the largest change of V at any node over a step (mV)
+     */
+    void SetAdaptiveTimeStep(double maxTimeStep, double maxVoltageChange=0.5);
+
+    /**
+     * @return the controller choosing the PDE time step in the last solve, for its step
+     *     counts, or NULL if the time step is fixed
+     */
+    const QuiescentTimeStepController* GetTimeStepController() const;
+
+    /**
+     * Advance V with a monodomain approximation, with conductivity
+     * sigma_i (sigma_i + sigma_e)^-1 sigma_e, while the electrodes are off, and solve the full
+     * bidomain system from the printing time at which they switch on (see BidomainSolverNeural).
+     * phi_e written while the electrodes are off is an estimate from V. Electrodes need a bath,
+     * and the approximation leaves out the loading of the tissue by it, so V drifts from the
+     * bidomain solution between pulses; check it against a full bidomain run of the mesh before
+     * relying on it. Stimuli from cell factories are intracellular and kept. Archived with the problem.
+     * Only electrodes switch back to bidomain, not neural input, so solving throws if the
+     * problem has none (Chaste only sets up electrodes with a bath).
+     *
+     * @param useMonodomain  whether to switch to the monodomain approximation
+     */
+    void SetMonodomainWhenUnstimulated(bool useMonodomain);
+
+    /**
+     * Choose a KSP solver and preconditioner preset for the bidomain system (see
+     * LinearSolverStrategy), set in HeartConfig for the duration of each solve and then put
+     * back. A change between solves resets the solver's KSP. Archived, since HeartConfig in a
+     * checkpoint holds the configured settings rather than the preset.
+     *
+     * @param strategy  the preset; CONFIGURED leaves HeartConfig alone
+     */
+    void SetLinearSolverStrategy(LinearSolverStrategy::type strategy);
+
+    /** @return the KSP preset for the bidomain system */
+    LinearSolverStrategy::type GetLinearSolverStrategy() const;
+
+    /**
+     * @return the KSP iterations and wall time of the bidomain linear solves of this process
+     *     since the last ResetLinearSolveStatistics()
+     */
+    const LinearSolveStatistics& rGetLinearSolveStatistics() const;
+
+    /** Start counting linear solves again, e.g. before timing a preset. */
+    void ResetLinearSolveStatistics();
+
+    /**
+     * End Solve() early once the slow waves are periodic (see SteadyStateDetector), e.g. so a
+     * baseline run stops when the network has settled rather than after a fixed duration. The
+     * solve runs in chunks of the check interval, and after each chunk every sampled node must
+     * have had the given number of cycles in a row whose period and amplitude are within the
+     * tolerances of the cycle before. The solve then stops at the end of that chunk, saving a
+     * checkpoint there if periodic checkpointing is set up; GetSteadyStateTime() tells when.
+     * Only oscillating nodes should be sampled, e.g. a spread of ICC nodes. The setting is
+     * archived, so a restart of the same run keeps it; LoadProlonged samples the fine nodes
+     * nearest the coarse ones. EfsScenarioRunner switches it off, so branches last their
+     * full duration.
+     *
+     * @note Must be called on every process; the sampled nodes are those passed by any process,
+     *     so each process need only pass nodes it owns.
+     *
+     * @param rSampleNodes  global indices of the sampled nodes, or empty to switch detection off
+     * @param periodTolerance  largest change of the period between cycles (ms)
+     * @param amplitudeTolerance  largest change of the amplitude between cycles (mV)
+     * @param numCycles  number of consecutive matching cycles needed
+     * @param checkInterval  simulated time between checks (ms), a multiple of the printing time step
+     * @param threshold  V at which a node activates (mV)
+     */
+    void SetSteadyStateDetection(const std::vector<unsigned>& rSampleNodes, double periodTolerance,
+                                 double amplitudeTolerance, unsigned numCycles=3,
+                                 double checkInterval=1000.0, double threshold=-40.0);
+
+    /** @return the time at which the last Solve() was found to be steady (ms), or -1 if it was not */
+    double GetSteadyStateTime() const;
+
+    /** @return whether Solve() checks for steady state */
+    bool IsDetectingSteadyState() const;
+
+    /**
+     * Solve the cell ODEs of the nodes each process owns on several threads, e.g. to run one
+     * process per socket rather than per core. The PDE is still solved by MPI processes only.
+     * Archived, so a restart keeps it; call again after loading to suit another machine.
+     *
+     * @param numThreads  number of threads per process, including the main one
+     */
+    void SetOdeThreads(unsigned numThreads);
+
+    /** @return the number of threads per process solving the cell ODEs */
+    unsigned GetOdeThreads() const;
+
+    /**
+     * Load the neural region series saved in another process's archive, when migrating a
+     * checkpoint to a different number of processes. Called after LoadExtraArchive.
+     *
+     * @param archive  the process-specific archive to load from
+     * @param version  the archive file version
+     */
+    template<class Archive>
+    void LoadExtraNeuralArchive(Archive & archive, unsigned version)
+    {
+        if (mNeuralRegionsArchived)
+        {
+            SerializeNeuralRegions(archive);
+        }
+    }
+
+    /**
+     * Solve the problem, as BidomainProblem::Solve() does. With periodic checkpointing set
+     * up, the solve runs in chunks and a checkpoint is saved at the end of each chunk. With
+     * steady state detection set up, it also runs in chunks of the check interval and stops
+     * after the first chunk that ends steady.
+     */
+    void Solve();
+
+    /**
+     * Save checkpoints through CardiacSimulationArchiverNeural while solving. Solve() runs
+     * in chunks of the given simulated time and saves a checkpoint to a subdirectory named
+     * after the time (e.g. "1000.000ms") at the end of each chunk, and at the end of the solve.
+     * Only the last few checkpoints are kept. These settings are archived, so a problem
+     * restored with LoadLatestCheckpoint() carries on checkpointing.
+     *
+     * @param rDirectory  directory for the checkpoints, relative to CHASTE_TEST_OUTPUT
+     * @param interval  simulated time between checkpoints (ms), a multiple of the printing time step
+     * @param numToKeep  number of checkpoints to keep
+     * @param wallInterval  if positive, only checkpoint at the end of a chunk once this many
+     *     minutes of wall time have passed since the last checkpoint
+     */
+    void SetCheckpointing(const std::string& rDirectory, double interval, unsigned numToKeep=2, double wallInterval=0.0);
+
+    /**
+     * Choose how periodic checkpoints are written; see CardiacSimulationArchiverNeural.
+     *
+     * @param format  text or binary archives
+     * @param compression  compression of the archive files
+     * @param compressionLevel  compression level, from 1 (fastest) to 9 (smallest)
+     * @param async  whether to write checkpoints in the background while solving continues
+     */
+    void SetCheckpointArchiveOptions(CheckpointArchiveFormat::type format,
+                                     CheckpointCompression::type compression=CheckpointCompression::NONE,
+                                     int compressionLevel=6, bool async=false);
+
+    /**
+     * Load the most recent complete checkpoint saved by periodic checkpointing, e.g. to carry
+     * on a long simulation in a new job.
+     *
+     * @note Must be called collectively.
+     *
+     * @param rDirectory  the checkpoint directory given to SetCheckpointing()
+     * @param pCellFactory  if given, the checkpoint is loaded through LoadBalanced()
+     * @return the restored problem
+     */
+    static BidomainProblemNeural<DIM>* LoadLatestCheckpoint(const std::string& rDirectory,
+                                                            AbstractCardiacCellFactory<DIM>* pCellFactory=NULL);
+
+    /**
+     * Get the wall time this process has spent solving cell ODEs and assembling the linear
+     * system since the last periodic checkpoint (or since it was created or loaded), as
+     * recorded by HeartEventHandler. Checkpoints record it for every process, so that
+     * LoadBalanced() can even out the load.
+     *
+     * @param rOdeTime  filled with the ODE time (ms)
+     * @param rAssemblyTime  filled with the assembly time (ms)
+     */
+    void GetMeasuredLoad(double& rOdeTime, double& rAssemblyTime) const;
+
+    /**
+     * Get the load imbalance (ratio of the maximum to the mean load of a process) that
+     * LoadBalanced() predicted from the measurements in the checkpoint this problem came from.
+     * Both are 0 if the problem did not come from LoadBalanced() or the checkpoint had no
+     * measurements.
+     *
+     * @param rLoadedImbalance  filled with the imbalance of the partition the checkpoint loaded with
+     * @param rBalancedImbalance  filled with the imbalance of the balanced partition, which the
+     *     problem only has if rLoadedImbalance was over the threshold
+     */
+    void GetLoadImbalance(double& rLoadedImbalance, double& rBalancedImbalance) const;
+
+    /**
+     * Load a checkpoint, then redistribute nodes and cells so that each process has an equal
+     * share of the ODE and assembly time measured before the checkpoint, spread evenly over
+     * the nodes each process owned. The partition stays a set of consecutive node ranges, so
+     * checkpointing and rebalancing at each restart moves the boundaries towards balance.
+     *
+     * Redistributing rebuilds the problem on the mesh of the checkpoint with new cells from
+     * the given factory, then moves the state (as saved by SaveState()) of every node to its
+     * new owner. The neural input is set up again at the next solve. Nothing is redistributed
+     * if the checkpoint has no measurements or the predicted imbalance of the partition it
+     * loads with is within the threshold. GetLoadImbalance() on the result gives the
+     * predicted imbalance of both partitions.
+     *
+     * @note Must be called collectively.
+     *
+     * @param rDirectory  the checkpoint, relative to CHASTE_TEST_OUTPUT
+     * @param pCellFactory  factory for the cells of the redistributed problem, as used for
+     *     the original one
+     * @param threshold  largest acceptable ratio of the maximum to the mean load
+     * @return the restored problem
+     */
+    static BidomainProblemNeural<DIM>* LoadBalanced(const std::string& rDirectory,
+                                                    AbstractCardiacCellFactory<DIM>* pCellFactory,
+                                                    double threshold=1.05);
+
+    /**
+     * Load a checkpoint of this problem on a coarse mesh and carry its state over to a finer
+     * mesh of the same geometry, e.g. to save most of the warm-up to a settled baseline. Each
+     * fine node takes V, phi_e and the cell state variables interpolated linearly from the
+     * coarse element containing it (or the nearest one). V and the cell state only come from
+     * coarse nodes whose cells have as many state variables as the fine one, so ICC state is not
+     * mixed with bath or other cells; a fine node with none of those keeps the initial state of
+     * its new cell. Cell parameters are left as the factory made them, and the neural input sets
+     * its parameters again at the next solve. Settings and time are taken from the checkpoint;
+     * electrodes come from HeartConfig, as loaded with it. The result can be saved with
+     * CardiacSimulationArchiverNeural::Save and should relax for a short while before use.
+     *
+     * Every process reads the whole coarse mesh and state, which is assumed to be small.
+     *
+     * @note Must be called collectively.
+     *
+     * @param rDirectory  the coarse checkpoint, relative to CHASTE_TEST_OUTPUT
+     * @param pFineMesh  the fine mesh, which the returned problem takes ownership of
+     * @param pCellFactory  factory for the cells of the fine mesh
+     * @return the problem on the fine mesh
+     */
+    static BidomainProblemNeural<DIM>* LoadProlonged(const std::string& rDirectory,
+                                                     DistributedTetrahedralMesh<DIM,DIM>* pFineMesh,
+                                                     AbstractCardiacCellFactory<DIM>* pCellFactory);
+
+    /**
+     * Save a state-only checkpoint, which refers to a full checkpoint of this problem (e.g. a
+     * baseline it was loaded from) for the mesh, partition, configuration and cell objects,
+     * and holds only what changes between them: the current time, and for each node the cell
+     * state variables, cell parameters and solution values. Each process writes the nodes it
+     * owns to its own packed binary file.
+     *
+     * @note Must be called collectively.
+     *
+     * @param rDirectory  directory for the state files, relative to CHASTE_TEST_OUTPUT
+     * @param rBaseCheckpoint  directory of the full checkpoint, relative to CHASTE_TEST_OUTPUT
+     */
+    void SaveState(const std::string& rDirectory, const std::string& rBaseCheckpoint);
+
+    /**
+     * Overwrite the time, cell states, cell parameters and solution with those of a state-only
+     * checkpoint saved from this problem or another one loaded from the same base checkpoint,
+     * on any number of processes.
+     *
+     * @note Must be called collectively.
+     *
+     * @param rDirectory  directory of the state files, relative to CHASTE_TEST_OUTPUT
+     */
+    void LoadState(const std::string& rDirectory);
+
+    /**
+     * Load the base checkpoint of a state-only checkpoint, then its state.
+     *
+     * @note Must be called collectively.
+     *
+     * @param rDirectory  directory of the state files, relative to CHASTE_TEST_OUTPUT
+     * @return the restored problem
+     */
+    static BidomainProblemNeural<DIM>* LoadFromState(const std::string& rDirectory);
+
+    /**
+     * Pack the state saved by SaveState() for the nodes this process owns into memory, e.g.
+     * to rewind to it later with UnpackState().
+     *
+     * @param rRecords  filled with a record for each owned node
+     */
+    void PackState(std::vector<double>& rRecords);
+
+    /**
+     * Restore a state packed by PackState() on this process, with the same partition.
+     *
+     * @note Must be called collectively.
+     *
+     * @param rRecords  the packed state
+     * @param time  the simulation time of the state
+     */
+    void UnpackState(const std::vector<double>& rRecords, double time);
+
+    /**
+     * @return the number of histogram control regions held by this process (or by its node
+     *     if the histogram is node shared)
+     */
+    unsigned GetNumLocalNeuralRegions() const;
+
+    /**
+     * @return whether the histogram, as set up for the last solve, is held in a node shared window
+     */
+    bool IsNeuralInputNodeShared() const;
+
 };
 
 #include "SerializationExportWrapper.hpp" // Must be last
 EXPORT_TEMPLATE_CLASS_SAME_DIMS(BidomainProblemNeural)
 
+namespace boost
+{
+namespace serialization
+{
+/**
+ * Specify a version number for archives of BidomainProblemNeural. Version 1 adds the
+ * neural input description, version 2 node sharing, version 3 the region series and
+ * version 4 periodic checkpointing, version 5 adaptive time stepping, version 6
+ * monodomain stepping while unstimulated, version 7 the number of ODE threads, version 8
+ * the linear solver preset and version 9 steady state detection.
+ */
+template<unsigned DIM>
+struct version<BidomainProblemNeural<DIM> >
+{
+    CHASTE_VERSION_CONTENT(9);
+};
+} // namespace serialization
+} // namespace boost
+
 #endif /*BidomainProblemNeural_HPP_*/
@@ -0,0 +1,438 @@
+#include "BidomainSolverNeural.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "AbstractCardiacCellInterface.hpp"
+#include "DistributedVector.hpp"
+#include "DistributedVectorFactory.hpp"
+#include "EulerIvpOdeSolver.hpp"
+#include "HeartConfig.hpp"
+#include "HeartEventHandler.hpp"
+#include "HeartRegionCodes.hpp"
+#include "PdeSimulationTime.hpp"
+#include "PetscTools.hpp"
+#include "PetscVecTools.hpp"
+#include "UblasCustomFunctions.hpp"
+#include "Warnings.hpp"
+
+/** Value of mCellThreads for a cell not yet given a thread's solver. */
+static const int UNASSIGNED = -1;
+
+/** Value of mCellThreads for a cell whose solver is left alone. */
+static const int OWN_SOLVER = -2;
+
+/** Number of consecutive cells a thread solves at a time. */
+static const unsigned CELLS_PER_CHUNK = 64;
+
+template<unsigned DIM>
+BidomainSolverNeural<DIM>::BidomainSolverNeural(bool bathSimulation,
+                                                AbstractTetrahedralMesh<DIM,DIM>* pMesh,
+                                                BidomainTissue<DIM>* pTissue,
+                                                BoundaryConditionsContainer<DIM,DIM,2>* pBoundaryConditions,
+                                                boost::shared_ptr<CellSweepPool> pPool)
+    : BidomainSolver<DIM,DIM>(bathSimulation, pMesh, pTissue, pBoundaryConditions),
+      mpPool(pPool),
+      mCheckedCells(false),
+      mMonodomainActive(false),
+      mSystemIsIdentity(false),
+      mMonodomainTimeStep(0.0),
+      mpStatistics(NULL),
+      mpSteadyStateDetector(NULL)
+{
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::CheckCells()
+{
+    mCheckedCells = true;
+    const std::vector<AbstractCardiacCellInterface*>& r_cells = this->mpBidomainTissue->rGetCellsDistributed();
+    mCellThreads.assign(r_cells.size(), UNASSIGNED);
+    for (unsigned local = 0; local < r_cells.size(); local++)
+    {
+        boost::shared_ptr<AbstractIvpOdeSolver> p_solver = r_cells[local]->GetSolver();
+        if (!p_solver)
+        {
+            mCellThreads[local] = OWN_SOLVER;
+        }
+        else if (dynamic_cast<EulerIvpOdeSolver*>(p_solver.get()) == NULL)
+        {
+            WARNING("Cells use an ODE solver that cannot be copied for each thread; solving them on one thread");
+            mpPool.reset();
+            return;
+        }
+    }
+
+    for (unsigned thread = 0; thread < mpPool->GetNumThreads(); thread++)
+    {
+        mThreadSolvers.push_back(boost::shared_ptr<AbstractIvpOdeSolver>(new EulerIvpOdeSolver));
+    }
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::PrepareForSetupLinearSystem(Vec existingSolution)
+{
+    if (mpPool && !mCheckedCells)
+    {
+        CheckCells();
+    }
+    if (!mpPool)
+    {
+        BidomainSolver<DIM,DIM>::PrepareForSetupLinearSystem(existingSolution);
+        return;
+    }
+
+    // As BidomainTissue::SolveCellSystems(), with the loop over cells shared out
+    HeartEventHandler::BeginEvent(HeartEventHandler::SOLVE_ODES);
+    const double time = PdeSimulationTime::GetTime();
+    const double next_time = time + PdeSimulationTime::GetPdeTimeStep();
+    BidomainTissue<DIM>* p_tissue = this->mpBidomainTissue;
+    const std::vector<AbstractCardiacCellInterface*>& r_cells = p_tissue->rGetCellsDistributed();
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    const unsigned lo = p_factory->GetLow();
+
+    // PETSc is only touched from this thread
+    std::vector<double> voltages(r_cells.size());
+    {
+        DistributedVector dist_solution = p_factory->CreateDistributedVector(existingSolution);
+        DistributedVector::Stripe voltage(dist_solution, 0);
+        for (DistributedVector::Iterator index = dist_solution.Begin(); index != dist_solution.End(); ++index)
+        {
+            voltages[index.Local] = voltage[index];
+        }
+    }
+
+    // Set up the singleton here, so the threads only read it
+    HeartConfig::Instance()->GetCapacitance();
+
+    try
+    {
+        mpPool->Run(r_cells.size(), CELLS_PER_CHUNK, [&](unsigned thread, unsigned begin, unsigned end)
+        {
+            for (unsigned local = begin; local < end; local++)
+            {
+                AbstractCardiacCellInterface* p_cell = r_cells[local];
+                if (mCellThreads[local] != OWN_SOLVER && mCellThreads[local] != (int) thread)
+                {
+                    p_cell->SetSolver(mThreadSolvers[thread]);
+                    mCellThreads[local] = thread;
+                }
+                p_cell->SetVoltage(voltages[local]);
+                p_cell->ComputeExceptVoltage(time, next_time);
+                p_tissue->UpdateCaches(lo + local, local, next_time);
+            }
+        });
+    }
+    catch (Exception&)
+    {
+        PetscTools::ReplicateException(true);
+        throw;
+    }
+    PetscTools::ReplicateException(false);
+    HeartEventHandler::EndEvent(HeartEventHandler::SOLVE_ODES);
+
+    HeartEventHandler::BeginEvent(HeartEventHandler::COMMUNICATION);
+    if (p_tissue->GetDoCacheReplication())
+    {
+        p_tissue->ReplicateCaches();
+    }
+    HeartEventHandler::EndEvent(HeartEventHandler::COMMUNICATION);
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::AssembleMonodomainSystem(double timeStep)
+{
+    HeartConfig* p_config = HeartConfig::Instance();
+    const double am_cm_over_dt = p_config->GetSurfaceAreaToVolumeRatio()*p_config->GetCapacitance()/timeStep;
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    const unsigned lo = p_factory->GetLow();
+    const unsigned hi = p_factory->GetHigh();
+    const unsigned row_preallocation = this->mpMesh->CalculateMaximumNodeConnectivityPerProcess();
+
+    Vec template_vec = p_factory->CreateVec();
+    mpMonodomainSystem.reset(new LinearSystem(template_vec, row_preallocation));
+    mpMassMatrix.reset(new LinearSystem(template_vec, row_preallocation));
+    PetscTools::Destroy(template_vec);
+    mIsTissueNode.assign(hi - lo, false);
+    mPotentialRatios.assign(hi - lo, 0.0);
+
+    // Linear elements, as BidomainAssembler; rows of other processes' nodes are dropped
+    unsigned factorial = 1;
+    for (unsigned i = 2; i <= DIM; i++)
+    {
+        factorial *= i;
+    }
+    BidomainTissue<DIM>* p_tissue = this->mpBidomainTissue;
+    for (typename AbstractTetrahedralMesh<DIM,DIM>::ElementIterator iter = this->mpMesh->GetElementIteratorBegin();
+         iter != this->mpMesh->GetElementIteratorEnd();
+         ++iter)
+    {
+        if (HeartRegionCode::IsRegionBath(iter->GetUnsignedAttribute()))
+        {
+            continue;
+        }
+        c_matrix<double, DIM, DIM> jacobian;
+        c_matrix<double, DIM, DIM> inverse_jacobian;
+        double jacobian_determinant;
+        iter->CalculateInverseJacobian(jacobian, jacobian_determinant, inverse_jacobian);
+        const double volume = std::fabs(jacobian_determinant)/factorial;
+
+        // Column j holds the gradient of the basis function of node j
+        c_matrix<double, DIM, DIM+1> gradients;
+        for (unsigned k = 0; k < DIM; k++)
+        {
+            gradients(k, 0) = 0.0;
+            for (unsigned j = 1; j <= DIM; j++)
+            {
+                gradients(k, j) = inverse_jacobian(j-1, k);
+                gradients(k, 0) -= gradients(k, j);
+            }
+        }
+        const c_matrix<double, DIM, DIM>& r_sigma_i = p_tissue->rGetIntracellularConductivityTensor(iter->GetIndex());
+        const c_matrix<double, DIM, DIM>& r_sigma_e = p_tissue->rGetExtracellularConductivityTensor(iter->GetIndex());
+        c_matrix<double, DIM, DIM> sigma_sum = r_sigma_i + r_sigma_e;
+        c_matrix<double, DIM, DIM> sigma = prod(r_sigma_i, c_matrix<double, DIM, DIM>(prod(Inverse(sigma_sum), r_sigma_e)));
+        c_matrix<double, DIM+1, DIM+1> stiffness = volume*prod(trans(gradients), c_matrix<double, DIM, DIM+1>(prod(sigma, gradients)));
+        double trace_i = 0.0;
+        double trace_sum = 0.0;
+        for (unsigned k = 0; k < DIM; k++)
+        {
+            trace_i += r_sigma_i(k, k);
+            trace_sum += sigma_sum(k, k);
+        }
+
+        for (unsigned a = 0; a <= DIM; a++)
+        {
+            unsigned row = iter->GetNodeGlobalIndex(a);
+            if (row >= lo && row < hi)
+            {
+                mIsTissueNode[row - lo] = true;
+                mPotentialRatios[row - lo] = trace_i/trace_sum;
+            }
+            for (unsigned b = 0; b <= DIM; b++)
+            {
+                unsigned col = iter->GetNodeGlobalIndex(b);
+                double mass = volume*(a == b ? 2.0 : 1.0)/((DIM + 1)*(DIM + 2));
+                mpMassMatrix->AddToMatrixElement(row, col, mass);
+                mpMonodomainSystem->AddToMatrixElement(row, col, am_cm_over_dt*mass + stiffness(a, b));
+            }
+        }
+    }
+
+    // V is zero in the bath, as in the bidomain solution
+    for (unsigned i = 0; i < hi - lo; i++)
+    {
+        if (!mIsTissueNode[i])
+        {
+            mpMonodomainSystem->AddToMatrixElement(lo + i, lo + i, 1.0);
+        }
+    }
+    mpMassMatrix->AssembleFinalLhsMatrix();
+    mpMonodomainSystem->AssembleFinalLhsMatrix();
+    mpMonodomainSystem->SetMatrixIsSymmetric(true);
+    mpMonodomainSystem->SetMatrixIsConstant(true);
+    mpMonodomainSystem->SetKspType("cg");
+    mpMonodomainSystem->SetPcType("bjacobi");
+    if (p_config->GetUseAbsoluteTolerance())
+    {
+        mpMonodomainSystem->SetAbsoluteTolerance(p_config->GetAbsoluteTolerance());
+    }
+    else
+    {
+        mpMonodomainSystem->SetRelativeTolerance(p_config->GetRelativeTolerance());
+    }
+    mMonodomainTimeStep = timeStep;
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::SetupMonodomainStep(Vec currentSolution, bool computeMatrix)
+{
+    const double time_step = PdeSimulationTime::GetPdeTimeStep();
+    if (!mpMonodomainSystem || mMonodomainTimeStep != time_step)
+    {
+        AssembleMonodomainSystem(time_step);
+    }
+
+    HeartConfig* p_config = HeartConfig::Instance();
+    const double am = p_config->GetSurfaceAreaToVolumeRatio();
+    const double am_cm_over_dt = am*p_config->GetCapacitance()/time_step;
+    BidomainTissue<DIM>* p_tissue = this->mpBidomainTissue;
+    ReplicatableVector& r_ionic = p_tissue->rGetIionicCacheReplicated();
+    ReplicatableVector& r_stimulus = p_tissue->rGetIntracellularStimulusCacheReplicated();
+    DistributedVectorFactory* p_factory = this->mpMesh->GetDistributedVectorFactory();
+    const unsigned lo = p_factory->GetLow();
+    const unsigned num_local = p_factory->GetLocalOwnership();
+
+    // Right-hand side M (Am Cm V/dt - Am Iion - Istim), as MonodomainSolver
+    Vec voltage = p_factory->CreateVec();
+    Vec source = p_factory->CreateVec();
+    const double* p_solution;
+    VecGetArrayRead(currentSolution, &p_solution);
+    for (unsigned i = 0; i < num_local; i++)
+    {
+        double v = p_solution[2*i];
+        PetscVecTools::SetElement(voltage, lo + i, v);
+        PetscVecTools::SetElement(source, lo + i, mIsTissueNode[i] ? am_cm_over_dt*v - am*r_ionic[lo + i] - r_stimulus[lo + i] : 0.0);
+    }
+    VecRestoreArrayRead(currentSolution, &p_solution);
+    PetscVecTools::Finalise(voltage);
+    PetscVecTools::Finalise(source);
+    MatMult(mpMassMatrix->rGetLhsMatrix(), source, mpMonodomainSystem->rGetRhsVector());
+    Vec next_voltage = mpMonodomainSystem->Solve(voltage);
+    PetscTools::Destroy(voltage);
+    PetscTools::Destroy(source);
+
+    // phi_e from the deviation of V from its mean over the tissue
+    const double* p_voltage;
+    VecGetArrayRead(next_voltage, &p_voltage);
+    double local_sums[2] = {0.0, 0.0};
+    for (unsigned i = 0; i < num_local; i++)
+    {
+        if (mIsTissueNode[i])
+        {
+            local_sums[0] += p_voltage[i];
+            local_sums[1] += 1.0;
+        }
+    }
+    double sums[2];
+    MPI_Allreduce(local_sums, sums, 2, MPI_DOUBLE, MPI_SUM, PETSC_COMM_WORLD);
+    const double mean_voltage = sums[1] > 0.0 ? sums[0]/sums[1] : 0.0;
+
+    // The bidomain system becomes the identity, so its solve hands back V and phi_e
+    LinearSystem* p_system = this->mpLinearSystem;
+    if (computeMatrix || !mSystemIsIdentity)
+    {
+        p_system->ZeroLhsMatrix();
+        for (unsigned row = 2*lo; row < 2*(lo + num_local); row++)
+        {
+            p_system->SetMatrixElement(row, row, 1.0);
+        }
+        p_system->AssembleFinalLhsMatrix();
+        mSystemIsIdentity = true;
+    }
+    p_system->ZeroRhsVector();
+    for (unsigned i = 0; i < num_local; i++)
+    {
+        double phi_e = mIsTissueNode[i] ? -mPotentialRatios[i]*(p_voltage[i] - mean_voltage) : 0.0;
+        p_system->SetRhsVectorElement(2*(lo + i), p_voltage[i]);
+        p_system->SetRhsVectorElement(2*(lo + i) + 1, phi_e);
+    }
+    p_system->AssembleRhsVector();
+    VecRestoreArrayRead(next_voltage, &p_voltage);
+    PetscTools::Destroy(next_voltage);
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::SetupLinearSystem(Vec currentSolution, bool computeMatrix)
+{
+    if (mMonodomainActive)
+    {
+        SetupMonodomainStep(currentSolution, computeMatrix);
+    }
+    else
+    {
+        mSystemIsIdentity = false;
+        BidomainSolver<DIM,DIM>::SetupLinearSystem(currentSolution, computeMatrix);
+    }
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::FinaliseLinearSystem(Vec existingSolution)
+{
+    if (!mMonodomainActive)
+    {
+        BidomainSolver<DIM,DIM>::FinaliseLinearSystem(existingSolution);
+    }
+    mSolveStart = std::chrono::steady_clock::now();
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::FollowingSolveLinearSystem(Vec currentSolution)
+{
+    if (mpStatistics && !mMonodomainActive)
+    {
+        double time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mSolveStart).count();
+        mpStatistics->Record(this->mpLinearSystem->GetNumIterations(), time);
+    }
+    BidomainSolver<DIM,DIM>::FollowingSolveLinearSystem(currentSolution);
+    if (mpSteadyStateDetector)
+    {
+        mpSteadyStateDetector->Record(PdeSimulationTime::GetNextTime(), currentSolution);
+    }
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::SetLinearSolveStatistics(LinearSolveStatistics* pStatistics)
+{
+    mpStatistics = pStatistics;
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::SetSteadyStateDetector(SteadyStateDetector* pDetector)
+{
+    mpSteadyStateDetector = pDetector;
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::SetMonodomainActive(bool active)
+{
+    if (active != mMonodomainActive)
+    {
+        mMonodomainActive = active;
+        // The matrix (and the preconditioner built from it) changes at the next step
+        this->mMatrixIsAssembled = false;
+        if (this->mpLinearSystem)
+        {
+            this->mpLinearSystem->ResetKspSolver();
+        }
+    }
+}
+
+template<unsigned DIM>
+void BidomainSolverNeural<DIM>::ResetKspFromConfig()
+{
+    if (!this->mpLinearSystem)
+    {
+        // InitialiseForSolve will read HeartConfig
+        return;
+    }
+    this->mpLinearSystem->ResetKspSolver();
+    HeartConfig* p_config = HeartConfig::Instance();
+    this->mpLinearSystem->SetKspType(p_config->GetKSPSolver());
+    if (strcmp(p_config->GetKSPPreconditioner(), "twolevelsblockdiagonal") == 0)
+    {
+        // As AbstractBidomainSolver::InitialiseForSolve, gathering the bath nodes of every process
+        std::vector<PetscInt> local_bath_nodes;
+        for (typename AbstractTetrahedralMesh<DIM,DIM>::NodeIterator iter = this->mpMesh->GetNodeIteratorBegin();
+             iter != this->mpMesh->GetNodeIteratorEnd();
+             ++iter)
+        {
+            if (HeartRegionCode::IsRegionBath(iter->GetRegion()))
+            {
+                local_bath_nodes.push_back(iter->GetIndex());
+            }
+        }
+        int num_local = local_bath_nodes.size();
+        std::vector<int> counts(PetscTools::GetNumProcs());
+        MPI_Allgather(&num_local, 1, MPI_INT, &counts[0], 1, MPI_INT, PETSC_COMM_WORLD);
+        std::vector<int> offsets(counts.size(), 0);
+        for (unsigned i = 1; i < counts.size(); i++)
+        {
+            offsets[i] = offsets[i - 1] + counts[i - 1];
+        }
+        boost::shared_ptr<std::vector<PetscInt> > p_bath_nodes(new std::vector<PetscInt>(offsets.back() + counts.back()));
+        MPI_Allgatherv(local_bath_nodes.empty() ? NULL : &local_bath_nodes[0], num_local, MPIU_INT,
+                       p_bath_nodes->empty() ? NULL : &(*p_bath_nodes)[0], &counts[0], &offsets[0], MPIU_INT, PETSC_COMM_WORLD);
+        std::sort(p_bath_nodes->begin(), p_bath_nodes->end());
+        this->mpLinearSystem->SetPcType(p_config->GetKSPPreconditioner(), p_bath_nodes);
+    }
+    else
+    {
+        this->mpLinearSystem->SetPcType(p_config->GetKSPPreconditioner());
+    }
+}
+
+template class BidomainSolverNeural<1>;
+template class BidomainSolverNeural<2>;
+template class BidomainSolverNeural<3>;
@@ -0,0 +1,189 @@
+#ifndef BIDOMAINSOLVERNEURAL_HPP_
+#define BIDOMAINSOLVERNEURAL_HPP_
+
+#include <chrono>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "AbstractIvpOdeSolver.hpp"
+#include "BidomainSolver.hpp"
+#include "LinearSystem.hpp"
+#include "../src/CellSweepPool.hpp"
+#include "../src/LinearSolverStrategy.hpp"
+#include "../src/SteadyStateDetector.hpp"
+
+/**
+ * The bidomain solver of BidomainProblemNeural. Given a CellSweepPool, it solves the cell
+ * ODEs of the nodes this process owns on the threads of the pool rather than in the serial
+ * loop of BidomainTissue::SolveCellSystems(); the PDE solve is unchanged.
+ *
+ * Cells created by a cell factory share one ODE solver, which keeps working memory, so each
+ * thread has its own copy and a cell is handed the copy of whichever thread solves it. This
+ * is only done for Euler solvers (the default); cells sharing any other kind of solver are
+ * solved serially. Cells read the capacitance from HeartConfig, so the singleton is set up
+ * before the threads start and is only read while they run.
+ *
+ * While no extracellular stimulus is applied, the solver can also advance V with a
+ * monodomain approximation instead of the coupled (V, phi_e) system (see
+ * SetMonodomainActive()). Its conductivity is sigma_i (sigma_i + sigma_e)^-1 sigma_e on each
+ * tissue element. That would be exact for tissue with equal anisotropy ratios and no bath, but
+ * the mode is only used with electrodes, and so always with a bath, whose loading of the
+ * tissue it leaves out. phi_e is then estimated from V as
+ * -sigma_i/(sigma_i + sigma_e) times the deviation of V from its tissue mean (0 in the bath),
+ * which is only used for output and as the initial guess of the next bidomain solve: the
+ * bidomain right-hand side does not depend on phi_e, so switching back needs no other
+ * re-initialisation.
+ *
+ * Given a LinearSolveStatistics, the solver records the KSP iterations and wall time of each
+ * bidomain solve (not the trivial solves of monodomain steps). Given a SteadyStateDetector, it
+ * hands it the solution after every step.
+ */
+template<unsigned DIM>
+class BidomainSolverNeural : public BidomainSolver<DIM,DIM>
+{
+private:
+    /** Threads for the cell ODEs, or empty to solve them as BidomainSolver does. */
+    boost::shared_ptr<CellSweepPool> mpPool;
+
+    /** An ODE solver for each thread of the pool. */
+    std::vector<boost::shared_ptr<AbstractIvpOdeSolver> > mThreadSolvers;
+
+    /**
+     * For each local cell, the thread whose solver it was last given, UNASSIGNED before the
+     * first sweep, or OWN_SOLVER if it keeps its own (e.g. a CVODE cell).
+     */
+    std::vector<int> mCellThreads;
+
+    /** Whether the cells have been checked for solvers the threads can share out. */
+    bool mCheckedCells;
+
+    /** Whether to advance V with the monodomain approximation. */
+    bool mMonodomainActive;
+
+    /** Whether the bidomain linear system holds the identity used on monodomain steps. */
+    bool mSystemIsIdentity;
+
+    /** The monodomain approximation for V, (Am Cm/dt) M + K. */
+    boost::scoped_ptr<LinearSystem> mpMonodomainSystem;
+
+    /** The mass matrix of the tissue, for the right-hand side of the monodomain system. */
+    boost::scoped_ptr<LinearSystem> mpMassMatrix;
+
+    /** The PDE time step mpMonodomainSystem was assembled for. */
+    double mMonodomainTimeStep;
+
+    /** For each owned node, whether it belongs to a tissue (non-bath) element. */
+    std::vector<bool> mIsTissueNode;
+
+    /** For each owned tissue node, sigma_i/(sigma_i + sigma_e), for estimating phi_e. */
+    std::vector<double> mPotentialRatios;
+
+    /** Where to record the bidomain solves, or NULL. */
+    LinearSolveStatistics* mpStatistics;
+
+    /** Watches the solution for a periodic pattern, or NULL. */
+    SteadyStateDetector* mpSteadyStateDetector;
+
+    /** When the current linear solve started. */
+    std::chrono::steady_clock::time_point mSolveStart;
+
+    /**
+     * Work out which cells get a per-thread solver, and drop the pool if any cell shares a
+     * solver that cannot be copied.
+     */
+    void CheckCells();
+
+    /**
+     * Assemble the monodomain approximation and mass matrix over the tissue elements.
+     *
+     * @param timeStep  the PDE time step
+     */
+    void AssembleMonodomainSystem(double timeStep);
+
+    /**
+     * Solve the monodomain approximation for V, and set the bidomain linear system up as the
+     * identity with V and the estimate of phi_e on the right, so its solve returns them at once.
+     *
+     * @param currentSolution  the solution at the start of the time step
+     * @param computeMatrix  whether the base class wants the matrix assembled
+     */
+    void SetupMonodomainStep(Vec currentSolution, bool computeMatrix);
+
+public:
+    /**
+     * Constructor, as for BidomainSolver.
+     *
+     * @param bathSimulation  whether the simulation has a bath
+     * @param pMesh  the mesh
+     * @param pTissue  the tissue
+     * @param pBoundaryConditions  the boundary conditions
+     * @param pPool  threads for the cell ODEs; if empty, they are solved serially
+     */
+    BidomainSolverNeural(bool bathSimulation,
+                         AbstractTetrahedralMesh<DIM,DIM>* pMesh,
+                         BidomainTissue<DIM>* pTissue,
+                         BoundaryConditionsContainer<DIM,DIM,2>* pBoundaryConditions,
+                         boost::shared_ptr<CellSweepPool> pPool);
+
+    /**
+     * Solve the cell ODEs over the next PDE time step, on the threads of the pool if there is
+     * one, and update the ionic and stimulus current caches.
+     *
+     * @param existingSolution  the solution at the start of the time step
+     */
+    void PrepareForSetupLinearSystem(Vec existingSolution);
+
+    /**
+     * Set up the bidomain linear system as BidomainSolver does, or for a monodomain step.
+     *
+     * @param currentSolution  the solution at the start of the time step
+     * @param computeMatrix  whether to assemble the matrix
+     */
+    void SetupLinearSystem(Vec currentSolution, bool computeMatrix);
+
+    /**
+     * Fix phi_e as AbstractBidomainSolver does, except on monodomain steps, just before the solve.
+     *
+     * @param existingSolution  the solution at the start of the time step
+     */
+    void FinaliseLinearSystem(Vec existingSolution);
+
+    /**
+     * Record the solve just done, then as AbstractBidomainSolver, then pass the new solution
+     * to the steady state detector.
+     *
+     * @param currentSolution  the new solution
+     */
+    void FollowingSolveLinearSystem(Vec currentSolution);
+
+    /**
+     * @param pStatistics  where to record the KSP iterations and time of each bidomain solve,
+     *     or NULL
+     */
+    void SetLinearSolveStatistics(LinearSolveStatistics* pStatistics);
+
+    /**
+     * @param pDetector  detector to hand the solution after every step, or NULL
+     */
+    void SetSteadyStateDetector(SteadyStateDetector* pDetector);
+
+    /**
+     * Choose between the monodomain approximation and the full bidomain system for the following
+     * time steps. Called by BidomainProblemNeural at each printing time, where electrodes
+     * switch. Changing the mode reassembles the bidomain matrix.
+     *
+     * @param active  whether to use the monodomain approximation
+     */
+    void SetMonodomainActive(bool active);
+
+    /**
+     * Take the KSP solver and preconditioner now in HeartConfig for the following solves.
+     * BidomainSolver only reads them when it first sets up the linear system, so this is
+     * needed when BidomainProblemNeural changes its LinearSolverStrategy between solves.
+     */
+    void ResetKspFromConfig();
+};
+
+#endif /*BIDOMAINSOLVERNEURAL_HPP_*/
@@ -0,0 +1,1003 @@
+#include <algorithm>
+#include <cerrno>
+#include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "CachedMeshReader.hpp"
+#include "DistributedVectorFactory.hpp"
+#include "Exception.hpp"
+#include "OutputFileHandler.hpp"
+#include "PetscTools.hpp"
+#include "TrianglesMeshReader.hpp"
+#include "Warnings.hpp"
+
+static const std::uint64_t CACHED_MESH_MAGIC = 0x4d45534843414348ull;
+static const std::uint32_t CACHED_MESH_VERSION = 4;
+
+// Source files whose sizes and times are recorded, in Header::sourceSizes order
+static const char* CACHED_MESH_SOURCES[4] = {".node", ".ele", ".face", ".edge"};
+
+// Node weights kept beside the caches, so they need not be worked out from the text files again
+static const std::uint64_t CACHED_WEIGHTS_MAGIC = 0x5354484749455743ull;
+static const std::uint32_t CACHED_WEIGHTS_VERSION = 1;
+
+/** Header of a node weights file, followed by the weight of each node. */
+struct CachedWeightsHeader
+{
+    std::uint64_t magic;
+    std::uint32_t version;
+    std::uint32_t padding;
+    std::uint64_t numNodes;
+    std::uint64_t keyHash;        // of the description of how the weights were computed
+    std::uint64_t sourceSizes[4]; // as for the mesh cache
+    std::int64_t sourceTimes[4];
+};
+
+/** FNV-1a hash of some bytes. */
+static std::uint64_t HashBytes(const void* pData, std::size_t size)
+{
+    std::uint64_t hash = 0xcbf29ce484222325ull;
+    const unsigned char* p_bytes = static_cast<const unsigned char*>(pData);
+    for (std::size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ p_bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+/** Hash of the partition weights, recorded so that changing them rebuilds the cache. */
+static std::uint64_t HashWeights(const std::vector<double>& rWeights)
+{
+    return rWeights.empty() ? 0 : HashBytes(rWeights.data(), rWeights.size() * sizeof(double));
+}
+
+/**
+ * Recursive coordinate bisection: split the nodes across the longest side of their bounding box
+ * so that the two halves carry total weights in proportion to the parts each is given, and so on
+ * until each part is a single process's.
+ */
+static void WeightedBisection(const std::vector<double>& rCoords, unsigned spaceDim, const std::vector<double>& rWeights,
+                              std::vector<unsigned>::iterator begin, std::vector<unsigned>::iterator end,
+                              unsigned firstPart, unsigned numParts, std::vector<unsigned>& rParts)
+{
+    if (numParts == 1)
+    {
+        for (std::vector<unsigned>::iterator it = begin; it != end; ++it)
+        {
+            rParts[*it] = firstPart;
+        }
+        return;
+    }
+
+    unsigned axis = 0;
+    double longest = -1.0;
+    for (unsigned d = 0; d < spaceDim; d++)
+    {
+        double lo = DBL_MAX;
+        double hi = -DBL_MAX;
+        for (std::vector<unsigned>::iterator it = begin; it != end; ++it)
+        {
+            lo = std::min(lo, rCoords[*it * spaceDim + d]);
+            hi = std::max(hi, rCoords[*it * spaceDim + d]);
+        }
+        if (hi - lo > longest)
+        {
+            longest = hi - lo;
+            axis = d;
+        }
+    }
+    std::sort(begin, end, [&](unsigned a, unsigned b)
+    {
+        return rCoords[a * spaceDim + axis] < rCoords[b * spaceDim + axis];
+    });
+
+    unsigned left_parts = numParts / 2;
+    double total = 0.0;
+    for (std::vector<unsigned>::iterator it = begin; it != end; ++it)
+    {
+        total += rWeights[*it];
+    }
+    double target = total * left_parts / numParts;
+    double left_total = 0.0;
+    std::vector<unsigned>::iterator split = begin;
+    while (split != end && left_total + 0.5 * rWeights[*split] < target)
+    {
+        left_total += rWeights[*split];
+        ++split;
+    }
+    WeightedBisection(rCoords, spaceDim, rWeights, begin, split, firstPart, left_parts, rParts);
+    WeightedBisection(rCoords, spaceDim, rWeights, split, end, firstPart + left_parts, numParts - left_parts, rParts);
+}
+
+/**
+ * Keys along a Z-order (Morton) curve: coordinates scaled to integers over the bounding box,
+ * with their bits interleaved.
+ */
+static void MortonKeys(const std::vector<double>& rCoords, unsigned spaceDim, std::vector<std::uint64_t>& rKeys)
+{
+    unsigned num_nodes = rCoords.size() / spaceDim;
+    unsigned bits = 63 / spaceDim;
+    std::vector<double> lo(spaceDim, DBL_MAX);
+    std::vector<double> hi(spaceDim, -DBL_MAX);
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        for (unsigned d = 0; d < spaceDim; d++)
+        {
+            lo[d] = std::min(lo[d], rCoords[i * spaceDim + d]);
+            hi[d] = std::max(hi[d], rCoords[i * spaceDim + d]);
+        }
+    }
+    double scale = double((std::uint64_t(1) << bits) - 1);
+    rKeys.assign(num_nodes, 0);
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        for (unsigned d = 0; d < spaceDim; d++)
+        {
+            double extent = hi[d] - lo[d];
+            std::uint64_t q = extent > 0.0 ? std::uint64_t((rCoords[i * spaceDim + d] - lo[d]) / extent * scale) : 0;
+            for (unsigned b = 0; b < bits; b++)
+            {
+                rKeys[i] |= ((q >> b) & 1) << (b * spaceDim + d);
+            }
+        }
+    }
+}
+
+/**
+ * Append to rVisited the nodes of a part reachable from a root, breadth first, visiting the
+ * neighbours of each node by increasing degree. Nodes are marked as they are reached.
+ */
+static void BreadthFirst(const std::vector<std::vector<unsigned> >& rAdjacency, const std::vector<unsigned>& rPart,
+                         const std::vector<unsigned>& rDegree, unsigned root,
+                         std::vector<unsigned>& rMarks, unsigned mark, std::vector<unsigned>& rVisited)
+{
+    std::size_t head = rVisited.size();
+    rVisited.push_back(root);
+    rMarks[root] = mark;
+    while (head < rVisited.size())
+    {
+        unsigned node = rVisited[head++];
+        std::size_t first = rVisited.size();
+        for (unsigned j = 0; j < rAdjacency[node].size(); j++)
+        {
+            unsigned neighbour = rAdjacency[node][j];
+            if (rPart[neighbour] == rPart[root] && rMarks[neighbour] != mark)
+            {
+                rMarks[neighbour] = mark;
+                rVisited.push_back(neighbour);
+            }
+        }
+        std::stable_sort(rVisited.begin() + first, rVisited.end(), [&](unsigned a, unsigned b)
+        {
+            return rDegree[a] < rDegree[b];
+        });
+    }
+}
+
+/**
+ * Order the nodes of one part by reverse Cuthill-McKee over the edges within the part: breadth
+ * first from a node of low degree far from the rest (one pass of the usual pseudo-peripheral
+ * search), then reversed. Each connected piece of the part is ordered in turn. rMarks is indexed
+ * by node and must be 0 for the nodes of the part: they end up 1 for visited (2 is used for
+ * nodes reached by a trial search).
+ */
+static void ReverseCuthillMcKee(const std::vector<std::vector<unsigned> >& rAdjacency, const std::vector<unsigned>& rPart,
+                                const std::vector<unsigned>& rDegree, std::vector<unsigned>& rMarks,
+                                std::vector<unsigned>& rNodes)
+{
+    std::vector<unsigned> by_degree(rNodes);
+    std::stable_sort(by_degree.begin(), by_degree.end(), [&](unsigned a, unsigned b)
+    {
+        return rDegree[a] < rDegree[b];
+    });
+
+    std::vector<unsigned> order;
+    order.reserve(rNodes.size());
+    std::vector<unsigned> trial;
+    for (unsigned i = 0; i < by_degree.size(); i++)
+    {
+        if (rMarks[by_degree[i]] == 1u)
+        {
+            continue;
+        }
+        // Start again from the far end of a first search, which lengthens the level structure
+        trial.clear();
+        BreadthFirst(rAdjacency, rPart, rDegree, by_degree[i], rMarks, 2u, trial);
+        BreadthFirst(rAdjacency, rPart, rDegree, trial.back(), rMarks, 1u, order);
+    }
+    std::reverse(order.begin(), order.end());
+    rNodes.swap(order);
+}
+
+/** Round up to a multiple of 8 bytes, so every array in the cache is aligned for doubles. */
+static std::size_t Align(std::size_t offset)
+{
+    return (offset + 7) & ~std::size_t(7);
+}
+
+/**
+ * Offsets of the arrays following the header: counts, permutation, coordinates, element nodes,
+ * element attributes, face nodes, face attributes, and the end of the file.
+ */
+static void GetOffsets(std::size_t headerSize, std::uint64_t numProcs, std::uint64_t numNodes, std::uint64_t spaceDim,
+                       std::uint64_t numElements, std::uint64_t nodesPerElement,
+                       std::uint64_t numFaces, std::uint64_t nodesPerFace, std::size_t offsets[8])
+{
+    offsets[0] = Align(headerSize);
+    offsets[1] = Align(offsets[0] + numProcs * sizeof(std::uint64_t));
+    offsets[2] = Align(offsets[1] + numNodes * sizeof(std::uint32_t));
+    offsets[3] = Align(offsets[2] + numNodes * spaceDim * sizeof(double));
+    offsets[4] = Align(offsets[3] + numElements * nodesPerElement * sizeof(std::uint32_t));
+    offsets[5] = Align(offsets[4] + numElements * sizeof(double));
+    offsets[6] = Align(offsets[5] + numFaces * nodesPerFace * sizeof(std::uint32_t));
+    offsets[7] = Align(offsets[6] + numFaces * sizeof(double));
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::CachedMeshReader(const std::string& rCachePath)
+    : path(rCachePath), mappedSize(0), pMapped(NULL), nextNode(0), nextElement(0), nextFace(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        EXCEPTION("Unable to open mesh cache " + path + ": " + strerror(errno));
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (std::size_t) info.st_size < sizeof(Header))
+    {
+        close(fd);
+        EXCEPTION("Mesh cache " + path + " is truncated");
+    }
+    void* p_memory = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p_memory == MAP_FAILED)
+    {
+        EXCEPTION("Unable to map mesh cache " + path + ": " + strerror(errno));
+    }
+    mappedSize = info.st_size;
+    pMapped = static_cast<const char*>(p_memory);
+    pHeader = reinterpret_cast<const Header*>(pMapped);
+
+    std::size_t offsets[8];
+    GetOffsets(sizeof(Header), pHeader->numProcs, pHeader->numNodes, pHeader->spaceDim, pHeader->numElements,
+               pHeader->nodesPerElement, pHeader->numFaces, pHeader->nodesPerFace, offsets);
+    if (pHeader->magic != CACHED_MESH_MAGIC || pHeader->version != CACHED_MESH_VERSION
+        || pHeader->elementDim != ELEMENT_DIM || pHeader->spaceDim != SPACE_DIM || offsets[7] != mappedSize)
+    {
+        munmap(const_cast<char*>(pMapped), mappedSize);
+        pMapped = NULL;
+        EXCEPTION(path + " is not a mesh cache for this mesh dimension");
+    }
+    pCounts = reinterpret_cast<const std::uint64_t*>(pMapped + offsets[0]);
+    pPermutation = reinterpret_cast<const std::uint32_t*>(pMapped + offsets[1]);
+    pCoords = reinterpret_cast<const double*>(pMapped + offsets[2]);
+    pElementNodes = reinterpret_cast<const std::uint32_t*>(pMapped + offsets[3]);
+    pElementAttributes = reinterpret_cast<const double*>(pMapped + offsets[4]);
+    pFaceNodes = reinterpret_cast<const std::uint32_t*>(pMapped + offsets[5]);
+    pFaceAttributes = reinterpret_cast<const double*>(pMapped + offsets[6]);
+
+    // An identity permutation is not recorded on the mesh
+    for (unsigned i = 0; i < pHeader->numNodes; i++)
+    {
+        if (pPermutation[i] != i)
+        {
+            permutation.assign(pPermutation, pPermutation + pHeader->numNodes);
+            break;
+        }
+    }
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::~CachedMeshReader()
+{
+    if (pMapped != NULL)
+    {
+        munmap(const_cast<char*>(pMapped), mappedSize);
+    }
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetSourceSignature(const std::string& rMeshBase,
+                                                                  std::uint64_t sizes[4], std::int64_t times[4])
+{
+    for (unsigned i = 0; i < 4; i++)
+    {
+        struct stat info;
+        bool exists = (stat((rMeshBase + CACHED_MESH_SOURCES[i]).c_str(), &info) == 0);
+        sizes[i] = exists ? info.st_size : 0;
+        // Nanoseconds, so a file rewritten within the same second as the cache still invalidates it
+        times[i] = exists ? (std::int64_t) info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec : 0;
+    }
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+bool CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::IsUpToDate(const std::string& rCachePath, const std::string& rMeshBase,
+                                                          std::uint64_t weightsHash, MeshNodeOrdering::type ordering)
+{
+    std::ifstream cache_file(rCachePath.c_str(), std::ios::binary);
+    Header header;
+    if (!cache_file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        return false;
+    }
+    std::uint64_t sizes[4];
+    std::int64_t times[4];
+    GetSourceSignature(rMeshBase, sizes, times);
+    bool is_up_to_date = header.magic == CACHED_MESH_MAGIC && header.version == CACHED_MESH_VERSION
+                         && header.numProcs == PetscTools::GetNumProcs() && header.weightsHash == weightsHash
+                         && header.nodeOrdering == (std::uint32_t) ordering;
+    for (unsigned i = 0; i < 4; i++)
+    {
+        is_up_to_date = is_up_to_date && header.sourceSizes[i] == sizes[i] && header.sourceTimes[i] == times[i];
+    }
+    return is_up_to_date;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::WriteCache(const std::string& rCachePath, const std::string& rMeshBase,
+                                                          const std::vector<unsigned>& rPermutation,
+                                                          const std::vector<std::uint64_t>& rCounts,
+                                                          std::uint64_t weightsHash, MeshNodeOrdering::type ordering,
+                                                          bool permuteSource)
+{
+    // The signature is taken before reading, so a change while reading invalidates the cache
+    Header header;
+    memset(&header, 0, sizeof(header));
+    GetSourceSignature(rMeshBase, header.sourceSizes, header.sourceTimes);
+
+    TrianglesMeshReader<ELEMENT_DIM, SPACE_DIM> source(rMeshBase);
+    header.magic = CACHED_MESH_MAGIC;
+    header.version = CACHED_MESH_VERSION;
+    header.elementDim = ELEMENT_DIM;
+    header.spaceDim = SPACE_DIM;
+    header.numProcs = rCounts.size();
+    header.numNodes = source.GetNumNodes();
+    header.numElements = source.GetNumElements();
+    header.numFaces = source.GetNumFaces();
+    header.nodesPerElement = ELEMENT_DIM + 1;
+    header.nodesPerFace = ELEMENT_DIM;
+    header.weightsHash = weightsHash;
+    header.nodeOrdering = ordering;
+
+    std::size_t offsets[8];
+    GetOffsets(sizeof(Header), header.numProcs, header.numNodes, SPACE_DIM, header.numElements,
+               header.nodesPerElement, header.numFaces, header.nodesPerFace, offsets);
+    std::vector<char> buffer(offsets[7], 0);
+    memcpy(&buffer[0], &header, sizeof(header));
+    memcpy(&buffer[offsets[0]], rCounts.data(), rCounts.size() * sizeof(std::uint64_t));
+
+    // Everything is stored in the permuted numbering the partition was computed for
+    std::uint32_t* p_permutation = reinterpret_cast<std::uint32_t*>(&buffer[offsets[1]]);
+    for (unsigned i = 0; i < header.numNodes; i++)
+    {
+        p_permutation[i] = rPermutation.empty() ? i : rPermutation[i];
+    }
+    std::vector<std::uint32_t> source_to_cache(header.numNodes);
+    for (unsigned i = 0; i < header.numNodes; i++)
+    {
+        source_to_cache[i] = permuteSource ? p_permutation[i] : i;
+    }
+    double* p_coords = reinterpret_cast<double*>(&buffer[offsets[2]]);
+    for (unsigned i = 0; i < header.numNodes; i++)
+    {
+        std::vector<double> coords = source.GetNextNode();
+        std::copy(coords.begin(), coords.begin() + SPACE_DIM, p_coords + source_to_cache[i] * SPACE_DIM);
+    }
+    std::uint32_t* p_element_nodes = reinterpret_cast<std::uint32_t*>(&buffer[offsets[3]]);
+    double* p_element_attributes = reinterpret_cast<double*>(&buffer[offsets[4]]);
+    for (unsigned i = 0; i < header.numElements; i++)
+    {
+        ElementData element = source.GetNextElementData();
+        if (element.NodeIndices.size() != header.nodesPerElement)
+        {
+            EXCEPTION("Only linear meshes can be cached: " + rMeshBase);
+        }
+        for (unsigned j = 0; j < header.nodesPerElement; j++)
+        {
+            p_element_nodes[i * header.nodesPerElement + j] = source_to_cache[element.NodeIndices[j]];
+        }
+        p_element_attributes[i] = element.AttributeValue;
+    }
+    std::uint32_t* p_face_nodes = reinterpret_cast<std::uint32_t*>(&buffer[offsets[5]]);
+    double* p_face_attributes = reinterpret_cast<double*>(&buffer[offsets[6]]);
+    for (unsigned i = 0; i < header.numFaces; i++)
+    {
+        ElementData face = source.GetNextFaceData();
+        for (unsigned j = 0; j < header.nodesPerFace && j < face.NodeIndices.size(); j++)
+        {
+            p_face_nodes[i * header.nodesPerFace + j] = source_to_cache[face.NodeIndices[j]];
+        }
+        p_face_attributes[i] = face.AttributeValue;
+    }
+
+    // Written aside and renamed, so a reader never sees a partial cache
+    std::string temp_path = rCachePath + ".tmp";
+    std::ofstream cache_file(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+    cache_file.write(&buffer[0], buffer.size());
+    cache_file.close();
+    if (cache_file.fail() || std::rename(temp_path.c_str(), rCachePath.c_str()) != 0)
+    {
+        std::remove(temp_path.c_str());
+        EXCEPTION("Unable to write mesh cache " + rCachePath);
+    }
+}
+
+/** @return the path in the MeshCache folder of CHASTE_TEST_OUTPUT for a mesh, without an extension */
+static std::string GetCacheBase(const std::string& rMeshBase)
+{
+    std::string name = rMeshBase;
+    for (unsigned i = 0; i < name.size(); i++)
+    {
+        if (name[i] == '/')
+        {
+            name[i] = '_';
+        }
+    }
+    OutputFileHandler handler("MeshCache", false);
+    return handler.GetOutputDirectoryFullPath() + name;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+std::string CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetCachePath(const std::string& rMeshBase)
+{
+    std::stringstream cache_path;
+    cache_path << GetCacheBase(rMeshBase) << "." << PetscTools::GetNumProcs() << "procs.cache";
+    return cache_path.str();
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+std::string CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetWeightsPath(const std::string& rMeshBase)
+{
+    return GetCacheBase(rMeshBase) + ".weights";
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+bool CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ReadWeights(const std::string& rWeightsPath, const std::string& rMeshBase,
+                                                           std::uint64_t keyHash, std::vector<double>& rNodeWeights)
+{
+    std::ifstream weights_file(rWeightsPath.c_str(), std::ios::binary);
+    CachedWeightsHeader header;
+    if (!weights_file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    {
+        return false;
+    }
+    std::uint64_t sizes[4];
+    std::int64_t times[4];
+    GetSourceSignature(rMeshBase, sizes, times);
+    bool is_up_to_date = header.magic == CACHED_WEIGHTS_MAGIC && header.version == CACHED_WEIGHTS_VERSION
+                         && header.keyHash == keyHash;
+    for (unsigned i = 0; i < 4; i++)
+    {
+        is_up_to_date = is_up_to_date && header.sourceSizes[i] == sizes[i] && header.sourceTimes[i] == times[i];
+    }
+    if (!is_up_to_date)
+    {
+        return false;
+    }
+    rNodeWeights.resize(header.numNodes);
+    return header.numNodes == 0
+           || bool(weights_file.read(reinterpret_cast<char*>(rNodeWeights.data()), header.numNodes * sizeof(double)));
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+std::vector<double> CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNodeWeights(const std::string& rMeshBase, const std::string& rKey,
+                                                                             const WeightFunction& rComputeWeights)
+{
+    std::string weights_path = GetWeightsPath(rMeshBase);
+    std::uint64_t key_hash = HashBytes(rKey.data(), rKey.size());
+
+    // The master checks the signature, so every process agrees; a process that then fails to
+    // read the file makes them all compute the weights
+    std::vector<double> weights;
+    bool is_up_to_date = PetscTools::AmMaster() && ReadWeights(weights_path, rMeshBase, key_hash, weights);
+    if (PetscTools::ReplicateBool(is_up_to_date))
+    {
+        bool is_read = PetscTools::AmMaster() || ReadWeights(weights_path, rMeshBase, key_hash, weights);
+        if (!PetscTools::ReplicateBool(!is_read))
+        {
+            return weights;
+        }
+    }
+
+    // The signature is taken before reading, so a change while reading invalidates the weights
+    CachedWeightsHeader header;
+    memset(&header, 0, sizeof(header));
+    GetSourceSignature(rMeshBase, header.sourceSizes, header.sourceTimes);
+    {
+        TrianglesMeshReader<ELEMENT_DIM, SPACE_DIM> source(rMeshBase);
+        weights = rComputeWeights(source);
+    }
+    if (PetscTools::AmMaster())
+    {
+        header.magic = CACHED_WEIGHTS_MAGIC;
+        header.version = CACHED_WEIGHTS_VERSION;
+        header.numNodes = weights.size();
+        header.keyHash = key_hash;
+
+        // Written aside and renamed, as the mesh cache; the run can go on without it
+        std::string temp_path = weights_path + ".tmp";
+        std::ofstream weights_file(temp_path.c_str(), std::ios::binary | std::ios::trunc);
+        weights_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        weights_file.write(reinterpret_cast<const char*>(weights.data()), weights.size() * sizeof(double));
+        weights_file.close();
+        if (weights_file.fail() || std::rename(temp_path.c_str(), weights_path.c_str()) != 0)
+        {
+            std::remove(temp_path.c_str());
+            WARNING("Unable to write node weights " + weights_path);
+        }
+    }
+    return weights;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ConstructFromCache(const std::string& rCachePath,
+                                                                  DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh)
+{
+    // A factory with these local sizes makes the mesh keep the cached partition
+    CachedMeshReader<ELEMENT_DIM, SPACE_DIM> reader(rCachePath);
+    rMesh.SetDistributedVectorFactory(new DistributedVectorFactory(reader.GetNumNodes(),
+                                                                   reader.GetNumOwnedNodes(PetscTools::GetMyRank())));
+    rMesh.ConstructFromMeshReader(reader);
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ConstructMesh(const std::string& rMeshBase,
+                                                             DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh,
+                                                             MeshNodeOrdering::type ordering)
+{
+    std::string cache_path = GetCachePath(rMeshBase);
+    bool is_up_to_date = PetscTools::AmMaster() && IsUpToDate(cache_path, rMeshBase, 0, ordering);
+    if (PetscTools::ReplicateBool(is_up_to_date))
+    {
+        ConstructFromCache(cache_path, rMesh);
+        return;
+    }
+
+    // Load and partition as usual, then record the result. A reordering only reaches the mesh
+    // through the cache, so then the partition is worked out on a mesh of its own.
+    DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM> partitioned_mesh;
+    DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& r_partitioned_mesh =
+        (ordering == MeshNodeOrdering::PARTITION) ? rMesh : partitioned_mesh;
+    TrianglesMeshReader<ELEMENT_DIM, SPACE_DIM> source(rMeshBase);
+    r_partitioned_mesh.ConstructFromMeshReader(source);
+
+    std::uint64_t num_owned = r_partitioned_mesh.GetNumLocalNodes();
+    std::vector<std::uint64_t> counts(PetscTools::GetNumProcs());
+    MPI_Allgather(&num_owned, 1, MPI_UINT64_T, &counts[0], 1, MPI_UINT64_T, PETSC_COMM_WORLD);
+    std::string message;
+    if (PetscTools::AmMaster())
+    {
+        try
+        {
+            std::vector<unsigned> permutation = r_partitioned_mesh.rGetNodePermutation();
+            ReorderNodes(rMeshBase, ordering, counts, permutation);
+            WriteCache(cache_path, rMeshBase, permutation, counts, 0, ordering);
+        }
+        catch (Exception& e)
+        {
+            message = e.GetShortMessage();
+        }
+    }
+    if (ordering == MeshNodeOrdering::PARTITION)
+    {
+        // The run can go on without a cache
+        if (!message.empty())
+        {
+            WARNING(message);
+        }
+        return;
+    }
+    if (PetscTools::ReplicateBool(!message.empty()))
+    {
+        EXCEPTION("Unable to reorder mesh " + rMeshBase + (message.empty() ? "" : ": " + message));
+    }
+    ConstructFromCache(cache_path, rMesh);
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ConstructMesh(const std::string& rMeshBase,
+                                                             DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh,
+                                                             const std::vector<double>& rNodeWeights,
+                                                             MeshNodeOrdering::type ordering)
+{
+    if (rNodeWeights.empty())
+    {
+        ConstructMesh(rMeshBase, rMesh, ordering);
+        return;
+    }
+
+    // The weighted partition only reaches the mesh through a cache, so it is always written
+    std::string cache_path = GetCachePath(rMeshBase);
+    std::uint64_t weights_hash = HashWeights(rNodeWeights);
+    bool is_up_to_date = PetscTools::AmMaster() && IsUpToDate(cache_path, rMeshBase, weights_hash, ordering);
+    if (!PetscTools::ReplicateBool(is_up_to_date))
+    {
+        bool failed = false;
+        std::string message;
+        if (PetscTools::AmMaster())
+        {
+            try
+            {
+                std::vector<unsigned> permutation;
+                std::vector<std::uint64_t> counts;
+                ComputeWeightedPartition(rMeshBase, rNodeWeights, PetscTools::GetNumProcs(), permutation, counts);
+                ReorderNodes(rMeshBase, ordering, counts, permutation);
+                WriteCache(cache_path, rMeshBase, permutation, counts, weights_hash, ordering);
+            }
+            catch (Exception& e)
+            {
+                failed = true;
+                message = e.GetShortMessage();
+            }
+        }
+        if (PetscTools::ReplicateBool(failed))
+        {
+            EXCEPTION("Unable to partition mesh " + rMeshBase + " by weight" + (message.empty() ? "" : ": " + message));
+        }
+    }
+    ConstructFromCache(cache_path, rMesh);
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ReorderNodes(const std::string& rMeshBase, MeshNodeOrdering::type ordering,
+                                                            const std::vector<std::uint64_t>& rCounts,
+                                                            std::vector<unsigned>& rPermutation)
+{
+    if (ordering == MeshNodeOrdering::PARTITION)
+    {
+        return;
+    }
+    TrianglesMeshReader<ELEMENT_DIM, SPACE_DIM> source(rMeshBase);
+    unsigned num_nodes = source.GetNumNodes();
+    if (rPermutation.empty())
+    {
+        rPermutation.resize(num_nodes);
+        std::iota(rPermutation.begin(), rPermutation.end(), 0u);
+    }
+
+    // The nodes of each process, in file numbering
+    std::vector<unsigned> partitioned_nodes(num_nodes);
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        partitioned_nodes[rPermutation[i]] = i;
+    }
+    std::vector<unsigned> order(num_nodes);
+    unsigned start = 0;
+    if (ordering == MeshNodeOrdering::MORTON)
+    {
+        std::vector<double> coords(num_nodes * SPACE_DIM);
+        for (unsigned i = 0; i < num_nodes; i++)
+        {
+            std::vector<double> location = source.GetNextNode();
+            std::copy(location.begin(), location.begin() + SPACE_DIM, coords.begin() + i * SPACE_DIM);
+        }
+        std::vector<std::uint64_t> keys;
+        MortonKeys(coords, SPACE_DIM, keys);
+        for (unsigned rank = 0; rank < rCounts.size(); rank++)
+        {
+            std::vector<unsigned>::iterator begin = partitioned_nodes.begin() + start;
+            std::sort(begin, begin + rCounts[rank], [&](unsigned a, unsigned b)
+            {
+                return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+            });
+            start += rCounts[rank];
+        }
+        order.swap(partitioned_nodes);
+    }
+    else
+    {
+        std::vector<std::vector<unsigned> > adjacency(num_nodes);
+        for (unsigned i = 0; i < source.GetNumElements(); i++)
+        {
+            ElementData element = source.GetNextElementData();
+            for (unsigned j = 0; j < element.NodeIndices.size(); j++)
+            {
+                for (unsigned k = 0; k < element.NodeIndices.size(); k++)
+                {
+                    if (j != k)
+                    {
+                        adjacency[element.NodeIndices[j]].push_back(element.NodeIndices[k]);
+                    }
+                }
+            }
+        }
+        for (unsigned i = 0; i < num_nodes; i++)
+        {
+            std::sort(adjacency[i].begin(), adjacency[i].end());
+            adjacency[i].erase(std::unique(adjacency[i].begin(), adjacency[i].end()), adjacency[i].end());
+        }
+
+        // Edges leaving a process's range are ignored, as they do not widen its diagonal block
+        std::vector<unsigned> part(num_nodes);
+        for (unsigned rank = 0; rank < rCounts.size(); rank++)
+        {
+            for (unsigned i = start; i < start + rCounts[rank]; i++)
+            {
+                part[partitioned_nodes[i]] = rank;
+            }
+            start += rCounts[rank];
+        }
+        std::vector<unsigned> degree(num_nodes, 0u);
+        for (unsigned i = 0; i < num_nodes; i++)
+        {
+            for (unsigned j = 0; j < adjacency[i].size(); j++)
+            {
+                degree[i] += (part[adjacency[i][j]] == part[i]);
+            }
+        }
+        std::vector<unsigned> marks(num_nodes, 0u);
+        start = 0;
+        for (unsigned rank = 0; rank < rCounts.size(); rank++)
+        {
+            std::vector<unsigned> nodes(partitioned_nodes.begin() + start, partitioned_nodes.begin() + start + rCounts[rank]);
+            ReverseCuthillMcKee(adjacency, part, degree, marks, nodes);
+            std::copy(nodes.begin(), nodes.end(), order.begin() + start);
+            start += rCounts[rank];
+        }
+    }
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        rPermutation[order[i]] = i;
+    }
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ConstructMeshWithPartition(const std::string& rMeshBase,
+                                                                          DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh,
+                                                                          const std::vector<unsigned>& rNodeCounts,
+                                                                          const std::vector<unsigned>& rPermutation)
+{
+    if (rNodeCounts.size() != PetscTools::GetNumProcs())
+    {
+        EXCEPTION("Got node counts for " << rNodeCounts.size() << " processes, running on " << PetscTools::GetNumProcs());
+    }
+
+    // Only needed until the mesh is built
+    std::string cache_path = GetCachePath(rMeshBase) + ".partition";
+    std::string message;
+    if (PetscTools::AmMaster())
+    {
+        try
+        {
+            std::vector<std::uint64_t> counts(rNodeCounts.begin(), rNodeCounts.end());
+            WriteCache(cache_path, rMeshBase, rPermutation, counts, 0, MeshNodeOrdering::PARTITION, false);
+        }
+        catch (Exception& e)
+        {
+            message = e.GetShortMessage();
+        }
+    }
+    if (PetscTools::ReplicateBool(!message.empty()))
+    {
+        EXCEPTION("Unable to partition mesh " + rMeshBase + (message.empty() ? "" : ": " + message));
+    }
+    ConstructFromCache(cache_path, rMesh);
+    PetscTools::Barrier("CachedMeshReader::ConstructMeshWithPartition");
+    if (PetscTools::AmMaster())
+    {
+        std::remove(cache_path.c_str());
+    }
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ComputeWeightedPartition(const std::string& rMeshBase,
+                                                                        const std::vector<double>& rNodeWeights,
+                                                                        unsigned numProcs,
+                                                                        std::vector<unsigned>& rPermutation,
+                                                                        std::vector<std::uint64_t>& rCounts)
+{
+    TrianglesMeshReader<ELEMENT_DIM, SPACE_DIM> source(rMeshBase);
+    unsigned num_nodes = source.GetNumNodes();
+    if (rNodeWeights.size() != num_nodes)
+    {
+        EXCEPTION("Got " << rNodeWeights.size() << " node weights for a mesh of " << num_nodes << " nodes");
+    }
+    std::vector<double> coords(num_nodes * SPACE_DIM);
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        std::vector<double> location = source.GetNextNode();
+        std::copy(location.begin(), location.begin() + SPACE_DIM, coords.begin() + i * SPACE_DIM);
+    }
+
+    std::vector<unsigned> order(num_nodes);
+    std::iota(order.begin(), order.end(), 0u);
+    std::vector<unsigned> parts(num_nodes);
+    WeightedBisection(coords, SPACE_DIM, rNodeWeights, order.begin(), order.end(), 0, numProcs, parts);
+
+    // Renumber part by part, keeping the original order within each part
+    rCounts.assign(numProcs, 0);
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        rCounts[parts[i]]++;
+    }
+    std::vector<unsigned> next(numProcs, 0);
+    for (unsigned p = 1; p < numProcs; p++)
+    {
+        next[p] = next[p - 1] + rCounts[p - 1];
+    }
+    rPermutation.resize(num_nodes);
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        rPermutation[i] = next[parts[i]]++;
+    }
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+double CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ReportLoadImbalance(DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh,
+                                                                     const std::vector<double>& rNodeWeights)
+{
+    if (rNodeWeights.size() != rMesh.GetNumNodes())
+    {
+        EXCEPTION("Got " << rNodeWeights.size() << " node weights for a mesh of " << rMesh.GetNumNodes() << " nodes");
+    }
+
+    // The weights are in the original numbering, the mesh may be permuted
+    const std::vector<unsigned>& r_permutation = rMesh.rGetNodePermutation();
+    std::vector<unsigned> original(rMesh.GetNumNodes());
+    for (unsigned i = 0; i < original.size(); i++)
+    {
+        original[r_permutation.empty() ? i : r_permutation[i]] = i;
+    }
+    DistributedVectorFactory* p_factory = rMesh.GetDistributedVectorFactory();
+    double local_load = 0.0;
+    for (unsigned i = p_factory->GetLow(); i < p_factory->GetHigh(); i++)
+    {
+        local_load += rNodeWeights[original[i]];
+    }
+    return ReportLoadImbalance(local_load);
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+double CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::ReportLoadImbalance(double localWeight)
+{
+    unsigned num_procs = PetscTools::GetNumProcs();
+    std::vector<double> loads(num_procs);
+    MPI_Allgather(&localWeight, 1, MPI_DOUBLE, &loads[0], 1, MPI_DOUBLE, PETSC_COMM_WORLD);
+    double mean = std::accumulate(loads.begin(), loads.end(), 0.0) / num_procs;
+    double imbalance = mean > 0.0 ? *std::max_element(loads.begin(), loads.end()) / mean : 1.0;
+    if (PetscTools::AmMaster())
+    {
+        std::cout << "Node weight per process:";
+        for (unsigned p = 0; p < num_procs; p++)
+        {
+            std::cout << " " << loads[p];
+        }
+        std::cout << "\nLoad imbalance (max/mean): " << imbalance << std::endl;
+    }
+    return imbalance;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+unsigned CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNumOwnedNodes(unsigned rank) const
+{
+    return rank < pHeader->numProcs ? pCounts[rank] : 0u;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+unsigned CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNumElements() const
+{
+    return pHeader->numElements;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+unsigned CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNumNodes() const
+{
+    return pHeader->numNodes;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+unsigned CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNumFaces() const
+{
+    return pHeader->numFaces;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+unsigned CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNumElementAttributes() const
+{
+    return 1u;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+unsigned CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNumFaceAttributes() const
+{
+    return 1u;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+std::vector<double> CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNextNode()
+{
+    return GetNode(nextNode++);
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+ElementData CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNextElementData()
+{
+    return GetElementData(nextElement++);
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+ElementData CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNextFaceData()
+{
+    return GetFaceData(nextFace++);
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+void CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::Reset()
+{
+    nextNode = 0;
+    nextElement = 0;
+    nextFace = 0;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+std::vector<double> CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetNode(unsigned index)
+{
+    if (index >= pHeader->numNodes)
+    {
+        EXCEPTION("Node does not exist in mesh cache " + path);
+    }
+    return std::vector<double>(pCoords + index * SPACE_DIM, pCoords + (index + 1) * SPACE_DIM);
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+ElementData CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetElementData(unsigned index)
+{
+    if (index >= pHeader->numElements)
+    {
+        EXCEPTION("Element does not exist in mesh cache " + path);
+    }
+    const std::uint32_t* p_nodes = pElementNodes + index * pHeader->nodesPerElement;
+    ElementData element;
+    element.NodeIndices.assign(p_nodes, p_nodes + pHeader->nodesPerElement);
+    element.AttributeValue = pElementAttributes[index];
+    element.ContainingElement = 0;
+    return element;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+ElementData CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::GetFaceData(unsigned index)
+{
+    if (index >= pHeader->numFaces)
+    {
+        EXCEPTION("Face does not exist in mesh cache " + path);
+    }
+    const std::uint32_t* p_nodes = pFaceNodes + index * pHeader->nodesPerFace;
+    ElementData face;
+    face.NodeIndices.assign(p_nodes, p_nodes + pHeader->nodesPerFace);
+    face.AttributeValue = pFaceAttributes[index];
+    face.ContainingElement = 0;
+    return face;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+bool CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::IsFileFormatBinary()
+{
+    // Random access to nodes and elements is cheap
+    return true;
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+bool CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::HasNodePermutation()
+{
+    return !permutation.empty();
+}
+
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+const std::vector<unsigned>& CachedMeshReader<ELEMENT_DIM, SPACE_DIM>::rGetNodePermutation()
+{
+    return permutation;
+}
+
+template class CachedMeshReader<1,1>;
+template class CachedMeshReader<2,2>;
+template class CachedMeshReader<3,3>;
@@ -0,0 +1,228 @@
+#ifndef CACHEDMESHREADER_HPP_
+#define CACHEDMESHREADER_HPP_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "AbstractMeshReader.hpp"
+#include "DistributedTetrahedralMesh.hpp"
+
+/**
+ * How nodes are numbered within each process's range when a mesh is loaded through the cache.
+ * Both reorderings follow the connectivity of the mesh more closely than the numbering of the
+ * files, which narrows the bandwidth of the matrices and keeps neighbouring cells together in
+ * memory.
+ */
+struct MeshNodeOrdering
+{
+    /** The possible orderings */
+    enum type
+    {
+        PARTITION = 0,          // as the partition leaves them, i.e. in file order
+        REVERSE_CUTHILL_MCKEE,  // breadth first from a peripheral node, reversed
+        MORTON                  // along a Z-order space-filling curve
+    };
+};
+
+/**
+ * Reads a mesh from a memory-mapped binary cache, so that runs after the first skip parsing
+ * the text Triangles/Tetgen files and computing a partition.
+ *
+ * The cache is written by ConstructMesh() the first time a mesh is loaded on a given number of
+ * processes. It holds the nodes, elements and boundary elements (with attributes), already
+ * permuted so that each process's nodes are contiguous, together with that permutation and the
+ * number of nodes each process owns, so later loads reproduce the partition exactly with no
+ * partitioning library. The sizes and modification times of the source files are recorded in
+ * the cache, which is rebuilt whenever they change.
+ *
+ * The reader offers random access (as for binary mesh files), so each process only looks at
+ * the nodes it needs.
+ *
+ * The partition can instead be computed from per-node weights (for instance
+ * ICCFactory::GetNodeWeights), by recursive coordinate bisection into parts of equal total
+ * weight rather than equal node counts. The weights are hashed into the cache, so changing them
+ * rebuilds it. Weights worked out from the mesh files can themselves be kept beside the cache
+ * (see GetNodeWeights()), checked against the same sizes and modification times, so a run whose
+ * partition is already cached does not parse the text files at all.
+ *
+ * Nodes can also be renumbered within each process's range (see MeshNodeOrdering). The cached
+ * permutation then takes the numbering of the files to the reordered one; the mesh records it,
+ * so output is written in the numbering of the files and checkpoints carry it over.
+ */
+template<unsigned ELEMENT_DIM, unsigned SPACE_DIM>
+class CachedMeshReader : public AbstractMeshReader<ELEMENT_DIM, SPACE_DIM>
+{
+    private:
+    struct Header
+    {
+        std::uint64_t magic;
+        std::uint32_t version;
+        std::uint32_t elementDim;
+        std::uint32_t spaceDim;
+        std::uint32_t numProcs;
+        std::uint64_t numNodes;
+        std::uint64_t numElements;
+        std::uint64_t numFaces;
+        std::uint32_t nodesPerElement;
+        std::uint32_t nodesPerFace;
+        std::uint64_t sourceSizes[4]; // .node, .ele, .face, .edge (0 if missing)
+        std::int64_t sourceTimes[4];  // modification times (ns)
+        std::uint64_t weightsHash;    // of the partition weights (0 if unweighted)
+        std::uint32_t nodeOrdering;   // a MeshNodeOrdering
+    };
+
+    std::string path;
+    std::size_t mappedSize;
+    const char* pMapped;
+    const Header* pHeader;
+    const std::uint64_t* pCounts;       // nodes owned by each process
+    const std::uint32_t* pPermutation;  // new index of each original node
+    const double* pCoords;
+    const std::uint32_t* pElementNodes;
+    const double* pElementAttributes;
+    const std::uint32_t* pFaceNodes;
+    const double* pFaceAttributes;
+    std::vector<unsigned> permutation;
+    unsigned nextNode;
+    unsigned nextElement;
+    unsigned nextFace;
+
+    static void GetSourceSignature(const std::string& rMeshBase, std::uint64_t sizes[4], std::int64_t times[4]);
+    static bool IsUpToDate(const std::string& rCachePath, const std::string& rMeshBase, std::uint64_t weightsHash,
+                           MeshNodeOrdering::type ordering);
+    static void WriteCache(const std::string& rCachePath, const std::string& rMeshBase,
+                           const std::vector<unsigned>& rPermutation, const std::vector<std::uint64_t>& rCounts,
+                           std::uint64_t weightsHash, MeshNodeOrdering::type ordering, bool permuteSource=true);
+    static void ReorderNodes(const std::string& rMeshBase, MeshNodeOrdering::type ordering,
+                             const std::vector<std::uint64_t>& rCounts, std::vector<unsigned>& rPermutation);
+    static void ComputeWeightedPartition(const std::string& rMeshBase, const std::vector<double>& rNodeWeights,
+                                         unsigned numProcs, std::vector<unsigned>& rPermutation,
+                                         std::vector<std::uint64_t>& rCounts);
+    static void ConstructFromCache(const std::string& rCachePath, DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh);
+    static std::string GetWeightsPath(const std::string& rMeshBase);
+    static bool ReadWeights(const std::string& rWeightsPath, const std::string& rMeshBase, std::uint64_t keyHash,
+                            std::vector<double>& rNodeWeights);
+
+    CachedMeshReader(const CachedMeshReader&) = delete;
+    CachedMeshReader& operator=(const CachedMeshReader&) = delete;
+
+    public:
+    /** Computes the weight of each node from a reader of the mesh files. */
+    typedef std::function<std::vector<double>(AbstractMeshReader<ELEMENT_DIM, SPACE_DIM>&)> WeightFunction;
+
+    /**
+     * Map a cache file.
+     *
+     * @param rCachePath  the cache
+     */
+    CachedMeshReader(const std::string& rCachePath);
+
+    ~CachedMeshReader();
+
+    /**
+     * Construct a mesh from Triangles/Tetgen files through the cache, building the cache first
+     * if it is missing, out of date, or for another number of processes. Must be called
+     * collectively.
+     *
+     * @param rMeshBase  mesh file base name, as for TrianglesMeshReader
+     * @param rMesh  an empty mesh to construct
+     * @param ordering  how to number the nodes within each process's range
+     */
+    static void ConstructMesh(const std::string& rMeshBase, DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh,
+                              MeshNodeOrdering::type ordering=MeshNodeOrdering::PARTITION);
+
+    /**
+     * As above, but partitioned so that each process owns an equal share of the total node
+     * weight. Must be called collectively.
+     *
+     * @param rMeshBase  mesh file base name, as for TrianglesMeshReader
+     * @param rMesh  an empty mesh to construct
+     * @param rNodeWeights  the cost of each node, in the numbering of the mesh files
+     * @param ordering  how to number the nodes within each process's range
+     */
+    static void ConstructMesh(const std::string& rMeshBase, DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh,
+                              const std::vector<double>& rNodeWeights,
+                              MeshNodeOrdering::type ordering=MeshNodeOrdering::PARTITION);
+
+    /**
+     * Construct a mesh from files already in the numbering of a partition, such as the mesh of a
+     * checkpoint, giving each process a chosen number of consecutive nodes. The numbering is
+     * kept, so data indexed by node (e.g. a state-only checkpoint) still applies. Goes through
+     * a temporary cache. Must be called collectively.
+     *
+     * @param rMeshBase  mesh file base name, as for TrianglesMeshReader
+     * @param rMesh  an empty mesh to construct
+     * @param rNodeCounts  the number of nodes each process owns
+     * @param rPermutation  the permutation that took the original mesh to the numbering of the
+     *     files, recorded on the mesh for output (may be empty)
+     */
+    static void ConstructMeshWithPartition(const std::string& rMeshBase, DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh,
+                                           const std::vector<unsigned>& rNodeCounts, const std::vector<unsigned>& rPermutation);
+
+    /**
+     * Get per-node weights computed from the mesh files, from a file beside the cache if it was
+     * written for the same key and the sizes and modification times of the mesh files have not
+     * changed since, and otherwise by computing them on every process from a reader of the
+     * files and then storing them. Must be called collectively.
+     *
+     * @param rMeshBase  mesh file base name, as for TrianglesMeshReader
+     * @param rKey  describes everything besides the mesh files that the weights depend on
+     * @param rComputeWeights  computes the weights, in the numbering of the mesh files
+     * @return the weight of each node
+     */
+    static std::vector<double> GetNodeWeights(const std::string& rMeshBase, const std::string& rKey,
+                                              const WeightFunction& rComputeWeights);
+
+    /**
+     * Report the total node weight owned by each process, and return the load imbalance: the
+     * largest total over the mean. Must be called collectively; only the master prints.
+     *
+     * @param rMesh  a constructed mesh
+     * @param rNodeWeights  the cost of each node, in the numbering of the mesh files
+     * @return the imbalance (1 for a perfect balance)
+     */
+    static double ReportLoadImbalance(DistributedTetrahedralMesh<ELEMENT_DIM, SPACE_DIM>& rMesh,
+                                      const std::vector<double>& rNodeWeights);
+
+    /**
+     * Report the load of each process, as above, from the total weight this process owns.
+     * Must be called collectively; only the master prints.
+     *
+     * @param localWeight  the total weight of the nodes this process owns
+     * @return the imbalance (1 for a perfect balance)
+     */
+    static double ReportLoadImbalance(double localWeight);
+
+    /**
+     * @return the cache file for a mesh on the current number of processes, in the MeshCache
+     *     folder of CHASTE_TEST_OUTPUT
+     * @param rMeshBase  mesh file base name
+     */
+    static std::string GetCachePath(const std::string& rMeshBase);
+
+    /** @return the number of nodes the given process owns in the cached partition */
+    unsigned GetNumOwnedNodes(unsigned rank) const;
+
+    unsigned GetNumElements() const;
+    unsigned GetNumNodes() const;
+    unsigned GetNumFaces() const;
+    unsigned GetNumElementAttributes() const;
+    unsigned GetNumFaceAttributes() const;
+
+    std::vector<double> GetNextNode();
+    ElementData GetNextElementData();
+    ElementData GetNextFaceData();
+    void Reset();
+
+    std::vector<double> GetNode(unsigned index);
+    ElementData GetElementData(unsigned index);
+    ElementData GetFaceData(unsigned index);
+
+    bool IsFileFormatBinary();
+    bool HasNodePermutation();
+    const std::vector<unsigned>& rGetNodePermutation();
+};
+
+#endif // CACHEDMESHREADER_HPP_
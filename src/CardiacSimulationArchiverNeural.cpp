@@ -33,57 +33,169 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 */
 
+#include <algorithm>
 #include <fstream>
+#include <iostream>
+#include <sstream>
+#include <boost/scoped_ptr.hpp>
 
 // Must be included before any other serialization headers
 #include "CheckpointArchiveTypes.hpp"
 #include "CardiacSimulationArchiverNeural.hpp"
 
 #include "Exception.hpp"
-#include "ArchiveOpener.hpp"
+#include "ProcessSpecificArchive.hpp"
 #include "OutputFileHandler.hpp"
 #include "ArchiveLocationInfo.hpp"
 #include "DistributedVectorFactory.hpp"
 #include "PetscTools.hpp"
 #include "FileFinder.hpp"
+#include "../src/CheckpointSharedFile.hpp"
 
 #include "../src/BidomainProblemNeural.hpp"
 
 template<class PROBLEM_CLASS>
-void CardiacSimulationArchiverNeural<PROBLEM_CLASS>::Save(PROBLEM_CLASS& rSimulationToArchive,
-                                                    const std::string& rDirectory,
-                                                    bool clearDirectory)
+std::string CardiacSimulationArchiverNeural<PROBLEM_CLASS>::GetFormatName(CheckpointArchiveFormat::type format)
 {
-    // Clear directory if requested (and make sure it exists)
-    OutputFileHandler handler(rDirectory, clearDirectory);
+    return format == CheckpointArchiveFormat::BINARY ? "binary" : "text";
+}
+
+template<class PROBLEM_CLASS>
+boost::shared_ptr<CheckpointBackgroundWriter> CardiacSimulationArchiverNeural<PROBLEM_CLASS>::mpBackgroundWriter;
 
-    // Nest the archive writing, so the ArchiveOpener goes out of scope before
-    // the method ends.
+template<class PROBLEM_CLASS>
+std::string CardiacSimulationArchiverNeural<PROBLEM_CLASS>::mPendingInfoPath;
+
+template<class PROBLEM_CLASS>
+std::string CardiacSimulationArchiverNeural<PROBLEM_CLASS>::mPendingInfo;
+
+template<class PROBLEM_CLASS>
+bool CardiacSimulationArchiverNeural<PROBLEM_CLASS>::mWaitRegistered = false;
+
+template<class PROBLEM_CLASS>
+template<class ARCHIVE>
+void CardiacSimulationArchiverNeural<PROBLEM_CLASS>::SaveArchive(PROBLEM_CLASS& rSimulationToArchive,
+                                                                 const FileFinder& rDirectory,
+                                                                 CheckpointCompression::type compression,
+                                                                 int compressionLevel,
+                                                                 CheckpointArchiveLayout::type layout,
+                                                                 CheckpointBackgroundWriter* pBackgroundWriter)
+{
+    // Open the archive files, or memory buffers for them. Only the master writes the common
+    // archive, but every process goes through the serialization methods.
+    ArchiveLocationInfo::SetArchiveDirectory(rDirectory);
+    std::string private_path = ArchiveLocationInfo::GetProcessUniqueFilePath("archive.arch");
+    std::string common_path = PetscTools::AmMaster() ? ArchiveLocationInfo::GetArchiveDirectory() + "archive.arch" : "";
+    std::string private_buffer;
+    std::string common_buffer;
     {
-        // Open the archive files
-        FileFinder dir(rDirectory, RelativeTo::ChasteTestOutput);
-        ArchiveOpener<boost::archive::text_oarchive, std::ofstream> archive_opener(dir, "archive.arch");
-        boost::archive::text_oarchive* p_main_archive = archive_opener.GetCommonArchive();
+        boost::scoped_ptr<CheckpointArchiveWriter<ARCHIVE> > p_private_writer;
+        boost::scoped_ptr<CheckpointArchiveWriter<ARCHIVE> > p_common_writer;
+        try
+        {
+            if (pBackgroundWriter)
+            {
+                p_private_writer.reset(new CheckpointArchiveWriter<ARCHIVE>(private_buffer));
+                p_common_writer.reset(common_path.empty() ? new CheckpointArchiveWriter<ARCHIVE>("", CheckpointCompression::NONE, 0)
+                                                          : new CheckpointArchiveWriter<ARCHIVE>(common_buffer));
+            }
+            else if (layout == CheckpointArchiveLayout::SHARED_FILE)
+            {
+                p_private_writer.reset(new CheckpointArchiveWriter<ARCHIVE>(private_buffer, compression, compressionLevel));
+                p_common_writer.reset(new CheckpointArchiveWriter<ARCHIVE>(common_path, compression, compressionLevel));
+            }
+            else
+            {
+                p_private_writer.reset(new CheckpointArchiveWriter<ARCHIVE>(private_path, compression, compressionLevel));
+                p_common_writer.reset(new CheckpointArchiveWriter<ARCHIVE>(common_path, compression, compressionLevel));
+            }
+        }
+        catch (Exception& e)
+        {
+            PetscTools::ReplicateException(true);
+            throw e;
+        }
+        PetscTools::ReplicateException(false);
 
         // And save
-        PROBLEM_CLASS* const p_simulation_to_archive = &rSimulationToArchive;
-        (*p_main_archive) & p_simulation_to_archive;
+        ProcessSpecificArchive<ARCHIVE>::Set(p_private_writer->GetArchive());
+        try
+        {
+            PROBLEM_CLASS* const p_simulation_to_archive = &rSimulationToArchive;
+            (*p_common_writer->GetArchive()) & p_simulation_to_archive;
+        }
+        catch (Exception& e)
+        {
+            ProcessSpecificArchive<ARCHIVE>::Set(NULL);
+            throw e;
+        }
+        ProcessSpecificArchive<ARCHIVE>::Set(NULL);
+    }
+
+    // The archives are complete once their writers are gone
+    if (layout == CheckpointArchiveLayout::SHARED_FILE)
+    {
+        CheckpointSharedFile::Write(ArchiveLocationInfo::GetArchiveDirectory() + "archive.shared", private_buffer);
+    }
+    else if (pBackgroundWriter)
+    {
+        pBackgroundWriter->AddFile(private_path, private_buffer);
+        if (!common_path.empty())
+        {
+            pBackgroundWriter->AddFile(common_path, common_buffer);
+        }
     }
+}
 
-    // Write the info file
+template<class PROBLEM_CLASS>
+std::string CardiacSimulationArchiverNeural<PROBLEM_CLASS>::GetInfo(PROBLEM_CLASS& rSimulation,
+                                                                    CheckpointArchiveFormat::type format,
+                                                                    CheckpointCompression::type compression,
+                                                                    int compressionLevel,
+                                                                    CheckpointArchiveLayout::type layout)
+{
+    DistributedVectorFactory* p_factory = rSimulation.rGetMesh().GetDistributedVectorFactory();
+    unsigned my_range[2] = {p_factory->GetLow(), p_factory->GetHigh()};
+    std::vector<unsigned> ranges(2*PetscTools::GetNumProcs());
+    MPI_Gather(my_range, 2, MPI_UNSIGNED, &ranges[0], 2, MPI_UNSIGNED, 0, PETSC_COMM_WORLD);
+    double my_load[2];
+    rSimulation.GetMeasuredLoad(my_load[0], my_load[1]);
+    std::vector<double> loads(2*PetscTools::GetNumProcs());
+    MPI_Gather(my_load, 2, MPI_DOUBLE, &loads[0], 2, MPI_DOUBLE, 0, PETSC_COMM_WORLD);
+
+    std::stringstream info;
+    unsigned archive_version = 0; // Note that Boost version numbers are per-class; this only needs to change if we change the Load/Save methods here
+    info << PetscTools::GetNumProcs() << " " << archive_version << std::endl;
+    // Further "key value" lines describe how the archive files are written
+    info << "format " << GetFormatName(format) << std::endl;
+    info << "compression " << CheckpointCompression::GetName(compression) << " " << compressionLevel << std::endl;
+    info << "layout " << (layout == CheckpointArchiveLayout::SHARED_FILE ? "shared" : "file_per_process") << std::endl;
+    for (unsigned rank=0; rank<PetscTools::GetNumProcs(); rank++)
+    {
+        info << "range " << rank << " " << ranges[2*rank] << " " << ranges[2*rank+1] << std::endl;
+    }
+    // Wall time (ms) solving cell ODEs and assembling
+    for (unsigned rank=0; rank<PetscTools::GetNumProcs(); rank++)
+    {
+        info << "load " << rank << " " << loads[2*rank] << " " << loads[2*rank+1] << std::endl;
+    }
+    return info.str();
+}
+
+template<class PROBLEM_CLASS>
+void CardiacSimulationArchiverNeural<PROBLEM_CLASS>::WriteInfoFile(const std::string& rInfoPath, const std::string& rInfo)
+{
     if (PetscTools::AmMaster())
     {
-        std::string info_path = handler.GetOutputDirectoryFullPath() + "archive.info";
-        std::ofstream info_file(info_path.c_str());
+        std::ofstream info_file(rInfoPath.c_str());
         if (!info_file.is_open())
         {
             // Avoid deadlock...
             PetscTools::ReplicateBool(true);
-            EXCEPTION("Unable to open archive information file: " + info_path);
+            EXCEPTION("Unable to open archive information file: " + rInfoPath);
         }
         PetscTools::ReplicateBool(false);
-        unsigned archive_version = 0; // Note that Boost version numbers are per-class; this only needs to change if we change the Load/Save methods here
-        info_file << PetscTools::GetNumProcs() << " " << archive_version;
+        info_file << rInfo;
     }
     else
     {
@@ -94,7 +206,108 @@ void CardiacSimulationArchiverNeural<PROBLEM_CLASS>::Save(PROBLEM_CLASS& rSimula
         }
     }
     // Make sure everything is written before any process continues.
-    PetscTools::Barrier("CardiacSimulationArchiverNeural::Save");
+    PetscTools::Barrier("CardiacSimulationArchiverNeural::WriteInfoFile");
+}
+
+template<class PROBLEM_CLASS>
+void CardiacSimulationArchiverNeural<PROBLEM_CLASS>::Save(PROBLEM_CLASS& rSimulationToArchive,
+                                                    const std::string& rDirectory,
+                                                    bool clearDirectory,
+                                                    CheckpointArchiveFormat::type format,
+                                                    CheckpointCompression::type compression,
+                                                    int compressionLevel,
+                                                    CheckpointArchiveLayout::type layout)
+{
+    // Finish any background save first, as it may be to the same directory
+    WaitForSave();
+
+    // Clear directory if requested (and make sure it exists)
+    OutputFileHandler handler(rDirectory, clearDirectory);
+
+    // The archive files are closed before the info file is written
+    FileFinder dir(rDirectory, RelativeTo::ChasteTestOutput);
+    if (format == CheckpointArchiveFormat::BINARY)
+    {
+        SaveArchive<boost::archive::binary_oarchive>(rSimulationToArchive, dir, compression, compressionLevel, layout);
+    }
+    else
+    {
+        SaveArchive<boost::archive::text_oarchive>(rSimulationToArchive, dir, compression, compressionLevel, layout);
+    }
+
+    WriteInfoFile(handler.GetOutputDirectoryFullPath() + "archive.info",
+                  GetInfo(rSimulationToArchive, format, compression, compressionLevel, layout));
+}
+
+template<class PROBLEM_CLASS>
+void CardiacSimulationArchiverNeural<PROBLEM_CLASS>::SaveAsync(PROBLEM_CLASS& rSimulationToArchive,
+                                                         const std::string& rDirectory,
+                                                         bool clearDirectory,
+                                                         CheckpointArchiveFormat::type format,
+                                                         CheckpointCompression::type compression,
+                                                         int compressionLevel)
+{
+    WaitForSave();
+
+    // Make sure a save still in progress at the end of the run is completed while MPI is available
+    if (!mWaitRegistered)
+    {
+        PetscRegisterFinalize(&CardiacSimulationArchiverNeural<PROBLEM_CLASS>::WaitForSaveAtFinalize);
+        mWaitRegistered = true;
+    }
+
+    OutputFileHandler handler(rDirectory, clearDirectory);
+    FileFinder dir(rDirectory, RelativeTo::ChasteTestOutput);
+
+    boost::shared_ptr<CheckpointBackgroundWriter> p_writer(new CheckpointBackgroundWriter(compression, compressionLevel));
+    if (format == CheckpointArchiveFormat::BINARY)
+    {
+        SaveArchive<boost::archive::binary_oarchive>(rSimulationToArchive, dir, compression, compressionLevel,
+                                                     CheckpointArchiveLayout::FILE_PER_PROCESS, p_writer.get());
+    }
+    else
+    {
+        SaveArchive<boost::archive::text_oarchive>(rSimulationToArchive, dir, compression, compressionLevel,
+                                                   CheckpointArchiveLayout::FILE_PER_PROCESS, p_writer.get());
+    }
+    p_writer->Start();
+
+    mpBackgroundWriter = p_writer;
+    mPendingInfoPath = handler.GetOutputDirectoryFullPath() + "archive.info";
+    mPendingInfo = GetInfo(rSimulationToArchive, format, compression, compressionLevel, CheckpointArchiveLayout::FILE_PER_PROCESS);
+}
+
+template<class PROBLEM_CLASS>
+void CardiacSimulationArchiverNeural<PROBLEM_CLASS>::WaitForSave()
+{
+    if (!mpBackgroundWriter)
+    {
+        return;
+    }
+
+    std::string error = mpBackgroundWriter->Wait();
+    mpBackgroundWriter.reset();
+    if (PetscTools::ReplicateBool(!error.empty()))
+    {
+        EXCEPTION((error.empty() ? "Another process failed to write its checkpoint archive file" : error));
+    }
+
+    // Only now are all the archive files in place
+    WriteInfoFile(mPendingInfoPath, mPendingInfo);
+}
+
+template<class PROBLEM_CLASS>
+PetscErrorCode CardiacSimulationArchiverNeural<PROBLEM_CLASS>::WaitForSaveAtFinalize()
+{
+    try
+    {
+        WaitForSave();
+    }
+    catch (Exception& e)
+    {
+        std::cerr << e.GetMessage() << std::endl;
+    }
+    return 0;
 }
 
 template<class PROBLEM_CLASS>
@@ -110,6 +323,133 @@ PROBLEM_CLASS* CardiacSimulationArchiverNeural<PROBLEM_CLASS>::Load(const FileFi
     return CardiacSimulationArchiverNeural<PROBLEM_CLASS>::Migrate(rDirectory);
 }
 
+template<class PROBLEM_CLASS>
+template<class ARCHIVE>
+PROBLEM_CLASS* CardiacSimulationArchiverNeural<PROBLEM_CLASS>::LoadArchive(const FileFinder& rDirectory,
+                                                                           unsigned numProcs,
+                                                                           unsigned archiveVersion,
+                                                                           CheckpointCompression::type compression,
+                                                                           const std::vector<std::pair<unsigned, unsigned> >& rRanges,
+                                                                           CheckpointArchiveLayout::type layout)
+{
+    PROBLEM_CLASS *p_unarchived_simulation = NULL; // Shouldn't be necessary but is on some setups!
+
+    // Opened (and closed) collectively, so kept outside the try block
+    ArchiveLocationInfo::SetArchiveDirectory(rDirectory);
+    boost::scoped_ptr<CheckpointSharedFile> p_shared_file;
+    if (layout == CheckpointArchiveLayout::SHARED_FILE)
+    {
+        p_shared_file.reset(new CheckpointSharedFile(ArchiveLocationInfo::GetArchiveDirectory() + "archive.shared"));
+    }
+
+    try
+    {
+        // Figure out which process-specific archive to load first.  If we're loading on the same number of
+        // processes, we must load our own one, or the mesh gets confused.  Otherwise, start with 0 to make
+        // sure it exists, unless the node ranges tell us which archive holds the start of our likely (dumb)
+        // partition, which spreads the reads over the files.
+        unsigned initial_archive = numProcs == PetscTools::GetNumProcs() ? PetscTools::GetMyRank() : 0u;
+        if (numProcs != PetscTools::GetNumProcs() && rRanges.size() == numProcs)
+        {
+            unsigned num_nodes = 0;
+            for (unsigned archive_num=0; archive_num<numProcs; archive_num++)
+            {
+                num_nodes = std::max(num_nodes, rRanges[archive_num].second);
+            }
+            unsigned my_rank = PetscTools::GetMyRank();
+            unsigned likely_low = my_rank*(num_nodes/PetscTools::GetNumProcs()) + std::min(my_rank, num_nodes%PetscTools::GetNumProcs());
+            for (unsigned archive_num=0; archive_num<numProcs; archive_num++)
+            {
+                if (rRanges[archive_num].first <= likely_low && likely_low < rRanges[archive_num].second)
+                {
+                    initial_archive = archive_num;
+                    break;
+                }
+            }
+        }
+
+        // Load the master and initial process-specific archive files
+        std::string block;
+        boost::scoped_ptr<CheckpointArchiveReader<ARCHIVE> > p_private_reader;
+        if (p_shared_file)
+        {
+            // Every process reads a block here, so a failure to read one is shared before throwing
+            std::string read_error = p_shared_file->ReadBlock(initial_archive, block);
+            if (PetscTools::ReplicateBool(!read_error.empty()))
+            {
+                EXCEPTION((read_error.empty() ? "Another process could not read its block of the shared archive file" : read_error));
+            }
+            p_private_reader.reset(new CheckpointArchiveReader<ARCHIVE>(block.data(), block.size(), compression));
+        }
+        else
+        {
+            p_private_reader.reset(new CheckpointArchiveReader<ARCHIVE>(ArchiveLocationInfo::GetProcessUniqueFilePath("archive.arch", initial_archive), compression));
+        }
+        CheckpointArchiveReader<ARCHIVE> common_reader(ArchiveLocationInfo::GetArchiveDirectory() + "archive.arch", compression);
+        ProcessSpecificArchive<ARCHIVE>::Set(p_private_reader->GetArchive());
+        try
+        {
+            (*common_reader.GetArchive()) >> p_unarchived_simulation;
+        }
+        catch (Exception &e)
+        {
+            ProcessSpecificArchive<ARCHIVE>::Set(NULL);
+            throw e;
+        }
+        ProcessSpecificArchive<ARCHIVE>::Set(NULL);
+
+        // Work out how many more process-specific files to load
+        DistributedVectorFactory* p_factory = p_unarchived_simulation->rGetMesh().GetDistributedVectorFactory();
+        assert(p_factory != NULL);
+        unsigned original_num_procs = p_factory->GetOriginalFactory()->GetNumProcs();
+        assert(original_num_procs == numProcs); // Paranoia
+
+        // Merge in the extra data, which each archive only has for the nodes its process owned
+        unsigned lo = p_factory->GetLow();
+        unsigned hi = p_factory->GetHigh();
+        std::string read_error;
+        for (unsigned archive_num=0; archive_num<original_num_procs; archive_num++)
+        {
+            bool overlaps = rRanges.size() != original_num_procs
+                            || (rRanges[archive_num].first < hi && lo < rRanges[archive_num].second);
+            if (archive_num != initial_archive && overlaps)
+            {
+                std::string extra_block;
+                boost::scoped_ptr<CheckpointArchiveReader<ARCHIVE> > p_reader;
+                if (p_shared_file)
+                {
+                    // Processes read different numbers of blocks, so failures are shared after the loop
+                    read_error = p_shared_file->ReadBlock(archive_num, extra_block);
+                    if (!read_error.empty())
+                    {
+                        break;
+                    }
+                    p_reader.reset(new CheckpointArchiveReader<ARCHIVE>(extra_block.data(), extra_block.size(), compression));
+                }
+                else
+                {
+                    std::string archive_path = ArchiveLocationInfo::GetProcessUniqueFilePath("archive.arch", archive_num);
+                    p_reader.reset(new CheckpointArchiveReader<ARCHIVE>(archive_path, compression));
+                }
+                p_unarchived_simulation->LoadExtraArchive(*p_reader->GetArchive(), archiveVersion);
+                p_unarchived_simulation->LoadExtraNeuralArchive(*p_reader->GetArchive(), archiveVersion);
+            }
+        }
+        if (p_shared_file && PetscTools::ReplicateBool(!read_error.empty()))
+        {
+            EXCEPTION((read_error.empty() ? "Another process could not read a block of the shared archive file" : read_error));
+        }
+    }
+    catch (Exception &e)
+    {
+        if (p_unarchived_simulation)
+        {
+            delete p_unarchived_simulation;
+        }
+        throw e;
+    }
+    return p_unarchived_simulation;
+}
 
 template<class PROBLEM_CLASS>
 PROBLEM_CLASS* CardiacSimulationArchiverNeural<PROBLEM_CLASS>::Migrate(const FileFinder& rDirectory)
@@ -132,51 +472,73 @@ PROBLEM_CLASS* CardiacSimulationArchiverNeural<PROBLEM_CLASS>::Migrate(const Fil
     unsigned num_procs, archive_version;
     info_file >> num_procs >> archive_version;
 
-    PROBLEM_CLASS *p_unarchived_simulation = NULL; // Shouldn't be necessary but is on some setups!
+    // Checkpoints written before the format was recorded are text
+    std::string format = GetFormatName(CheckpointArchiveFormat::TEXT);
+    std::string compression_name = CheckpointCompression::GetName(CheckpointCompression::NONE);
+    std::vector<std::pair<unsigned, unsigned> > ranges;
+    std::string layout_name = "file_per_process";
+    std::string key;
+    while (info_file >> key)
+    {
+        if (key == "format")
+        {
+            info_file >> format;
+        }
+        else if (key == "compression")
+        {
+            info_file >> compression_name;
+            std::getline(info_file, key); // The level is only needed for writing
+        }
+        else if (key == "layout")
+        {
+            info_file >> layout_name;
+        }
+        else if (key == "range")
+        {
+            unsigned archive_num, lo, hi;
+            info_file >> archive_num >> lo >> hi;
+            if (archive_num == ranges.size())
+            {
+                ranges.push_back(std::make_pair(lo, hi));
+            }
+        }
+        else
+        {
+            std::getline(info_file, key); // Skip what we don't need
+        }
+    }
+    if (format != GetFormatName(CheckpointArchiveFormat::TEXT) && format != GetFormatName(CheckpointArchiveFormat::BINARY))
+    {
+        EXCEPTION("Unknown checkpoint archive format '" + format + "' in " + info_path);
+    }
+    CheckpointCompression::type compression = CheckpointCompression::GetType(compression_name);
+    if (layout_name != "file_per_process" && layout_name != "shared")
+    {
+        EXCEPTION("Unknown checkpoint archive layout '" + layout_name + "' in " + info_path);
+    }
+    CheckpointArchiveLayout::type layout = layout_name == "shared" ? CheckpointArchiveLayout::SHARED_FILE
+                                                                   : CheckpointArchiveLayout::FILE_PER_PROCESS;
 
     // Avoid the DistributedVectorFactory throwing a 'wrong number of processes' exception when loading,
     // and make it get the original DistributedVectorFactory from the archive so we can compare against
     // num_procs.
     DistributedVectorFactory::SetCheckNumberOfProcessesOnLoad(false);
     // Put what follows in a try-catch to make sure we reset this
+    PROBLEM_CLASS *p_unarchived_simulation = NULL;
     try
     {
-        // Figure out which process-specific archive to load first.  If we're loading on the same number of
-        // processes, we must load our own one, or the mesh gets confused.  Otherwise, start with 0 to make
-        // sure it exists.
-        unsigned initial_archive = num_procs == PetscTools::GetNumProcs() ? PetscTools::GetMyRank() : 0u;
-
-        // Load the master and initial process-specific archive files.
-        // This will also set up ArchiveLocationInfo for us.
-        ArchiveOpener<boost::archive::text_iarchive, std::ifstream> archive_opener(rDirectory, "archive.arch", initial_archive);
-        boost::archive::text_iarchive* p_main_archive = archive_opener.GetCommonArchive();
-        (*p_main_archive) >> p_unarchived_simulation;
-
-        // Work out how many more process-specific files to load
-        DistributedVectorFactory* p_factory = p_unarchived_simulation->rGetMesh().GetDistributedVectorFactory();
-        assert(p_factory != NULL);
-        unsigned original_num_procs = p_factory->GetOriginalFactory()->GetNumProcs();
-        assert(original_num_procs == num_procs); // Paranoia
-
-        // Merge in the extra data
-        for (unsigned archive_num=0; archive_num<original_num_procs; archive_num++)
+        if (format == GetFormatName(CheckpointArchiveFormat::BINARY))
         {
-            if (archive_num != initial_archive)
-            {
-                std::string archive_path = ArchiveLocationInfo::GetProcessUniqueFilePath("archive.arch", archive_num);
-                std::ifstream ifs(archive_path.c_str());
-                boost::archive::text_iarchive archive(ifs);
-                p_unarchived_simulation->LoadExtraArchive(archive, archive_version);
-            }
+            p_unarchived_simulation = LoadArchive<boost::archive::binary_iarchive>(rDirectory, num_procs, archive_version, compression, ranges, layout);
+        }
+        else
+        {
+            p_unarchived_simulation = LoadArchive<boost::archive::text_iarchive>(rDirectory, num_procs, archive_version, compression, ranges, layout);
         }
     }
     catch (Exception &e)
     {
         DistributedVectorFactory::SetCheckNumberOfProcessesOnLoad(true);
-        if (p_unarchived_simulation)
-        {
-            delete p_unarchived_simulation;
-        }
         throw e;
     }
 
@@ -185,6 +547,57 @@ PROBLEM_CLASS* CardiacSimulationArchiverNeural<PROBLEM_CLASS>::Migrate(const Fil
     return p_unarchived_simulation;
 }
 
+template<class PROBLEM_CLASS>
+bool CardiacSimulationArchiverNeural<PROBLEM_CLASS>::GetMeasuredNodeCosts(const FileFinder& rDirectory,
+                                                                          std::vector<double>& rNodeCosts)
+{
+    std::string info_path = rDirectory.GetAbsolutePath() + "archive.info";
+    std::ifstream info_file(info_path.c_str());
+    if (!info_file.is_open())
+    {
+        EXCEPTION("Unable to open archive information file: " + info_path);
+    }
+    unsigned num_procs, archive_version;
+    info_file >> num_procs >> archive_version;
+
+    std::vector<std::pair<unsigned, unsigned> > ranges(num_procs, std::make_pair(0u, 0u));
+    std::vector<double> loads(num_procs, 0.0);
+    bool has_loads = false;
+    unsigned num_nodes = 0;
+    std::string key;
+    while (info_file >> key)
+    {
+        unsigned rank;
+        if (key == "range" && info_file >> rank && rank < num_procs)
+        {
+            info_file >> ranges[rank].first >> ranges[rank].second;
+            num_nodes = std::max(num_nodes, ranges[rank].second);
+        }
+        else if (key == "load" && info_file >> rank && rank < num_procs)
+        {
+            double ode_time, assembly_time;
+            info_file >> ode_time >> assembly_time;
+            loads[rank] = ode_time + assembly_time;
+            has_loads = has_loads || loads[rank] > 0.0;
+        }
+        else
+        {
+            std::getline(info_file, key); // Skip what we don't need
+        }
+    }
+
+    rNodeCosts.assign(num_nodes, 0.0);
+    for (unsigned rank=0; rank<num_procs; rank++)
+    {
+        if (ranges[rank].second > ranges[rank].first)
+        {
+            double cost = loads[rank]/(ranges[rank].second - ranges[rank].first);
+            std::fill(rNodeCosts.begin() + ranges[rank].first, rNodeCosts.begin() + ranges[rank].second, cost);
+        }
+    }
+    return has_loads;
+}
+
 // Explicit instantiation
 template class CardiacSimulationArchiverNeural<BidomainProblemNeural<1> >;
 template class CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >;
@@ -37,9 +37,47 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define CARDIACSIMULATIONARCHIVERNEURAL_HPP_
 
 #include <string>
+#include <utility>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <petscsys.h>
 
 #include "FileFinder.hpp"
+#include "../src/CheckpointArchiveStreams.hpp"
 
+/**
+ * Formats in which CardiacSimulationArchiverNeural can write a checkpoint.
+ *
+ * Text archives can be moved between any machines. Binary archives are much faster to save
+ * and load, but can only be loaded on machines with the same sizes of basic types and byte
+ * order as the one that saved them.
+ */
+struct CheckpointArchiveFormat
+{
+    /** The possible formats */
+    enum type
+    {
+        TEXT = 0,
+        BINARY
+    };
+};
+
+/**
+ * How CardiacSimulationArchiverNeural lays out the process-specific archives of a checkpoint.
+ *
+ * With FILE_PER_PROCESS each process writes its own archive file. With SHARED_FILE they are
+ * the blocks of a single CheckpointSharedFile written collectively with MPI-IO, which avoids
+ * creating (and later opening) one file per process on parallel file systems.
+ */
+struct CheckpointArchiveLayout
+{
+    /** The possible layouts */
+    enum type
+    {
+        FILE_PER_PROCESS = 0,
+        SHARED_FILE
+    };
+};
 
 /**
  * CardiacSimulationArchiverNeural is a helper class for checkpointing of cardiac simulations.
@@ -51,6 +89,88 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 template<class PROBLEM_CLASS>
 class CardiacSimulationArchiverNeural
 {
+private:
+    /**
+     * Write the common and process-specific archive files of a checkpoint.
+     *
+     * @param rSimulationToArchive object defining the simulation to archive
+     * @param rDirectory checkpoint directory
+     * @param compression compression codec for the archive files
+     * @param compressionLevel compression level
+     * @param layout whether to write a process-specific archive file each, or a shared file
+     * @param pBackgroundWriter if given, the archives are serialised into memory and handed to
+     *     this to compress and write, rather than written directly
+     */
+    template<class ARCHIVE>
+    static void SaveArchive(PROBLEM_CLASS& rSimulationToArchive, const FileFinder& rDirectory,
+                            CheckpointCompression::type compression, int compressionLevel,
+                            CheckpointArchiveLayout::type layout, CheckpointBackgroundWriter* pBackgroundWriter=NULL);
+
+    /**
+     * @return the contents of archive.info for a checkpoint saved by this many processes,
+     *     including the range of global node indices [lo, hi) owned by each process, so that
+     *     loading only needs the process-specific archives overlapping the new partition, and
+     *     the load each process measured, for rebalancing. Only complete on the master process.
+     *
+     * @note Must be called collectively.
+     *
+     * @param rSimulation the simulation archived
+     * @param format archive format
+     * @param compression compression codec
+     * @param compressionLevel compression level
+     * @param layout layout of the process-specific archives
+     */
+    static std::string GetInfo(PROBLEM_CLASS& rSimulation, CheckpointArchiveFormat::type format,
+                               CheckpointCompression::type compression, int compressionLevel,
+                               CheckpointArchiveLayout::type layout);
+
+    /**
+     * Write archive.info from the master process, which completes a checkpoint.
+     *
+     * @param rInfoPath path of archive.info
+     * @param rInfo its contents
+     */
+    static void WriteInfoFile(const std::string& rInfoPath, const std::string& rInfo);
+
+    /** Called by PetscFinalize to complete an outstanding background save. */
+    static PetscErrorCode WaitForSaveAtFinalize();
+
+    /** Writer of the files of the background save in progress, if any. */
+    static boost::shared_ptr<CheckpointBackgroundWriter> mpBackgroundWriter;
+
+    /** Path of archive.info for the background save in progress. */
+    static std::string mPendingInfoPath;
+
+    /** Contents of archive.info for the background save in progress. */
+    static std::string mPendingInfo;
+
+    /** Whether WaitForSaveAtFinalize has been registered with PETSc. */
+    static bool mWaitRegistered;
+
+    /**
+     * Read the common and process-specific archive files of a checkpoint.
+     *
+     * @param rDirectory checkpoint directory
+     * @param numProcs number of processes that saved the checkpoint
+     * @param archiveVersion version of the checkpoint layout, from archive.info
+     * @param compression compression codec of the archive files
+     * @param rRanges node range [lo, hi) of each process-specific archive, or empty if not
+     *     recorded, in which case every archive is read
+     * @param layout layout of the process-specific archives
+     * @return the unarchived cardiac problem class
+     */
+    template<class ARCHIVE>
+    static PROBLEM_CLASS* LoadArchive(const FileFinder& rDirectory, unsigned numProcs, unsigned archiveVersion,
+                                      CheckpointCompression::type compression,
+                                      const std::vector<std::pair<unsigned, unsigned> >& rRanges,
+                                      CheckpointArchiveLayout::type layout);
+
+    /**
+     * @return the name of an archive format, as written to archive.info
+     * @param format the format
+     */
+    static std::string GetFormatName(CheckpointArchiveFormat::type format);
+
 public:
     /**
      * Archives a simulation in the directory specified.
@@ -61,8 +181,50 @@ public:
      * @param rDirectory directory where the multiple files defining the checkpoint will be stored
      *     (relative to CHASTE_TEST_OUTPUT)
      * @param clearDirectory whether the directory needs to be cleared or not.
+     * @param format whether to write a (portable) text or a (fast) binary archive. The format
+     *     is recorded in archive.info, so loading does not need to be told it.
+     * @param compression codec compressing the common and process-specific archive files, also
+     *     recorded in archive.info
+     * @param compressionLevel compression level, from 1 (fastest) to 9 (smallest)
+     * @param layout whether each process writes its own archive file, or all write one shared
+     *     file with MPI-IO; also recorded in archive.info
      */
-    static void Save(PROBLEM_CLASS& rSimulationToArchive, const std::string& rDirectory, bool clearDirectory=true);
+    static void Save(PROBLEM_CLASS& rSimulationToArchive, const std::string& rDirectory, bool clearDirectory=true,
+                     CheckpointArchiveFormat::type format=CheckpointArchiveFormat::TEXT,
+                     CheckpointCompression::type compression=CheckpointCompression::NONE,
+                     int compressionLevel=6,
+                     CheckpointArchiveLayout::type layout=CheckpointArchiveLayout::FILE_PER_PROCESS);
+
+    /**
+     * Archives a simulation as Save() does (with a file per process), but only serialises it
+     * into memory before returning.
+     * A background thread then compresses and writes the archive files while the simulation
+     * carries on, at the cost of holding a copy of the archives in memory. The checkpoint is
+     * complete (archive.info is written) once WaitForSave() returns, which happens at the latest
+     * at the next Save() or SaveAsync(), or when PETSc is finalised.
+     *
+     * @note Must be called collectively, i.e. by all processes.
+     *
+     * @param rSimulationToArchive object defining the simulation to archive
+     * @param rDirectory directory where the multiple files defining the checkpoint will be stored
+     *     (relative to CHASTE_TEST_OUTPUT)
+     * @param clearDirectory whether the directory needs to be cleared or not.
+     * @param format text or binary archive
+     * @param compression codec compressing the archive files
+     * @param compressionLevel compression level, from 1 (fastest) to 9 (smallest)
+     */
+    static void SaveAsync(PROBLEM_CLASS& rSimulationToArchive, const std::string& rDirectory, bool clearDirectory=true,
+                          CheckpointArchiveFormat::type format=CheckpointArchiveFormat::TEXT,
+                          CheckpointCompression::type compression=CheckpointCompression::NONE,
+                          int compressionLevel=6);
+
+    /**
+     * Wait for the archive files of a SaveAsync() to be written, then complete the checkpoint.
+     * Does nothing if there is no save in progress.
+     *
+     * @note Must be called collectively, i.e. by all processes.
+     */
+    static void WaitForSave();
 
 
     /**
@@ -106,10 +268,24 @@ public:
      * the processes.  If we are loading on the same number of processes as the
      * simulation was saved on, it uses exactly the same distribution as before.
      *
+     * When archive.info records the node range of each secondary archive, each process
+     * only reads the archives overlapping its own nodes.
+     *
      * @param rDirectory directory where the multiple files defining the checkpoint are located
      * @return a pointer to the migrated cardiac problem class
      */
     static PROBLEM_CLASS* Migrate(const FileFinder& rDirectory);
+
+    /**
+     * Spread the wall time each process measured solving cell ODEs and assembling before a
+     * checkpoint (see BidomainProblemNeural::GetMeasuredLoad) evenly over the nodes it owned,
+     * giving a cost for each node from which to compute a balanced partition.
+     *
+     * @param rDirectory directory where the multiple files defining the checkpoint are located
+     * @param rNodeCosts filled with the cost of each node (ms), in the numbering of the checkpoint
+     * @return whether the checkpoint records any measurements
+     */
+    static bool GetMeasuredNodeCosts(const FileFinder& rDirectory, std::vector<double>& rNodeCosts);
 };
 
 #endif /*CardiacSimulationArchiverNeural_HPP_*/
@@ -0,0 +1,154 @@
+#include "CellSweepPool.hpp"
+
+#include <algorithm>
+#include <new>
+
+#include "Exception.hpp"
+
+CellSweepPool::CellSweepPool(unsigned numThreads)
+    : generation(0),
+      numBusy(0),
+      stopping(false),
+      pTask(NULL),
+      runItems(0),
+      runChunkSize(1),
+      failed(false)
+{
+    if (numThreads == 0)
+    {
+        EXCEPTION("A cell sweep needs at least one thread");
+    }
+    void* p_memory = NULL;
+    if (posix_memalign(&p_memory, alignof(Slice), numThreads*sizeof(Slice)) != 0)
+    {
+        EXCEPTION("Could not allocate the slices of a cell sweep");
+    }
+    pSlices.reset(static_cast<Slice*>(p_memory));
+    for (unsigned i = 0; i < numThreads; i++)
+    {
+        new (&pSlices[i]) Slice;
+        pSlices[i].next = 0;
+        pSlices[i].end = 0;
+    }
+    for (unsigned thread = 1; thread < numThreads; thread++)
+    {
+        workers.push_back(std::thread(&CellSweepPool::WorkerLoop, this, thread));
+    }
+}
+
+CellSweepPool::~CellSweepPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start.notify_all();
+    for (unsigned i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+
+unsigned CellSweepPool::GetNumThreads() const
+{
+    return workers.size() + 1;
+}
+
+void CellSweepPool::Run(unsigned numItems, unsigned chunkSize, const std::function<void(unsigned, unsigned, unsigned)>& rTask)
+{
+    if (numItems == 0)
+    {
+        return;
+    }
+    unsigned num_threads = GetNumThreads();
+    runItems = numItems;
+    runChunkSize = std::max(chunkSize, 1u);
+    unsigned num_chunks = (runItems + runChunkSize - 1)/runChunkSize;
+    for (unsigned thread = 0; thread < num_threads; thread++)
+    {
+        pSlices[thread].next = (unsigned) ((unsigned long long) thread*num_chunks/num_threads);
+        pSlices[thread].end = (unsigned) ((unsigned long long) (thread + 1)*num_chunks/num_threads);
+    }
+    pTask = &rTask;
+    failed = false;
+    error = std::exception_ptr();
+
+    // The lock publishes the slices and task to the workers
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        numBusy = workers.size();
+        generation++;
+    }
+    start.notify_all();
+    Work(0);
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]{ return numBusy == 0; });
+    }
+    pTask = NULL;
+
+    if (error)
+    {
+        std::exception_ptr first_error = error;
+        error = std::exception_ptr();
+        std::rethrow_exception(first_error);
+    }
+}
+
+void CellSweepPool::WorkerLoop(unsigned thread)
+{
+    unsigned seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [this, seen]{ return stopping || generation != seen; });
+            if (stopping)
+            {
+                return;
+            }
+            seen = generation;
+        }
+        Work(thread);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--numBusy == 0)
+            {
+                done.notify_one();
+            }
+        }
+    }
+}
+
+void CellSweepPool::Work(unsigned thread)
+{
+    // Own slice first, then whatever the others have left
+    unsigned num_threads = GetNumThreads();
+    for (unsigned i = 0; i < num_threads; i++)
+    {
+        Slice& r_slice = pSlices[(thread + i)%num_threads];
+        while (!failed.load(std::memory_order_relaxed))
+        {
+            unsigned chunk = r_slice.next.fetch_add(1);
+            if (chunk >= r_slice.end)
+            {
+                break;
+            }
+            unsigned begin = chunk*runChunkSize;
+            unsigned end = std::min(begin + runChunkSize, runItems);
+            try
+            {
+                (*pTask)(thread, begin, end);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                failed = true;
+            }
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef CELLSWEEPPOOL_HPP_
+#define CELLSWEEPPOOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of threads sharing out a loop over items, such as the cells a process owns.
+ *
+ * Each Run() splits the items into chunks and gives each thread a contiguous slice of them,
+ * so a thread tends to get the same cells every time. A thread that finishes its slice takes
+ * chunks from the slices of the others, so uneven work (e.g. ICC cells next to bath) evens
+ * out. The calling thread works too, so a pool of one thread has no workers and runs the loop
+ * in place. The threads do no MPI communication.
+ */
+class CellSweepPool
+{
+    private:
+    /** Chunks not yet taken from one thread's slice, on a cache line of its own */
+    struct alignas(64) Slice
+    {
+        std::atomic<unsigned> next;
+        unsigned end;
+    };
+
+    /** Frees slices from posix_memalign, since new[] only honours their alignment from C++17 */
+    struct FreeSlices
+    {
+        void operator()(Slice* pMemory) const
+        {
+            free(pMemory);
+        }
+    };
+
+    std::vector<std::thread> workers;  // threads 1 to numThreads-1; the caller is thread 0
+    std::unique_ptr<Slice[], FreeSlices> pSlices;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    unsigned generation;  // number of Run() calls, to wake the workers
+    unsigned numBusy;     // workers still on the current Run()
+    bool stopping;
+
+    const std::function<void(unsigned, unsigned, unsigned)>* pTask;
+    unsigned runItems;      // number of items of the current Run()
+    unsigned runChunkSize;  // items per chunk of the current Run()
+    std::atomic<bool> failed;
+    std::exception_ptr error;  // first failure of the current Run()
+
+    void WorkerLoop(unsigned thread);
+    void Work(unsigned thread);
+
+    CellSweepPool(const CellSweepPool&) = delete;
+    CellSweepPool& operator=(const CellSweepPool&) = delete;
+
+    public:
+    /**
+     * Start the worker threads.
+     *
+     * @param numThreads  number of threads, including the caller of Run()
+     */
+    CellSweepPool(unsigned numThreads);
+
+    /** Stop and join the worker threads. */
+    ~CellSweepPool();
+
+    /** @return the number of threads, including the caller of Run() */
+    unsigned GetNumThreads() const;
+
+    /**
+     * Call a task on every item, in chunks, from all the threads, and wait for them to finish.
+     * If a chunk throws, the chunks not yet started are skipped and the first exception is
+     * rethrown here.
+     *
+     * @param numItems  number of items
+     * @param chunkSize  number of consecutive items per call of the task
+     * @param rTask  called as task(thread, begin, end) for items [begin, end), where thread
+     *     numbers from 0 (the caller) to GetNumThreads()-1
+     */
+    void Run(unsigned numItems, unsigned chunkSize, const std::function<void(unsigned, unsigned, unsigned)>& rTask);
+};
+
+#endif // CELLSWEEPPOOL_HPP_
@@ -0,0 +1,323 @@
+#ifndef CHECKPOINTARCHIVESTREAMS_HPP_
+#define CHECKPOINTARCHIVESTREAMS_HPP_
+
+#include <exception>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/device/back_inserter.hpp>
+#include <boost/iostreams/device/null.hpp>
+#include <boost/iostreams/filter/zlib.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "Exception.hpp"
+
+/**
+ * Compression applied to the archive files of a checkpoint.
+ */
+struct CheckpointCompression
+{
+    /** The possible codecs */
+    enum type
+    {
+        NONE = 0,
+        ZLIB
+    };
+
+    /**
+     * @return the name of a codec, as written to archive.info
+     * @param compression the codec
+     */
+    static std::string GetName(type compression)
+    {
+        return compression == ZLIB ? "zlib" : "none";
+    }
+
+    /**
+     * @return the codec with the given name
+     * @param rName the name, as written to archive.info
+     */
+    static type GetType(const std::string& rName)
+    {
+        if (rName == "zlib")
+        {
+            return ZLIB;
+        }
+        if (rName != "none")
+        {
+            EXCEPTION("Unknown checkpoint compression '" + rName + "'");
+        }
+        return NONE;
+    }
+};
+
+/**
+ * A Boost archive written to a file through an optional compression filter.
+ */
+template<class ARCHIVE>
+class CheckpointArchiveWriter
+{
+private:
+    /** The archive file. */
+    std::ofstream mFile;
+
+    /** Compression filter (if any) followed by the file, or by nothing. */
+    boost::iostreams::filtering_ostream mStream;
+
+    /** The archive. */
+    boost::scoped_ptr<ARCHIVE> mpArchive;
+
+public:
+    /**
+     * Open the file and the archive.
+     *
+     * @param rPath  the archive file, or an empty string to discard what is written
+     * @param compression  the compression codec
+     * @param level  the compression level, from 1 (fastest) to 9 (smallest)
+     */
+    CheckpointArchiveWriter(const std::string& rPath, CheckpointCompression::type compression, int level)
+    {
+        if (compression == CheckpointCompression::ZLIB)
+        {
+            mStream.push(boost::iostreams::zlib_compressor(boost::iostreams::zlib_params(level)));
+        }
+        if (rPath.empty())
+        {
+            mStream.push(boost::iostreams::null_sink());
+        }
+        else
+        {
+            mFile.open(rPath.c_str(), std::ios::binary | std::ios::trunc);
+            if (!mFile.is_open())
+            {
+                EXCEPTION("Failed to open archive file for writing: " + rPath);
+            }
+            mStream.push(mFile);
+        }
+        mpArchive.reset(new ARCHIVE(mStream));
+    }
+
+    /**
+     * Open an archive in memory, to be written out later by a CheckpointBackgroundWriter
+     * (uncompressed) or to a CheckpointSharedFile.
+     *
+     * @param rBuffer  filled with the archive, once this object is destroyed
+     * @param compression  the compression codec
+     * @param level  the compression level, from 1 (fastest) to 9 (smallest)
+     */
+    CheckpointArchiveWriter(std::string& rBuffer,
+                            CheckpointCompression::type compression=CheckpointCompression::NONE, int level=6)
+    {
+        if (compression == CheckpointCompression::ZLIB)
+        {
+            mStream.push(boost::iostreams::zlib_compressor(boost::iostreams::zlib_params(level)));
+        }
+        mStream.push(boost::iostreams::back_inserter(rBuffer));
+        mpArchive.reset(new ARCHIVE(mStream));
+    }
+
+    /**
+     * Finish the archive before flushing the compression filter and closing the file.
+     */
+    ~CheckpointArchiveWriter()
+    {
+        mpArchive.reset();
+        mStream.reset();
+    }
+
+    /** @return the archive */
+    ARCHIVE* GetArchive()
+    {
+        return mpArchive.get();
+    }
+};
+
+/**
+ * A Boost archive read from a file (or memory) through an optional decompression filter.
+ */
+template<class ARCHIVE>
+class CheckpointArchiveReader
+{
+private:
+    /** The archive file. */
+    std::ifstream mFile;
+
+    /** Decompression filter (if any) followed by the file or memory. */
+    boost::iostreams::filtering_istream mStream;
+
+    /** The archive. */
+    boost::scoped_ptr<ARCHIVE> mpArchive;
+
+public:
+    /**
+     * Open the file and the archive.
+     *
+     * @param rPath  the archive file
+     * @param compression  the compression codec it was written with
+     */
+    CheckpointArchiveReader(const std::string& rPath, CheckpointCompression::type compression)
+    {
+        mFile.open(rPath.c_str(), std::ios::binary);
+        if (!mFile.is_open())
+        {
+            EXCEPTION("Cannot load archive file: " + rPath);
+        }
+        if (compression == CheckpointCompression::ZLIB)
+        {
+            mStream.push(boost::iostreams::zlib_decompressor());
+        }
+        mStream.push(mFile);
+        mpArchive.reset(new ARCHIVE(mStream));
+    }
+
+    /**
+     * Open an archive held in memory, e.g. a block of a CheckpointSharedFile.
+     *
+     * @param pData  the archive, which must outlive this object
+     * @param size  its size in bytes
+     * @param compression  the compression codec it was written with
+     */
+    CheckpointArchiveReader(const char* pData, std::size_t size, CheckpointCompression::type compression)
+    {
+        if (compression == CheckpointCompression::ZLIB)
+        {
+            mStream.push(boost::iostreams::zlib_decompressor());
+        }
+        mStream.push(boost::iostreams::array_source(pData, size));
+        mpArchive.reset(new ARCHIVE(mStream));
+    }
+
+    /** Close the archive before the file. */
+    ~CheckpointArchiveReader()
+    {
+        mpArchive.reset();
+        mStream.reset();
+    }
+
+    /** @return the archive */
+    ARCHIVE* GetArchive()
+    {
+        return mpArchive.get();
+    }
+};
+
+/**
+ * Compresses and writes archive files, already serialised into memory, on a background thread
+ * so the simulation can carry on meanwhile. The thread does no MPI communication.
+ */
+class CheckpointBackgroundWriter
+{
+private:
+    /** (path, contents) of each file to write. */
+    std::vector<std::pair<std::string, std::string> > mFiles;
+
+    /** Compression codec for the files. */
+    CheckpointCompression::type mCompression;
+
+    /** Compression level. */
+    int mLevel;
+
+    /** The writing thread. */
+    std::thread mThread;
+
+    /** Description of the first failure, if any. */
+    std::string mError;
+
+    /** Write the files, recording rather than throwing any failure. */
+    void Run()
+    {
+        for (unsigned i = 0; i < mFiles.size() && mError.empty(); i++)
+        {
+            try
+            {
+                std::ofstream file(mFiles[i].first.c_str(), std::ios::binary | std::ios::trunc);
+                if (!file.is_open())
+                {
+                    mError = "Failed to open archive file for writing: " + mFiles[i].first;
+                    break;
+                }
+                boost::iostreams::filtering_ostream stream;
+                if (mCompression == CheckpointCompression::ZLIB)
+                {
+                    stream.push(boost::iostreams::zlib_compressor(boost::iostreams::zlib_params(mLevel)));
+                }
+                stream.push(file);
+                stream.write(mFiles[i].second.data(), mFiles[i].second.size());
+                stream.reset();
+                file.close();
+                if (file.fail())
+                {
+                    mError = "Failed to write archive file: " + mFiles[i].first;
+                }
+            }
+            catch (const std::exception& e)
+            {
+                mError = "Failed to write archive file " + mFiles[i].first + ": " + e.what();
+            }
+            // Give the memory back as soon as each file is written
+            std::string().swap(mFiles[i].second);
+        }
+    }
+
+    CheckpointBackgroundWriter(const CheckpointBackgroundWriter&) = delete;
+    CheckpointBackgroundWriter& operator=(const CheckpointBackgroundWriter&) = delete;
+
+public:
+    /**
+     * @param compression  compression codec for the files
+     * @param level  compression level
+     */
+    CheckpointBackgroundWriter(CheckpointCompression::type compression, int level)
+        : mCompression(compression),
+          mLevel(level)
+    {
+    }
+
+    /** Wait for the files to be written, if that has not been done already. */
+    ~CheckpointBackgroundWriter()
+    {
+        if (mThread.joinable())
+        {
+            mThread.join();
+        }
+    }
+
+    /**
+     * Add a file to write, before calling Start().
+     *
+     * @param rPath  the file
+     * @param rContents  its contents, which are taken (leaving rContents empty) rather than copied
+     */
+    void AddFile(const std::string& rPath, std::string& rContents)
+    {
+        mFiles.push_back(std::make_pair(rPath, std::string()));
+        mFiles.back().second.swap(rContents);
+    }
+
+    /** Start writing the files in the background. */
+    void Start()
+    {
+        mThread = std::thread(&CheckpointBackgroundWriter::Run, this);
+    }
+
+    /**
+     * Wait for the files to be written.
+     *
+     * @return a description of what went wrong, or an empty string if all the files were written
+     */
+    std::string Wait()
+    {
+        if (mThread.joinable())
+        {
+            mThread.join();
+        }
+        return mError;
+    }
+};
+
+#endif // CHECKPOINTARCHIVESTREAMS_HPP_
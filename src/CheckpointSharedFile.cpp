@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <sstream>
+
+#include "CheckpointSharedFile.hpp"
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+
+static const std::uint64_t CHECKPOINT_SHARED_FILE_MAGIC = 0x4348535453484152ull;
+
+// MPI counts are ints, so large blocks are transferred in pieces of this many bytes
+static const std::uint64_t MAX_TRANSFER = 1u << 30;
+
+void CheckpointSharedFile::Write(const std::string& rPath, const std::string& rBlock)
+{
+    unsigned num_procs = PetscTools::GetNumProcs();
+    std::uint64_t header_size = sizeof(std::uint64_t) * (2 + 2 * num_procs);
+
+    // Blocks follow the header in process order
+    std::uint64_t size = rBlock.size();
+    std::uint64_t offset = 0;
+    MPI_Exscan(&size, &offset, 1, MPI_UINT64_T, MPI_SUM, PETSC_COMM_WORLD);
+    if (PetscTools::AmMaster())
+    {
+        offset = 0; // MPI_Exscan leaves it undefined
+    }
+    offset += header_size;
+
+    std::vector<std::uint64_t> header(2 + 2 * num_procs);
+    std::uint64_t my_block[2] = {offset, size};
+    MPI_Gather(my_block, 2, MPI_UINT64_T, &header[2], 2, MPI_UINT64_T, 0, PETSC_COMM_WORLD);
+    header[0] = CHECKPOINT_SHARED_FILE_MAGIC;
+    header[1] = num_procs;
+
+    // Opening is collective, but may fail on only some processes, so all find out before throwing
+    MPI_File file;
+    int error = MPI_File_open(PETSC_COMM_WORLD, const_cast<char*>(rPath.c_str()), MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                              MPI_INFO_NULL, &file);
+    if (PetscTools::ReplicateBool(error != MPI_SUCCESS))
+    {
+        if (error == MPI_SUCCESS)
+        {
+            MPI_File_close(&file);
+        }
+        EXCEPTION("Failed to open shared archive file for writing: " + rPath);
+    }
+    error = MPI_File_set_size(file, 0);
+
+    if (error == MPI_SUCCESS && PetscTools::AmMaster())
+    {
+        error = MPI_File_write_at(file, 0, &header[0], header.size(), MPI_UINT64_T, MPI_STATUS_IGNORE);
+    }
+
+    // Every process takes part in the same number of collective writes
+    std::uint64_t num_pieces = (size + MAX_TRANSFER - 1) / MAX_TRANSFER;
+    std::uint64_t max_num_pieces;
+    MPI_Allreduce(&num_pieces, &max_num_pieces, 1, MPI_UINT64_T, MPI_MAX, PETSC_COMM_WORLD);
+    for (std::uint64_t piece = 0; piece < max_num_pieces; piece++)
+    {
+        std::uint64_t start = std::min(size, piece * MAX_TRANSFER);
+        int count = std::min(size - start, MAX_TRANSFER);
+        int piece_error = MPI_File_write_at_all(file, offset + start, const_cast<char*>(rBlock.data() + start), count,
+                                                MPI_BYTE, MPI_STATUS_IGNORE);
+        error = (error == MPI_SUCCESS) ? piece_error : error;
+    }
+    MPI_File_close(&file);
+
+    if (PetscTools::ReplicateBool(error != MPI_SUCCESS))
+    {
+        EXCEPTION("Failed to write shared archive file: " + rPath);
+    }
+}
+
+CheckpointSharedFile::CheckpointSharedFile(const std::string& rPath)
+{
+    int error = MPI_File_open(PETSC_COMM_WORLD, const_cast<char*>(rPath.c_str()), MPI_MODE_RDONLY, MPI_INFO_NULL, &file);
+    if (PetscTools::ReplicateBool(error != MPI_SUCCESS))
+    {
+        if (error == MPI_SUCCESS)
+        {
+            MPI_File_close(&file);
+        }
+        EXCEPTION("Cannot load shared archive file: " + rPath);
+    }
+
+    // The master reads the header and shares it, rather than every process reading it
+    std::uint64_t counts[2] = {0, 0};
+    if (PetscTools::AmMaster())
+    {
+        error = MPI_File_read_at(file, 0, counts, 2, MPI_UINT64_T, MPI_STATUS_IGNORE);
+        if (error != MPI_SUCCESS || counts[0] != CHECKPOINT_SHARED_FILE_MAGIC)
+        {
+            counts[1] = 0;
+        }
+    }
+    MPI_Bcast(counts, 2, MPI_UINT64_T, 0, PETSC_COMM_WORLD);
+    if (counts[1] == 0)
+    {
+        MPI_File_close(&file);
+        EXCEPTION(rPath + " is not a shared archive file");
+    }
+
+    std::vector<std::uint64_t> table(2 * counts[1]);
+    if (PetscTools::AmMaster())
+    {
+        error = MPI_File_read_at(file, 2 * sizeof(std::uint64_t), &table[0], table.size(), MPI_UINT64_T, MPI_STATUS_IGNORE);
+    }
+    if (PetscTools::ReplicateBool(error != MPI_SUCCESS))
+    {
+        MPI_File_close(&file);
+        EXCEPTION("Unable to read the block table of shared archive file " + rPath);
+    }
+    MPI_Bcast(&table[0], table.size(), MPI_UINT64_T, 0, PETSC_COMM_WORLD);
+    for (unsigned i = 0; i < counts[1]; i++)
+    {
+        blocks.push_back(std::make_pair(table[2 * i], table[2 * i + 1]));
+    }
+}
+
+CheckpointSharedFile::~CheckpointSharedFile()
+{
+    MPI_File_close(&file);
+}
+
+std::string CheckpointSharedFile::ReadBlock(unsigned index, std::string& rBlock)
+{
+    std::stringstream error;
+    if (index >= blocks.size())
+    {
+        error << "Shared archive file has no block " << index;
+        return error.str();
+    }
+    std::uint64_t offset = blocks[index].first;
+    std::uint64_t size = blocks[index].second;
+    rBlock.resize(size);
+    for (std::uint64_t start = 0; start < size; start += MAX_TRANSFER)
+    {
+        int count = std::min(size - start, MAX_TRANSFER);
+        MPI_Status status;
+        int num_read = 0;
+        int read_error = MPI_File_read_at(file, offset + start, &rBlock[start], count, MPI_BYTE, &status);
+        if (read_error == MPI_SUCCESS)
+        {
+            MPI_Get_count(&status, MPI_BYTE, &num_read);
+        }
+        if (num_read != count)
+        {
+            error << "Shared archive file is truncated at block " << index;
+            return error.str();
+        }
+    }
+    return "";
+}
@@ -0,0 +1,64 @@
+#ifndef CHECKPOINTSHAREDFILE_HPP_
+#define CHECKPOINTSHAREDFILE_HPP_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <mpi.h>
+
+/**
+ * A single file holding one block of bytes (e.g. a process-specific archive) per process,
+ * written collectively with MPI-IO so that a checkpoint on many processes does not create
+ * one file each.
+ *
+ * The file starts with a header: a magic number, the number of blocks, and the (offset, size)
+ * in bytes of each block, as 64 bit integers. The blocks follow in process order. Each
+ * process works out its offset from the sizes of the blocks before it, so blocks are written
+ * in parallel at computed offsets, and any block can be read by any process, whatever the
+ * number of processes reading the file.
+ */
+class CheckpointSharedFile
+{
+    private:
+    MPI_File file;
+    std::vector<std::pair<std::uint64_t, std::uint64_t> > blocks; // (offset, size) of each block
+
+    CheckpointSharedFile(const CheckpointSharedFile&) = delete;
+    CheckpointSharedFile& operator=(const CheckpointSharedFile&) = delete;
+
+    public:
+    /**
+     * Write a shared file, replacing any existing one. Must be called collectively.
+     *
+     * @param rPath  the file
+     * @param rBlock  this process's block
+     */
+    static void Write(const std::string& rPath, const std::string& rBlock);
+
+    /**
+     * Open a shared file and read its header. Must be called collectively, as must the
+     * destructor.
+     *
+     * @param rPath  the file
+     */
+    CheckpointSharedFile(const std::string& rPath);
+
+    ~CheckpointSharedFile();
+
+    /** @return the number of blocks, i.e. of processes that wrote the file */
+    unsigned GetNumBlocks() const {return blocks.size();};
+
+    /**
+     * Read a block. Not collective, so each process reads only the blocks it needs. Errors are
+     * returned rather than thrown, for the caller to replicate at its next collective step.
+     *
+     * @param index  the block (writing process)
+     * @param rBlock  filled with the block
+     * @return an error message, or an empty string if the block was read
+     */
+    std::string ReadBlock(unsigned index, std::string& rBlock);
+};
+
+#endif // CHECKPOINTSHAREDFILE_HPP_
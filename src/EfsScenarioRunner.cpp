@@ -0,0 +1,113 @@
+#include <set>
+
+#include "EfsScenarioRunner.hpp"
+#include "CardiacSimulationArchiverNeural.hpp"
+#include "DistributedVectorFactory.hpp"
+#include "HeartConfig.hpp"
+#include "NeuralComponents.hpp"
+
+template<unsigned DIM>
+EfsScenarioRunner<DIM>::EfsScenarioRunner(const std::string& rBaselineCheckpoint, double tissueAttribute)
+    : pProblem(CardiacSimulationArchiverNeural<BidomainProblemNeural<DIM> >::Load(rBaselineCheckpoint)),
+      ownsProblem(true)
+{
+    try
+    {
+        Initialise(tissueAttribute);
+    }
+    catch (Exception&)
+    {
+        delete pProblem;
+        throw;
+    }
+}
+
+template<unsigned DIM>
+EfsScenarioRunner<DIM>::EfsScenarioRunner(BidomainProblemNeural<DIM>& rProblem, double tissueAttribute)
+    : pProblem(&rProblem),
+      ownsProblem(false)
+{
+    Initialise(tissueAttribute);
+}
+
+template<unsigned DIM>
+void EfsScenarioRunner<DIM>::Initialise(double tissueAttribute)
+{
+    parameters.push_back(std::make_pair("excitatory_neural", "Beta_Baker2018"));
+    parameters.push_back(std::make_pair("inhibitory_neural", "GBKmax_Kim2003_EFS"));
+    pProblem->SetSteadyStateDetection(std::vector<unsigned>(), 0.0, 0.0);
+
+    pProblem->PackState(baselineState);
+    baselineTime = pProblem->GetCurrentTime();
+
+    // Only cells of nodes this process owns can be changed here
+    AbstractTetrahedralMesh<DIM,DIM>& r_mesh = pProblem->rGetMesh();
+    DistributedVectorFactory* p_factory = r_mesh.GetDistributedVectorFactory();
+    std::set<unsigned> nodes;
+    for (typename AbstractTetrahedralMesh<DIM,DIM>::ElementIterator iter = r_mesh.GetElementIteratorBegin();
+         iter != r_mesh.GetElementIteratorEnd();
+         ++iter)
+    {
+        if (iter->GetAttribute() != tissueAttribute)
+        {
+            continue;
+        }
+        for (unsigned i = 0; i < iter->GetNumNodes(); i++)
+        {
+            unsigned node_index = iter->GetNodeGlobalIndex(i);
+            if (!iter->GetNode(i)->IsBoundaryNode() && node_index >= p_factory->GetLow() && node_index < p_factory->GetHigh())
+            {
+                nodes.insert(node_index);
+            }
+        }
+    }
+    stimulatedNodes.assign(nodes.begin(), nodes.end());
+}
+
+template<unsigned DIM>
+EfsScenarioRunner<DIM>::~EfsScenarioRunner()
+{
+    if (ownsProblem)
+    {
+        delete pProblem;
+    }
+}
+
+template<unsigned DIM>
+void EfsScenarioRunner<DIM>::SetParameters(const std::vector<std::pair<std::string, std::string> >& rParameters)
+{
+    parameters = rParameters;
+}
+
+template<unsigned DIM>
+void EfsScenarioRunner<DIM>::Run(const EfsScenario& rScenario, double duration)
+{
+    pProblem->UnpackState(baselineState, baselineTime);
+
+    AbstractCardiacTissue<DIM>* p_tissue = pProblem->GetTissue();
+    for (unsigned i = 0; i < parameters.size(); i++)
+    {
+        double value = CalibrationFunctions::Evaluate(parameters[i].second, rScenario.frequency);
+        for (unsigned j = 0; j < stimulatedNodes.size(); j++)
+        {
+            p_tissue->GetCardiacCell(stimulatedNodes[j])->SetParameter(parameters[i].first, value);
+        }
+    }
+
+    HeartConfig::Instance()->SetSimulationDuration(baselineTime + duration);
+    HeartConfig::Instance()->SetOutputDirectory(rScenario.outputDirectory);
+    pProblem->Solve();
+}
+
+template<unsigned DIM>
+void EfsScenarioRunner<DIM>::Run(const std::vector<EfsScenario>& rScenarios, double duration)
+{
+    for (unsigned i = 0; i < rScenarios.size(); i++)
+    {
+        Run(rScenarios[i], duration);
+    }
+}
+
+template class EfsScenarioRunner<1>;
+template class EfsScenarioRunner<2>;
+template class EfsScenarioRunner<3>;
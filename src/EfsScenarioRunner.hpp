@@ -0,0 +1,97 @@
+#ifndef EFSSCENARIORUNNER_HPP_
+#define EFSSCENARIORUNNER_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BidomainProblemNeural.hpp"
+
+/**
+ * One EFS branch off a baseline.
+ */
+struct EfsScenario
+{
+    std::string outputDirectory; // relative to CHASTE_TEST_OUTPUT
+    double frequency;            // Hz
+};
+
+/**
+ * Runs EFS branches one after another from a baseline checkpoint that is loaded only once.
+ *
+ * The baseline state (time, cell states and parameters, solution) is packed into memory after
+ * loading, and the problem is rewound to it before each branch, so a frequency sweep reads the
+ * mesh and checkpoint once rather than once per frequency. Each branch then sets the neural
+ * parameters of the stimulated cells from its frequency through calibration functions, and
+ * solves on from the baseline time. Steady state detection of the baseline is switched off,
+ * so every branch lasts its whole duration.
+ */
+template<unsigned DIM>
+class EfsScenarioRunner
+{
+    private:
+    BidomainProblemNeural<DIM>* pProblem;
+    bool ownsProblem;
+    std::vector<double> baselineState;
+    double baselineTime;
+    std::vector<unsigned> stimulatedNodes; // owned, non-boundary nodes of the stimulated tissue
+    std::vector<std::pair<std::string, std::string> > parameters; // (cell parameter, calibration function)
+
+    void Initialise(double tissueAttribute);
+
+    EfsScenarioRunner(const EfsScenarioRunner&) = delete;
+    EfsScenarioRunner& operator=(const EfsScenarioRunner&) = delete;
+
+    public:
+    /**
+     * Load the baseline. Must be called collectively.
+     *
+     * By default a branch sets excitatory_neural with Beta_Baker2018 and inhibitory_neural
+     * with GBKmax_Kim2003_EFS, as TestEFS_ApplyStim does.
+     *
+     * @param rBaselineCheckpoint  checkpoint directory, relative to CHASTE_TEST_OUTPUT
+     * @param tissueAttribute  element attribute of the stimulated tissue (ICC=1, bath=0)
+     */
+    EfsScenarioRunner(const std::string& rBaselineCheckpoint, double tissueAttribute=1.0);
+
+    /**
+     * Branch from a problem already solved to the baseline in this process, e.g. straight after
+     * the baseline run, so that neither the mesh nor a checkpoint need loading. The problem is
+     * rewound to its current state before each branch, and is not deleted by the runner.
+     * Must be called collectively.
+     *
+     * @param rProblem  the baseline problem
+     * @param tissueAttribute  element attribute of the stimulated tissue (ICC=1, bath=0)
+     */
+    EfsScenarioRunner(BidomainProblemNeural<DIM>& rProblem, double tissueAttribute=1.0);
+
+    ~EfsScenarioRunner();
+
+    /**
+     * Replace the cell parameters set by each branch.
+     *
+     * @param rParameters  (cell parameter, CalibrationFunctions name) pairs
+     */
+    void SetParameters(const std::vector<std::pair<std::string, std::string> >& rParameters);
+
+    /**
+     * Rewind to the baseline and run a branch. Must be called collectively.
+     *
+     * @param rScenario  the branch
+     * @param duration  how long to simulate after the baseline (ms)
+     */
+    void Run(const EfsScenario& rScenario, double duration);
+
+    /**
+     * Run branches one after another. Must be called collectively.
+     *
+     * @param rScenarios  the branches
+     * @param duration  how long to simulate each after the baseline (ms)
+     */
+    void Run(const std::vector<EfsScenario>& rScenarios, double duration);
+
+    BidomainProblemNeural<DIM>& rGetProblem() {return *pProblem;};
+    double GetBaselineTime() const {return baselineTime;};
+};
+
+#endif // EFSSCENARIORUNNER_HPP_
@@ -1,4 +1,9 @@
+#include <limits>
+#include <sstream>
+
 #include "ICCFactory.hpp"
+#include "CachedMeshReader.hpp"
+#include "DistributedVectorFactory.hpp"
 
 template<unsigned DIM>
 AbstractCardiacCell* ICCFactory<DIM>::CreateCardiacCellForTissueNode(Node<DIM>* pNode)
@@ -18,6 +23,83 @@ AbstractCardiacCell* ICCFactory<DIM>::CreateCardiacCellForTissueNode(Node<DIM>*
 
 }
 
+template<unsigned DIM>
+std::vector<double> ICCFactory<DIM>::GetNodeWeights(AbstractMeshReader<DIM,DIM>& rReader, double iccAttribute,
+                                                    double iccWeight, double dummyWeight)
+{
+  rReader.Reset();
+  std::vector<bool> is_boundary(rReader.GetNumNodes(), false);
+  for (unsigned i = 0; i < rReader.GetNumFaces(); i++)
+  {
+    ElementData face = rReader.GetNextFaceData();
+    for (unsigned j = 0; j < face.NodeIndices.size(); j++)
+    {
+      is_boundary[face.NodeIndices[j]] = true;
+    }
+  }
+
+  std::vector<double> weights(rReader.GetNumNodes(), 1.0);
+  std::vector<bool> is_tissue(rReader.GetNumNodes(), false);
+  for (unsigned i = 0; i < rReader.GetNumElements(); i++)
+  {
+    ElementData element = rReader.GetNextElementData();
+    if (element.AttributeValue != iccAttribute)
+    {
+      continue;
+    }
+    for (unsigned j = 0; j < element.NodeIndices.size(); j++)
+    {
+      unsigned index = element.NodeIndices[j];
+      if (!is_tissue[index])
+      {
+        is_tissue[index] = true;
+        weights[index] += is_boundary[index] ? dummyWeight : iccWeight;
+      }
+    }
+  }
+  rReader.Reset();
+  return weights;
+}
+
+template<unsigned DIM>
+std::vector<double> ICCFactory<DIM>::GetNodeWeights(const std::string& rMeshBase, double iccAttribute,
+                                                    double iccWeight, double dummyWeight)
+{
+  std::stringstream key;
+  key.precision(std::numeric_limits<double>::max_digits10);
+  key << "ICCFactory " << iccAttribute << " " << iccWeight << " " << dummyWeight;
+  return CachedMeshReader<DIM,DIM>::GetNodeWeights(rMeshBase, key.str(),
+      [=](AbstractMeshReader<DIM,DIM>& rReader) { return GetNodeWeights(rReader, iccAttribute, iccWeight, dummyWeight); });
+}
+
+template<unsigned DIM>
+double ICCFactory<DIM>::GetLocalWeight(AbstractTetrahedralMesh<DIM,DIM>& rMesh, double iccAttribute,
+                                       double iccWeight, double dummyWeight)
+{
+  DistributedVectorFactory* p_factory = rMesh.GetDistributedVectorFactory();
+  double weight = p_factory->GetLocalOwnership();
+
+  std::set<unsigned> tissue_nodes;
+  for (typename AbstractTetrahedralMesh<DIM,DIM>::ElementIterator iter = rMesh.GetElementIteratorBegin();
+       iter != rMesh.GetElementIteratorEnd();
+       ++iter)
+  {
+    if (iter->GetAttribute() != iccAttribute)
+    {
+      continue;
+    }
+    for (unsigned j = 0; j < iter->GetNumNodes(); j++)
+    {
+      unsigned index = iter->GetNodeGlobalIndex(j);
+      if (index >= p_factory->GetLow() && index < p_factory->GetHigh() && tissue_nodes.insert(index).second)
+      {
+        weight += iter->GetNode(j)->IsBoundaryNode() ? dummyWeight : iccWeight;
+      }
+    }
+  }
+  return weight;
+}
+
 // Explicit instantiation
 template class ICCFactory<1>;
 template class ICCFactory<2>;
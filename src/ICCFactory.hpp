@@ -2,9 +2,13 @@
 #define ICCFACTORY_HPP_
 
 #include <set>
+#include <string>
+#include <vector>
 
 #include "AbstractCardiacCell.hpp"
 #include "AbstractCardiacCellFactory.hpp"
+#include "AbstractMeshReader.hpp"
+#include "AbstractTetrahedralMesh.hpp"
 #include "../src/DummyDerivedCa.hpp"
 #include "../src/Du2013_neural_sens.hpp"
 
@@ -24,6 +28,47 @@ class ICCFactory : public AbstractCardiacCellFactory<DIM>
   virtual ~ICCFactory(){};
 
   AbstractCardiacCell* CreateCardiacCellForTissueNode(Node<DIM>* pNode);
+
+  /**
+   * Relative cost of each node of a mesh, for a weighted partition (see CachedMeshReader). Every
+   * node costs 1 for the PDE; tissue nodes add the cost of the cell this factory would create
+   * for them: Du2013 for non-boundary nodes of ICC elements, DummyDerivedCa for the rest.
+   *
+   * @param rReader  the mesh, in its original numbering
+   * @param iccAttribute  attribute of ICC elements
+   * @param iccWeight  extra cost of a Du2013 cell
+   * @param dummyWeight  extra cost of a DummyDerivedCa cell
+   * @return the weight of each node
+   */
+  static std::vector<double> GetNodeWeights(AbstractMeshReader<DIM,DIM>& rReader, double iccAttribute,
+                                            double iccWeight=5.0, double dummyWeight=0.1);
+
+  /**
+   * As above, for the mesh files of the given base name, kept beside the mesh cache (see
+   * CachedMeshReader::GetNodeWeights) so that later runs on the same files and weights skip
+   * parsing them. Must be called collectively.
+   *
+   * @param rMeshBase  mesh file base name, as for TrianglesMeshReader
+   * @param iccAttribute  attribute of ICC elements
+   * @param iccWeight  extra cost of a Du2013 cell
+   * @param dummyWeight  extra cost of a DummyDerivedCa cell
+   * @return the weight of each node
+   */
+  static std::vector<double> GetNodeWeights(const std::string& rMeshBase, double iccAttribute,
+                                            double iccWeight=5.0, double dummyWeight=0.1);
+
+  /**
+   * Total weight, as GetNodeWeights gives it, of the nodes this process owns in a constructed
+   * mesh, so that the load can be reported without reading the mesh files again.
+   *
+   * @param rMesh  the mesh
+   * @param iccAttribute  attribute of ICC elements
+   * @param iccWeight  extra cost of a Du2013 cell
+   * @param dummyWeight  extra cost of a DummyDerivedCa cell
+   * @return the total weight of the owned nodes
+   */
+  static double GetLocalWeight(AbstractTetrahedralMesh<DIM,DIM>& rMesh, double iccAttribute,
+                               double iccWeight=5.0, double dummyWeight=0.1);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "LinearSolverStrategy.hpp"
+
+#include <algorithm>
+
+#include "Exception.hpp"
+#include "HeartConfig.hpp"
+
+std::string LinearSolverStrategy::GetName(type strategy)
+{
+    switch (strategy)
+    {
+        case BLOCK_DIAGONAL:
+            return "block_diagonal";
+        case BATH_TWO_LEVEL:
+            return "bath_two_level";
+        case LDU_FACTORISATION:
+            return "ldu";
+        default:
+            return "configured";
+    }
+}
+
+LinearSolverStrategy::type LinearSolverStrategy::FromName(const std::string& rName)
+{
+    for (unsigned strategy = CONFIGURED; strategy <= LDU_FACTORISATION; strategy++)
+    {
+        if (rName == GetName((type) strategy))
+        {
+            return (type) strategy;
+        }
+    }
+    EXCEPTION("No linear solver strategy called " + rName);
+}
+
+void LinearSolverStrategy::Apply(type strategy, bool hasBath)
+{
+    HeartConfig* p_config = HeartConfig::Instance();
+    switch (strategy)
+    {
+        case BLOCK_DIAGONAL:
+            p_config->SetKSPSolver("cg");
+            p_config->SetKSPPreconditioner("blockdiagonal");
+            break;
+        case BATH_TWO_LEVEL:
+            if (!hasBath)
+            {
+                EXCEPTION("The bath_two_level linear solver strategy needs a bath");
+            }
+            p_config->SetKSPSolver("cg");
+            p_config->SetKSPPreconditioner("twolevelsblockdiagonal");
+            break;
+        case LDU_FACTORISATION:
+            p_config->SetKSPSolver("gmres");
+            p_config->SetKSPPreconditioner("ldufactorisation");
+            break;
+        default:
+            break;
+    }
+}
+
+LinearSolveStatistics::LinearSolveStatistics()
+    : numSolves(0),
+      numIterations(0),
+      maxIterations(0),
+      solveTime(0.0)
+{
+}
+
+void LinearSolveStatistics::Record(unsigned iterations, double time)
+{
+    numSolves++;
+    numIterations += iterations;
+    maxIterations = std::max(maxIterations, iterations);
+    solveTime += time;
+}
+
+double LinearSolveStatistics::GetMeanIterations() const
+{
+    return numSolves > 0 ? double(numIterations)/numSolves : 0.0;
+}
+
+double LinearSolveStatistics::GetMeanTime() const
+{
+    return numSolves > 0 ? solveTime/numSolves : 0.0;
+}
@@ -0,0 +1,71 @@
+#ifndef LINEARSOLVERSTRATEGY_HPP_
+#define LINEARSOLVERSTRATEGY_HPP_
+
+#include <string>
+
+/**
+ * Named KSP solver and preconditioner presets for the bidomain linear system, set in
+ * HeartConfig before each solve (see BidomainProblemNeural::SetLinearSolverStrategy()).
+ * Every preset keeps Chaste's warm start from the previous step's (V, phi_e).
+ */
+struct LinearSolverStrategy
+{
+    /** The presets */
+    enum type
+    {
+        CONFIGURED = 0,         // whatever HeartConfig already holds
+        BLOCK_DIAGONAL,         // CG, with AMG on the V and phi_e blocks separately
+        BATH_TWO_LEVEL,         // CG, block diagonal with the phi_e block split into tissue and bath, AMG on each
+        LDU_FACTORISATION       // GMRES, with a block LDU factorisation using AMG on the diagonal blocks
+    };
+
+    /**
+     * @return the name of a preset, as EfsDriver reads it
+     * @param strategy  the preset
+     */
+    static std::string GetName(type strategy);
+
+    /**
+     * @return the preset with a name, throwing if there is none
+     * @param rName  the name
+     */
+    static type FromName(const std::string& rName);
+
+    /**
+     * Set the KSP solver and preconditioner of a preset in HeartConfig.
+     *
+     * @param strategy  the preset
+     * @param hasBath  whether the problem has a bath, which BATH_TWO_LEVEL needs
+     */
+    static void Apply(type strategy, bool hasBath);
+};
+
+/**
+ * Counts of the bidomain linear solves, for comparing the presets on a mesh. Times are the
+ * wall time of this process.
+ */
+struct LinearSolveStatistics
+{
+    unsigned numSolves;
+    unsigned numIterations;     // total over the solves
+    unsigned maxIterations;     // in any one solve
+    double solveTime;           // total (ms)
+
+    LinearSolveStatistics();
+
+    /**
+     * Add a solve.
+     *
+     * @param iterations  its KSP iterations
+     * @param time  its wall time (ms)
+     */
+    void Record(unsigned iterations, double time);
+
+    /** @return the mean iterations per solve, or 0 with no solves */
+    double GetMeanIterations() const;
+
+    /** @return the mean time per solve (ms), or 0 with no solves */
+    double GetMeanTime() const;
+};
+
+#endif // LINEARSOLVERSTRATEGY_HPP_
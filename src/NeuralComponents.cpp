@@ -1,7 +1,11 @@
+#include <algorithm>
 #include <cmath>
 #include <fstream>
+#include <limits>
+#include <unordered_map>
 #include "NeuralComponents.hpp"
 #include "Exception.hpp"
+#include "PetscTools.hpp"
 
 double CalibrationFunctions::All_FromData(double data)
 {
@@ -54,6 +58,76 @@ double CalibrationFunctions::GBKmax_Kim2003(double f_EFS)
     }
 }
 
+double CalibrationFunctions::Beta_Baker2018(double f_EFS)
+{
+    double a = 0.00506829502520040;
+    double b = 0.0208263263233946;
+    double c = -0.00489642388727810;
+    double d = -0.289000341617805;
+
+    double toHz = 1.0;
+    double endings_per_ICC = 1.0;
+
+    double eval_val = a*exp(b * f_EFS * toHz * endings_per_ICC) + c*exp(d * f_EFS * toHz * endings_per_ICC);
+
+    if (eval_val > 0.007)
+    {
+        return 0.007;
+    } else if (eval_val < 0.0001)
+    {
+        return 0.0001;
+    } else
+    {
+        return eval_val;
+    }
+}
+
+double CalibrationFunctions::GBKmax_Kim2003_EFS(double f_EFS)
+{
+    double a = 0.147525397773565;
+    double b = -0.175087725001323;
+    double c = 1.00016775704983;
+    double d = 0.0285035244071441;
+
+    double toHz = 1.0;
+    double endings_per_ICC = 1.0;
+
+    double eval_val = a*exp(b * f_EFS * toHz * endings_per_ICC) + c*exp(d * f_EFS * toHz * endings_per_ICC);
+
+    if (eval_val > 2.5)
+    {
+        return 2.5;
+    } else if (eval_val < 1.15)
+    {
+        return 1.15;
+    } else
+    {
+        return eval_val;
+    }
+}
+
+CalibrationFunctions::Function CalibrationFunctions::Get(const std::string& rName)
+{
+    static const std::unordered_map<std::string, Function> functions {
+        {"All_FromData", &All_FromData},
+        {"Beta_Zhang2011", &Beta_Zhang2011},
+        {"GBKmax_Kim2003", &GBKmax_Kim2003},
+        {"Beta_Baker2018", &Beta_Baker2018},
+        {"GBKmax_Kim2003_EFS", &GBKmax_Kim2003_EFS}
+    };
+    std::unordered_map<std::string, Function>::const_iterator it = functions.find(rName);
+    if (it == functions.end())
+    {
+        EXCEPTION("Unknown calibration function: " + rName);
+    }
+    return it->second;
+}
+
+double CalibrationFunctions::Evaluate(const std::string& rName, double value)
+{
+    return Get(rName)(value);
+}
+
 ModifiableParams::ModifiableParams(const std::string& name, const double init, double timeStep, double timeMax, const std::vector<double>& timeDep, const std::string& fName)
 {
     this->pName = name;
@@ -61,23 +135,62 @@ ModifiableParams::ModifiableParams(const std::string& name, const double init, d
     this->tStep = timeStep;
     this->tMax = timeMax;
     this->pTimeDep = timeDep;
+    this->pSeries = this->pTimeDep.data();
+    this->numSeries = this->pTimeDep.size();
     this->isTimeVarying = true;
     this->funcName = fName;
-    this->calibFunc = calibFuncMap[funcName];
+    this->calibFunc = CalibrationFunctions::Get(funcName);
+}
+
+ModifiableParams::ModifiableParams(const std::string& name, const double init, double timeStep, double timeMax, const double* timeDep, unsigned numT, const std::string& fName)
+{
+    this->pName = name;
+    this->pInit = init;
+    this->tStep = timeStep;
+    this->tMax = timeMax;
+    this->pSeries = timeDep;
+    this->numSeries = numT;
+    this->isTimeVarying = true;
+    this->funcName = fName;
+    this->calibFunc = CalibrationFunctions::Get(funcName);
 }
 
 ModifiableParams::ModifiableParams(const std::string &name, const double init)
 {
     this->pName = name;
     this->pInit = init;
+    this->pSeries = NULL;
+    this->numSeries = 0;
     this->isTimeVarying = false;
 }
 
+ModifiableParams::ModifiableParams(const ModifiableParams& rOther)
+{
+    *this = rOther;
+}
+
+ModifiableParams& ModifiableParams::operator=(const ModifiableParams& rOther)
+{
+    this->pName = rOther.pName;
+    this->pInit = rOther.pInit;
+    this->pTimeDep = rOther.pTimeDep;
+    this->tStep = rOther.tStep;
+    this->tMax = rOther.tMax;
+    this->isTimeVarying = rOther.isTimeVarying;
+    this->funcName = rOther.funcName;
+    this->calibFunc = rOther.calibFunc;
+    this->numSeries = rOther.numSeries;
+    // An owned series must point at our own copy, a referenced one is shared
+    bool owns_series = !rOther.pTimeDep.empty() && rOther.pSeries == rOther.pTimeDep.data();
+    this->pSeries = owns_series ? this->pTimeDep.data() : rOther.pSeries;
+    return *this;
+}
+
 double ModifiableParams::GetValue(int index) const
 {
     if (this->isTimeVarying)
     {
-        return this->calibFunc(pTimeDep[index]);
+        return this->calibFunc(pSeries[index]);
     }
     else
     {
@@ -91,7 +204,7 @@ double ModifiableParams::GetValue(double time) const
     int index = (int) ((fmod(time, tMax))/(tStep));
     if (this->isTimeVarying) 
     {
-        return this->calibFunc(pTimeDep[index]);
+        return this->calibFunc(pSeries[index]);
     }
     else
     {
@@ -106,40 +219,132 @@ double ModifiableParams::GetValue() const
 
 std::vector<double> HistogramData::GetValueOverTime(double xCoord, double yCoord, int numT)
 {
-    int xInd = (xCoord/(xLen/xDivs)); // Get2DIndex(xCoord, 20.0, 2.0);
-    int yInd = (yCoord/(yLen/yDivs)); // Get2DIndex(xCoord, 20.0, 2.0);
-    typedef boost::multi_array_types::index_range range;
+    const double* p_series = GetRegionSeries(GetRegion(xCoord, yCoord));
 
-    std::vector<double> vect;
+    return std::vector<double>(p_series, p_series + numT);
+}
+
+unsigned HistogramData::GetRegion(double xCoord, double yCoord) const
+{
+    // A grid of zero length along an axis (y on a 1D mesh, or driven tissue one node wide) has
+    // all its nodes in the first row of regions along it, rather than dividing 0 by 0
+    int xInd = (xLen > 0.0) ? (int) (xCoord/(xLen/xDivs)) : 0;
+    int yInd = (yLen > 0.0) ? (int) (yCoord/(yLen/yDivs)) : 0;
 
-    for (double v : A[boost::indices[xInd][yInd][range(0,numT)]])
+    // Nodes on the far edges of the grid belong to the last region
+    xInd = std::min(std::max(xInd, 0), xDivs - 1);
+    yInd = std::min(std::max(yInd, 0), yDivs - 1);
+
+    return xInd + xDivs*yInd;
+}
+
+bool HistogramData::HasRegion(unsigned region) const
+{
+    return region < regionSlot.size() && regionSlot[region] >= 0;
+}
+
+const double* HistogramData::GetRegionSeries(unsigned region) const
+{
+    if (!HasRegion(region))
     {
-        vect.push_back(v);
+        EXCEPTION("Control region " << region << " is not held by this process");
     }
+    return pData + regionSlot[region]*tDivs;
+}
 
-    return vect;
+unsigned HistogramData::GetNumLocalRegions() const
+{
+    return std::count_if(regionSlot.begin(), regionSlot.end(), [](int slot){ return slot >= 0; });
+}
+
+void HistogramData::AllocateRegions(const std::vector<unsigned>& rRegions)
+{
+    regionSlot.assign(xDivs*yDivs, -1);
+    for (unsigned slot = 0; slot < rRegions.size(); slot++)
+    {
+        regionSlot[rRegions[slot]] = slot;
+    }
+    A.assign(rRegions.size()*tDivs, 0.0);
+    pData = A.data();
+}
+
+void HistogramData::AllocateNodeSharedRegions(const std::set<unsigned>& rLocalRegions, std::vector<unsigned>& rRegionsToRead)
+{
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(PETSC_COMM_WORLD, MPI_COMM_TYPE_SHARED, PetscTools::GetMyRank(), MPI_INFO_NULL, &node_comm);
+    int node_rank, node_size;
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+
+    // Flag the regions needed anywhere on the node, and which process on the node reads each
+    // one (the lowest ranked that needs it), so each region is written into the window once
+    const int num_regions = xDivs*yDivs;
+    std::vector<int> reader(num_regions, node_size);
+    for (std::set<unsigned>::const_iterator it = rLocalRegions.begin(); it != rLocalRegions.end(); ++it)
+    {
+        reader[*it] = node_rank;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, reader.data(), num_regions, MPI_INT, MPI_MIN, node_comm);
+
+    std::vector<unsigned> node_regions;
+    rRegionsToRead.clear();
+    for (int region = 0; region < num_regions; region++)
+    {
+        if (reader[region] < node_size)
+        {
+            node_regions.push_back(region);
+            if (reader[region] == node_rank)
+            {
+                rRegionsToRead.push_back(region);
+            }
+        }
+    }
+    AllocateRegions(node_regions);
+    A.clear();
+
+    // The first process on the node allocates the whole window, the others map it
+    MPI_Aint window_size = (node_rank == 0) ? node_regions.size()*tDivs*sizeof(double) : 0;
+    double* p_base;
+    MPI_Win_allocate_shared(window_size, sizeof(double), MPI_INFO_NULL, node_comm, &p_base, &window);
+    int disp_unit;
+    MPI_Win_shared_query(window, 0, &window_size, &disp_unit, &pData);
+    isNodeShared = true;
+
+    MPI_Comm_free(&node_comm);
+}
+
+HistogramData::~HistogramData()
+{
+    if (isNodeShared)
+    {
+        MPI_Win_free(&window);
+    }
 }
 
 HistogramData::HistogramData(const std::string fName, int X, int Y, int T, double xL, double yL):
-A(boost::extents[X][Y][T]), xLen(xL), yLen(yL), xDivs(X), yDivs(Y)
+xLen(xL), yLen(yL), xDivs(X), yDivs(Y), tDivs(T), isNodeShared(false)
 {
+    std::vector<unsigned> all_regions(X*Y);
+    for (unsigned region = 0; region < all_regions.size(); region++)
+    {
+        all_regions[region] = region;
+    }
+    AllocateRegions(all_regions);
 
     // Open file
     std::ifstream inFile;
     inFile.open(fName); 
 
-    // Create a 3D array
-
     double input1;
     // Assign values to the elements
-    for(indexHist k = 0; k != T; k++) 
+    for(int k = 0; k != T; k++) 
     {
-        for(indexHist j = 0; j != Y; j++)
+        for(int j = 0; j != Y; j++)
         {
-            for(indexHist i = 0; i != X; i++)
+            for(int i = 0; i != X; i++)
             {
                 inFile >> input1;
-                A[i][j][k] = input1;
+                pData[regionSlot[i + X*j]*T + k] = input1;
             }
         }
     }
@@ -148,5 +353,361 @@ A(boost::extents[X][Y][T]), xLen(xL), yLen(yL), xDivs(X), yDivs(Y)
     inFile.close();
 }
 
+HistogramData::HistogramData(int X, int Y, double xL, double yL):
+xLen(xL), yLen(yL), xDivs(X), yDivs(Y), tDivs(0), isNodeShared(false)
+{
+    AllocateRegions(std::vector<unsigned>());
+}
+
+HistogramData::HistogramData(int X, int Y, int T, double xL, double yL, const std::map<unsigned, std::vector<double> >& rRegionSeries, bool nodeShared):
+xLen(xL), yLen(yL), xDivs(X), yDivs(Y), tDivs(T), isNodeShared(false)
+{
+    std::set<unsigned> regions;
+    std::map<unsigned, std::vector<double> >::const_iterator p_bad = rRegionSeries.end();
+    for (std::map<unsigned, std::vector<double> >::const_iterator it = rRegionSeries.begin(); it != rRegionSeries.end(); ++it)
+    {
+        if (p_bad == rRegionSeries.end() && (it->first >= (unsigned) (X*Y) || it->second.size() != (unsigned) T))
+        {
+            p_bad = it;
+        }
+        regions.insert(it->first);
+    }
+    // Sharing the regions is collective, so a bad series must stop every process
+    bool is_bad = (p_bad != rRegionSeries.end());
+    if (nodeShared ? PetscTools::ReplicateBool(is_bad) : is_bad)
+    {
+        if (is_bad)
+        {
+            EXCEPTION("Control region " << p_bad->first << " does not have " << T << " values in a " << X << " by " << Y << " histogram");
+        }
+        EXCEPTION("Another process has a control region without " << T << " values in a " << X << " by " << Y << " histogram");
+    }
+
+    if (!nodeShared)
+    {
+        AllocateRegions(std::vector<unsigned>(regions.begin(), regions.end()));
+        for (std::map<unsigned, std::vector<double> >::const_iterator it = rRegionSeries.begin(); it != rRegionSeries.end(); ++it)
+        {
+            std::copy(it->second.begin(), it->second.end(), pData + regionSlot[it->first]*T);
+        }
+        return;
+    }
+
+    // As when reading the file, each region needed on the node is written into the window once
+    std::vector<unsigned> regions_to_write;
+    AllocateNodeSharedRegions(regions, regions_to_write);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+    for (unsigned i = 0; i < regions_to_write.size(); i++)
+    {
+        const std::vector<double>& r_series = rRegionSeries.find(regions_to_write[i])->second;
+        std::copy(r_series.begin(), r_series.end(), pData + regionSlot[regions_to_write[i]]*T);
+    }
+    MPI_Win_sync(window);
+    PetscTools::Barrier("HistogramData::HistogramData");
+    MPI_Win_sync(window);
+    MPI_Win_unlock_all(window);
+}
+
+HistogramData::HistogramData(const std::string fName, int X, int Y, int T, double xL, double yL, const std::set<unsigned>& rLocalRegions, bool nodeShared):
+xLen(xL), yLen(yL), xDivs(X), yDivs(Y), tDivs(T), isNodeShared(false)
+{
+    if (!nodeShared)
+    {
+        std::vector<unsigned> regions(rLocalRegions.begin(), rLocalRegions.end());
+        AllocateRegions(regions);
+        ReadAndScatter(fName, regions);
+        return;
+    }
+
+    std::vector<unsigned> regions_to_read;
+    AllocateNodeSharedRegions(rLocalRegions, regions_to_read);
+
+    // Each process writes its share of the node's regions straight into the window
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+    try
+    {
+        ReadAndScatter(fName, regions_to_read);
+    }
+    catch (Exception&)
+    {
+        MPI_Win_unlock_all(window);
+        MPI_Win_free(&window);
+        throw;
+    }
+    MPI_Win_sync(window);
+    PetscTools::Barrier("HistogramData::HistogramData");
+    MPI_Win_sync(window);
+    MPI_Win_unlock_all(window);
+}
+
+void HistogramData::ReadAndScatter(const std::string& fName, const std::vector<unsigned>& rRegions)
+{
+    const unsigned num_procs = PetscTools::GetNumProcs();
+    const unsigned num_regions = xDivs*yDivs;
+
+    // Tell the master which regions each process needs
+    int num_local = rRegions.size();
+    std::vector<int> num_requested(num_procs);
+    MPI_Gather(&num_local, 1, MPI_INT, &num_requested[0], 1, MPI_INT, 0, PETSC_COMM_WORLD);
+
+    std::vector<int> displacements(num_procs, 0);
+    for (unsigned proc = 1; proc < num_procs; proc++)
+    {
+        displacements[proc] = displacements[proc-1] + num_requested[proc-1];
+    }
+    std::vector<unsigned> requested(PetscTools::AmMaster() ? displacements.back() + num_requested.back() : 0);
+    MPI_Gatherv(const_cast<unsigned*>(rRegions.data()), num_local, MPI_UNSIGNED,
+                requested.data(), &num_requested[0], &displacements[0], MPI_UNSIGNED, 0, PETSC_COMM_WORLD);
+
+    std::ifstream inFile;
+    if (PetscTools::AmMaster())
+    {
+        inFile.open(fName);
+    }
+    if (PetscTools::ReplicateBool(PetscTools::AmMaster() && !inFile.is_open()))
+    {
+        EXCEPTION("Unable to open neural histogram file: " + fName);
+    }
+
+    // Stream the file in blocks of time bins so that the master never holds the whole array either
+    const int block_size = std::max(1, (int) ((1u << 20)/num_regions));
+    std::vector<double> block;
+    std::vector<double> send_buffer;
+    std::vector<double> receive_buffer;
+    std::vector<int> send_counts(num_procs);
+    std::vector<int> send_displacements(num_procs);
+
+    for (int k0 = 0; k0 < tDivs; k0 += block_size)
+    {
+        const int num_t = std::min(block_size, tDivs - k0);
+
+        bool read_failed = false;
+        if (PetscTools::AmMaster())
+        {
+            block.resize(num_t*num_regions);
+            for (unsigned entry = 0; entry < block.size(); entry++)
+            {
+                inFile >> block[entry];
+            }
+            read_failed = inFile.fail();
+
+            // Pack region-major for each process in turn
+            send_buffer.resize(requested.size()*num_t);
+            for (unsigned proc = 0; proc < num_procs; proc++)
+            {
+                send_counts[proc] = num_requested[proc]*num_t;
+                send_displacements[proc] = displacements[proc]*num_t;
+            }
+            for (unsigned r = 0; r < requested.size(); r++)
+            {
+                for (int k = 0; k < num_t; k++)
+                {
+                    send_buffer[r*num_t + k] = block[k*num_regions + requested[r]];
+                }
+            }
+        }
+        if (PetscTools::ReplicateBool(read_failed))
+        {
+            EXCEPTION("Neural histogram file " + fName + " holds fewer values than expected");
+        }
+
+        receive_buffer.resize(num_local*num_t);
+        MPI_Scatterv(send_buffer.data(), &send_counts[0], &send_displacements[0], MPI_DOUBLE,
+                     receive_buffer.data(), num_local*num_t, MPI_DOUBLE, 0, PETSC_COMM_WORLD);
+
+        for (int r = 0; r < num_local; r++)
+        {
+            std::copy(&receive_buffer[r*num_t], &receive_buffer[r*num_t] + num_t, pData + regionSlot[rRegions[r]]*tDivs + k0);
+        }
+    }
+}
+
+NeuralIngestion::NeuralIngestion(const std::string& fName, int X, int Y, int T, double xL, double yL, double tStep,
+                                 const std::vector<std::pair<std::string, std::string> >& rParameters,
+                                 const std::set<unsigned>& rLocalRegions, bool nodeShared):
+pHistogram(new HistogramData(fName, X, Y, T, xL, yL, rLocalRegions, nodeShared)), binWidth(tStep)
+{
+    Calibrate(rParameters, rLocalRegions);
+}
+
+NeuralIngestion::NeuralIngestion(int X, int Y, int T, double xL, double yL, double tStep,
+                                 const std::vector<std::pair<std::string, std::string> >& rParameters,
+                                 const std::map<unsigned, std::vector<double> >& rRegionSeries, bool nodeShared):
+pHistogram(new HistogramData(X, Y, T, xL, yL, rRegionSeries, nodeShared)), binWidth(tStep)
+{
+    std::set<unsigned> regions;
+    for (std::map<unsigned, std::vector<double> >::const_iterator it = rRegionSeries.begin(); it != rRegionSeries.end(); ++it)
+    {
+        regions.insert(it->first);
+    }
+    Calibrate(rParameters, regions);
+}
+
+void NeuralIngestion::Calibrate(const std::vector<std::pair<std::string, std::string> >& rParameters, const std::set<unsigned>& rLocalRegions)
+{
+    const unsigned num_times = pHistogram->GetNumTimes();
+    for (unsigned i = 0; i < rParameters.size(); i++)
+    {
+        paramNames.push_back(rParameters[i].first);
+    }
+
+    for (std::set<unsigned>::const_iterator it = rLocalRegions.begin(); it != rLocalRegions.end(); ++it)
+    {
+        const double* p_series = pHistogram->GetRegionSeries(*it);
+        std::vector<ModifiableParams>& r_params = regionParams[*it];
+        for (unsigned i = 0; i < rParameters.size(); i++)
+        {
+            r_params.push_back(ModifiableParams(rParameters[i].first, 0.0, binWidth, num_times*binWidth,
+                                                p_series, num_times, rParameters[i].second));
+        }
+    }
+
+    DetectChanges();
+}
+
+void NeuralIngestion::DetectChanges()
+{
+    const unsigned num_bins = pHistogram->GetNumTimes();
+    binStart.assign(num_bins + 1, 0);
+    updates.clear();
+
+    for (unsigned bin = 0; bin < num_bins; bin++)
+    {
+        binStart[bin] = updates.size();
+        unsigned previous_bin = (bin + num_bins - 1) % num_bins;
+        for (std::map<unsigned, std::vector<ModifiableParams> >::const_iterator it = regionParams.begin(); it != regionParams.end(); ++it)
+        {
+            for (unsigned i = 0; i < it->second.size(); i++)
+            {
+                // Compare calibrated values, as calibration clamps many firing rates to the same value
+                double value = it->second[i].GetValue((int) bin);
+                if (value != it->second[i].GetValue((int) previous_bin))
+                {
+                    NeuralUpdate update = {it->first, i, value};
+                    updates.push_back(update);
+                }
+            }
+        }
+    }
+    binStart[num_bins] = updates.size();
+}
+
+unsigned NeuralIngestion::GetBin(double time) const
+{
+    const unsigned num_bins = GetNumBins();
+    unsigned bin = (unsigned) (fmod(time, num_bins*binWidth)/binWidth);
+    return std::min(bin, num_bins - 1);
+}
+
+const std::vector<ModifiableParams>& NeuralIngestion::rGetRegionParams(unsigned region) const
+{
+    std::map<unsigned, std::vector<ModifiableParams> >::const_iterator it = regionParams.find(region);
+    if (it == regionParams.end())
+    {
+        EXCEPTION("Control region " << region << " is not held by this process");
+    }
+    return it->second;
+}
+
+NeuralStream::NeuralStream(const std::string& rBufferName, int X, int Y, unsigned capacity,
+                           const std::vector<std::pair<std::string, std::string> >& rParameters,
+                           const std::set<unsigned>& rLocalRegions, double binTimeout):
+binValues(X*Y + 1, 0.0), numBinsRead(0), isFinished(false), timeout(binTimeout)
+{
+    std::string error;
+    if (PetscTools::AmMaster())
+    {
+        try
+        {
+            pBuffer.reset(new NeuralRingBuffer(rBufferName, X*Y, capacity));
+        }
+        catch (Exception& e)
+        {
+            error = e.GetShortMessage();
+        }
+    }
+    if (PetscTools::ReplicateBool(!error.empty()))
+    {
+        EXCEPTION((error.empty() ? "Unable to create neural ring buffer " + rBufferName : error));
+    }
+
+    for (unsigned i = 0; i < rParameters.size(); i++)
+    {
+        paramNames.push_back(rParameters[i].first);
+    }
+    for (std::set<unsigned>::const_iterator it = rLocalRegions.begin(); it != rLocalRegions.end(); ++it)
+    {
+        std::vector<ModifiableParams>& r_params = regionParams[*it];
+        for (unsigned i = 0; i < rParameters.size(); i++)
+        {
+            r_params.push_back(ModifiableParams(rParameters[i].first, 0.0, 1.0, 1.0,
+                                                &binValues[*it], 1, rParameters[i].second));
+        }
+    }
+    lastValues.assign(rLocalRegions.size()*rParameters.size(), std::numeric_limits<double>::quiet_NaN());
+}
+
+bool NeuralStream::ReadBin()
+{
+    updates.clear();
+    if (isFinished)
+    {
+        return false;
+    }
+
+    // The flag is 1 for a bin, 0 once the producer has finished and -1 if it has been lost
+    const unsigned num_regions = binValues.size() - 1;
+    std::string error;
+    if (PetscTools::AmMaster())
+    {
+        try
+        {
+            binValues[num_regions] = pBuffer->Pop(binValues.data(), timeout) ? 1.0 : 0.0;
+        }
+        catch (Exception& e)
+        {
+            error = e.GetShortMessage();
+            binValues[num_regions] = -1.0;
+        }
+    }
+    MPI_Bcast(binValues.data(), num_regions + 1, MPI_DOUBLE, 0, PETSC_COMM_WORLD);
+
+    if (binValues[num_regions] < 0.0)
+    {
+        // Every process reports the master's reason
+        isFinished = true;
+        unsigned error_length = error.size();
+        MPI_Bcast(&error_length, 1, MPI_UNSIGNED, 0, PETSC_COMM_WORLD);
+        error.resize(error_length);
+        if (error_length > 0)
+        {
+            MPI_Bcast(&error[0], error_length, MPI_CHAR, 0, PETSC_COMM_WORLD);
+        }
+        EXCEPTION((error.empty() ? "Lost the producer of the live neural input on the master process" : error));
+    }
+    if (binValues[num_regions] == 0.0)
+    {
+        isFinished = true;
+        return false;
+    }
+    numBinsRead++;
+
+    unsigned index = 0;
+    for (std::map<unsigned, std::vector<ModifiableParams> >::const_iterator it = regionParams.begin(); it != regionParams.end(); ++it)
+    {
+        for (unsigned i = 0; i < it->second.size(); i++, index++)
+        {
+            double value = it->second[i].GetValue(0);
+            if (!(value == lastValues[index]))
+            {
+                NeuralUpdate update = {it->first, i, value};
+                updates.push_back(update);
+                lastValues[index] = value;
+            }
+        }
+    }
+    return true;
+}
+
 #include "SerializationExportWrapperForCpp.hpp"
 CHASTE_CLASS_EXPORT(ModifiableParams)
\ No newline at end of file
@@ -1,12 +1,18 @@
 #ifndef NEURALCOMPONENTS_HPP_
 #define NEURALCOMPONENTS_HPP_
 
-#include <boost/multi_array.hpp>
-#include <unordered_map>
+#include <map>
+#include <set>
+#include <utility>
+#include <boost/shared_ptr.hpp>
+#include <boost/serialization/binary_object.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/string.hpp>
+#include <boost/serialization/version.hpp>
 
 #include "ChasteSerialization.hpp"
+#include "PetscTools.hpp"
+#include "NeuralRingBuffer.hpp"
 
 
 class CalibrationFunctions
@@ -15,24 +21,85 @@ class CalibrationFunctions
     static double All_FromData(double data);
     static double Beta_Zhang2011(double f_EFS);
     static double GBKmax_Kim2003(double f_EFS);
+    // Fits used for the EFS frequency experiments, taking the stimulation frequency in Hz directly
+    static double Beta_Baker2018(double f_EFS);
+    static double GBKmax_Kim2003_EFS(double f_EFS);
+
+    typedef double (*Function)(double);
+    // The function of the given name, from the one registry of calibration functions, throwing if there is none
+    static Function Get(const std::string& rName);
+    // Calls the function of the given name, throwing if there is none
+    static double Evaluate(const std::string& rName, double value);
 };
 
 class HistogramData
 {
     private:
-    typedef boost::multi_array<double, 3> Hist3D;
-    typedef Hist3D::index indexHist;
-    Hist3D A;
     double xLen;
     double yLen;
     int xDivs;
     int yDivs;
+    int tDivs;
+    // Slot of each (x, y) control region in pData, or -1 if the region is not held by this process
+    std::vector<int> regionSlot;
+    // Time series of the held regions when they are private to this process
+    std::vector<double> A;
+    // Time series of the held regions, tDivs values per slot, in A or in the node shared window
+    double* pData;
+    bool isNodeShared;
+    MPI_Win window;
     // int Get2DIndex(double val, double dimLength, double nLength);
 
+    void AllocateRegions(const std::vector<unsigned>& rRegions);
+    void AllocateNodeSharedRegions(const std::set<unsigned>& rLocalRegions, std::vector<unsigned>& rRegionsToRead);
+    void ReadAndScatter(const std::string& fName, const std::vector<unsigned>& rRegions);
+
+    HistogramData(const HistogramData&) = delete;
+    HistogramData& operator=(const HistogramData&) = delete;
+
     public:
     std::vector<double> GetValueOverTime(double xCoord, double yCoord, int numT);
     HistogramData(const std::string fName, int X, int Y, int T, double xL, double yL);
 
+    /**
+     * Distributed constructor, which must be called collectively. The master process streams
+     * the histogram file in blocks of time bins and scatters to each process only the control
+     * regions it asked for, so no process holds the whole X*Y*T array.
+     *
+     * With nodeShared, the regions needed by all processes on a compute node are held once in
+     * a read-only MPI shared memory window mapped by each of them, instead of once per process.
+     * The object must then also be destroyed collectively.
+     *
+     * @param rLocalRegions  control regions (as given by GetRegion) needed by this process
+     * @param nodeShared  whether to share the regions between the processes on each node
+     */
+    HistogramData(const std::string fName, int X, int Y, int T, double xL, double yL, const std::set<unsigned>& rLocalRegions, bool nodeShared=false);
+
+    ~HistogramData();
+
+    /**
+     * Grid-only constructor, holding no time series. Useful for looking up control regions
+     * before deciding which ones to load.
+     */
+    HistogramData(int X, int Y, double xL, double yL);
+
+    /**
+     * Constructor from series already in memory, e.g. restored from a checkpoint. With
+     * nodeShared it must be called (and the object destroyed) collectively, as for the
+     * distributed constructor.
+     *
+     * @param rRegionSeries  T values for each control region to hold
+     * @param nodeShared  whether to share the regions between the processes on each node
+     */
+    HistogramData(int X, int Y, int T, double xL, double yL, const std::map<unsigned, std::vector<double> >& rRegionSeries, bool nodeShared=false);
+
+    unsigned GetRegion(double xCoord, double yCoord) const;
+    bool HasRegion(unsigned region) const;
+    const double* GetRegionSeries(unsigned region) const;
+    unsigned GetNumLocalRegions() const;
+    unsigned GetNumTimes() const {return tDivs;};
+    bool IsNodeShared() const {return isNodeShared;};
+
 };
 class ModifiableParams
 {
@@ -55,21 +122,22 @@ class ModifiableParams
     std::string pName;
     double pInit;
     std::vector<double> pTimeDep;
+    // Series used by GetValue: pTimeDep, or a series owned by a HistogramData
+    const double* pSeries;
+    unsigned numSeries;
     double tStep;
     double tMax;
     bool isTimeVarying;
     std::string funcName;
-    typedef double (*CFunc)(double);
-    CFunc calibFunc;
-
-    std::unordered_map<std::string, CFunc> calibFuncMap {  {"All_FromData", &CalibrationFunctions::All_FromData}, 
-                                                            {"Beta_Zhang2011", &CalibrationFunctions::Beta_Zhang2011},  
-                                                            {"GBKmax_Kim2003", &CalibrationFunctions::GBKmax_Kim2003}
-                                                        };
+    CalibrationFunctions::Function calibFunc;
 
     public:
     ModifiableParams(const std::string &name, const double init, double timeStep, double timeMax, const std::vector<double> &pTimeDep, const std::string& fName);
     ModifiableParams(const std::string &name, const double init);
+    // Refers to a series held elsewhere (e.g. by HistogramData) instead of copying it
+    ModifiableParams(const std::string &name, const double init, double timeStep, double timeMax, const double* pTimeDep, unsigned numT, const std::string& fName);
+    ModifiableParams(const ModifiableParams& rOther);
+    ModifiableParams& operator=(const ModifiableParams& rOther);
     double GetValue(double time) const;
     double GetValue(int index) const;
     double GetValue() const;
@@ -79,14 +147,140 @@ class ModifiableParams
     const std::string& GetFuncName() const {return funcName;};
     double GetStep() const {return tStep;};
     double GetMax() const {return tMax;};
-    const std::vector<double>& GetVals() const {return pTimeDep;};
+    std::vector<double> GetVals() const {return std::vector<double>(pSeries, pSeries + numSeries);};
     bool GetTimeDepBool() const {return isTimeVarying;};
 
 };
 
+/**
+ * A change in one calibrated parameter of one control region on entering a histogram bin.
+ */
+struct NeuralUpdate
+{
+    unsigned region;
+    unsigned parameter;
+    double value;
+};
+
+/**
+ * In-process ingestion of a NEURON firing rate histogram. Loads the control regions needed
+ * by this process, calibrates them into cell parameter values with CalibrationFunctions and
+ * detects, for each time bin, which regions' parameter values change on entering it. This
+ * replaces the tidy (time, region, parameter, value) table of the Python preprocessing step.
+ */
+class NeuralIngestion
+{
+    private:
+    boost::shared_ptr<HistogramData> pHistogram;
+    double binWidth;
+    std::vector<std::string> paramNames;
+    // Calibrated parameters for each held region, in the order of paramNames
+    std::map<unsigned, std::vector<ModifiableParams> > regionParams;
+    // Changes on entering bin k are updates[binStart[k]] to updates[binStart[k+1]-1]
+    std::vector<unsigned> binStart;
+    std::vector<NeuralUpdate> updates;
+
+    void Calibrate(const std::vector<std::pair<std::string, std::string> >& rParameters, const std::set<unsigned>& rLocalRegions);
+    void DetectChanges();
+
+    public:
+    /**
+     * Must be called collectively, see the distributed HistogramData constructor.
+     *
+     * @param rParameters  (cell parameter name, calibration function name) pairs
+     * @param rLocalRegions  control regions needed by this process
+     * @param nodeShared  whether to share the histogram within each compute node
+     */
+    NeuralIngestion(const std::string& fName, int X, int Y, int T, double xL, double yL, double tStep,
+                    const std::vector<std::pair<std::string, std::string> >& rParameters,
+                    const std::set<unsigned>& rLocalRegions, bool nodeShared=false);
+
+    /**
+     * Constructor from firing rate series already in memory, e.g. restored from a checkpoint,
+     * so the histogram file need not be read again. Must be called collectively with nodeShared.
+     *
+     * @param rRegionSeries  T firing rates for each control region needed by this process
+     * @param nodeShared  whether to share the histogram within each compute node
+     */
+    NeuralIngestion(int X, int Y, int T, double xL, double yL, double tStep,
+                    const std::vector<std::pair<std::string, std::string> >& rParameters,
+                    const std::map<unsigned, std::vector<double> >& rRegionSeries, bool nodeShared=false);
+
+    unsigned GetBin(double time) const;
+    unsigned GetNumBins() const {return binStart.size() - 1;};
+    const std::vector<std::string>& rGetParameterNames() const {return paramNames;};
+    const std::vector<ModifiableParams>& rGetRegionParams(unsigned region) const;
+    const HistogramData& rGetHistogram() const {return *pHistogram;};
+
+    // Changes on entering the given bin from the one before (the last bin precedes bin 0)
+    const NeuralUpdate* GetUpdatesBegin(unsigned bin) const {return updates.data() + binStart[bin];};
+    const NeuralUpdate* GetUpdatesEnd(unsigned bin) const {return updates.data() + binStart[bin+1];};
+};
+
+/**
+ * Live neural input from a concurrently running producer, received bin by bin through a
+ * NeuralRingBuffer created by the master process. Each bin is broadcast to all processes,
+ * which calibrate their own control regions and work out which parameter values change,
+ * as NeuralIngestion does for a whole histogram.
+ */
+class NeuralStream
+{
+    private:
+    // Only on the master process
+    boost::shared_ptr<NeuralRingBuffer> pBuffer;
+    // Firing rates of all regions in the current bin, followed by a flag that the bin is valid
+    std::vector<double> binValues;
+    std::vector<std::string> paramNames;
+    // Calibrated parameters for each held region, referring to binValues
+    std::map<unsigned, std::vector<ModifiableParams> > regionParams;
+    // Values of regionParams after the last bin, in map order, NaN before the first bin
+    std::vector<double> lastValues;
+    std::vector<NeuralUpdate> updates;
+    unsigned numBinsRead;
+    bool isFinished;
+    // How long the master waits for each bin (s), 0 for as long as the producer lives
+    double timeout;
+
+    NeuralStream(const NeuralStream&) = delete;
+    NeuralStream& operator=(const NeuralStream&) = delete;
+
+    public:
+    /**
+     * Must be called collectively. Creates the ring buffer for the producer to attach to.
+     *
+     * @param rBufferName  shared memory name of the ring buffer
+     * @param capacity  number of bins the producer may get ahead by
+     * @param rParameters  (cell parameter name, calibration function name) pairs
+     * @param rLocalRegions  control regions needed by this process
+     * @param binTimeout  how long to wait for each bin (s), or 0 to wait as long as the producer lives
+     */
+    NeuralStream(const std::string& rBufferName, int X, int Y, unsigned capacity,
+                 const std::vector<std::pair<std::string, std::string> >& rParameters,
+                 const std::set<unsigned>& rLocalRegions, double binTimeout=600.0);
+
+    /**
+     * Wait for the next bin from the producer and work out the resulting changes. Must be
+     * called collectively. If the producer exits without closing the buffer, or the next bin
+     * does not arrive in time, every process throws with the reason found on the master.
+     *
+     * @return false, with no changes, once the producer has finished
+     */
+    bool ReadBin();
+
+    unsigned GetNumBinsRead() const {return numBinsRead;};
+    bool IsFinished() const {return isFinished;};
+    const std::vector<std::string>& rGetParameterNames() const {return paramNames;};
+
+    // Changes on entering the bin last read
+    const NeuralUpdate* GetUpdatesBegin() const {return updates.data();};
+    const NeuralUpdate* GetUpdatesEnd() const {return updates.data() + updates.size();};
+};
+
 #include "SerializationExportWrapper.hpp"
 // Declare identifier for the serializer
 CHASTE_CLASS_EXPORT(ModifiableParams)
+// Version 1 packs the time series into a binary block
+BOOST_CLASS_VERSION(ModifiableParams, 1)
 
 namespace boost
 {
@@ -102,9 +296,17 @@ inline void save_construct_data(
     ar & t->GetValue(); //pInit
     ar & t->GetStep();
     ar & t->GetMax();
-    ar & t->GetVals();
     ar & t->GetTimeDepBool();
     ar & t->GetFuncName();
+
+    // The series as one packed block rather than value by value
+    std::vector<double> time_dep = t->GetVals();
+    unsigned num_times = time_dep.size();
+    ar & num_times;
+    if (num_times > 0)
+    {
+        ar & boost::serialization::make_binary_object(time_dep.data(), num_times*sizeof(double));
+    }
 }
 
 /**
@@ -128,9 +330,24 @@ inline void load_construct_data(
     ar & pInit;
     ar & tStep;
     ar & tMax;
-    ar & pTimeDep;
-    ar & isTimeVarying;
-    ar & funcName;
+    if (file_version > 0)
+    {
+        ar & isTimeVarying;
+        ar & funcName;
+        unsigned num_times;
+        ar & num_times;
+        pTimeDep.resize(num_times);
+        if (num_times > 0)
+        {
+            ar & boost::serialization::make_binary_object(pTimeDep.data(), num_times*sizeof(double));
+        }
+    }
+    else
+    {
+        ar & pTimeDep;
+        ar & isTimeVarying;
+        ar & funcName;
+    }
 
     if (isTimeVarying)
     {
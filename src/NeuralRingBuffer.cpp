@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "NeuralRingBuffer.hpp"
+#include "Exception.hpp"
+
+// The head and tail are shared between processes, which needs address-free (lock-free) atomics
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "NeuralRingBuffer needs lock-free 64 bit atomics");
+
+static const std::uint64_t NEURAL_RING_BUFFER_MAGIC = 0x4e4555524f4e5242ull;
+
+// Bins start on their own cache line, after the header
+static const std::size_t BINS_OFFSET = 256;
+
+NeuralRingBuffer::NeuralRingBuffer(const std::string& rName, unsigned binSize, unsigned capacity)
+    : name(rName), isOwner(true), mappedSize(0), pHeader(NULL), pBins(NULL)
+{
+    static_assert(sizeof(Header) <= BINS_OFFSET, "NeuralRingBuffer header overlaps the bins");
+    if (binSize == 0 || capacity == 0)
+    {
+        EXCEPTION("Neural ring buffer " + name + " needs a non-zero bin size and capacity");
+    }
+
+    // Replace any buffer left behind by an earlier run
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        EXCEPTION("Unable to create neural ring buffer " + name + ": " + strerror(errno));
+    }
+    std::size_t size = BINS_OFFSET + sizeof(double) * binSize * capacity;
+    if (ftruncate(fd, size) != 0)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        EXCEPTION("Unable to size neural ring buffer " + name + ": " + strerror(errno));
+    }
+    Map(fd, size);
+
+    new (pHeader) Header();
+    pHeader->magic = NEURAL_RING_BUFFER_MAGIC;
+    pHeader->binSize = binSize;
+    pHeader->capacity = capacity;
+    pHeader->head.store(0, std::memory_order_relaxed);
+    pHeader->tail.store(0, std::memory_order_relaxed);
+    pHeader->closed.store(0, std::memory_order_relaxed);
+    pHeader->producerPid.store(0, std::memory_order_relaxed);
+    pHeader->ready.store(1, std::memory_order_release);
+}
+
+NeuralRingBuffer::NeuralRingBuffer(const std::string& rName, double timeout)
+    : name(rName), isOwner(false), mappedSize(0), pHeader(NULL), pBins(NULL)
+{
+    std::chrono::steady_clock::time_point give_up = std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    unsigned num_waits = 0;
+    while (true)
+    {
+        int fd = shm_open(name.c_str(), O_RDWR, 0600);
+        if (fd >= 0)
+        {
+            // The creator may not have sized and initialised it yet
+            struct stat info;
+            if (fstat(fd, &info) == 0 && (std::size_t) info.st_size >= BINS_OFFSET)
+            {
+                Map(fd, info.st_size);
+                if (pHeader->ready.load(std::memory_order_acquire) == 1)
+                {
+                    if (pHeader->magic != NEURAL_RING_BUFFER_MAGIC)
+                    {
+                        munmap(pHeader, mappedSize);
+                        pHeader = NULL;
+                        EXCEPTION(name + " is not a neural ring buffer");
+                    }
+                    pHeader->producerPid.store(getpid(), std::memory_order_release);
+                    return;
+                }
+                munmap(pHeader, mappedSize);
+                pHeader = NULL;
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+        else if (errno != ENOENT)
+        {
+            EXCEPTION("Unable to open neural ring buffer " + name + ": " + strerror(errno));
+        }
+
+        if (std::chrono::steady_clock::now() > give_up)
+        {
+            EXCEPTION("Timed out waiting for neural ring buffer " + name);
+        }
+        Wait(num_waits);
+    }
+}
+
+NeuralRingBuffer::~NeuralRingBuffer()
+{
+    if (pHeader != NULL)
+    {
+        munmap(pHeader, mappedSize);
+    }
+    if (isOwner)
+    {
+        shm_unlink(name.c_str());
+    }
+}
+
+void NeuralRingBuffer::Map(int fd, std::size_t size)
+{
+    void* p_memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p_memory == MAP_FAILED)
+    {
+        EXCEPTION("Unable to map neural ring buffer " + name + ": " + strerror(errno));
+    }
+    mappedSize = size;
+    pHeader = static_cast<Header*>(p_memory);
+    pBins = reinterpret_cast<double*>(static_cast<char*>(p_memory) + BINS_OFFSET);
+}
+
+void NeuralRingBuffer::Wait(unsigned& rNumWaits)
+{
+    // Spin briefly, then back off to sleeping so a stalled peer does not burn a core
+    if (rNumWaits < 64)
+    {
+        std::this_thread::yield();
+    }
+    else
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(std::min(1000u, 10u * (rNumWaits - 63))));
+    }
+    rNumWaits = std::min(rNumWaits + 1, 1000u);
+}
+
+bool NeuralRingBuffer::IsProducerAlive() const
+{
+    // Until a producer attaches there is nothing to check
+    pid_t pid = pHeader->producerPid.load(std::memory_order_acquire);
+    return pid == 0 || kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void NeuralRingBuffer::Push(const double* pBin)
+{
+    std::uint64_t head = pHeader->head.load(std::memory_order_relaxed);
+    unsigned num_waits = 0;
+    while (head - pHeader->tail.load(std::memory_order_acquire) >= pHeader->capacity)
+    {
+        Wait(num_waits);
+    }
+    std::copy(pBin, pBin + pHeader->binSize, pBins + (head % pHeader->capacity) * pHeader->binSize);
+    pHeader->head.store(head + 1, std::memory_order_release);
+}
+
+bool NeuralRingBuffer::Pop(double* pBin, double timeout)
+{
+    std::chrono::steady_clock::time_point give_up = std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+    std::uint64_t tail = pHeader->tail.load(std::memory_order_relaxed);
+    unsigned num_waits = 0;
+    while (pHeader->head.load(std::memory_order_acquire) == tail)
+    {
+        // Bins pushed before closing are still read
+        if (pHeader->closed.load(std::memory_order_acquire) == 1
+            && pHeader->head.load(std::memory_order_acquire) == tail)
+        {
+            return false;
+        }
+        // Only checked once spinning has given way to sleeping, to keep the fast path cheap
+        if (num_waits >= 64)
+        {
+            if (!IsProducerAlive())
+            {
+                EXCEPTION("The producer of neural ring buffer " + name + " exited without closing it");
+            }
+            if (timeout > 0.0 && std::chrono::steady_clock::now() > give_up)
+            {
+                EXCEPTION("Timed out waiting for a bin from neural ring buffer " + name);
+            }
+        }
+        Wait(num_waits);
+    }
+    const double* p_slot = pBins + (tail % pHeader->capacity) * pHeader->binSize;
+    std::copy(p_slot, p_slot + pHeader->binSize, pBin);
+    pHeader->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void NeuralRingBuffer::Close()
+{
+    pHeader->closed.store(1, std::memory_order_release);
+}
@@ -0,0 +1,92 @@
+#ifndef NEURALRINGBUFFER_HPP_
+#define NEURALRINGBUFFER_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * Single producer, single consumer ring buffer of neural firing rate bins in POSIX shared
+ * memory, so that a concurrently running NEURON (or stand-in) producer can feed Chaste.
+ *
+ * Each bin holds one value per control region, ordered as the rows of a histogram file
+ * (y, then x). The buffer is lock-free: the producer only advances the head and the consumer
+ * only advances the tail. Push waits while the buffer is full and Pop waits while it is empty,
+ * so whichever side gets ahead is held back by the other.
+ */
+class NeuralRingBuffer
+{
+    private:
+    struct Header
+    {
+        std::uint64_t magic;
+        std::uint32_t binSize;
+        std::uint32_t capacity;
+        // Written by one side each, so kept on separate cache lines
+        alignas(64) std::atomic<std::uint64_t> head; // number of bins pushed
+        alignas(64) std::atomic<std::uint64_t> tail; // number of bins popped
+        std::atomic<std::uint32_t> closed; // producer has finished
+        std::atomic<std::uint32_t> ready;  // header initialised by the creator
+        std::atomic<std::int32_t> producerPid; // process that attached, 0 until then
+    };
+
+    std::string name;
+    bool isOwner;
+    std::size_t mappedSize;
+    Header* pHeader;
+    double* pBins;
+
+    void Map(int fd, std::size_t size);
+    static void Wait(unsigned& rNumWaits);
+    bool IsProducerAlive() const;
+
+    NeuralRingBuffer(const NeuralRingBuffer&) = delete;
+    NeuralRingBuffer& operator=(const NeuralRingBuffer&) = delete;
+
+    public:
+    /**
+     * Create a new buffer, replacing any existing one of the same name. The creator unlinks
+     * the shared memory when it is destroyed.
+     *
+     * @param rName  shared memory object name, e.g. "/neural_bins"
+     * @param binSize  number of values in each bin
+     * @param capacity  number of bins the buffer can hold
+     */
+    NeuralRingBuffer(const std::string& rName, unsigned binSize, unsigned capacity);
+
+    /**
+     * Attach to a buffer created by another process, waiting for it to appear. The attaching
+     * process is recorded as the producer, so that Pop can tell if it exits without closing.
+     *
+     * @param rName  shared memory object name
+     * @param timeout  how long to wait for the buffer to be created (s)
+     */
+    NeuralRingBuffer(const std::string& rName, double timeout=60.0);
+
+    ~NeuralRingBuffer();
+
+    /**
+     * Append a bin, waiting while the buffer is full.
+     *
+     * @param pBin  GetBinSize() values
+     */
+    void Push(const double* pBin);
+
+    /**
+     * Take the oldest bin, waiting while the buffer is empty. Throws if the producer process
+     * exits without closing the buffer, or no bin arrives within the timeout.
+     *
+     * @param pBin  filled with GetBinSize() values
+     * @param timeout  how long to wait for a bin (s), or 0 to wait as long as the producer lives
+     * @return false if the producer has closed the buffer and no bins are left
+     */
+    bool Pop(double* pBin, double timeout=0.0);
+
+    /** Mark that no more bins will be pushed. */
+    void Close();
+
+    unsigned GetBinSize() const {return pHeader->binSize;};
+    unsigned GetCapacity() const {return pHeader->capacity;};
+};
+
+#endif // NEURALRINGBUFFER_HPP_
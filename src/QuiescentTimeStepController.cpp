@@ -0,0 +1,163 @@
+#include "QuiescentTimeStepController.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+
+/** Number of steps in a row that must allow a longer step before it is taken. */
+static const unsigned STEPS_BEFORE_GROWING = 5;
+
+QuiescentTimeStepController::QuiescentTimeStepController(double baseTimeStep, double printingTimeStep,
+                                                         double maxTimeStep, double maxVoltageChange)
+    : AbstractTimeAdaptivityController(baseTimeStep, std::max(baseTimeStep, maxTimeStep)),
+      baseTimeStep(baseTimeStep),
+      maxTimeStep(maxTimeStep),
+      maxVoltageChange(maxVoltageChange),
+      rung(0),
+      growCount(0),
+      eventPending(false),
+      lastTime(0.0),
+      hasHistory(false),
+      numSteps(0),
+      numChanges(0)
+{
+    if (baseTimeStep <= 0.0 || maxVoltageChange <= 0.0)
+    {
+        EXCEPTION("Adaptive time stepping needs a positive base time step and voltage tolerance");
+    }
+    stepsPerPrint = (unsigned) std::floor(printingTimeStep/baseTimeStep + 0.5);
+    if (stepsPerPrint == 0 || std::fabs(stepsPerPrint*baseTimeStep - printingTimeStep) > 1e-9*printingTimeStep)
+    {
+        EXCEPTION("Printing time step must be a multiple of the PDE time step for adaptive time stepping");
+    }
+
+    // The top rung is the longest step within the maximum that divides the printing step. Each
+    // rung below divides it by its largest prime factor, so the big jumps are at the top.
+    unsigned top = 1;
+    for (unsigned steps = 2; steps <= stepsPerPrint && steps*baseTimeStep <= maxTimeStep*(1.0 + 1e-9); steps++)
+    {
+        if (stepsPerPrint % steps == 0)
+        {
+            top = steps;
+        }
+    }
+    for (unsigned steps = top; steps > 1; )
+    {
+        ladder.insert(ladder.begin(), steps);
+        unsigned largest_factor = steps;
+        for (unsigned factor = 2; factor*factor <= largest_factor; )
+        {
+            if (largest_factor % factor == 0 && largest_factor > factor)
+            {
+                largest_factor /= factor;
+            }
+            else
+            {
+                factor++;
+            }
+        }
+        steps /= largest_factor;
+    }
+    ladder.insert(ladder.begin(), 1u);
+}
+
+double QuiescentTimeStepController::ComputeTimeStep(double currentTime, Vec currentSolution)
+{
+    // Largest change of V at the owned nodes since the last call
+    PetscInt size;
+    VecGetLocalSize(currentSolution, &size);
+    const double* p_solution;
+    VecGetArrayRead(currentSolution, &p_solution);
+    unsigned num_nodes = size/2;
+    bool has_history = hasHistory && lastVoltages.size() == num_nodes && currentTime > lastTime;
+    lastVoltages.resize(num_nodes);
+    double max_change = 0.0;
+    for (unsigned i = 0; i < num_nodes; i++)
+    {
+        max_change = std::max(max_change, std::fabs(p_solution[2*i] - lastVoltages[i]));
+        lastVoltages[i] = p_solution[2*i];
+    }
+    VecRestoreArrayRead(currentSolution, &p_solution);
+
+    // One reduction for the fastest rate and whether any process must restart from the base step
+    double local[2] = {has_history ? max_change/(currentTime - lastTime) : 0.0,
+                       (eventPending || !has_history) ? 1.0 : 0.0};
+    double global[2];
+    MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_MAX, PETSC_COMM_WORLD);
+    lastTime = currentTime;
+    hasHistory = true;
+    eventPending = false;
+
+    unsigned last_rung = rung;
+    if (global[1] > 0.0)
+    {
+        rung = 0;
+        growCount = 0;
+    }
+    else
+    {
+        // The longest step over which V would change by at most the tolerance
+        unsigned wanted = 0;
+        while (wanted + 1 < ladder.size() && ladder[wanted + 1]*baseTimeStep*global[0] <= maxVoltageChange)
+        {
+            wanted++;
+        }
+        if (wanted < rung)
+        {
+            rung = wanted;
+            growCount = 0;
+        }
+        else if (wanted > rung)
+        {
+            // Only onto a step that ends on the printing grid from here
+            unsigned offset = ((unsigned long long) std::floor(currentTime/baseTimeStep + 0.5)) % stepsPerPrint;
+            if (++growCount >= STEPS_BEFORE_GROWING && offset % ladder[rung + 1] == 0)
+            {
+                rung++;
+                growCount = 0;
+            }
+        }
+        else
+        {
+            growCount = 0;
+        }
+    }
+
+    numSteps++;
+    if (rung != last_rung)
+    {
+        numChanges++;
+    }
+    return ladder[rung]*baseTimeStep;
+}
+
+void QuiescentTimeStepController::NotifyEvent()
+{
+    eventPending = true;
+}
+
+void QuiescentTimeStepController::Reset()
+{
+    hasHistory = false;
+    eventPending = false;
+    rung = 0;
+    growCount = 0;
+}
+
+unsigned QuiescentTimeStepController::GetNumSteps() const
+{
+    return numSteps;
+}
+
+unsigned QuiescentTimeStepController::GetNumChanges() const
+{
+    return numChanges;
+}
+
+bool QuiescentTimeStepController::IsFor(double baseTimeStep, double printingTimeStep, double maxTimeStep, double maxVoltageChange) const
+{
+    return this->baseTimeStep == baseTimeStep && std::fabs(stepsPerPrint*this->baseTimeStep - printingTimeStep) <= 1e-9*printingTimeStep
+           && this->maxTimeStep == maxTimeStep && this->maxVoltageChange == maxVoltageChange;
+}
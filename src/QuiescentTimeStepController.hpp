@@ -0,0 +1,78 @@
+#ifndef QUIESCENTTIMESTEPCONTROLLER_HPP_
+#define QUIESCENTTIMESTEPCONTROLLER_HPP_
+
+#include <vector>
+
+#include "AbstractTimeAdaptivityController.hpp"
+
+/**
+ * Chooses the PDE time step of a bidomain solve from how fast the transmembrane potential is
+ * changing: long steps while the tissue is quiescent, the configured PDE time step around
+ * upstrokes and straight after an event (electrodes switching, new neural input).
+ *
+ * Steps come from a ladder of multiples of the configured PDE time step, each dividing the
+ * next and the printing time step, so every step ends on the printing grid, where events
+ * happen, and the cell ODE time step still divides the PDE time step. The step shrinks at once
+ * when the largest change of V over a step would exceed the tolerance, but only grows by one
+ * rung after several steps in a row allow it, so the system matrix (which depends on the time
+ * step) is reassembled rarely and the same matrix and preconditioner are reused otherwise.
+ *
+ * ComputeTimeStep() is called collectively by the solver, and every process gets the same step.
+ */
+class QuiescentTimeStepController : public AbstractTimeAdaptivityController
+{
+    private:
+    double baseTimeStep;
+    unsigned stepsPerPrint;              // printing time step in base steps
+    std::vector<unsigned> ladder;        // allowed steps in base steps, ascending
+    double maxTimeStep;
+    double maxVoltageChange;
+    unsigned rung;                       // index into the ladder of the step in use
+    unsigned growCount;                  // consecutive steps that allowed a longer step
+    bool eventPending;
+    std::vector<double> lastVoltages;    // V at the owned nodes at the last call
+    double lastTime;
+    bool hasHistory;
+    unsigned numSteps;
+    unsigned numChanges;
+
+    protected:
+    /**
+     * @return the next time step
+     * @param currentTime  the time at the start of the step
+     * @param currentSolution  the bidomain solution (V, phi_e interleaved) at that time
+     */
+    double ComputeTimeStep(double currentTime, Vec currentSolution);
+
+    public:
+    /**
+     * @param baseTimeStep  the shortest step, i.e. the configured PDE time step (ms)
+     * @param printingTimeStep  the printing time step, a multiple of the base (ms)
+     * @param maxTimeStep  the longest step (ms)
+     * @param maxVoltageChange  largest change of V at any node over a step (mV)
+     */
+    QuiescentTimeStepController(double baseTimeStep, double printingTimeStep, double maxTimeStep, double maxVoltageChange);
+
+    /**
+     * Start the next step with the base time step, e.g. because electrodes switched or cell
+     * parameters changed. Need only be called on the processes that saw the event.
+     */
+    void NotifyEvent();
+
+    /**
+     * Forget the history and any pending event, e.g. at the start of a solve after the state was
+     * changed, so the next step is the base time step.
+     */
+    void Reset();
+
+    /** @return the number of steps taken */
+    unsigned GetNumSteps() const;
+
+    /** @return the number of times the time step changed, each of which reassembles the system matrix */
+    unsigned GetNumChanges() const;
+
+    /** @return whether the controller is for these time steps */
+    bool IsFor(double baseTimeStep, double printingTimeStep, double maxTimeStep, double maxVoltageChange) const;
+};
+
+#endif // QUIESCENTTIMESTEPCONTROLLER_HPP_
@@ -0,0 +1,112 @@
+#include "SteadyStateDetector.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "Exception.hpp"
+#include "PetscTools.hpp"
+
+SteadyStateDetector::SteadyStateDetector(const std::vector<unsigned>& rSampleNodes, unsigned low, unsigned high,
+                                         double periodTolerance, double amplitudeTolerance, unsigned numCycles, double threshold)
+    : periodTolerance(periodTolerance),
+      amplitudeTolerance(amplitudeTolerance),
+      numCycles(numCycles),
+      threshold(threshold),
+      lastTime(0.0),
+      hasHistory(false)
+{
+    if (numCycles == 0)
+    {
+        EXCEPTION("Steady state detection needs at least one cycle");
+    }
+    for (unsigned i = 0; i < rSampleNodes.size(); i++)
+    {
+        if (rSampleNodes[i] >= low && rSampleNodes[i] < high)
+        {
+            NodeHistory node = NodeHistory();
+            node.localIndex = rSampleNodes[i] - low;
+            nodes.push_back(node);
+        }
+    }
+}
+
+void SteadyStateDetector::Record(double time, Vec solution)
+{
+    if (hasHistory && time <= lastTime)
+    {
+        Reset();
+    }
+    const double* p_solution;
+    VecGetArrayRead(solution, &p_solution);
+    for (unsigned i = 0; i < nodes.size(); i++)
+    {
+        NodeHistory& r_node = nodes[i];
+        double voltage = p_solution[2*r_node.localIndex];
+        if (!hasHistory)
+        {
+            r_node.cycleMin = voltage;
+            r_node.cycleMax = voltage;
+        }
+        else if (r_node.lastVoltage < threshold && voltage >= threshold)
+        {
+            double activation = lastTime + (time - lastTime)*(threshold - r_node.lastVoltage)/(voltage - r_node.lastVoltage);
+            if (r_node.hasActivation)
+            {
+                double period = activation - r_node.lastActivation;
+                double amplitude = r_node.cycleMax - r_node.cycleMin;
+                bool is_matching = r_node.hasCycle && std::fabs(period - r_node.lastPeriod) <= periodTolerance
+                                   && std::fabs(amplitude - r_node.lastAmplitude) <= amplitudeTolerance;
+                r_node.numMatching = is_matching ? r_node.numMatching + 1 : 0;
+                r_node.lastPeriod = period;
+                r_node.lastAmplitude = amplitude;
+                r_node.hasCycle = true;
+            }
+            r_node.lastActivation = activation;
+            r_node.hasActivation = true;
+            r_node.cycleMin = voltage;
+            r_node.cycleMax = voltage;
+        }
+        else
+        {
+            r_node.cycleMin = std::min(r_node.cycleMin, voltage);
+            r_node.cycleMax = std::max(r_node.cycleMax, voltage);
+        }
+        r_node.lastVoltage = voltage;
+    }
+    VecRestoreArrayRead(solution, &p_solution);
+    lastTime = time;
+    hasHistory = true;
+}
+
+bool SteadyStateDetector::IsSteady() const
+{
+    bool is_settled = true;
+    for (unsigned i = 0; i < nodes.size(); i++)
+    {
+        is_settled = is_settled && nodes[i].numMatching >= numCycles;
+    }
+    // A process may own none of the sampled nodes, but some process must
+    bool is_sampled = PetscTools::ReplicateBool(!nodes.empty());
+    return is_sampled && !PetscTools::ReplicateBool(!is_settled);
+}
+
+void SteadyStateDetector::Reset()
+{
+    for (unsigned i = 0; i < nodes.size(); i++)
+    {
+        unsigned local_index = nodes[i].localIndex;
+        nodes[i] = NodeHistory();
+        nodes[i].localIndex = local_index;
+    }
+    hasHistory = false;
+}
+
+unsigned SteadyStateDetector::GetMaxMatchingCycles() const
+{
+    unsigned max_matching = 0;
+    for (unsigned i = 0; i < nodes.size(); i++)
+    {
+        max_matching = std::max(max_matching, nodes[i].numMatching);
+    }
+    return max_matching;
+}
@@ -0,0 +1,83 @@
+#ifndef STEADYSTATEDETECTOR_HPP_
+#define STEADYSTATEDETECTOR_HPP_
+
+#include <vector>
+
+#include <petscvec.h>
+
+/**
+ * Watches V at a few sampled nodes (e.g. ICC nodes spread over the network) for a periodic
+ * pattern, so a baseline solve can stop once the slow waves have settled rather than after a
+ * fixed duration.
+ *
+ * A node activates when V crosses the threshold upwards, at a time interpolated between steps.
+ * Each cycle, from one activation to the next, gives a period and an amplitude (the range of V
+ * over the cycle). A node is settled once this many cycles in a row each have a period and an
+ * amplitude within the tolerances of the cycle before. Nodes that stop activating never settle,
+ * so only oscillating nodes should be sampled.
+ *
+ * Record() is called by the solver after every PDE step on every process; IsSteady() is
+ * collective.
+ */
+class SteadyStateDetector
+{
+    private:
+    /** What is known about one sampled node */
+    struct NodeHistory
+    {
+        unsigned localIndex;             // of the node among the nodes this process owns
+        double lastVoltage;
+        double cycleMin;
+        double cycleMax;
+        double lastActivation;
+        double lastPeriod;
+        double lastAmplitude;
+        bool hasActivation;
+        bool hasCycle;
+        unsigned numMatching;            // consecutive cycles matching the one before
+    };
+
+    std::vector<NodeHistory> nodes;      // sampled nodes this process owns
+    double periodTolerance;
+    double amplitudeTolerance;
+    unsigned numCycles;
+    double threshold;
+    double lastTime;
+    bool hasHistory;
+
+    public:
+    /**
+     * @param rSampleNodes  global indices of the sampled nodes; only those this process owns are kept
+     * @param low  first node this process owns
+     * @param high  one past the last node this process owns
+     * @param periodTolerance  largest change of the period between cycles (ms)
+     * @param amplitudeTolerance  largest change of the amplitude between cycles (mV)
+     * @param numCycles  number of consecutive matching cycles needed at every node
+     * @param threshold  V at which a node activates (mV)
+     */
+    SteadyStateDetector(const std::vector<unsigned>& rSampleNodes, unsigned low, unsigned high,
+                        double periodTolerance, double amplitudeTolerance, unsigned numCycles, double threshold);
+
+    /**
+     * Take V at the sampled nodes this process owns. A time not after the last one (e.g. the
+     * state was rewound) starts the history again.
+     *
+     * @param time  the time of the solution
+     * @param solution  the bidomain solution (V, phi_e interleaved)
+     */
+    void Record(double time, Vec solution);
+
+    /**
+     * @return whether some process owns a sampled node and every sampled node on every process
+     *     has settled. Collective.
+     */
+    bool IsSteady() const;
+
+    /** Forget the history of every node. */
+    void Reset();
+
+    /** @return the largest number of consecutive matching cycles at any sampled node of this process */
+    unsigned GetMaxMatchingCycles() const;
+};
+
+#endif // STEADYSTATEDETECTOR_HPP_
@@ -0,0 +1,184 @@
+#ifndef TESTCACHEDMESHREADER_HPP_
+#define TESTCACHEDMESHREADER_HPP_
+
+#include <cxxtest/TestSuite.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "../src/CachedMeshReader.hpp"
+#include "../src/ICCFactory.hpp"
+
+#include "DistributedTetrahedralMesh.hpp"
+#include "FileFinder.hpp"
+#include "OutputFileHandler.hpp"
+#include "PetscTools.hpp"
+#include "TrianglesMeshReader.hpp"
+
+#include "PetscSetupAndFinalize.hpp"
+
+class TestCachedMeshReader : public CxxTest::TestSuite
+{
+  private:
+  // Check two meshes have the same partition, nodes and elements
+  void CompareMeshes(DistributedTetrahedralMesh<2,2>& rMesh, DistributedTetrahedralMesh<2,2>& rOtherMesh)
+  {
+    TS_ASSERT_EQUALS(rMesh.GetNumNodes(), rOtherMesh.GetNumNodes());
+    TS_ASSERT_EQUALS(rMesh.GetNumElements(), rOtherMesh.GetNumElements());
+    TS_ASSERT_EQUALS(rMesh.GetNumBoundaryElements(), rOtherMesh.GetNumBoundaryElements());
+    TS_ASSERT_EQUALS(rMesh.GetDistributedVectorFactory()->GetLow(), rOtherMesh.GetDistributedVectorFactory()->GetLow());
+    TS_ASSERT_EQUALS(rMesh.GetDistributedVectorFactory()->GetHigh(), rOtherMesh.GetDistributedVectorFactory()->GetHigh());
+
+    for (DistributedTetrahedralMesh<2,2>::NodeIterator iter = rMesh.GetNodeIteratorBegin(); iter != rMesh.GetNodeIteratorEnd(); ++iter)
+    {
+      Node<2>* p_other_node = rOtherMesh.GetNode(iter->GetIndex());
+      TS_ASSERT_DELTA(iter->rGetLocation()[0], p_other_node->rGetLocation()[0], 1e-12);
+      TS_ASSERT_DELTA(iter->rGetLocation()[1], p_other_node->rGetLocation()[1], 1e-12);
+      TS_ASSERT_EQUALS(iter->IsBoundaryNode(), p_other_node->IsBoundaryNode());
+    }
+    for (DistributedTetrahedralMesh<2,2>::ElementIterator iter = rMesh.GetElementIteratorBegin(); iter != rMesh.GetElementIteratorEnd(); ++iter)
+    {
+      Element<2,2>* p_other_element = rOtherMesh.GetElement(iter->GetIndex());
+      TS_ASSERT_EQUALS(iter->GetAttribute(), p_other_element->GetAttribute());
+      for (unsigned i = 0; i < 3; i++)
+      {
+        TS_ASSERT_EQUALS(iter->GetNodeGlobalIndex(i), p_other_element->GetNodeGlobalIndex(i));
+      }
+    }
+  }
+
+  // A copy of a square mesh in the given output folder, so it can be changed
+  std::string CopySquareMesh(const std::string& rDirectory)
+  {
+    OutputFileHandler handler(rDirectory);
+    std::string mesh_base = handler.GetOutputDirectoryFullPath() + "square";
+    if (PetscTools::AmMaster())
+    {
+      FileFinder source_dir("mesh/test/data", RelativeTo::ChasteSourceRoot);
+      std::string extensions[3] = {".node", ".ele", ".edge"};
+      for (unsigned i = 0; i < 3; i++)
+      {
+        std::ifstream in_file((source_dir.GetAbsolutePath() + "2D_0_to_1mm_200_elements" + extensions[i]).c_str());
+        std::ofstream out_file((mesh_base + extensions[i]).c_str());
+        out_file << in_file.rdbuf();
+      }
+    }
+    PetscTools::Barrier("TestCachedMeshReader::CopySquareMesh");
+    return mesh_base;
+  }
+
+  public:
+  void TestCacheRoundTrip() throw(Exception)
+  {
+    std::string mesh_base = CopySquareMesh("TestCachedMeshReader");
+
+    // The first load partitions as usual and writes the cache...
+    std::string cache_path = CachedMeshReader<2,2>::GetCachePath(mesh_base);
+    if (PetscTools::AmMaster())
+    {
+      std::remove(cache_path.c_str());
+    }
+    PetscTools::Barrier("TestCacheRoundTrip");
+    DistributedTetrahedralMesh<2,2> mesh;
+    CachedMeshReader<2,2>::ConstructMesh(mesh_base, mesh);
+    TS_ASSERT(FileFinder(cache_path, RelativeTo::Absolute).Exists());
+
+    // ...which later loads reproduce
+    DistributedTetrahedralMesh<2,2> cached_mesh;
+    CachedMeshReader<2,2>::ConstructMesh(mesh_base, cached_mesh);
+    CompareMeshes(mesh, cached_mesh);
+
+    CachedMeshReader<2,2> reader(cache_path);
+    TS_ASSERT_EQUALS(reader.GetNumNodes(), mesh.GetNumNodes());
+    TS_ASSERT_EQUALS(reader.GetNumOwnedNodes(PetscTools::GetMyRank()), mesh.GetNumLocalNodes());
+
+    // Changing the source mesh (here by adding a comment) rebuilds the cache
+    if (PetscTools::AmMaster())
+    {
+      std::ofstream node_file((mesh_base + ".node").c_str(), std::ios::app);
+      node_file << "# changed" << std::endl;
+    }
+    PetscTools::Barrier("TestCacheRoundTrip");
+    DistributedTetrahedralMesh<2,2> rebuilt_mesh;
+    CachedMeshReader<2,2>::ConstructMesh(mesh_base, rebuilt_mesh);
+    CompareMeshes(mesh, rebuilt_mesh);
+  }
+
+  void TestCachedNodeWeights() throw(Exception)
+  {
+    std::string mesh_base = CopySquareMesh("TestCachedNodeWeights");
+    unsigned num_computed = 0;
+    CachedMeshReader<2,2>::WeightFunction compute_weights = [&num_computed](AbstractMeshReader<2,2>& rReader)
+    {
+      num_computed++;
+      return ICCFactory<2>::GetNodeWeights(rReader, 0.0);
+    };
+
+    // The first call reads the mesh files, later ones with the same key only the stored weights
+    std::vector<double> weights = CachedMeshReader<2,2>::GetNodeWeights(mesh_base, "icc", compute_weights);
+    TS_ASSERT_EQUALS(num_computed, 1u);
+    std::vector<double> stored_weights = CachedMeshReader<2,2>::GetNodeWeights(mesh_base, "icc", compute_weights);
+    TS_ASSERT_EQUALS(num_computed, 1u);
+    TS_ASSERT_EQUALS(stored_weights.size(), weights.size());
+    for (unsigned i = 0; i < std::min(weights.size(), stored_weights.size()); i++)
+    {
+      TS_ASSERT_DELTA(stored_weights[i], weights[i], 1e-12);
+    }
+
+    // Another key or a change to the mesh files computes them again
+    CachedMeshReader<2,2>::GetNodeWeights(mesh_base, "icc with other costs", compute_weights);
+    TS_ASSERT_EQUALS(num_computed, 2u);
+    if (PetscTools::AmMaster())
+    {
+      std::ofstream node_file((mesh_base + ".node").c_str(), std::ios::app);
+      node_file << "# changed" << std::endl;
+    }
+    PetscTools::Barrier("TestCachedNodeWeights");
+    CachedMeshReader<2,2>::GetNodeWeights(mesh_base, "icc with other costs", compute_weights);
+    TS_ASSERT_EQUALS(num_computed, 3u);
+
+    // ICCFactory stores its weights the same way
+    std::vector<double> icc_weights = ICCFactory<2>::GetNodeWeights(mesh_base, 0.0);
+    TS_ASSERT_EQUALS(icc_weights.size(), weights.size());
+    for (unsigned i = 0; i < std::min(weights.size(), icc_weights.size()); i++)
+    {
+      TS_ASSERT_DELTA(icc_weights[i], weights[i], 1e-12);
+    }
+  }
+
+  void TestWeightedPartition() throw(Exception)
+  {
+    // Nodes on the left half cost ten times as much, as ICC nodes would next to bath
+    std::string mesh_base = "mesh/test/data/2D_0_to_1mm_200_elements";
+    TrianglesMeshReader<2,2> source(mesh_base);
+    std::vector<double> weights(source.GetNumNodes());
+    for (unsigned i = 0; i < weights.size(); i++)
+    {
+      weights[i] = (source.GetNextNode()[0] < 0.05) ? 10.0 : 1.0;
+    }
+
+    DistributedTetrahedralMesh<2,2> mesh;
+    CachedMeshReader<2,2>::ConstructMesh(mesh_base, mesh, weights);
+    TS_ASSERT_EQUALS(mesh.GetNumNodes(), weights.size());
+    double imbalance = CachedMeshReader<2,2>::ReportLoadImbalance(mesh, weights);
+    TS_ASSERT_LESS_THAN(imbalance, 1.15);
+
+    // The partition comes back from the cache
+    DistributedTetrahedralMesh<2,2> cached_mesh;
+    CachedMeshReader<2,2>::ConstructMesh(mesh_base, cached_mesh, weights);
+    CompareMeshes(mesh, cached_mesh);
+    TS_ASSERT_DELTA(CachedMeshReader<2,2>::ReportLoadImbalance(cached_mesh, weights), imbalance, 1e-12);
+
+    // ICC cell costs come out the same from the mesh files and from the constructed mesh
+    std::vector<double> icc_weights = ICCFactory<2>::GetNodeWeights(source, 0.0);
+    TS_ASSERT_DELTA(CachedMeshReader<2,2>::ReportLoadImbalance(ICCFactory<2>::GetLocalWeight(mesh, 0.0)),
+                    CachedMeshReader<2,2>::ReportLoadImbalance(mesh, icc_weights), 1e-12);
+
+    // Too few weights for the mesh
+    weights.pop_back();
+    DistributedTetrahedralMesh<2,2> bad_mesh;
+    TS_ASSERT_THROWS_CONTAINS(CachedMeshReader<2,2>::ConstructMesh(mesh_base, bad_mesh, weights), "node weights");
+  }
+};
+
+#endif /*TESTCACHEDMESHREADER_HPP_*/
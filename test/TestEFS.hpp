@@ -13,6 +13,8 @@
  * and closing it at the end.  (If you never run code in parallel then it is safe to replace PetscSetupAndFinalize.hpp with FakePetscSetup.hpp)
  */
 
+#include <algorithm>
+
 #include "Debug.hpp"
 
 #include "ChasteEllipsoid.hpp"
@@ -26,6 +28,7 @@
 #include "../src/ICCFactory.hpp"
 
 #include "DistributedTetrahedralMesh.hpp"
+#include "DistributedVectorFactory.hpp"
 #include "TrianglesMeshReader.hpp"
 
 #include "../src/CardiacSimulationArchiverNeural.hpp"
@@ -93,8 +96,13 @@ class TestEFS : public CxxTest::TestSuite
     std::string output_dir = mesh_ident + "-BaselineCheckpoint";
     unsigned bath_attr = 0;
     unsigned icc_attr = 1;
-    double duration = 60000.0;      // ms
+    double duration = 60000.0;      // ms, the longest the baseline may run
     double print_step = 100.0;        // ms
+    unsigned steady_nodes = 10;       // ICC nodes per process watched for periodic slow waves
+    double steady_period_tol = 50.0;  // ms
+    double steady_amplitude_tol = 0.5; // mV
+    unsigned steady_cycles = 2;
+    double steady_check = 5000.0;     // ms
     // ---------------------------------------- //
 
     // Mesh location
@@ -149,6 +157,23 @@ class TestEFS : public CxxTest::TestSuite
     BidomainProblemNeural<PROBLEM_SPACE_DIM> bidomain_problem(&network_cells, true);
     bidomain_problem.SetMesh( &mesh );
 
+    // Stop the baseline once a spread of the owned ICC nodes has periodic slow waves
+    std::vector<unsigned> ownedIccNodes;
+    for (std::set<unsigned>::iterator it = iccNodes.begin(); it != iccNodes.end(); ++it)
+    {
+      if (mesh.GetDistributedVectorFactory()->IsGlobalIndexLocal(*it))
+      {
+        ownedIccNodes.push_back(*it);
+      }
+    }
+    std::vector<unsigned> steadyNodes;
+    unsigned nSteadyNodes = std::min<unsigned>(steady_nodes, ownedIccNodes.size());
+    for (unsigned i = 0; i < nSteadyNodes; i++)
+    {
+      steadyNodes.push_back(ownedIccNodes[(i*ownedIccNodes.size())/nSteadyNodes]);
+    }
+    bidomain_problem.SetSteadyStateDetection(steadyNodes, steady_period_tol, steady_amplitude_tol, steady_cycles, steady_check);
+
     // Modify simulation config
     HeartConfig::Instance()->Reset();
     HeartConfig::Instance()->SetSimulationDuration(duration);
@@ -169,6 +194,7 @@ class TestEFS : public CxxTest::TestSuite
     TRACE("Starting Solve");
     // Solve problem
     bidomain_problem.Solve();
+    TRACE("Steady state time (-1 if never steady): " << bidomain_problem.GetSteadyStateTime());
 
     CardiacSimulationArchiverNeural< BidomainProblemNeural<PROBLEM_SPACE_DIM> >::Save(bidomain_problem, output_dir + "/checkpoint_problem");
 
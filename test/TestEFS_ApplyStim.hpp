@@ -29,61 +29,18 @@
 #include "TrianglesMeshReader.hpp"
 
 #include "../src/CardiacSimulationArchiverNeural.hpp"
+#include "../src/EfsScenarioRunner.hpp"
+#include "../src/NeuralComponents.hpp"
+
+#include "FileFinder.hpp"
+#include "OutputFileHandler.hpp"
+#include "ReplicatableVector.hpp"
 
 
 #include "PetscSetupAndFinalize.hpp"
 
 class TestEFS : public CxxTest::TestSuite
 {
-  private:
-  double Beta_Baker2018(double f_EFS)
-  {
-      double a = 0.00506829502520040;
-      double b = 0.0208263263233946;
-      double c = -0.00489642388727810;
-      double d = -0.289000341617805;
-
-      double toHz = 1.0;
-      double endings_per_ICC = 1.0;
-
-      double eval_val = a*exp(b * f_EFS * toHz * endings_per_ICC) + c*exp(d * f_EFS * toHz * endings_per_ICC);
-
-      if (eval_val > 0.007)
-      {
-          return 0.007;
-      } else if (eval_val < 0.0001)
-      {
-          return 0.0001;
-      } else
-      {
-          return eval_val;
-      }
-  }
-
-  double GBKmax_Kim2003(double f_EFS)
-  {
-      double a = 0.147525397773565;
-      double b = -0.175087725001323;
-      double c = 1.00016775704983;
-      double d = 0.0285035244071441;
-
-      double toHz = 1.0;
-      double endings_per_ICC = 1.0;
-
-      double eval_val = a*exp(b * f_EFS * toHz * endings_per_ICC) + c*exp(d * f_EFS * toHz * endings_per_ICC);
-
-      if (eval_val > 2.5)
-      {
-          return 2.5;
-      } else if (eval_val < 1.15)
-      {
-          return 1.15;
-      } else
-      {
-          return eval_val;
-      }
-  }
-
   public:
   void TestRestartingEFS() throw(Exception)
   {
@@ -132,8 +89,8 @@ class TestEFS : public CxxTest::TestSuite
       }
     }
 
-    double ex_val = Beta_Baker2018(freq);
-    double in_val = GBKmax_Kim2003(freq);
+    double ex_val = CalibrationFunctions::Beta_Baker2018(freq);
+    double in_val = CalibrationFunctions::GBKmax_Kim2003_EFS(freq);
 
     TRACE("beta: " << ex_val);
     TRACE("GBKmax: " << in_val);
@@ -156,6 +113,103 @@ class TestEFS : public CxxTest::TestSuite
 
   };
 
+  void TestFrequencySweep() throw(Exception)
+  {
+    // A short baseline on a small all-ICC slab, checkpointed as a real baseline would be
+    DistributedTetrahedralMesh<PROBLEM_ELEMENT_DIM,PROBLEM_SPACE_DIM> mesh;
+    mesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+    std::set<unsigned> icc_nodes;
+    for (unsigned node = 0; node < mesh.GetNumNodes(); node++)
+    {
+      icc_nodes.insert(node);
+    }
+    ICCFactory<PROBLEM_SPACE_DIM> cells(icc_nodes);
+    BidomainProblemNeural<PROBLEM_SPACE_DIM> baseline(&cells);
+    baseline.SetMesh(&mesh);
+    HeartConfig::Instance()->Reset();
+    HeartConfig::Instance()->SetSimulationDuration(2.0);
+    HeartConfig::Instance()->SetOutputDirectory("TestFrequencySweep/baseline");
+    HeartConfig::Instance()->SetOutputFilenamePrefix("results");
+    HeartConfig::Instance()->SetOdePdeAndPrintingTimeSteps(0.1, 0.1, 1.0);
+    baseline.Initialise();
+    baseline.Solve();
+    CardiacSimulationArchiverNeural< BidomainProblemNeural<PROBLEM_SPACE_DIM> >::Save(baseline, "TestFrequencySweep/checkpoint_problem");
+
+    // Frequencies (Hz), one per line, as a sweep would be given them
+    OutputFileHandler handler("TestFrequencySweep", false);
+    if (PetscTools::AmMaster())
+    {
+      out_stream p_file = handler.OpenOutputFile("frequencies.txt");
+      (*p_file) << "1\n5\n10\n";
+      p_file->close();
+    }
+    PetscTools::Barrier("TestFrequencySweep");
+
+    std::vector<EfsScenario> scenarios;
+    std::ifstream in((handler.GetOutputDirectoryFullPath() + "frequencies.txt").c_str());
+    std::string line;
+    while (std::getline(in, line))
+    {
+      if (!line.empty())
+      {
+        EfsScenario scenario;
+        scenario.frequency = std::stod(line);
+        scenario.outputDirectory = "TestFrequencySweep/EFS_" + line + "Hz";
+        scenarios.push_back(scenario);
+      }
+    }
+    TS_ASSERT_EQUALS(scenarios.size(), 3u);
+
+    // The baseline is loaded once and rewound in memory before each frequency; the slab's elements
+    // all have attribute 0, and its boundary nodes are left unstimulated
+    EfsScenarioRunner<PROBLEM_SPACE_DIM> runner("TestFrequencySweep/checkpoint_problem", 0.0);
+    BidomainProblemNeural<PROBLEM_SPACE_DIM>& r_problem = runner.rGetProblem();
+    std::vector<double> baseline_state;
+    r_problem.PackState(baseline_state);
+    TS_ASSERT_DELTA(runner.GetBaselineTime(), 2.0, 1e-9);
+
+    DistributedVectorFactory* p_factory = r_problem.rGetMesh().GetDistributedVectorFactory();
+    for (unsigned i = 0; i < scenarios.size(); i++)
+    {
+      runner.Run(scenarios[i], 1.0);
+      TS_ASSERT_DELTA(r_problem.GetCurrentTime(), 3.0, 1e-9);
+      TS_ASSERT(FileFinder(scenarios[i].outputDirectory + "/results.h5", RelativeTo::ChasteTestOutput).Exists());
+
+      // Interior cells take the calibrated values of this branch's frequency
+      double excitatory = CalibrationFunctions::Beta_Baker2018(scenarios[i].frequency);
+      double inhibitory = CalibrationFunctions::GBKmax_Kim2003_EFS(scenarios[i].frequency);
+      for (unsigned node = p_factory->GetLow(); node < p_factory->GetHigh(); node++)
+      {
+        if (!r_problem.rGetMesh().GetNode(node)->IsBoundaryNode())
+        {
+          AbstractCardiacCellInterface* p_cell = r_problem.GetTissue()->GetCardiacCell(node);
+          TS_ASSERT_DELTA(p_cell->GetParameter("excitatory_neural"), excitatory, 1e-12);
+          TS_ASSERT_DELTA(p_cell->GetParameter("inhibitory_neural"), inhibitory, 1e-12);
+        }
+      }
+
+      ReplicatableVector solution(r_problem.GetSolution());
+      for (unsigned j = 0; j < solution.GetSize(); j++)
+      {
+        TS_ASSERT(std::isfinite(solution[j]));
+      }
+    }
+
+    // Rewinding in memory gives the same state as loading the baseline afresh
+    r_problem.UnpackState(baseline_state, runner.GetBaselineTime());
+    BidomainProblemNeural<PROBLEM_SPACE_DIM>* p_fresh = CardiacSimulationArchiverNeural< BidomainProblemNeural<PROBLEM_SPACE_DIM> >::Load("TestFrequencySweep/checkpoint_problem");
+    TS_ASSERT_DELTA(r_problem.GetCurrentTime(), p_fresh->GetCurrentTime(), 1e-9);
+    std::vector<double> rewound_state, fresh_state;
+    r_problem.PackState(rewound_state);
+    p_fresh->PackState(fresh_state);
+    TS_ASSERT_EQUALS(rewound_state.size(), fresh_state.size());
+    for (unsigned i = 0; i < std::min(rewound_state.size(), fresh_state.size()); i++)
+    {
+      TS_ASSERT_DELTA(rewound_state[i], fresh_state[i], 1e-10*(1.0 + fabs(fresh_state[i])));
+    }
+    delete p_fresh;
+  }
+
 };
 
 #endif /*TESTMINIMAL_HPP_*/
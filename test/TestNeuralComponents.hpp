@@ -0,0 +1,1357 @@
+#ifndef TESTNEURALCOMPONENTS_HPP_
+#define TESTNEURALCOMPONENTS_HPP_
+
+/**
+ * @file
+ * This test checks loading of neural histogram data, in serial and in parallel, and
+ * receiving it live through a ring buffer
+ */
+
+#include <cxxtest/TestSuite.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/text_oarchive.hpp>
+#include <boost/serialization/vector.hpp>
+
+#include "../src/NeuralComponents.hpp"
+#include "../src/BidomainProblemNeural.hpp"
+#include "../src/CardiacSimulationArchiverNeural.hpp"
+#include "../src/EfsScenarioRunner.hpp"
+#include "../src/ICCFactory.hpp"
+#include "../src/CheckpointArchiveStreams.hpp"
+#include "../src/CheckpointSharedFile.hpp"
+#include "../src/CellSweepPool.hpp"
+#include "../src/QuiescentTimeStepController.hpp"
+#include "../src/LinearSolverStrategy.hpp"
+#include "../src/SteadyStateDetector.hpp"
+
+#include "ArchiveLocationInfo.hpp"
+#include "DistributedTetrahedralMesh.hpp"
+#include "DistributedVectorFactory.hpp"
+#include "FileFinder.hpp"
+#include "HeartConfig.hpp"
+#include "HeartRegionCodes.hpp"
+#include "OutputFileHandler.hpp"
+#include "PetscTools.hpp"
+#include "ReplicatableVector.hpp"
+
+#include "PetscSetupAndFinalize.hpp"
+
+class TestNeuralComponents : public CxxTest::TestSuite
+{
+  private:
+  static const int X = 4;
+  static const int Y = 3;
+  static const int T = 5;
+
+  // Histogram value encoding its own bin and region
+  double ExpectedValue(unsigned region, int k)
+  {
+    return 100.0*k + 10.0*(region/X) + (region%X);
+  }
+
+  std::string WriteHistogram()
+  {
+    OutputFileHandler handler("TestNeuralComponents", false);
+    if (PetscTools::AmMaster())
+    {
+      out_stream p_file = handler.OpenOutputFile("histogram.txt");
+      for (int k = 0; k < T; k++)
+      {
+        for (int j = 0; j < Y; j++)
+        {
+          for (int i = 0; i < X; i++)
+          {
+            (*p_file) << ExpectedValue(i + X*j, k) << " ";
+          }
+        }
+        (*p_file) << "\n";
+      }
+      p_file->close();
+    }
+    PetscTools::Barrier("TestNeuralComponents::WriteHistogram");
+    return handler.GetOutputDirectoryFullPath() + "histogram.txt";
+  }
+
+  // Even regions are constant in time, odd regions change every bin
+  std::string WriteHistogramWithConstantRegions()
+  {
+    OutputFileHandler handler("TestNeuralComponents", false);
+    if (PetscTools::AmMaster())
+    {
+      out_stream p_file = handler.OpenOutputFile("histogram_constant.txt");
+      for (int k = 0; k < T; k++)
+      {
+        for (int region = 0; region < X*Y; region++)
+        {
+          (*p_file) << (region % 2 == 0 ? 7.0 : ExpectedValue(region, k)) << " ";
+        }
+        (*p_file) << "\n";
+      }
+      p_file->close();
+    }
+    PetscTools::Barrier("TestNeuralComponents::WriteHistogramWithConstantRegions");
+    return handler.GetOutputDirectoryFullPath() + "histogram_constant.txt";
+  }
+
+  // A slow wave from -70 to -20 mV whose cycles start at the given times
+  double SlowWave(double time, const std::vector<double>& rStarts)
+  {
+    unsigned cycle = 0;
+    while (cycle + 2 < rStarts.size() && rStarts[cycle + 1] <= time)
+    {
+      cycle++;
+    }
+    double phase = (time - rStarts[cycle])/(rStarts[cycle + 1] - rStarts[cycle]);
+    return -70.0 + 50.0*pow(sin(M_PI*phase), 2);
+  }
+
+  // HeartConfig for the small all-ICC problems checkpointed below
+  void ConfigureSmallProblem(const std::string& rOutputDirectory, double duration)
+  {
+    HeartConfig::Instance()->Reset();
+    HeartConfig::Instance()->SetSimulationDuration(duration);
+    HeartConfig::Instance()->SetOutputDirectory(rOutputDirectory);
+    HeartConfig::Instance()->SetOutputFilenamePrefix("results");
+    HeartConfig::Instance()->SetOdePdeAndPrintingTimeSteps(0.1, 0.1, 1.0);
+  }
+
+  static std::set<unsigned> GetAllNodes(const AbstractTetrahedralMesh<2,2>& rMesh)
+  {
+    std::set<unsigned> nodes;
+    for (unsigned node = 0; node < rMesh.GetNumNodes(); node++)
+    {
+      nodes.insert(node);
+    }
+    return nodes;
+  }
+
+  // The small all-ICC problem checkpointed below: a 0.5 by 0.5 slab meshed at 0.1, ICC throughout
+  struct SmallProblem
+  {
+    DistributedTetrahedralMesh<2,2> mesh;
+    ICCFactory<2> cells;
+    BidomainProblemNeural<2> problem;
+
+    static std::set<unsigned> ConstructMesh(DistributedTetrahedralMesh<2,2>& rMesh)
+    {
+      rMesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+      return GetAllNodes(rMesh);
+    }
+
+    SmallProblem() : cells(ConstructMesh(mesh)), problem(&cells)
+    {
+      problem.SetMesh(&mesh);
+    }
+  };
+
+  // Configure, initialise and solve a small problem to the given time, and pack its state
+  void SolveSmallProblem(SmallProblem& rSmall, const std::string& rOutputDirectory, double duration,
+                         std::vector<double>& rRecords)
+  {
+    ConfigureSmallProblem(rOutputDirectory, duration);
+    rSmall.problem.Initialise();
+    rSmall.problem.Solve();
+    rSmall.problem.PackState(rRecords);
+  }
+
+  // Compare the time, solution and cell state of the nodes this process owns with a packed state
+  void CheckSameState(BidomainProblemNeural<2>& rProblem, const std::vector<double>& rExpectedRecords, double expectedTime)
+  {
+    TS_ASSERT_DELTA(rProblem.GetCurrentTime(), expectedTime, 1e-9);
+    std::vector<double> records;
+    rProblem.PackState(records);
+    TS_ASSERT_EQUALS(records.size(), rExpectedRecords.size());
+    for (unsigned i = 0; i < std::min(records.size(), rExpectedRecords.size()); i++)
+    {
+      TS_ASSERT_DELTA(records[i], rExpectedRecords[i], 1e-10*(1.0 + fabs(rExpectedRecords[i])));
+    }
+  }
+
+  public:
+  void TestFullHistogram() throw(Exception)
+  {
+    std::string file_name = WriteHistogram();
+    HistogramData histogram(file_name, X, Y, T, 4.0, 3.0);
+
+    TS_ASSERT_EQUALS(histogram.GetNumLocalRegions(), (unsigned) (X*Y));
+    TS_ASSERT_EQUALS(histogram.GetRegion(1.5, 2.5), 9u);
+    TS_ASSERT_EQUALS(histogram.GetRegion(4.0, 3.0), 11u); // far edge belongs to the last region
+
+    // An axis of zero length, as y is on a 1D mesh, maps to the first row of regions
+    HistogramData flat_grid(X, Y, 4.0, 0.0);
+    TS_ASSERT_EQUALS(flat_grid.GetRegion(1.5, 0.0), 1u);
+    TS_ASSERT_EQUALS(flat_grid.GetRegion(4.0, 0.0), 3u);
+    HistogramData narrow_grid(X, Y, 0.0, 3.0);
+    TS_ASSERT_EQUALS(narrow_grid.GetRegion(0.0, 2.5), 8u);
+
+    std::vector<double> series = histogram.GetValueOverTime(1.5, 2.5, T);
+    TS_ASSERT_EQUALS(series.size(), (unsigned) T);
+    for (int k = 0; k < T; k++)
+    {
+      TS_ASSERT_DELTA(series[k], ExpectedValue(9u, k), 1e-12);
+    }
+  }
+
+  void TestDistributedHistogram() throw(Exception)
+  {
+    std::string file_name = WriteHistogram();
+
+    // Each process asks for a different region, plus one shared by all
+    std::set<unsigned> regions;
+    regions.insert(PetscTools::GetMyRank() % (X*Y));
+    regions.insert(X*Y - 1);
+    HistogramData histogram(file_name, X, Y, T, 4.0, 3.0, regions);
+
+    TS_ASSERT_EQUALS(histogram.GetNumLocalRegions(), regions.size());
+    for (std::set<unsigned>::iterator it = regions.begin(); it != regions.end(); ++it)
+    {
+      TS_ASSERT(histogram.HasRegion(*it));
+      const double* p_series = histogram.GetRegionSeries(*it);
+      for (int k = 0; k < T; k++)
+      {
+        TS_ASSERT_DELTA(p_series[k], ExpectedValue(*it, k), 1e-12);
+      }
+    }
+
+    unsigned missing = (PetscTools::GetMyRank() + 1) % (X*Y - 1);
+    if (regions.find(missing) == regions.end())
+    {
+      TS_ASSERT(!histogram.HasRegion(missing));
+      TS_ASSERT_THROWS_CONTAINS(histogram.GetRegionSeries(missing), "is not held by this process");
+    }
+
+    // A missing file is reported on every process
+    TS_ASSERT_THROWS_CONTAINS(HistogramData("not_a_file.txt", X, Y, T, 4.0, 3.0, regions),
+                              "Unable to open neural histogram file");
+  }
+
+  void TestNodeSharedHistogram() throw(Exception)
+  {
+    std::string file_name = WriteHistogram();
+
+    std::set<unsigned> regions;
+    regions.insert(PetscTools::GetMyRank() % (X*Y));
+    regions.insert(X*Y - 1);
+    HistogramData histogram(file_name, X, Y, T, 4.0, 3.0, regions, true);
+    TS_ASSERT(histogram.IsNodeShared());
+
+    // Every process can see (at least) its own regions in the node's window
+    TS_ASSERT_LESS_THAN_EQUALS(regions.size(), histogram.GetNumLocalRegions());
+    for (std::set<unsigned>::iterator it = regions.begin(); it != regions.end(); ++it)
+    {
+      const double* p_series = histogram.GetRegionSeries(*it);
+      for (int k = 0; k < T; k++)
+      {
+        TS_ASSERT_DELTA(p_series[k], ExpectedValue(*it, k), 1e-12);
+      }
+    }
+
+    // Parameters can refer to the shared series rather than copying it
+    ModifiableParams param("inhibitory_neural", 0.0, 2.0, 2.0*T, histogram.GetRegionSeries(X*Y - 1), T, "All_FromData");
+    ModifiableParams copied_param(param);
+    TS_ASSERT_DELTA(copied_param.GetValue(3.0), ExpectedValue(X*Y - 1, 1), 1e-12);
+    TS_ASSERT_EQUALS(copied_param.GetVals().size(), (unsigned) T);
+  }
+
+  void TestIngestionChangeDetection() throw(Exception)
+  {
+    std::string file_name = WriteHistogramWithConstantRegions();
+
+    std::set<unsigned> regions;
+    for (unsigned region = 0; region < (unsigned) (X*Y); region++)
+    {
+      regions.insert(region);
+    }
+    std::vector<std::pair<std::string, std::string> > parameters;
+    parameters.push_back(std::make_pair("excitatory_neural", "All_FromData"));
+    parameters.push_back(std::make_pair("inhibitory_neural", "GBKmax_Kim2003"));
+
+    NeuralIngestion input(file_name, X, Y, T, 4.0, 3.0, 2.0, parameters, regions);
+
+    TS_ASSERT_EQUALS(input.GetNumBins(), (unsigned) T);
+    TS_ASSERT_EQUALS(input.GetBin(0.0), 0u);
+    TS_ASSERT_EQUALS(input.GetBin(5.9), 2u);
+    TS_ASSERT_EQUALS(input.GetBin(2.0*T + 1.0), 0u); // the histogram repeats
+
+    for (unsigned bin = 0; bin < (unsigned) T; bin++)
+    {
+      for (const NeuralUpdate* p_update = input.GetUpdatesBegin(bin); p_update != input.GetUpdatesEnd(bin); ++p_update)
+      {
+        // Constant regions never change
+        TS_ASSERT_EQUALS(p_update->region % 2, 1u);
+        TS_ASSERT_DELTA(p_update->value, input.rGetRegionParams(p_update->region)[p_update->parameter].GetValue((int) bin), 1e-12);
+      }
+    }
+
+    // Every odd region's raw value changes each bin
+    unsigned num_raw_updates = 0;
+    for (const NeuralUpdate* p_update = input.GetUpdatesBegin(1); p_update != input.GetUpdatesEnd(1); ++p_update)
+    {
+      num_raw_updates += (p_update->parameter == 0u);
+    }
+    TS_ASSERT_EQUALS(num_raw_updates, (unsigned) (X*Y/2));
+
+    std::vector<std::pair<std::string, std::string> > bad_parameters;
+    bad_parameters.push_back(std::make_pair("excitatory_neural", "NotACalibration"));
+    TS_ASSERT_THROWS_THIS(NeuralIngestion(file_name, X, Y, T, 4.0, 3.0, 2.0, bad_parameters, regions),
+                          "Unknown calibration function: NotACalibration");
+
+    // Evaluating by name goes through the same registry
+    TS_ASSERT_DELTA(CalibrationFunctions::Evaluate("All_FromData", 3.0), 3.0, 1e-12);
+    TS_ASSERT_THROWS_THIS(CalibrationFunctions::Evaluate("NotACalibration", 3.0),
+                          "Unknown calibration function: NotACalibration");
+  }
+
+  void TestIngestionFromArchivedSeries() throw(Exception)
+  {
+    std::string file_name = WriteHistogramWithConstantRegions();
+
+    std::set<unsigned> regions;
+    regions.insert(2u);
+    regions.insert(5u);
+    std::vector<std::pair<std::string, std::string> > parameters;
+    parameters.push_back(std::make_pair("inhibitory_neural", "GBKmax_Kim2003"));
+    NeuralIngestion from_file(file_name, X, Y, T, 4.0, 3.0, 2.0, parameters, regions);
+
+    // Series as restored from a checkpoint give the same parameter changes, without the file
+    std::map<unsigned, std::vector<double> > series;
+    for (std::set<unsigned>::iterator it = regions.begin(); it != regions.end(); ++it)
+    {
+      const double* p_series = from_file.rGetHistogram().GetRegionSeries(*it);
+      series[*it].assign(p_series, p_series + T);
+    }
+    NeuralIngestion from_series(X, Y, T, 4.0, 3.0, 2.0, parameters, series);
+    TS_ASSERT_EQUALS(from_series.rGetHistogram().GetNumLocalRegions(), 2u);
+    for (unsigned bin = 0; bin < (unsigned) T; bin++)
+    {
+      TS_ASSERT_EQUALS(from_series.GetUpdatesEnd(bin) - from_series.GetUpdatesBegin(bin),
+                       from_file.GetUpdatesEnd(bin) - from_file.GetUpdatesBegin(bin));
+      for (const NeuralUpdate* p_update = from_series.GetUpdatesBegin(bin); p_update != from_series.GetUpdatesEnd(bin); ++p_update)
+      {
+        TS_ASSERT_DELTA(p_update->value, from_file.rGetRegionParams(p_update->region)[0].GetValue((int) bin), 1e-12);
+      }
+    }
+
+    // Or held once per node, like the file
+    NeuralIngestion shared_from_series(X, Y, T, 4.0, 3.0, 2.0, parameters, series, true);
+    TS_ASSERT(shared_from_series.rGetHistogram().IsNodeShared());
+    for (std::set<unsigned>::iterator it = regions.begin(); it != regions.end(); ++it)
+    {
+      const double* p_series = shared_from_series.rGetHistogram().GetRegionSeries(*it);
+      for (int k = 0; k < T; k++)
+      {
+        TS_ASSERT_DELTA(p_series[k], series[*it][k], 1e-12);
+      }
+    }
+
+    series[5u].pop_back();
+    TS_ASSERT_THROWS_CONTAINS(NeuralIngestion(X, Y, T, 4.0, 3.0, 2.0, parameters, series),
+                              "Control region 5 does not have 5 values");
+    TS_ASSERT_THROWS_CONTAINS(NeuralIngestion(X, Y, T, 4.0, 3.0, 2.0, parameters, series, true),
+                              "Control region 5 does not have 5 values");
+
+    // Parameters archive their series as one packed block
+    ModifiableParams* const p_param = new ModifiableParams(from_file.rGetRegionParams(5u)[0]);
+    std::stringstream archive_stream;
+    {
+      boost::archive::text_oarchive output_arch(archive_stream);
+      output_arch << p_param;
+    }
+    ModifiableParams* p_loaded_param;
+    {
+      boost::archive::text_iarchive input_arch(archive_stream);
+      input_arch >> p_loaded_param;
+    }
+    TS_ASSERT_EQUALS(p_loaded_param->GetFuncName(), "GBKmax_Kim2003");
+    TS_ASSERT_EQUALS(p_loaded_param->GetVals().size(), (unsigned) T);
+    for (int k = 0; k < T; k++)
+    {
+      TS_ASSERT_DELTA(p_loaded_param->GetValue(k), p_param->GetValue(k), 1e-12);
+    }
+    delete p_param;
+    delete p_loaded_param;
+  }
+
+  void TestRingBufferStream() throw(Exception)
+  {
+    std::set<unsigned> regions;
+    regions.insert(PetscTools::GetMyRank() % (X*Y));
+    regions.insert(1u);
+    std::vector<std::pair<std::string, std::string> > parameters;
+    parameters.push_back(std::make_pair("excitatory_neural", "All_FromData"));
+
+    // A buffer of two bins, so the producer is held back while the consumer catches up
+    std::string buffer_name = "/TestNeuralComponents";
+    NeuralStream stream(buffer_name, X, Y, 2, parameters, regions);
+
+    // Stand-in producer, as in apps/src/NeuralBinProducer.cpp, replaying the constant region histogram
+    std::thread producer;
+    if (PetscTools::AmMaster())
+    {
+      producer = std::thread([this, buffer_name]()
+      {
+        NeuralRingBuffer buffer(buffer_name, 10.0);
+        std::vector<double> bin(X*Y);
+        for (int k = 0; k < T; k++)
+        {
+          for (int region = 0; region < X*Y; region++)
+          {
+            bin[region] = (region % 2 == 0 ? 7.0 : ExpectedValue(region, k));
+          }
+          buffer.Push(bin.data());
+        }
+        buffer.Close();
+      });
+    }
+
+    for (int k = 0; k < T; k++)
+    {
+      TS_ASSERT(stream.ReadBin());
+      TS_ASSERT_EQUALS(stream.GetNumBinsRead(), (unsigned) (k + 1));
+      unsigned num_updates = 0;
+      for (const NeuralUpdate* p_update = stream.GetUpdatesBegin(); p_update != stream.GetUpdatesEnd(); ++p_update)
+      {
+        TS_ASSERT(regions.find(p_update->region) != regions.end());
+        TS_ASSERT_EQUALS(p_update->parameter, 0u);
+        TS_ASSERT_DELTA(p_update->value, (p_update->region % 2 == 0 ? 7.0 : ExpectedValue(p_update->region, k)), 1e-12);
+        num_updates++;
+      }
+      // Every region is set by the first bin, then only odd (changing) regions are updated
+      unsigned num_odd = 0;
+      for (std::set<unsigned>::iterator it = regions.begin(); it != regions.end(); ++it)
+      {
+        num_odd += (*it % 2);
+      }
+      TS_ASSERT_EQUALS(num_updates, (k == 0 ? regions.size() : num_odd));
+    }
+
+    // Once the producer has finished, no more bins arrive
+    TS_ASSERT(!stream.ReadBin());
+    TS_ASSERT(stream.IsFinished());
+    TS_ASSERT_EQUALS(stream.GetNumBinsRead(), (unsigned) T);
+
+    if (producer.joinable())
+    {
+      producer.join();
+    }
+  }
+
+  void TestRingBufferStreamTimeout() throw(Exception)
+  {
+    std::set<unsigned> regions;
+    regions.insert(0u);
+    std::vector<std::pair<std::string, std::string> > parameters;
+    parameters.push_back(std::make_pair("excitatory_neural", "All_FromData"));
+
+    // A producer that never pushes or closes: every process gives up, rather than waiting in the broadcast
+    NeuralStream stream("/TestNeuralComponentsTimeout", X, Y, 2, parameters, regions, 0.2);
+    unsigned threw = 0;
+    try
+    {
+      stream.ReadBin();
+    }
+    catch (Exception& e)
+    {
+      threw = 1;
+      TS_ASSERT_EQUALS(e.GetShortMessage(), "Timed out waiting for a bin from neural ring buffer /TestNeuralComponentsTimeout");
+    }
+    unsigned num_threw = 0;
+    MPI_Allreduce(&threw, &num_threw, 1, MPI_UNSIGNED, MPI_SUM, PETSC_COMM_WORLD);
+    TS_ASSERT_EQUALS(num_threw, PetscTools::GetNumProcs());
+    TS_ASSERT(stream.IsFinished());
+    TS_ASSERT(!stream.ReadBin());
+  }
+
+  void TestSharedCheckpointFile() throw(Exception)
+  {
+    OutputFileHandler handler("TestNeuralComponents/Shared");
+    std::string path = handler.GetOutputDirectoryFullPath() + "archive.shared";
+
+    // Blocks of different sizes (the master's is empty), each written through a compressed archive
+    std::string block;
+    {
+      CheckpointArchiveWriter<boost::archive::text_oarchive> writer(block, CheckpointCompression::ZLIB, 6);
+      std::vector<double> values(100*PetscTools::GetMyRank(), PetscTools::GetMyRank() + 0.5);
+      (*writer.GetArchive()) << values;
+    }
+    CheckpointSharedFile::Write(path, block);
+
+    // Every process can read every block
+    CheckpointSharedFile shared_file(path);
+    TS_ASSERT_EQUALS(shared_file.GetNumBlocks(), PetscTools::GetNumProcs());
+    for (unsigned rank = 0; rank < shared_file.GetNumBlocks(); rank++)
+    {
+      std::string read_block;
+      TS_ASSERT_EQUALS(shared_file.ReadBlock(rank, read_block), "");
+      CheckpointArchiveReader<boost::archive::text_iarchive> reader(read_block.data(), read_block.size(), CheckpointCompression::ZLIB);
+      std::vector<double> values;
+      (*reader.GetArchive()) >> values;
+      TS_ASSERT_EQUALS(values.size(), 100*rank);
+      for (unsigned i = 0; i < values.size(); i++)
+      {
+        TS_ASSERT_DELTA(values[i], rank + 0.5, 1e-12);
+      }
+    }
+    TS_ASSERT_DIFFERS(shared_file.ReadBlock(shared_file.GetNumBlocks(), block).find("has no block"), std::string::npos);
+
+    // Failing to open is reported on every process, rather than leaving the others in the next collective call
+    std::string missing_path = handler.GetOutputDirectoryFullPath() + "missing/archive.shared";
+    TS_ASSERT_THROWS_CONTAINS(CheckpointSharedFile::Write(missing_path, block), "Failed to open shared archive file");
+    TS_ASSERT_THROWS_CONTAINS(CheckpointSharedFile shared_missing(missing_path), "Cannot load shared archive file");
+  }
+
+  void TestCellSweepPool() throw(Exception)
+  {
+    // Uneven work, as ICC cells among bath, still visits every item exactly once
+    CellSweepPool pool(4);
+    TS_ASSERT_EQUALS(pool.GetNumThreads(), 4u);
+    for (unsigned num_items = 0; num_items < 300; num_items += 37)
+    {
+      std::vector<unsigned> visits(num_items, 0u);
+      std::vector<unsigned> threads(num_items, 0u);
+      pool.Run(num_items, 8, [&](unsigned thread, unsigned begin, unsigned end)
+      {
+        for (unsigned i = begin; i < end; i++)
+        {
+          volatile double x = 0.0;
+          for (unsigned j = 0; j < (i % 3 == 0 ? 20000u : 10u); j++)
+          {
+            x = x + 1.0;
+          }
+          visits[i]++;
+          threads[i] = thread;
+        }
+      });
+      for (unsigned i = 0; i < num_items; i++)
+      {
+        TS_ASSERT_EQUALS(visits[i], 1u);
+        TS_ASSERT_LESS_THAN(threads[i], 4u);
+      }
+    }
+
+    // A failure on any thread comes back to the caller
+    TS_ASSERT_THROWS_THIS(pool.Run(100, 1, [](unsigned thread, unsigned begin, unsigned end)
+                                   {
+                                     if (begin == 57)
+                                     {
+                                       EXCEPTION("cell 57 failed");
+                                     }
+                                   }),
+                          "cell 57 failed");
+
+    // One thread runs in place
+    CellSweepPool serial_pool(1);
+    unsigned num_calls = 0;
+    serial_pool.Run(10, 4, [&](unsigned thread, unsigned begin, unsigned end)
+    {
+      TS_ASSERT_EQUALS(thread, 0u);
+      num_calls++;
+    });
+    TS_ASSERT_EQUALS(num_calls, 3u);
+    TS_ASSERT_THROWS_THIS(CellSweepPool(0), "A cell sweep needs at least one thread");
+  }
+
+  void TestThreadedCellOdes() throw(Exception)
+  {
+    // Each cell is solved on its own, so the threads must give exactly the serial V, phi_e and state
+    std::vector<double> serial_records;
+    unsigned threads[2] = {1u, 4u};
+    for (unsigned i = 0; i < 2; i++)
+    {
+      DistributedTetrahedralMesh<2,2> mesh;
+      mesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+      ICCFactory<2> cells(GetAllNodes(mesh));
+      BidomainProblemNeural<2> problem(&cells);
+      problem.SetMesh(&mesh);
+      problem.SetOdeThreads(threads[i]);
+      ConfigureSmallProblem(i == 0 ? "TestThreadedCellOdes/serial" : "TestThreadedCellOdes/threaded", 2.0);
+      problem.Initialise();
+      problem.Solve();
+      if (i == 0)
+      {
+        problem.PackState(serial_records);
+      }
+      else
+      {
+        CheckSameState(problem, serial_records, 2.0);
+        CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(problem, "TestThreadedCellOdes/checkpoint");
+      }
+    }
+
+    // The setting comes back with a checkpoint
+    BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load("TestThreadedCellOdes/checkpoint");
+    TS_ASSERT_EQUALS(p_loaded->GetOdeThreads(), 4u);
+    delete p_loaded;
+  }
+  void TestQuiescentTimeStepController() throw(Exception)
+  {
+    // Two nodes per process, (V, phi_e) interleaved
+    Vec solution = PetscTools::CreateVec(4*PetscTools::GetNumProcs(), 4);
+    QuiescentTimeStepController controller(0.1, 10.0, 1.0, 0.5);
+    double time = 0.0;
+    double largest_step = 0.0;
+    unsigned num_upstroke_steps = 0;
+    while (time < 100.0 - 1e-9)
+    {
+      // A slow ramp with an upstroke at 50 ms on the master only, which must still hold everyone back
+      double* p_solution;
+      VecGetArray(solution, &p_solution);
+      p_solution[0] = -70.0 + 0.01*time;
+      p_solution[2] = (PetscTools::AmMaster() && time >= 50.0 && time < 55.0) ? -70.0 + 10.0*(time - 50.0) : -70.0;
+      VecRestoreArray(solution, &p_solution);
+
+      double dt = controller.GetNextTimeStep(time, solution);
+      largest_step = std::max(largest_step, dt);
+      if (time > 50.5 && time < 55.0)
+      {
+        TS_ASSERT_DELTA(dt, 0.1, 1e-12);
+        num_upstroke_steps++;
+      }
+
+      // Every step ends on the printing grid or inside it
+      double next_print = (floor(time/10.0 + 1e-9) + 1.0)*10.0;
+      TS_ASSERT_LESS_THAN_EQUALS(time + dt, next_print + 1e-9);
+      time += dt;
+      if (fabs(time - 30.0) < 1e-9)
+      {
+        controller.NotifyEvent();
+        TS_ASSERT_DELTA(controller.GetNextTimeStep(time, solution), 0.1, 1e-12);
+      }
+    }
+    TS_ASSERT_DELTA(largest_step, 1.0, 1e-12);
+    TS_ASSERT_LESS_THAN(0u, num_upstroke_steps);
+    TS_ASSERT_LESS_THAN(controller.GetNumSteps(), 1000u);
+    TS_ASSERT_LESS_THAN(controller.GetNumChanges(), 20u);
+    PetscTools::Destroy(solution);
+
+    TS_ASSERT_THROWS_THIS(QuiescentTimeStepController(0.1, 0.25, 1.0, 0.5),
+                          "Printing time step must be a multiple of the PDE time step for adaptive time stepping");
+  }
+
+  void TestAdaptiveTimeStepOverChunks() throw(Exception)
+  {
+    // Checking for steady state every 2 ms solves in chunks, which must not restart the time step
+    unsigned num_steps[2];
+    unsigned num_changes[2];
+    std::vector<double> voltages[2];
+    for (unsigned chunked = 0; chunked < 2; chunked++)
+    {
+      DistributedTetrahedralMesh<2,2> mesh;
+      mesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+      ICCFactory<2> cells(GetAllNodes(mesh));
+      BidomainProblemNeural<2> problem(&cells);
+      problem.SetMesh(&mesh);
+      problem.SetAdaptiveTimeStep(1.0);
+      if (chunked)
+      {
+        problem.SetSteadyStateDetection(std::vector<unsigned>(), 0.5, 0.5, 3, 2.0);
+      }
+      ConfigureSmallProblem(chunked ? "TestAdaptiveTimeStepOverChunks/chunked" : "TestAdaptiveTimeStepOverChunks/whole", 20.0);
+      problem.Initialise();
+      problem.Solve();
+      TS_ASSERT_DELTA(problem.GetCurrentTime(), 20.0, 1e-9);
+      num_steps[chunked] = problem.GetTimeStepController()->GetNumSteps();
+      num_changes[chunked] = problem.GetTimeStepController()->GetNumChanges();
+      ReplicatableVector solution(problem.GetSolution());
+      for (unsigned node = 0; node < mesh.GetNumNodes(); node++)
+      {
+        voltages[chunked].push_back(solution[2*node]);
+      }
+    }
+    TS_ASSERT_LESS_THAN(num_steps[0], 200u);
+    TS_ASSERT_EQUALS(num_steps[1], num_steps[0]);
+    TS_ASSERT_EQUALS(num_changes[1], num_changes[0]);
+    for (unsigned node = 0; node < voltages[0].size(); node++)
+    {
+      TS_ASSERT_DELTA(voltages[1][node], voltages[0][node], 1e-6);
+    }
+
+  }
+  void TestLinearSolverStrategy() throw(Exception)
+  {
+    HeartConfig::Instance()->Reset();
+    std::string default_pc = HeartConfig::Instance()->GetKSPPreconditioner();
+    LinearSolverStrategy::Apply(LinearSolverStrategy::CONFIGURED, false);
+    TS_ASSERT_EQUALS(HeartConfig::Instance()->GetKSPPreconditioner(), default_pc);
+
+    LinearSolverStrategy::Apply(LinearSolverStrategy::FromName("ldu"), false);
+    TS_ASSERT_EQUALS(std::string(HeartConfig::Instance()->GetKSPSolver()), "gmres");
+    TS_ASSERT_EQUALS(std::string(HeartConfig::Instance()->GetKSPPreconditioner()), "ldufactorisation");
+    TS_ASSERT_EQUALS(LinearSolverStrategy::FromName("bath_two_level"), LinearSolverStrategy::BATH_TWO_LEVEL);
+    TS_ASSERT_THROWS_THIS(LinearSolverStrategy::Apply(LinearSolverStrategy::BATH_TWO_LEVEL, false),
+                          "The bath_two_level linear solver strategy needs a bath");
+    TS_ASSERT_THROWS_THIS(LinearSolverStrategy::FromName("amg"), "No linear solver strategy called amg");
+    HeartConfig::Instance()->Reset();
+
+    LinearSolveStatistics statistics;
+    TS_ASSERT_DELTA(statistics.GetMeanIterations(), 0.0, 1e-12);
+    statistics.Record(10, 2.0);
+    statistics.Record(30, 4.0);
+    TS_ASSERT_EQUALS(statistics.numSolves, 2u);
+    TS_ASSERT_EQUALS(statistics.maxIterations, 30u);
+    TS_ASSERT_DELTA(statistics.GetMeanIterations(), 20.0, 1e-12);
+    TS_ASSERT_DELTA(statistics.GetMeanTime(), 3.0, 1e-12);
+
+    // A preset changed between solves is taken up, and HeartConfig keeps its own settings
+    std::vector<double> voltages[2];
+    for (unsigned switched = 0; switched < 2; switched++)
+    {
+      DistributedTetrahedralMesh<2,2> mesh;
+      mesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+      ICCFactory<2> cells(GetAllNodes(mesh));
+      BidomainProblemNeural<2> problem(&cells);
+      problem.SetMesh(&mesh);
+      ConfigureSmallProblem(switched ? "TestLinearSolverStrategy/switched" : "TestLinearSolverStrategy/configured", 1.0);
+      HeartConfig::Instance()->SetUseAbsoluteTolerance(1e-8);
+      problem.Initialise();
+      if (switched)
+      {
+        problem.SetLinearSolverStrategy(LinearSolverStrategy::LDU_FACTORISATION);
+      }
+      problem.Solve();
+      TS_ASSERT_EQUALS(std::string(HeartConfig::Instance()->GetKSPPreconditioner()), default_pc);
+      if (switched)
+      {
+        problem.SetLinearSolverStrategy(LinearSolverStrategy::BLOCK_DIAGONAL);
+        problem.ResetLinearSolveStatistics();
+      }
+      HeartConfig::Instance()->SetSimulationDuration(2.0);
+      problem.Solve();
+      TS_ASSERT_EQUALS(std::string(HeartConfig::Instance()->GetKSPPreconditioner()), default_pc);
+      TS_ASSERT_EQUALS(problem.rGetLinearSolveStatistics().numSolves, switched ? 10u : 20u);
+
+      ReplicatableVector solution(problem.GetSolution());
+      for (unsigned node = 0; node < mesh.GetNumNodes(); node++)
+      {
+        voltages[switched].push_back(solution[2*node]);
+      }
+      if (switched)
+      {
+        CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(problem, "TestLinearSolverStrategy/checkpoint");
+      }
+    }
+    for (unsigned node = 0; node < voltages[0].size(); node++)
+    {
+      TS_ASSERT_DELTA(voltages[1][node], voltages[0][node], 1e-4);
+    }
+
+    // A restart keeps the preset, which the checkpointed HeartConfig does not hold
+    BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load("TestLinearSolverStrategy/checkpoint");
+    TS_ASSERT_EQUALS(p_loaded->GetLinearSolverStrategy(), LinearSolverStrategy::BLOCK_DIAGONAL);
+    TS_ASSERT_EQUALS(std::string(HeartConfig::Instance()->GetKSPPreconditioner()), default_pc);
+    delete p_loaded;
+  }
+  void TestMonodomainWhenUnstimulated() throw(Exception)
+  {
+    // Electrodes in the bath on either side of a tissue strip, on from 2 to 4 ms
+    std::vector<double> solutions[2];
+    std::vector<double> final_solutions[2];
+    std::vector<bool> is_bath;
+    for (unsigned hybrid = 0; hybrid < 2; hybrid++)
+    {
+      DistributedTetrahedralMesh<2,2> mesh;
+      mesh.ConstructRegularSlabMesh(0.05, 0.5, 0.5);
+      for (AbstractTetrahedralMesh<2,2>::ElementIterator iter = mesh.GetElementIteratorBegin(); iter != mesh.GetElementIteratorEnd(); ++iter)
+      {
+        double x = iter->CalculateCentroid()[0];
+        if (x < 0.15 || x > 0.35)
+        {
+          iter->SetAttribute(HeartRegionCode::GetValidBathId());
+        }
+      }
+      ICCFactory<2> cells(GetAllNodes(mesh));
+      BidomainProblemNeural<2> problem(&cells, true);
+      problem.SetMesh(&mesh);
+
+      HeartConfig::Instance()->Reset();
+      HeartConfig::Instance()->SetSimulationDuration(3.0);
+      HeartConfig::Instance()->SetOutputDirectory(hybrid ? "TestMonodomainWhenUnstimulated/hybrid" : "TestMonodomainWhenUnstimulated/bidomain");
+      HeartConfig::Instance()->SetOutputFilenamePrefix("results");
+      HeartConfig::Instance()->SetIntracellularConductivities(Create_c_vector(0.12, 0.12));
+      HeartConfig::Instance()->SetExtracellularConductivities(Create_c_vector(0.2, 0.2));
+      HeartConfig::Instance()->SetSurfaceAreaToVolumeRatio(2000);
+      HeartConfig::Instance()->SetCapacitance(2.5);
+      HeartConfig::Instance()->SetUseAbsoluteTolerance(1e-8);
+      HeartConfig::Instance()->SetOdePdeAndPrintingTimeSteps(0.1, 0.1, 1.0);
+      HeartConfig::Instance()->SetElectrodeParameters(false, 0, 100.0, 2.0, 2.0);
+      problem.SetMonodomainWhenUnstimulated(hybrid == 1);
+      problem.Initialise();
+
+      // Up to the middle of the pulse, where the hybrid run is back on the bidomain system
+      problem.Solve();
+      ReplicatableVector solution(problem.GetSolution());
+      solutions[hybrid].assign(solution.GetSize(), 0.0);
+      for (unsigned i = 0; i < solution.GetSize(); i++)
+      {
+        solutions[hybrid][i] = solution[i];
+      }
+      if (hybrid == 0)
+      {
+        is_bath.assign(mesh.GetNumNodes(), false);
+        for (AbstractTetrahedralMesh<2,2>::NodeIterator iter = mesh.GetNodeIteratorBegin(); iter != mesh.GetNodeIteratorEnd(); ++iter)
+        {
+          is_bath[iter->GetIndex()] = HeartRegionCode::IsRegionBath(iter->GetRegion());
+        }
+        std::vector<int> local(is_bath.begin(), is_bath.end());
+        std::vector<int> global(local.size());
+        MPI_Allreduce(&local[0], &global[0], local.size(), MPI_INT, MPI_MAX, PETSC_COMM_WORLD);
+        is_bath.assign(global.begin(), global.end());
+      }
+
+      // After the pulse the hybrid run is monodomain again until the end, which leaves phi_e at 0 in the bath
+      HeartConfig::Instance()->SetSimulationDuration(10.0);
+      problem.Solve();
+      ReplicatableVector final_solution(problem.GetSolution());
+      final_solutions[hybrid].assign(final_solution.GetSize(), 0.0);
+      double largest_bath_potential = 0.0;
+      for (unsigned i = 0; i < final_solution.GetSize(); i++)
+      {
+        final_solutions[hybrid][i] = final_solution[i];
+        if (i % 2 == 1 && is_bath[i/2])
+        {
+          largest_bath_potential = std::max(largest_bath_potential, fabs(final_solution[i]));
+        }
+      }
+      if (hybrid == 1)
+      {
+        TS_ASSERT_DELTA(largest_bath_potential, 0.0, 1e-6);
+      }
+    }
+
+    // V and phi_e match the full bidomain solve, including the electrode potential in the bath
+    double largest_bath_potential = 0.0;
+    for (unsigned node = 0; node < is_bath.size(); node++)
+    {
+      if (is_bath[node])
+      {
+        largest_bath_potential = std::max(largest_bath_potential, fabs(solutions[0][2*node + 1]));
+      }
+      else
+      {
+        TS_ASSERT_DELTA(solutions[1][2*node], solutions[0][2*node], 0.1);
+      }
+      TS_ASSERT_DELTA(solutions[1][2*node + 1], solutions[0][2*node + 1], 0.1);
+    }
+    TS_ASSERT_LESS_THAN(1.0, largest_bath_potential);
+
+    // The monodomain reduction leaves out the bath, so it is an approximation with a bath. Over
+    // the whole electrodes-off interval from 4 to 10 ms, V stays close to the full bidomain
+    // solve, and so does phi_e, estimated in the tissue and taken as 0 in the bath
+    double largest_voltage_error = 0.0;
+    double largest_potential_error = 0.0;
+    for (unsigned node = 0; node < is_bath.size(); node++)
+    {
+      if (!is_bath[node])
+      {
+        largest_voltage_error = std::max(largest_voltage_error, fabs(final_solutions[1][2*node] - final_solutions[0][2*node]));
+      }
+      largest_potential_error = std::max(largest_potential_error, fabs(final_solutions[1][2*node + 1] - final_solutions[0][2*node + 1]));
+    }
+    TS_ASSERT_LESS_THAN(largest_voltage_error, 0.5);
+    TS_ASSERT_LESS_THAN(largest_potential_error, 0.5);
+
+    // Without electrodes nothing would switch back
+    DistributedTetrahedralMesh<2,2> mesh;
+    mesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+    ICCFactory<2> cells(GetAllNodes(mesh));
+    BidomainProblemNeural<2> problem(&cells);
+    problem.SetMesh(&mesh);
+    ConfigureSmallProblem("TestMonodomainWhenUnstimulated/no_electrodes", 1.0);
+    problem.SetMonodomainWhenUnstimulated(true);
+    problem.Initialise();
+    TS_ASSERT_THROWS_THIS(problem.Solve(),
+                          "Monodomain between pulses needs electrodes, which need a bath, to switch back to bidomain");
+  }
+  void TestLoadProlonged() throw(Exception)
+  {
+    // A short coarse run, checkpointed
+    double coarse_min = DBL_MAX, coarse_max = -DBL_MAX;
+    {
+      DistributedTetrahedralMesh<2,2> mesh;
+      mesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+      std::set<unsigned> icc_nodes;
+      for (unsigned node = 0; node < mesh.GetNumNodes(); node++)
+      {
+        icc_nodes.insert(node);
+      }
+      ICCFactory<2> cells(icc_nodes);
+      BidomainProblemNeural<2> problem(&cells);
+      problem.SetMesh(&mesh);
+      HeartConfig::Instance()->Reset();
+      HeartConfig::Instance()->SetSimulationDuration(5.0);
+      HeartConfig::Instance()->SetOutputDirectory("TestLoadProlonged/coarse");
+      HeartConfig::Instance()->SetOutputFilenamePrefix("results");
+      HeartConfig::Instance()->SetOdePdeAndPrintingTimeSteps(0.1, 0.1, 5.0);
+      problem.Initialise();
+      problem.Solve();
+      ReplicatableVector solution(problem.GetSolution());
+      for (unsigned node = 0; node < mesh.GetNumNodes(); node++)
+      {
+        coarse_min = std::min(coarse_min, solution[2*node]);
+        coarse_max = std::max(coarse_max, solution[2*node]);
+      }
+      CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(problem, "TestLoadProlonged/coarse_checkpoint");
+    }
+
+    // Onto a mesh of half the spacing, where V lies within the range of the coarse V
+    DistributedTetrahedralMesh<2,2>* p_fine_mesh = new DistributedTetrahedralMesh<2,2>;
+    p_fine_mesh->ConstructRegularSlabMesh(0.05, 0.5, 0.5);
+    std::set<unsigned> icc_nodes;
+    for (unsigned node = 0; node < p_fine_mesh->GetNumNodes(); node++)
+    {
+      icc_nodes.insert(node);
+    }
+    ICCFactory<2> cells(icc_nodes);
+    BidomainProblemNeural<2>* p_problem = BidomainProblemNeural<2>::LoadProlonged("TestLoadProlonged/coarse_checkpoint", p_fine_mesh, &cells);
+    TS_ASSERT_DELTA(p_problem->GetCurrentTime(), 5.0, 1e-9);
+    TS_ASSERT_EQUALS(p_problem->rGetMesh().GetNumNodes(), 121u);
+    ReplicatableVector solution(p_problem->GetSolution());
+    for (unsigned node = 0; node < p_problem->rGetMesh().GetNumNodes(); node++)
+    {
+      TS_ASSERT_LESS_THAN_EQUALS(coarse_min - 1e-9, solution[2*node]);
+      TS_ASSERT_LESS_THAN_EQUALS(solution[2*node], coarse_max + 1e-9);
+    }
+
+    // The result is a checkpoint like any other, and carries on from where the coarse run stopped
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(*p_problem, "TestLoadProlonged/fine_checkpoint");
+    delete p_problem;
+    BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load("TestLoadProlonged/fine_checkpoint");
+    HeartConfig::Instance()->SetSimulationDuration(6.0);
+    p_loaded->Solve();
+    TS_ASSERT_DELTA(p_loaded->GetCurrentTime(), 6.0, 1e-9);
+    delete p_loaded;
+  }
+  void TestSteadyStateDetector() throw(Exception)
+  {
+    // Two nodes per process, (V, phi_e) interleaved; the first node of each process is sampled
+    Vec solution = PetscTools::CreateVec(4*PetscTools::GetNumProcs(), 4);
+    std::vector<unsigned> sample_nodes;
+    for (unsigned process = 0; process < PetscTools::GetNumProcs(); process++)
+    {
+      sample_nodes.push_back(2*process);
+    }
+    unsigned low = 2*PetscTools::GetMyRank();
+    SteadyStateDetector detector(sample_nodes, low, low + 2, 0.5, 0.5, 3, -40.0);
+
+    // Cycles of 40, 30 and then 25 ms: the fourth 25 ms cycle makes the third match in a row
+    double settling_starts[] = {0.0, 40.0, 70.0, 95.0, 120.0, 145.0, 170.0, 195.0, 220.0};
+    std::vector<double> settling(settling_starts, settling_starts + 9);
+    for (unsigned step = 1; step <= 2000; step++)
+    {
+      double time = 0.1*step;
+      double* p_solution;
+      VecGetArray(solution, &p_solution);
+      p_solution[0] = SlowWave(time, settling);
+      p_solution[2] = -70.0;
+      VecRestoreArray(solution, &p_solution);
+      detector.Record(time, solution);
+      if (step == 1700)
+      {
+        TS_ASSERT(!detector.IsSteady());
+      }
+    }
+    TS_ASSERT(detector.IsSteady());
+    TS_ASSERT_EQUALS(detector.GetMaxMatchingCycles(), 3u);
+
+    // Rewinding starts again, and a master alternating between 25 and 30 ms holds everyone back
+    double alternating_starts[] = {0.0, 25.0, 55.0, 80.0, 110.0, 135.0, 165.0, 190.0, 220.0};
+    std::vector<double> alternating(alternating_starts, alternating_starts + 9);
+    for (unsigned step = 1; step <= 2000; step++)
+    {
+      double time = 0.1*step;
+      double* p_solution;
+      VecGetArray(solution, &p_solution);
+      p_solution[0] = SlowWave(time, PetscTools::AmMaster() ? alternating : settling);
+      VecRestoreArray(solution, &p_solution);
+      detector.Record(time, solution);
+    }
+    TS_ASSERT(!detector.IsSteady());
+    PetscTools::Destroy(solution);
+
+    TS_ASSERT_THROWS_THIS(SteadyStateDetector(sample_nodes, low, low + 2, 0.5, 0.5, 0, -40.0),
+                          "Steady state detection needs at least one cycle");
+  }
+
+  void TestSteadyStateDetectionBetweenSolves() throw(Exception)
+  {
+    // The solver outlives each solve, so switching detection off and on again must reach it
+    DistributedTetrahedralMesh<2,2> mesh;
+    mesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+    ICCFactory<2> cells(GetAllNodes(mesh));
+    BidomainProblemNeural<2> problem(&cells);
+    problem.SetMesh(&mesh);
+    std::vector<unsigned> sample_nodes;
+    if (mesh.GetNumLocalNodes() > 0)
+    {
+      sample_nodes.push_back(mesh.GetDistributedVectorFactory()->GetLow());
+    }
+    problem.SetSteadyStateDetection(sample_nodes, 0.5, 0.5, 3, 1.0);
+    ConfigureSmallProblem("TestSteadyStateDetectionBetweenSolves", 2.0);
+    problem.Initialise();
+    problem.Solve();
+    TS_ASSERT_DELTA(problem.GetCurrentTime(), 2.0, 1e-9);
+
+    problem.SetSteadyStateDetection(std::vector<unsigned>(), 0.0, 0.0);
+    HeartConfig::Instance()->SetSimulationDuration(4.0);
+    problem.Solve();
+    TS_ASSERT_DELTA(problem.GetCurrentTime(), 4.0, 1e-9);
+
+    problem.SetSteadyStateDetection(sample_nodes, 0.5, 0.5, 3, 1.0);
+    HeartConfig::Instance()->SetSimulationDuration(6.0);
+    problem.Solve();
+    TS_ASSERT_DELTA(problem.GetCurrentTime(), 6.0, 1e-9);
+    TS_ASSERT_DELTA(problem.GetSteadyStateTime(), -1.0, 1e-12);
+
+    // A restart of the same run keeps detecting, which a branch off it does not
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(problem, "TestSteadyStateDetectionBetweenSolves/checkpoint");
+    BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load("TestSteadyStateDetectionBetweenSolves/checkpoint");
+    TS_ASSERT(p_loaded->IsDetectingSteadyState());
+    HeartConfig::Instance()->SetSimulationDuration(7.0);
+    p_loaded->Solve();
+    TS_ASSERT_DELTA(p_loaded->GetCurrentTime(), 7.0, 1e-9);
+    {
+      EfsScenarioRunner<2> runner(*p_loaded);
+      TS_ASSERT(!p_loaded->IsDetectingSteadyState());
+    }
+    delete p_loaded;
+  }
+
+  void TestBinaryCheckpoint() throw(Exception)
+  {
+    SmallProblem small;
+    std::vector<double> records;
+    SolveSmallProblem(small, "TestBinaryCheckpoint", 2.0, records);
+
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(small.problem, "TestBinaryCheckpoint/checkpoint", true,
+                                                                    CheckpointArchiveFormat::BINARY);
+    BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load("TestBinaryCheckpoint/checkpoint");
+    CheckSameState(*p_loaded, records, 2.0);
+    delete p_loaded;
+  }
+
+  void TestCompressedCheckpoint() throw(Exception)
+  {
+    SmallProblem small;
+    std::vector<double> records;
+    SolveSmallProblem(small, "TestCompressedCheckpoint", 2.0, records);
+
+    // Both formats through zlib
+    for (unsigned format = 0; format < 2; format++)
+    {
+      std::string directory = format == 0 ? "TestCompressedCheckpoint/text" : "TestCompressedCheckpoint/binary";
+      CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(small.problem, directory, true,
+                                                                      (CheckpointArchiveFormat::type) format,
+                                                                      CheckpointCompression::ZLIB, 6);
+      BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load(directory);
+      CheckSameState(*p_loaded, records, 2.0);
+      delete p_loaded;
+    }
+  }
+
+  void TestAsyncCheckpoint() throw(Exception)
+  {
+    SmallProblem small;
+    std::vector<double> records;
+    SolveSmallProblem(small, "TestAsyncCheckpoint", 2.0, records);
+
+    // The checkpoint holds the state when it was saved, though the solve carries on while it is written
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::SaveAsync(small.problem, "TestAsyncCheckpoint/checkpoint", true,
+                                                                         CheckpointArchiveFormat::BINARY,
+                                                                         CheckpointCompression::ZLIB, 6);
+    HeartConfig::Instance()->SetSimulationDuration(4.0);
+    small.problem.Solve();
+    FileFinder info("TestAsyncCheckpoint/checkpoint/archive.info", RelativeTo::ChasteTestOutput);
+    TS_ASSERT(!info.Exists());
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::WaitForSave();
+    TS_ASSERT(info.Exists());
+
+    BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load("TestAsyncCheckpoint/checkpoint");
+    CheckSameState(*p_loaded, records, 2.0);
+    delete p_loaded;
+
+    // Waiting again with nothing in progress does nothing
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::WaitForSave();
+  }
+
+  void TestPeriodicCheckpoints() throw(Exception)
+  {
+    SmallProblem small;
+    small.problem.SetCheckpointing("TestPeriodicCheckpoints/checkpoints", 1.0, 2);
+    std::vector<double> records;
+    SolveSmallProblem(small, "TestPeriodicCheckpoints/output", 3.0, records);
+
+    // A checkpoint at the end of each 1 ms chunk, of which the last two are kept
+    FileFinder index("TestPeriodicCheckpoints/checkpoints/checkpoints.txt", RelativeTo::ChasteTestOutput);
+    std::ifstream index_file(index.GetAbsolutePath().c_str());
+    std::vector<std::string> names;
+    std::string name;
+    while (index_file >> name)
+    {
+      names.push_back(name);
+    }
+    TS_ASSERT_EQUALS(names.size(), 2u);
+    if (names.size() == 2u)
+    {
+      TS_ASSERT_EQUALS(names[0], "2.000ms");
+      TS_ASSERT_EQUALS(names[1], "3.000ms");
+    }
+    TS_ASSERT(!FileFinder("TestPeriodicCheckpoints/checkpoints/1.000ms", RelativeTo::ChasteTestOutput).Exists());
+    TS_ASSERT(FileFinder("TestPeriodicCheckpoints/checkpoints/2.000ms/archive.info", RelativeTo::ChasteTestOutput).Exists());
+
+    BidomainProblemNeural<2>* p_loaded = BidomainProblemNeural<2>::LoadLatestCheckpoint("TestPeriodicCheckpoints/checkpoints");
+    CheckSameState(*p_loaded, records, 3.0);
+    delete p_loaded;
+  }
+
+  void TestStateOnlyCheckpoint() throw(Exception)
+  {
+    SmallProblem small;
+    std::vector<double> records;
+    SolveSmallProblem(small, "TestStateOnlyCheckpoint/output", 2.0, records);
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(small.problem, "TestStateOnlyCheckpoint/base");
+
+    // Only the state changes between the base checkpoint and this one
+    HeartConfig::Instance()->SetSimulationDuration(3.0);
+    small.problem.Solve();
+    small.problem.PackState(records);
+    small.problem.SaveState("TestStateOnlyCheckpoint/state", "TestStateOnlyCheckpoint/base");
+
+    // Loading it into the problem rewinds it
+    HeartConfig::Instance()->SetSimulationDuration(4.0);
+    small.problem.Solve();
+    small.problem.LoadState("TestStateOnlyCheckpoint/state");
+    CheckSameState(small.problem, records, 3.0);
+
+    // As does loading the base checkpoint, then the state
+    BidomainProblemNeural<2>* p_loaded = BidomainProblemNeural<2>::LoadFromState("TestStateOnlyCheckpoint/state");
+    CheckSameState(*p_loaded, records, 3.0);
+    delete p_loaded;
+  }
+
+  void TestRangeSelectiveMigrate() throw(Exception)
+  {
+    SmallProblem small;
+    std::vector<double> records;
+    SolveSmallProblem(small, "TestRangeSelectiveMigrate/output", 2.0, records);
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(small.problem, "TestRangeSelectiveMigrate/checkpoint");
+
+    // Each process gets a copy of the checkpoint without the other processes' archives, which
+    // the node ranges in archive.info tell it it does not need
+    FileFinder checkpoint("TestRangeSelectiveMigrate/checkpoint", RelativeTo::ChasteTestOutput);
+    ArchiveLocationInfo::SetArchiveDirectory(checkpoint);
+    std::set<std::string> other_archives;
+    for (unsigned rank = 0; rank < PetscTools::GetNumProcs(); rank++)
+    {
+      if (rank != PetscTools::GetMyRank())
+      {
+        other_archives.insert(FileFinder(ArchiveLocationInfo::GetProcessUniqueFilePath("archive.arch", rank), RelativeTo::Absolute).GetLeafName());
+      }
+    }
+    FileFinder copy;
+    for (unsigned rank = 0; rank < PetscTools::GetNumProcs(); rank++)
+    {
+      std::stringstream directory;
+      directory << "TestRangeSelectiveMigrate/process_" << rank;
+      OutputFileHandler handler(directory.str());
+      if (rank == PetscTools::GetMyRank())
+      {
+        copy = handler.FindFile("");
+      }
+    }
+    std::vector<FileFinder> files = checkpoint.FindMatches("*");
+    for (unsigned i = 0; i < files.size(); i++)
+    {
+      if (files[i].IsFile() && other_archives.find(files[i].GetLeafName()) == other_archives.end())
+      {
+        files[i].CopyTo(copy);
+      }
+    }
+    PetscTools::Barrier("TestRangeSelectiveMigrate");
+
+    BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Migrate(copy);
+    CheckSameState(*p_loaded, records, 2.0);
+    delete p_loaded;
+  }
+
+  void TestSharedFileCheckpoint() throw(Exception)
+  {
+    SmallProblem small;
+    std::vector<double> records;
+    SolveSmallProblem(small, "TestSharedFileCheckpoint/output", 2.0, records);
+
+    // The process archives go into one file, in either format and with or without zlib
+    for (unsigned format = 0; format < 2; format++)
+    {
+      std::string directory = format == 0 ? "TestSharedFileCheckpoint/text" : "TestSharedFileCheckpoint/binary";
+      CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(small.problem, directory, true,
+                                                                      (CheckpointArchiveFormat::type) format,
+                                                                      format == 0 ? CheckpointCompression::NONE : CheckpointCompression::ZLIB, 6,
+                                                                      CheckpointArchiveLayout::SHARED_FILE);
+      FileFinder checkpoint(directory, RelativeTo::ChasteTestOutput);
+      TS_ASSERT(FileFinder(directory + "/archive.shared", RelativeTo::ChasteTestOutput).Exists());
+      ArchiveLocationInfo::SetArchiveDirectory(checkpoint);
+      TS_ASSERT(!FileFinder(ArchiveLocationInfo::GetProcessUniqueFilePath("archive.arch", PetscTools::GetMyRank()),
+                            RelativeTo::Absolute).Exists());
+      BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load(directory);
+      CheckSameState(*p_loaded, records, 2.0);
+      delete p_loaded;
+    }
+  }
+
+  void TestLoadBalanced() throw(Exception)
+  {
+    SmallProblem small;
+    std::vector<double> saved_records;
+    SolveSmallProblem(small, "TestLoadBalanced/output", 2.0, saved_records);
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(small.problem, "TestLoadBalanced/checkpoint");
+    unsigned num_procs = PetscTools::GetNumProcs();
+    unsigned saved_local = small.mesh.GetDistributedVectorFactory()->GetLocalOwnership();
+
+    // Replace the measured loads, so the master seems to have taken ten times as long as the others
+    FileFinder info("TestLoadBalanced/checkpoint/archive.info", RelativeTo::ChasteTestOutput);
+    if (PetscTools::AmMaster())
+    {
+      std::ifstream in_file(info.GetAbsolutePath().c_str());
+      std::stringstream contents;
+      std::string line;
+      while (std::getline(in_file, line))
+      {
+        if (line.compare(0, 5, "load ") != 0)
+        {
+          contents << line << "\n";
+        }
+      }
+      in_file.close();
+      for (unsigned rank = 0; rank < num_procs; rank++)
+      {
+        contents << "load " << rank << " " << (rank == 0 ? 1000.0 : 100.0) << " 0\n";
+      }
+      std::ofstream out_file(info.GetAbsolutePath().c_str());
+      out_file << contents.str();
+    }
+    PetscTools::Barrier("TestLoadBalanced");
+
+    BidomainProblemNeural<2>* p_balanced = BidomainProblemNeural<2>::LoadBalanced("TestLoadBalanced/checkpoint", &small.cells);
+    TS_ASSERT_DELTA(p_balanced->GetCurrentTime(), 2.0, 1e-9);
+    double loaded_imbalance, balanced_imbalance;
+    p_balanced->GetLoadImbalance(loaded_imbalance, balanced_imbalance);
+    TS_ASSERT_LESS_THAN_EQUALS(balanced_imbalance, loaded_imbalance);
+    if (num_procs > 1)
+    {
+      TS_ASSERT_LESS_THAN(1.05, loaded_imbalance);
+    }
+
+    // The ranges stay consecutive and cover the mesh, with the master given fewer nodes
+    DistributedVectorFactory* p_factory = p_balanced->rGetMesh().GetDistributedVectorFactory();
+    std::vector<unsigned> lows(num_procs), highs(num_procs);
+    unsigned low = p_factory->GetLow(), high = p_factory->GetHigh();
+    MPI_Allgather(&low, 1, MPI_UNSIGNED, &lows[0], 1, MPI_UNSIGNED, PETSC_COMM_WORLD);
+    MPI_Allgather(&high, 1, MPI_UNSIGNED, &highs[0], 1, MPI_UNSIGNED, PETSC_COMM_WORLD);
+    TS_ASSERT_EQUALS(lows[0], 0u);
+    TS_ASSERT_EQUALS(highs[num_procs - 1], small.mesh.GetNumNodes());
+    for (unsigned rank = 1; rank < num_procs; rank++)
+    {
+      TS_ASSERT_EQUALS(lows[rank], highs[rank - 1]);
+    }
+    if (num_procs > 1 && PetscTools::AmMaster())
+    {
+      TS_ASSERT_LESS_THAN(p_factory->GetLocalOwnership(), saved_local);
+    }
+
+    // Every node keeps its solution and cell state through the move to its new owner
+    ReplicatableVector saved_solution(small.problem.GetSolution());
+    ReplicatableVector balanced_solution(p_balanced->GetSolution());
+    TS_ASSERT_EQUALS(balanced_solution.GetSize(), saved_solution.GetSize());
+    for (unsigned i = 0; i < saved_solution.GetSize(); i++)
+    {
+      TS_ASSERT_DELTA(balanced_solution[i], saved_solution[i], 1e-10*(1.0 + fabs(saved_solution[i])));
+    }
+    int num_saved = saved_records.size();
+    std::vector<int> saved_counts(num_procs), saved_offsets(num_procs, 0);
+    MPI_Allgather(&num_saved, 1, MPI_INT, &saved_counts[0], 1, MPI_INT, PETSC_COMM_WORLD);
+    for (unsigned rank = 1; rank < num_procs; rank++)
+    {
+      saved_offsets[rank] = saved_offsets[rank - 1] + saved_counts[rank - 1];
+    }
+    std::vector<double> all_saved_records(saved_offsets[num_procs - 1] + saved_counts[num_procs - 1]);
+    MPI_Allgatherv(saved_records.data(), num_saved, MPI_DOUBLE, all_saved_records.data(), &saved_counts[0],
+                   &saved_offsets[0], MPI_DOUBLE, PETSC_COMM_WORLD);
+    std::map<unsigned, unsigned> saved_positions;
+    for (unsigned position = 0; position < all_saved_records.size(); )
+    {
+      saved_positions[(unsigned) all_saved_records[position]] = position;
+      position += 5 + (unsigned) all_saved_records[position + 1] + (unsigned) all_saved_records[position + 2];
+    }
+    std::vector<double> balanced_records;
+    p_balanced->PackState(balanced_records);
+    for (unsigned position = 0; position < balanced_records.size(); )
+    {
+      unsigned length = 5 + (unsigned) balanced_records[position + 1] + (unsigned) balanced_records[position + 2];
+      unsigned saved_position = saved_positions[(unsigned) balanced_records[position]];
+      for (unsigned i = 0; i < length; i++)
+      {
+        TS_ASSERT_DELTA(balanced_records[position + i], all_saved_records[saved_position + i],
+                        1e-10*(1.0 + fabs(all_saved_records[saved_position + i])));
+      }
+      position += length;
+    }
+    delete p_balanced;
+
+    // Cells of another kind on the master's new nodes only fail on every process, not just the master
+    if (num_procs > 1)
+    {
+      std::set<unsigned> other_nodes;
+      for (unsigned node = highs[0]; node < small.mesh.GetNumNodes(); node++)
+      {
+        other_nodes.insert(node);
+      }
+      ICCFactory<2> mismatched_cells(other_nodes);
+      TS_ASSERT_THROWS_CONTAINS(BidomainProblemNeural<2>::LoadBalanced("TestLoadBalanced/checkpoint", &mismatched_cells),
+                                "State does not match");
+    }
+  }
+
+  void TestNodeSharedNeuralInputCheckpoint() throw(Exception)
+  {
+    std::string file_name = WriteHistogramWithConstantRegions();
+    DistributedTetrahedralMesh<2,2> mesh;
+    mesh.ConstructRegularSlabMesh(0.1, 0.5, 0.5);
+    ICCFactory<2> cells(GetAllNodes(mesh));
+    BidomainProblemNeural<2> problem(&cells);
+    problem.SetMesh(&mesh);
+    problem.SetNeuralInput(file_name, X, Y, T, 2.0);
+    problem.AddNeuralParameter("inhibitory_neural", "GBKmax_Kim2003");
+    problem.SetNeuralInputNodeShared(true);
+    ConfigureSmallProblem("TestNodeSharedNeuralInputCheckpoint/output", 1.0);
+    problem.Initialise();
+    problem.Solve();
+    TS_ASSERT(problem.IsNeuralInputNodeShared());
+    CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Save(problem, "TestNodeSharedNeuralInputCheckpoint/checkpoint");
+
+    // Without the file, the input can only come from the series in the checkpoint
+    if (PetscTools::AmMaster())
+    {
+      std::remove(file_name.c_str());
+    }
+    PetscTools::Barrier("TestNodeSharedNeuralInputCheckpoint");
+    BidomainProblemNeural<2>* p_loaded = CardiacSimulationArchiverNeural<BidomainProblemNeural<2> >::Load("TestNodeSharedNeuralInputCheckpoint/checkpoint");
+    HeartConfig::Instance()->SetSimulationDuration(2.0);
+    p_loaded->Solve();
+    TS_ASSERT(p_loaded->IsNeuralInputNodeShared());
+    TS_ASSERT_EQUALS(p_loaded->GetNumLocalNeuralRegions(), problem.GetNumLocalNeuralRegions());
+    delete p_loaded;
+  }
+};
+
+#endif /*TESTNEURALCOMPONENTS_HPP_*/
@@ -0,0 +1,296 @@
+#ifndef TESTNODEORDERING_HPP_
+#define TESTNODEORDERING_HPP_
+
+/**
+ * @file
+ * This test reorders the nodes of a mesh numbered at random, as meshes from our generator are,
+ * and benchmarks the KSP time per step of a short bidomain solve for each ordering
+ */
+
+#include <cxxtest/TestSuite.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "../src/BidomainProblemNeural.hpp"
+#include "../src/CachedMeshReader.hpp"
+#include "../src/ICCFactory.hpp"
+
+#include "DistributedTetrahedralMesh.hpp"
+#include "DistributedVectorFactory.hpp"
+#include "Hdf5DataReader.hpp"
+#include "HeartConfig.hpp"
+#include "HeartEventHandler.hpp"
+#include "OutputFileHandler.hpp"
+#include "PetscTools.hpp"
+#include "ReplicatableVector.hpp"
+#include "TrianglesMeshReader.hpp"
+
+#include "PetscSetupAndFinalize.hpp"
+
+class TestNodeOrdering : public CxxTest::TestSuite
+{
+  private:
+  // Write an N by N square of triangles with its nodes numbered at random
+  std::string WriteShuffledSquare(unsigned n)
+  {
+    OutputFileHandler handler("TestNodeOrdering", false);
+    std::string mesh_base = handler.GetOutputDirectoryFullPath() + "shuffled_square";
+    if (PetscTools::AmMaster())
+    {
+      unsigned num_nodes = (n + 1)*(n + 1);
+      std::vector<unsigned> index(num_nodes);
+      for (unsigned i = 0; i < num_nodes; i++)
+      {
+        index[i] = i;
+      }
+      std::mt19937 generator(42);
+      std::shuffle(index.begin(), index.end(), generator);
+
+      std::vector<unsigned> grid_node(num_nodes);
+      for (unsigned i = 0; i < num_nodes; i++)
+      {
+        grid_node[index[i]] = i;
+      }
+      std::ofstream node_file((mesh_base + ".node").c_str());
+      node_file << num_nodes << " 2 0 1\n";
+      for (unsigned i = 0; i < num_nodes; i++)
+      {
+        unsigned x = grid_node[i]%(n + 1);
+        unsigned y = grid_node[i]/(n + 1);
+        node_file << i << " " << 0.0025*x << " " << 0.0025*y << " " << (x == 0 || y == 0 || x == n || y == n) << "\n";
+      }
+
+      std::ofstream ele_file((mesh_base + ".ele").c_str());
+      ele_file << 2*n*n << " 3 0\n";
+      unsigned element = 0;
+      for (unsigned y = 0; y < n; y++)
+      {
+        for (unsigned x = 0; x < n; x++)
+        {
+          unsigned a = index[y*(n + 1) + x];
+          unsigned b = index[y*(n + 1) + x + 1];
+          unsigned c = index[(y + 1)*(n + 1) + x];
+          unsigned d = index[(y + 1)*(n + 1) + x + 1];
+          ele_file << element++ << " " << a << " " << b << " " << d << "\n";
+          ele_file << element++ << " " << a << " " << d << " " << c << "\n";
+        }
+      }
+
+      std::ofstream edge_file((mesh_base + ".edge").c_str());
+      edge_file << 4*n << " 0\n";
+      unsigned edge = 0;
+      for (unsigned i = 0; i < n; i++)
+      {
+        edge_file << edge++ << " " << index[i] << " " << index[i + 1] << "\n";
+        edge_file << edge++ << " " << index[n*(n + 1) + i] << " " << index[n*(n + 1) + i + 1] << "\n";
+        edge_file << edge++ << " " << index[i*(n + 1)] << " " << index[(i + 1)*(n + 1)] << "\n";
+        edge_file << edge++ << " " << index[i*(n + 1) + n] << " " << index[(i + 1)*(n + 1) + n] << "\n";
+      }
+    }
+    PetscTools::Barrier("WriteShuffledSquare");
+    return mesh_base;
+  }
+
+  // Widest gap between the indices of connected nodes owned by one process
+  unsigned GetLocalBandwidth(DistributedTetrahedralMesh<2,2>& rMesh)
+  {
+    unsigned lo = rMesh.GetDistributedVectorFactory()->GetLow();
+    unsigned hi = rMesh.GetDistributedVectorFactory()->GetHigh();
+    unsigned bandwidth = 0;
+    for (DistributedTetrahedralMesh<2,2>::ElementIterator iter = rMesh.GetElementIteratorBegin(); iter != rMesh.GetElementIteratorEnd(); ++iter)
+    {
+      for (unsigned i = 0; i < 3; i++)
+      {
+        for (unsigned j = 0; j < 3; j++)
+        {
+          unsigned a = iter->GetNodeGlobalIndex(i);
+          unsigned b = iter->GetNodeGlobalIndex(j);
+          if (a >= lo && a < hi && b >= lo && b < hi)
+          {
+            bandwidth = std::max(bandwidth, a > b ? a - b : b - a);
+          }
+        }
+      }
+    }
+    unsigned global_bandwidth;
+    MPI_Allreduce(&bandwidth, &global_bandwidth, 1, MPI_UNSIGNED, MPI_MAX, PETSC_COMM_WORLD);
+    return global_bandwidth;
+  }
+
+  // Solve briefly with ICC cells on the given nodes (in file numbering) and read back the final V from the output
+  std::vector<double> SolveAndReadVoltage(DistributedTetrahedralMesh<2,2>& rMesh, const std::vector<unsigned>& rIccFileNodes,
+                                          const std::string& rOutputDirectory)
+  {
+    const std::vector<unsigned>& r_permutation = rMesh.rGetNodePermutation();
+    std::set<unsigned> icc_nodes;
+    for (unsigned i = 0; i < rIccFileNodes.size(); i++)
+    {
+      icc_nodes.insert(r_permutation.empty() ? rIccFileNodes[i] : r_permutation[rIccFileNodes[i]]);
+    }
+    ICCFactory<2> cells(icc_nodes);
+    BidomainProblemNeural<2> problem(&cells);
+    problem.SetMesh(&rMesh);
+
+    HeartConfig::Instance()->Reset();
+    HeartConfig::Instance()->SetSimulationDuration(2.0);
+    HeartConfig::Instance()->SetOutputDirectory(rOutputDirectory);
+    HeartConfig::Instance()->SetOutputFilenamePrefix("results");
+    HeartConfig::Instance()->SetIntracellularConductivities(Create_c_vector(0.12, 0.12));
+    HeartConfig::Instance()->SetExtracellularConductivities(Create_c_vector(0.2, 0.2));
+    HeartConfig::Instance()->SetSurfaceAreaToVolumeRatio(2000);
+    HeartConfig::Instance()->SetCapacitance(2.5);
+    HeartConfig::Instance()->SetOdePdeAndPrintingTimeSteps(0.1, 0.1, 1.0);
+    // As EfsDriver does, so that a renumbered mesh writes its output in file numbering
+    HeartConfig::Instance()->SetOutputUsingOriginalNodeOrdering(!r_permutation.empty());
+    problem.Initialise();
+    problem.Solve();
+
+    Hdf5DataReader reader(rOutputDirectory, "results");
+    unsigned num_times = reader.GetUnlimitedDimensionValues().size();
+    DistributedVectorFactory factory(rMesh.GetNumNodes());
+    Vec voltage = factory.CreateVec();
+    reader.GetVariableOverNodes(voltage, "V", num_times - 1);
+    ReplicatableVector replicated(voltage);
+    PetscTools::Destroy(voltage);
+
+    std::vector<double> result(replicated.GetSize());
+    for (unsigned i = 0; i < replicated.GetSize(); i++)
+    {
+      result[i] = replicated[i];
+    }
+    return result;
+  }
+
+  public:
+  void TestReorderedMeshes() throw(Exception)
+  {
+    std::string mesh_base = WriteShuffledSquare(40);
+    DistributedTetrahedralMesh<2,2> file_mesh;
+    CachedMeshReader<2,2>::ConstructMesh(mesh_base, file_mesh);
+    unsigned file_bandwidth = GetLocalBandwidth(file_mesh);
+
+    MeshNodeOrdering::type orderings[2] = {MeshNodeOrdering::REVERSE_CUTHILL_MCKEE, MeshNodeOrdering::MORTON};
+    for (unsigned i = 0; i < 2; i++)
+    {
+      DistributedTetrahedralMesh<2,2> mesh;
+      CachedMeshReader<2,2>::ConstructMesh(mesh_base, mesh, orderings[i]);
+      TS_ASSERT_EQUALS(mesh.GetNumNodes(), file_mesh.GetNumNodes());
+      TS_ASSERT_EQUALS(mesh.GetNumLocalNodes(), file_mesh.GetNumLocalNodes());
+
+      // The permutation maps file numbering to the mesh, so locations still match the files
+      const std::vector<unsigned>& r_permutation = mesh.rGetNodePermutation();
+      TS_ASSERT_EQUALS(r_permutation.size(), mesh.GetNumNodes());
+      TrianglesMeshReader<2,2> reader(mesh_base);
+      for (unsigned node = 0; node < reader.GetNumNodes(); node++)
+      {
+        std::vector<double> location = reader.GetNextNode();
+        unsigned index = r_permutation[node];
+        if (mesh.GetDistributedVectorFactory()->IsGlobalIndexLocal(index))
+        {
+          TS_ASSERT_DELTA(mesh.GetNode(index)->rGetLocation()[0], location[0], 1e-12);
+          TS_ASSERT_DELTA(mesh.GetNode(index)->rGetLocation()[1], location[1], 1e-12);
+        }
+      }
+
+      if (orderings[i] == MeshNodeOrdering::REVERSE_CUTHILL_MCKEE)
+      {
+        unsigned bandwidth = GetLocalBandwidth(mesh);
+        TS_ASSERT_LESS_THAN(bandwidth, file_bandwidth);
+        TS_ASSERT_LESS_THAN_EQUALS(bandwidth, 2*41u);
+      }
+    }
+  }
+
+  void TestKspTimePerStep() throw(Exception)
+  {
+    std::string mesh_base = WriteShuffledSquare(100);
+    const double duration = 5.0; // ms
+    const double pde_dt = 0.1;   // ms
+    MeshNodeOrdering::type orderings[3] = {MeshNodeOrdering::PARTITION, MeshNodeOrdering::REVERSE_CUTHILL_MCKEE, MeshNodeOrdering::MORTON};
+    std::string names[3] = {"file", "reverse_cuthill_mckee", "morton"};
+    for (unsigned i = 0; i < 3; i++)
+    {
+      DistributedTetrahedralMesh<2,2> mesh;
+      CachedMeshReader<2,2>::ConstructMesh(mesh_base, mesh, orderings[i]);
+
+      std::set<unsigned> icc_nodes;
+      for (unsigned node = 0; node < mesh.GetNumNodes(); node++)
+      {
+        icc_nodes.insert(node);
+      }
+      ICCFactory<2> cells(icc_nodes);
+      BidomainProblemNeural<2> problem(&cells);
+      problem.SetMesh(&mesh);
+
+      HeartConfig::Instance()->Reset();
+      HeartConfig::Instance()->SetSimulationDuration(duration);
+      HeartConfig::Instance()->SetOutputDirectory("TestNodeOrdering/" + names[i]);
+      HeartConfig::Instance()->SetOutputFilenamePrefix("results");
+      HeartConfig::Instance()->SetIntracellularConductivities(Create_c_vector(0.12, 0.12));
+      HeartConfig::Instance()->SetExtracellularConductivities(Create_c_vector(0.2, 0.2));
+      HeartConfig::Instance()->SetSurfaceAreaToVolumeRatio(2000);
+      HeartConfig::Instance()->SetCapacitance(2.5);
+      HeartConfig::Instance()->SetOdePdeAndPrintingTimeSteps(pde_dt, pde_dt, duration);
+      problem.Initialise();
+
+      HeartEventHandler::Reset();
+      problem.Solve();
+      double ksp_time = HeartEventHandler::GetElapsedTime(HeartEventHandler::SOLVE_LINEAR_SYSTEM);
+      unsigned bandwidth = GetLocalBandwidth(mesh);
+      if (PetscTools::AmMaster())
+      {
+        std::cout << "Node ordering " << names[i] << ": local bandwidth " << bandwidth
+                  << ", KSP time per step " << ksp_time*pde_dt/duration << " ms" << std::endl;
+      }
+    }
+  }
+  void TestOutputInFileNumbering() throw(Exception)
+  {
+    std::string mesh_base = WriteShuffledSquare(20);
+
+    // ICC cells on the left half only, so that V varies over the square
+    std::vector<unsigned> icc_file_nodes;
+    {
+      TrianglesMeshReader<2,2> reader(mesh_base);
+      for (unsigned node = 0; node < reader.GetNumNodes(); node++)
+      {
+        if (reader.GetNextNode()[0] < 0.025)
+        {
+          icc_file_nodes.push_back(node);
+        }
+      }
+    }
+
+    // A dumb partition keeps the file numbering, so this output needs no permutation
+    DistributedTetrahedralMesh<2,2> file_mesh(DistributedTetrahedralMeshPartitionType::DUMB);
+    {
+      TrianglesMeshReader<2,2> reader(mesh_base);
+      file_mesh.ConstructFromMeshReader(reader);
+    }
+    TS_ASSERT(file_mesh.rGetNodePermutation().empty());
+    std::vector<double> expected = SolveAndReadVoltage(file_mesh, icc_file_nodes, "TestNodeOrdering/output_file");
+    TS_ASSERT_LESS_THAN(*std::min_element(expected.begin(), expected.end()) + 1e-2,
+                        *std::max_element(expected.begin(), expected.end()));
+
+    MeshNodeOrdering::type orderings[2] = {MeshNodeOrdering::REVERSE_CUTHILL_MCKEE, MeshNodeOrdering::MORTON};
+    std::string names[2] = {"reverse_cuthill_mckee", "morton"};
+    for (unsigned i = 0; i < 2; i++)
+    {
+      DistributedTetrahedralMesh<2,2> mesh;
+      CachedMeshReader<2,2>::ConstructMesh(mesh_base, mesh, orderings[i]);
+      std::vector<double> voltage = SolveAndReadVoltage(mesh, icc_file_nodes, "TestNodeOrdering/output_" + names[i]);
+      TS_ASSERT_EQUALS(voltage.size(), expected.size());
+      for (unsigned node = 0; node < expected.size(); node++)
+      {
+        TS_ASSERT_DELTA(voltage[node], expected[node], 1e-3);
+      }
+    }
+  }
+};
+
+#endif /*TESTNODEORDERING_HPP_*/